@@ -19,106 +19,1113 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include "audio-capture.hpp"
 
 #include <obs-module.h>
+#include <media-io/audio-math.h>
 #include <util/dstr.hpp>
+#include <util/platform.h>
+#include <util/util_uint64.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
 
 #include "plugin-macros.hpp"
-#include "preinit.hpp"
+#include "hook-backend.hpp"
+#include "capture/trace-backend.hpp"
 #include "helpers/audio-session-helper.hpp"
+#include "helpers/windows-helper.hpp"
 
 #pragma region Macros
 /* clang-format off */
 #define SETTING_SESSION				"session"
+#define SETTING_SESSION_EXE			"session_exe"
+#define SETTING_SESSION_NAME		"session_name"
 #define SETTING_ANTI_CHEAT_HOOK		"anti_cheat_hook"
 #define SETTING_HOOK_RATE			"hook_rate"
+#define SETTING_RESAMPLE_QUALITY	"resample_quality"
+#define SETTING_BATCHING			"batching"
+#define SETTING_GAIN				"gain"
+#define SETTING_SILENCE_GATE		"silence_gate"
+#define SETTING_SILENCE_THRESHOLD	"silence_threshold"
+#define SETTING_JITTER_BUFFER		"jitter_buffer"
+#define SETTING_LOUDNESS_METER		"loudness_meter"
+#define SETTING_RECORD_TRACE		"record_trace"
+#define SETTING_STATISTICS			"statistics"
+#define SETTING_LOG_STATISTICS		"log_statistics"
 
 #define TEXT_AUDIO_CAPTURE			obs_module_text("AudioCapture")
 #define TEXT_SESSION				obs_module_text("AudioCapture.Session")
+#define TEXT_GAIN					obs_module_text("AudioCapture.Gain")
+#define TEXT_SILENCE_GATE			obs_module_text("AudioCapture.SilenceGate")
+#define TEXT_SILENCE_THRESHOLD		obs_module_text("AudioCapture.SilenceThreshold")
+#define TEXT_JITTER_BUFFER			obs_module_text("AudioCapture.JitterBuffer")
+#define TEXT_LOUDNESS_METER			obs_module_text("AudioCapture.LoudnessMeter")
+#define TEXT_RECORD_TRACE			obs_module_text("AudioCapture.RecordTrace")
+#define TEXT_STATISTICS				obs_module_text("AudioCapture.Statistics")
+#define TEXT_LOG_STATISTICS			obs_module_text("AudioCapture.LogStatistics")
 #define TEXT_ANTI_CHEAT_HOOK		obs_module_text("AudioCapture.AntiCheatHook")
 #define TEXT_HOOK_RATE				obs_module_text("AudioCapture.HookRate")
 #define TEXT_HOOK_RATE_SLOW			obs_module_text("AudioCapture.HookRate.Slow")
 #define TEXT_HOOK_RATE_NORMAL		obs_module_text("AudioCapture.HookRate.Normal")
 #define TEXT_HOOK_RATE_FAST			obs_module_text("AudioCapture.HookRate.Fast")
 #define TEXT_HOOK_RATE_FASTEST		obs_module_text("AudioCapture.HookRate.Fastest")
+#define TEXT_BATCHING				obs_module_text("AudioCapture.Batching")
+#define TEXT_BATCHING_OFF			obs_module_text("AudioCapture.Batching.Off")
+#define TEXT_BATCHING_LOW_LATENCY	obs_module_text("AudioCapture.Batching.LowLatency")
+#define TEXT_BATCHING_BALANCED		obs_module_text("AudioCapture.Batching.Balanced")
+#define TEXT_BATCHING_THROUGHPUT	obs_module_text("AudioCapture.Batching.Throughput")
+#define TEXT_RESAMPLE_QUALITY		obs_module_text("AudioCapture.ResampleQuality")
+#define TEXT_RESAMPLE_QUALITY_LOW	obs_module_text("AudioCapture.ResampleQuality.Low")
+#define TEXT_RESAMPLE_QUALITY_MEDIUM	obs_module_text("AudioCapture.ResampleQuality.Medium")
+#define TEXT_RESAMPLE_QUALITY_HIGH	obs_module_text("AudioCapture.ResampleQuality.High")
 /* clang-format on */
+#pragma endregion
 
-#define OBS_KSAUDIO_SPEAKER_4POINT1 \
-	(KSAUDIO_SPEAKER_SURROUND | SPEAKER_LOW_FREQUENCY)
+#pragma region Session switching
+// Sessions switched in the settings crossfade over this long
+#define CROSSFADE_MS 20
+// A new session that stays quiet this long doesn't hold up the old one
+#define SWAP_TIMEOUT_NS 500000000ULL
 #pragma endregion
 
 #pragma region Miscellany
-// Borrowed from win-wasapi (win-wasapi.cpp)
-static speaker_layout ConvertSpeakerLayout(DWORD layout, WORD channels)
+/* The inverse of win-wasapi's ConvertSpeakerLayout. We remix into whatever
+ * OBS is outputting so libobs never has to do a second pass. */
+static uint32_t SpeakerLayoutMask(speaker_layout layout)
 {
 	switch (layout) {
-	case KSAUDIO_SPEAKER_2POINT1:
-		return SPEAKERS_2POINT1;
-	case KSAUDIO_SPEAKER_SURROUND:
-		return SPEAKERS_4POINT0;
-	case OBS_KSAUDIO_SPEAKER_4POINT1:
-		return SPEAKERS_4POINT1;
-	case KSAUDIO_SPEAKER_5POINT1_SURROUND:
-		return SPEAKERS_5POINT1;
-	case KSAUDIO_SPEAKER_7POINT1_SURROUND:
-		return SPEAKERS_7POINT1;
+	case SPEAKERS_MONO:
+		return KSAUDIO_SPEAKER_MONO;
+	case SPEAKERS_STEREO:
+		return KSAUDIO_SPEAKER_STEREO;
+	case SPEAKERS_2POINT1:
+		return KSAUDIO_SPEAKER_2POINT1;
+	case SPEAKERS_4POINT0:
+		return KSAUDIO_SPEAKER_SURROUND;
+	case SPEAKERS_4POINT1:
+		return KSAUDIO_SPEAKER_SURROUND | SPEAKER_LOW_FREQUENCY;
+	case SPEAKERS_5POINT1:
+		return KSAUDIO_SPEAKER_5POINT1_SURROUND;
+	case SPEAKERS_7POINT1:
+		return KSAUDIO_SPEAKER_7POINT1_SURROUND;
+	default:
+		return KSAUDIO_SPEAKER_STEREO;
+	}
+}
+
+/* BS.1770 channel weights in OBS's channel order: the LFE is left out and
+ * anything behind the listener counts for about +1.5 dB */
+static void LoudnessWeights(speaker_layout layout, float *weights)
+{
+	uint32_t channels = get_audio_channels(layout);
+	for (uint32_t c = 0; c < channels; c++) {
+		weights[c] = c < 4 ? 1.0f : 1.41f;
+	}
+
+	switch (layout) {
+	case SPEAKERS_2POINT1:
+		weights[2] = 0.0f;
+		break;
+	case SPEAKERS_4POINT0:
+		weights[3] = 1.41f;
+		break;
+	case SPEAKERS_4POINT1:
+	case SPEAKERS_5POINT1:
+	case SPEAKERS_7POINT1:
+		weights[3] = 0.0f;
+		break;
+	default:
+		break;
+	}
+}
+
+// For packets passed through as they are, see IsNativeSampleFormat
+static audio_format NativeAudioFormat(SampleFormat format)
+{
+	switch (format) {
+	case SampleFormat::S16:
+		return AUDIO_FORMAT_16BIT;
+	case SampleFormat::S32:
+		return AUDIO_FORMAT_32BIT;
+	case SampleFormat::F32:
+		return AUDIO_FORMAT_FLOAT;
+	default:
+		return AUDIO_FORMAT_UNKNOWN;
+	}
+}
+
+/* Wraps a stream so everything it hands out also lands in a trace under
+ * the plugin's config directory, for replaying glitches from the field */
+static std::unique_ptr<CaptureStream>
+RecordTrace(std::unique_ptr<CaptureStream> stream,
+	    const SessionRecord &session)
+{
+	char *dir = obs_module_config_path("traces");
+	if (!dir) {
+		return stream;
+	}
+
+	// The same session can well be reattached within the second
+	static std::atomic<uint32_t> sequence{0};
+
+	os_mkdirs(dir);
+	long long now = static_cast<long long>(time(nullptr));
+	std::string path = std::string(dir) + "/" + session.exe + "-" +
+			   std::to_string(session.processId) + "-" +
+			   std::to_string(now) + "-" +
+			   std::to_string(sequence++) + ".actrace";
+	bfree(dir);
+
+	FILE *file = os_fopen(path.c_str(), "wb");
+	if (!file) {
+		bwarn("Couldn't create capture trace '%s'", path.c_str());
+		return stream;
+	}
+
+	binfo("Recording capture trace to '%s'", path.c_str());
+	return std::unique_ptr<CaptureStream>(
+		new TracingStream(std::move(stream), file, session));
+}
+
+/* The worker is woken by the hook, the hook rate only decides how long it
+ * sleeps before checking anyway */
+static uint32_t HookRateInterval(HookRate rate)
+{
+	switch (rate) {
+	case HookRate::SLOW:
+		return 100;
+	case HookRate::FAST:
+		return 20;
+	case HookRate::FASTEST:
+		return 10;
+	default:
+		return 40;
+	}
+}
+
+/* Packet length and deadline handed to the hook. Every chunk wakes the
+ * worker with batching off, which with short engine periods means several
+ * hundred wakeups a second. */
+static void ApplyBatchMode(CaptureStream &stream, BatchMode mode)
+{
+	switch (mode) {
+	case BatchMode::LOW_LATENCY:
+		stream.SetBatching(5000, 5000);
+		break;
+	case BatchMode::BALANCED:
+		stream.SetBatching(10000, 15000);
+		break;
+	case BatchMode::THROUGHPUT:
+		stream.SetBatching(20000, 30000);
+		break;
+	default:
+		stream.SetBatching(0, 0);
+		break;
 	}
+}
+
+// The first session keeps the original setting names
+static std::string SessionSetting(const char *name, uint32_t slot)
+{
+	return slot ? name + std::string("_") + std::to_string(slot + 1)
+		    : std::string(name);
+}
+
+// Settings hold sessions as "<device id>::<session id>"
+static void ParseSession(const std::string &session, std::string &deviceId,
+			 std::string &sessionId)
+{
+	size_t delim = session.find("::");
+	deviceId = session.substr(0, delim);
+	sessionId = delim == std::string::npos ? ""
+					       : session.substr(delim + 2);
+}
 
-	return static_cast<speaker_layout>(channels);
+static bool TaskFinished(const std::future<void> &task)
+{
+	return task.wait_for(std::chrono::seconds(0)) ==
+	       std::future_status::ready;
+}
+
+static void LogCapture(const SessionCapture &capture)
+{
+	const CaptureWorkerStats &stats = capture.worker->Stats();
+	const ClockSync &clock = capture.pipeline.Clock();
+	binfo("Capture worker for %lu: %.1f wakeups/s, "
+	      "%llu signalled, %llu timed out, max drain %.3f ms, "
+	      "max queued %.3f ms",
+	      static_cast<unsigned long>(capture.processId),
+	      capture.worker->WakeupsPerSecond(),
+	      static_cast<unsigned long long>(stats.signalledWakeups.load()),
+	      static_cast<unsigned long long>(stats.timeoutWakeups.load()),
+	      stats.maxLatencyNs.load() / 1000000.0,
+	      stats.maxQueuedNs.load() / 1000000.0);
+	binfo("Session clock for %lu: drift %.1f ppm, skew %.3f ms, "
+	      "max jitter %.3f ms, %llu resyncs",
+	      static_cast<unsigned long>(capture.processId), clock.DriftPpm(),
+	      clock.SkewNs() / 1000000.0, clock.MaxErrorNs() / 1000000.0,
+	      static_cast<unsigned long long>(clock.Resyncs()));
+	if (capture.gate.Closings()) {
+		binfo("Silence gate for %lu: %llu frames skipped over "
+		      "%llu closings",
+		      static_cast<unsigned long>(capture.processId),
+		      static_cast<unsigned long long>(
+			      capture.gate.GatedFrames()),
+		      static_cast<unsigned long long>(capture.gate.Closings()));
+	}
 }
 #pragma endregion
 
 #pragma region Class Implementation
 #pragma region Public
-AudioRenderClientOffsets AudioCaptureSource::offsets32 = {};
-AudioRenderClientOffsets AudioCaptureSource::offsets64 = {};
-
 AudioCaptureSource::AudioCaptureSource(
-	obs_data_t * settings,
-				       obs_source_t *source)
-	: source(source)
+	obs_data_t *settings, obs_source_t *source,
+	std::shared_ptr<CaptureBackend> backend)
+	: source(source), backend(std::move(backend))
 {
-	WaitForPreinitialization();
+	obs_audio_info aoi = {};
+	obs_get_audio_info(&aoi);
+
+	uint32_t outChannels = get_audio_channels(aoi.speakers);
+	pool.Configure(outChannels, aoi.samples_per_sec);
+	mixer.Configure(outChannels, aoi.samples_per_sec, MIXER_MAX_INPUTS);
+	crossfadeFrames = aoi.samples_per_sec * CROSSFADE_MS / 1000;
+	jitter.Configure(outChannels, aoi.samples_per_sec);
+
+	float weights[LOUDNESS_MAX_CHANNELS];
+	LoudnessWeights(aoi.speakers, weights);
+	meter.Configure(outChannels, aoi.samples_per_sec, weights);
+	PublishLoudness();
+	rebound.resize(AUDIO_CAPTURE_MAX_SESSIONS, 0);
+
 	Update(settings);
+
+	subscription = this->backend->Subscribe([this]() { Rebind(); });
 }
 
 AudioCaptureSource::~AudioCaptureSource()
 {
+	backend->Unsubscribe(subscription);
 	Stop();
 }
 
 void AudioCaptureSource::Update(obs_data_t *settings)
 {
-	std::string newSession =
-		obs_data_get_string(settings, SETTING_SESSION);
-	bool reset = newSession != session;
+	std::lock_guard<std::mutex> switchLock(switchMutex);
 
-	if (reset) {
-		Stop();
+	std::vector<std::string> newSessions;
+	float newGains[AUDIO_CAPTURE_MAX_SESSIONS];
+	rules.resize(AUDIO_CAPTURE_MAX_SESSIONS);
+	for (uint32_t i = 0; i < AUDIO_CAPTURE_MAX_SESSIONS; i++) {
+		newSessions.push_back(obs_data_get_string(
+			settings, SessionSetting(SETTING_SESSION, i).c_str()));
+		newGains[i] = db_to_mul(static_cast<float>(obs_data_get_double(
+			settings, SessionSetting(SETTING_GAIN, i).c_str())));
+		std::string exe = obs_data_get_string(
+			settings,
+			SessionSetting(SETTING_SESSION_EXE, i).c_str());
+		std::string name = obs_data_get_string(
+			settings,
+			SessionSetting(SETTING_SESSION_NAME, i).c_str());
+		if (exe != rules[i].exe || name != rules[i].sessionName) {
+			rules[i] = SessionRule();
+			rules[i].exe = exe;
+			rules[i].sessionName = name;
+		}
 	}
 
-	session = newSession;
-	if (session.empty()) {
-		sessionId = "";
-		deviceId = "";
-	} else {
-		size_t delim = newSession.find("::");
-		sessionId = session.substr(0, delim);
-		deviceId = session.substr(delim);
+	// Slots a rule has moved stay where they are until the setting changes
+	bool changed = false;
+	configured.resize(newSessions.size());
+	sessions.resize(newSessions.size());
+	for (uint32_t i = 0; i < newSessions.size(); i++) {
+		if (newSessions[i] != configured[i]) {
+			configured[i] = newSessions[i];
+			sessions[i] = newSessions[i];
+			changed = true;
+		}
 	}
 
 	anticheatHook = obs_data_get_bool(settings, SETTING_ANTI_CHEAT_HOOK);
+	recordTrace = obs_data_get_bool(settings, SETTING_RECORD_TRACE);
 	hookRate = static_cast<HookRate>(
 		obs_data_get_int(settings, SETTING_HOOK_RATE));
+	batchMode = static_cast<BatchMode>(
+		obs_data_get_int(settings, SETTING_BATCHING));
+
+	ResamplerQuality newQuality = static_cast<ResamplerQuality>(
+		obs_data_get_int(settings, SETTING_RESAMPLE_QUALITY));
+	bool qualityChanged = newQuality != resampleQuality;
+	resampleQuality = newQuality;
+
+	bool newGate = obs_data_get_bool(settings, SETTING_SILENCE_GATE);
+	float newThreshold = static_cast<float>(
+		obs_data_get_double(settings, SETTING_SILENCE_THRESHOLD));
+	bool gateChanged = newGate != silenceGate ||
+			   newThreshold != silenceThreshold;
+	silenceGate = newGate;
+	silenceThreshold = newThreshold;
+
+	bool newJitter = obs_data_get_bool(settings, SETTING_JITTER_BUFFER);
+	bool newMeter = obs_data_get_bool(settings, SETTING_LOUDNESS_METER);
+
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		if (newJitter != jitterBuffer) {
+			jitterBuffer = newJitter;
+			jitter.Reset();
+		}
+		if (newMeter != loudnessMeter) {
+			loudnessMeter = newMeter;
+			meter.Reset();
+			PublishLoudness();
+		}
+
+		memcpy(gains, newGains, sizeof(gains));
+		for (auto &capture : captures) {
+			mixer.SetGain(capture->input, gains[capture->slot]);
+			capture->worker->SetInterval(
+				HookRateInterval(hookRate));
+			ApplyBatchMode(*capture->stream, batchMode);
+			if (qualityChanged || gateChanged) {
+				// Picked up by the worker on its next drain
+				capture->formatDirty = true;
+			}
+		}
+	}
 
-	if (reset) {
-		Start();
+	if (changed) {
+		Switch();
+	}
+
+	// Hidden, only here so the rules outlive OBS being restarted
+	for (uint32_t i = 0; i < AUDIO_CAPTURE_MAX_SESSIONS; i++) {
+		if (sessions[i].empty()) {
+			rules[i] = SessionRule();
+		}
+		obs_data_set_string(
+			settings,
+			SessionSetting(SETTING_SESSION_EXE, i).c_str(),
+			rules[i].exe.c_str());
+		obs_data_set_string(
+			settings,
+			SessionSetting(SETTING_SESSION_NAME, i).c_str(),
+			rules[i].sessionName.c_str());
 	}
 }
 #pragma endregion
 
 #pragma region Private
-void AudioCaptureSource::Start() {}
+/* Points every slot whose session is gone at a live one of the same exe and
+ * name on the same device, the newest process's if there are several.
+ * Returns true if any moved. Callers must hold the switch mutex. */
+bool AudioCaptureSource::Resolve(const SessionSnapshot &snapshot)
+{
+	bool moved = false;
+
+	for (uint32_t slot = 0; slot < sessions.size(); slot++) {
+		const SessionRule &rule = rules[slot];
+		if (sessions[slot].empty() || rule.exe.empty()) {
+			continue;
+		}
+
+		std::string deviceId, sessionId;
+		ParseSession(sessions[slot], deviceId, sessionId);
+		const SessionRecord *current =
+			snapshot.Find(sessionId, deviceId);
+		if (current && current->processId) {
+			continue;
+		}
+
+		const SessionRecord *next = nullptr;
+		for (const auto &record : snapshot.sessions) {
+			if (!record.processId || record.deviceId != deviceId ||
+			    record.exe != rule.exe ||
+			    record.sessionName != rule.sessionName ||
+			    record.processCreateTime < rule.processCreateTime) {
+				continue;
+			}
+			if (!next || record.processCreateTime >
+					     next->processCreateTime) {
+				next = &record;
+			}
+		}
+		if (!next) {
+			continue;
+		}
+
+		binfo("Session '%s' is gone, following %s to %lu",
+		      sessions[slot].c_str(), rule.exe.c_str(),
+		      static_cast<unsigned long>(next->processId));
+		sessions[slot] = deviceId + "::" + next->sessionId;
+		rebound[slot] = os_gettime_ns();
+		moved = true;
+	}
 
-void AudioCaptureSource::Stop() {}
+	return moved;
+}
+
+/* True if a slot's session carries on in a new process, which keeps the
+ * session id across a restart, or has turned up with nothing attached to
+ * it yet. Callers must hold the switch mutex. */
+bool AudioCaptureSource::Relaunched(const SessionSnapshot &snapshot)
+{
+	std::vector<bool> attached(sessions.size());
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		for (auto &capture : captures) {
+			if (capture->outgoing) {
+				continue;
+			}
+			attached[capture->slot] = true;
+			if (snapshot.Successor(capture->instanceId,
+					       capture->sessionId,
+					       capture->deviceId)) {
+				return true;
+			}
+		}
+	}
+
+	for (uint32_t slot = 0; slot < sessions.size(); slot++) {
+		if (sessions[slot].empty() || attached[slot]) {
+			continue;
+		}
+
+		std::string deviceId, sessionId;
+		ParseSession(sessions[slot], deviceId, sessionId);
+		const SessionRecord *record =
+			snapshot.Find(sessionId, deviceId);
+		if (record && record->processId) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Runs on whichever thread changed the sessions. Attaching right here
+ * rather than on some poll gets a restarted game back within about an
+ * audio period of its session turning up, and the hook offsets and every
+ * buffer past the stream are the ones already in use. */
+void AudioCaptureSource::Rebind()
+{
+	std::lock_guard<std::mutex> lock(switchMutex);
+	std::shared_ptr<const SessionSnapshot> snapshot = backend->Sessions();
+	bool moved = Resolve(*snapshot);
+	if (moved || Relaunched(*snapshot)) {
+		Switch();
+	}
+}
+
+std::unique_ptr<SessionCapture>
+AudioCaptureSource::Attach(const SessionSnapshot &snapshot, uint32_t slot)
+{
+	const std::string &session = sessions[slot];
+
+	std::unique_ptr<SessionCapture> capture(new SessionCapture);
+	capture->session = session;
+	capture->slot = slot;
+	ParseSession(session, capture->deviceId, capture->sessionId);
+	capture->reboundAt = rebound[slot];
+	rebound[slot] = 0;
+
+	const SessionRecord *record =
+		snapshot.Find(capture->sessionId, capture->deviceId);
+	if (!record || !record->processId) {
+		bwarn("Session '%s' is not active", session.c_str());
+		return nullptr;
+	}
+
+	rules[slot].exe = record->exe;
+	rules[slot].sessionName = record->sessionName;
+	rules[slot].processCreateTime = record->processCreateTime;
+
+	capture->instanceId = record->instanceId;
+	capture->processId = record->processId;
+	capture->stream = backend->Attach(*record);
+	if (!capture->stream) {
+		return nullptr;
+	}
+	if (recordTrace) {
+		capture->stream =
+			RecordTrace(std::move(capture->stream), *record);
+	}
+
+	// The ring may well outlive earlier sources
+	capture->droppedFrames = capture->stream->DroppedFrames();
+	capture->overruns = capture->stream->Overruns();
+	return capture;
+}
+
+/* Attaches whatever the settings now ask for while everything already
+ * running keeps playing. The crossfade and teardown happen later on the
+ * workers, so this costs the calling thread no more than the attach.
+ * Callers must hold the switch mutex. */
+void AudioCaptureSource::Switch()
+{
+	std::shared_ptr<const SessionSnapshot> snapshot = backend->Sessions();
+	Resolve(*snapshot);
+
+	// A relaunched session is attached again as if it were a new one
+	std::vector<std::string> current(sessions.size());
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		for (auto &capture : captures) {
+			if (capture->outgoing) {
+				continue;
+			}
+
+			const SessionRecord *next = snapshot->Successor(
+				capture->instanceId, capture->sessionId,
+				capture->deviceId);
+			if (!next) {
+				current[capture->slot] = capture->session;
+				continue;
+			}
+
+			binfo("Session '%s' was relaunched, following it "
+			      "from %lu to %lu",
+			      capture->session.c_str(),
+			      static_cast<unsigned long>(capture->processId),
+			      static_cast<unsigned long>(next->processId));
+			rebound[capture->slot] = os_gettime_ns();
+		}
+	}
+
+	std::vector<std::unique_ptr<SessionCapture>> attached;
+	uint32_t replaced = 0;
+	for (uint32_t slot = 0; slot < sessions.size(); slot++) {
+		if (sessions[slot].empty() || sessions[slot] == current[slot]) {
+			continue;
+		}
+
+		std::unique_ptr<SessionCapture> capture =
+			Attach(*snapshot, slot);
+		if (capture) {
+			replaced |= 1u << slot;
+			attached.push_back(std::move(capture));
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(outputMutex);
+
+	retiring.erase(std::remove_if(retiring.begin(), retiring.end(),
+				      TaskFinished),
+		       retiring.end());
+
+	if (captures.empty()) {
+		mixer.Reset();
+		jitter.Reset();
+		bypassed = false;
+	}
+
+	uint32_t used = 0;
+	for (auto &capture : captures) {
+		used |= 1u << capture->input;
+		if (!capture->outgoing &&
+		    (sessions[capture->slot] != capture->session ||
+		     (replaced & (1u << capture->slot)))) {
+			capture->outgoing = true;
+			capture->incoming = false;
+			swapStarted = os_gettime_ns();
+			crossfadeAt = 0;
+		}
+	}
+
+	for (auto &capture : attached) {
+		uint32_t input = 0;
+		while (input < mixer.Inputs() && (used & (1u << input))) {
+			input++;
+		}
+		if (input == mixer.Inputs()) {
+			bwarn("Too many sessions switching at once, "
+			      "skipping '%s'",
+			      capture->session.c_str());
+			continue;
+		}
+		used |= 1u << input;
+
+		// Silent until its first output turns up
+		capture->input = input;
+		capture->incoming = true;
+		mixer.ResetInput(input);
+		mixer.SetGain(input, gains[capture->slot]);
+		mixer.SetEnvelope(input, 0.0f);
+		ApplyBatchMode(*capture->stream, batchMode);
+
+		// Blocks on the output mutex until the list has it
+		SessionCapture *target = capture.get();
+		capture->worker.reset(new CaptureWorker(
+			capture->stream->Waker(),
+			[this, target]() { return Drain(*target); },
+			HookRateInterval(hookRate)));
+		captures.push_back(std::move(capture));
+	}
+}
+
+/* Starts the outgoing fades once every incoming session has output (or
+ * took too long to) and retires the outgoing captures whose fade is done.
+ * Callers must hold the output mutex. */
+void AudioCaptureSource::UpdateSwap(uint64_t now)
+{
+	if (swapStarted) {
+		bool primed = true;
+		for (auto &capture : captures) {
+			if (capture->incoming) {
+				primed = false;
+			}
+		}
+
+		if (primed || now - swapStarted > SWAP_TIMEOUT_NS) {
+			for (auto &capture : captures) {
+				if (capture->outgoing && !capture->fadingOut) {
+					mixer.Fade(capture->input, 0.0f,
+						   crossfadeFrames,
+						   primed ? crossfadeAt : 0);
+					capture->fadingOut = true;
+				}
+			}
+			swapStarted = 0;
+		}
+	}
+
+	std::vector<std::unique_ptr<SessionCapture>> done;
+	for (auto it = captures.begin(); it != captures.end();) {
+		SessionCapture &capture = **it;
+		if (!capture.fadingOut || mixer.Fading(capture.input)) {
+			++it;
+			continue;
+		}
+
+		capture.retired = true;
+		mixer.ResetInput(capture.input);
+		done.push_back(std::move(*it));
+		it = captures.erase(it);
+	}
+
+	if (!done.empty()) {
+		Retire(std::move(done));
+	}
+}
+
+/* Removing a worker waits out its drain, and this may well be running
+ * inside one, so the teardown gets a thread of its own.
+ * Callers must hold the output mutex. */
+void AudioCaptureSource::Retire(
+	std::vector<std::unique_ptr<SessionCapture>> list)
+{
+	std::shared_ptr<std::vector<std::unique_ptr<SessionCapture>>> retired =
+		std::make_shared<std::vector<std::unique_ptr<SessionCapture>>>(
+			std::move(list));
+
+	retiring.push_back(std::async(std::launch::async, [retired]() {
+		for (auto &capture : *retired) {
+			LogCapture(*capture);
+			capture->worker.reset();
+		}
+		retired->clear();
+	}));
+}
+
+void AudioCaptureSource::Stop()
+{
+	std::vector<std::unique_ptr<SessionCapture>> list;
+	std::vector<std::future<void>> pending;
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		for (auto &capture : captures) {
+			capture->retired = true;
+		}
+		list.swap(captures);
+		pending.swap(retiring);
+	}
+
+	for (auto &capture : list) {
+		LogCapture(*capture);
+	}
+
+	// Every worker has to be gone before any capture it might touch
+	for (auto &capture : list) {
+		capture->worker.reset();
+	}
+
+	for (auto &task : pending) {
+		task.wait();
+	}
+
+	const FramePoolStats &stats = pool.Stats();
+	if (stats.acquires.load()) {
+		binfo("Frame pool: %llu slabs of %u frames, %llu oversized, "
+		      "%llu acquires, high water %u",
+		      static_cast<unsigned long long>(stats.slabs.load()),
+		      pool.SlabFrames(),
+		      static_cast<unsigned long long>(stats.oversized.load()),
+		      static_cast<unsigned long long>(stats.acquires.load()),
+		      stats.highWater.load());
+	}
+
+	const JitterBufferStats &timing = jitter.Stats();
+	if (timing.blocks.load()) {
+		binfo("Jitter buffer: %.1f ms delay, %.1f ms target, "
+		      "%.2f ms jitter, %llu late, %llu frames concealed, "
+		      "%llu dropped, %llu restarts",
+		      jitter.DelayNs() / 1000000.0,
+		      jitter.TargetNs() / 1000000.0,
+		      jitter.JitterNs() / 1000000.0,
+		      static_cast<unsigned long long>(timing.late.load()),
+		      static_cast<unsigned long long>(
+			      timing.concealedFrames.load()),
+		      static_cast<unsigned long long>(
+			      timing.droppedFrames.load()),
+		      static_cast<unsigned long long>(timing.restarts.load()));
+	}
+
+	list.clear();
+	mixer.Reset();
+	jitter.Reset();
+}
+
+void AudioCaptureSource::UpdateFormat(SessionCapture &capture,
+				      const AudioRingFormatInfo &info)
+{
+	obs_audio_info aoi = {};
+	obs_get_audio_info(&aoi);
+
+	// Every worker lands here, and each emits under the output mutex
+	{
+		std::lock_guard<std::mutex> lock(outputMutex);
+		speakers = aoi.speakers;
+		format = AUDIO_FORMAT_FLOAT_PLANAR;
+	}
+
+	capture.peakScan = silenceGate ? GetPeakScan(GetRingSampleFormat(info))
+				       : nullptr;
+	capture.gate.Configure(silenceThreshold, info.samplesPerSec);
+
+	CapturePipeline &pipeline = capture.pipeline;
+	if (!pipeline.Configure(info, SpeakerLayoutMask(aoi.speakers),
+				aoi.samples_per_sec, resampleQuality)) {
+		bwarn("Unsupported session format: tag %u, %u bits, "
+		      "%u channels, %u Hz to %u Hz",
+		      info.tag, info.bitsPerSample, info.channels,
+		      info.samplesPerSec, aoi.samples_per_sec);
+		return;
+	}
+
+	binfo("Session format for %lu: %u Hz, %u channels (mask 0x%X), %s, "
+	      "%s, %s",
+	      static_cast<unsigned long>(capture.processId), info.samplesPerSec,
+	      info.channels, pipeline.Remix().InputMask(),
+	      pipeline.Remix().Passthrough() ? "no remix" : "remixing",
+	      pipeline.Resample().Passthrough() ? "no resampling"
+						: "resampling",
+	      pipeline.Native() ? "passed through when unmixed" : "converted");
+}
+
+void AudioCaptureSource::ProcessPacket(SessionCapture &capture,
+				       const CapturePacket &packet)
+{
+	uint64_t start = os_gettime_ns();
+
+	CaptureCount(metrics.counters.framesCaptured, packet.frames);
+
+	if (capture.reboundAt) {
+		binfo("First sample from %lu %.1f ms after its session "
+		      "turned up",
+		      static_cast<unsigned long>(capture.processId),
+		      (start - capture.reboundAt) / 1000000.0);
+		capture.reboundAt = 0;
+	}
+
+	if (capture.peakScan &&
+	    packet.size >= packet.frames * packet.format->blockAlign) {
+		float peak = capture.peakScan(
+			packet.data, packet.frames * packet.format->channels);
+		if (!capture.gate.Process(peak, packet.frames)) {
+			CaptureCount(metrics.counters.framesGated,
+				     packet.frames);
+			// The gap that follows is on purpose
+			capture.underruns.Reset();
+			return;
+		}
+	}
+
+	if (capture.pipeline.Native() && Passthrough(capture, packet)) {
+		CaptureCount(metrics.counters.framesNative, packet.frames);
+	} else {
+		CaptureOutput output;
+		if (!capture.pipeline.Process(packet, pool, output)) {
+			return;
+		}
+
+		CaptureCount(metrics.counters.bytesCopied, packet.size);
+		CaptureCount(metrics.counters.bytesCopied,
+			     output.frames * output.channels * sizeof(float));
+		Advance(capture, output.timestamp, output.frames,
+			output.samplesPerSec);
+
+		std::lock_guard<std::mutex> lock(outputMutex);
+		Deliver(capture, output);
+	}
+
+	uint64_t end = os_gettime_ns();
+	metrics.processing.Record(end - start);
+	if (end > packet.timestamp) {
+		metrics.latency.Record(end - packet.timestamp);
+	}
+}
+
+void AudioCaptureSource::Advance(SessionCapture &capture, uint64_t timestamp,
+				 uint32_t frames, uint32_t samplesPerSec)
+{
+	if (capture.underruns.Advance(timestamp, frames, samplesPerSec)) {
+		CaptureCount(metrics.counters.underruns);
+	}
+}
+
+/* A lone session at unity gain has nothing to be mixed with. Callers must
+ * hold the output mutex. */
+bool AudioCaptureSource::Unmixed(const SessionCapture &capture) const
+{
+	return captures.size() == 1 && gains[capture.slot] == 1.0f &&
+	       mixer.Envelope(capture.input) == 1.0f &&
+	       !mixer.Fading(capture.input) && !mixer.Queued(capture.input);
+}
+
+/* Hands the packet's own memory to OBS when nothing on the way would
+ * change it: an unmixed session already in the output layout and rate,
+ * and nothing left for the jitter buffer to squeeze out. Returns false
+ * if the packet has to be converted after all. */
+bool AudioCaptureSource::Passthrough(SessionCapture &capture,
+				     const CapturePacket &packet)
+{
+	std::lock_guard<std::mutex> lock(outputMutex);
+
+	uint64_t now = os_gettime_ns();
+	if (!capture.retired) {
+		UpdateSwap(now);
+	}
+	// The meter only takes float, so it's converted like anything else
+	if (capture.retired || !Unmixed(capture) || loudnessMeter ||
+	    (jitterBuffer && !jitter.Settled())) {
+		return false;
+	}
+
+	CaptureSpan span;
+	if (!capture.pipeline.Span(packet, span)) {
+		return false;
+	}
+
+	Advance(capture, span.timestamp, span.frames, span.samplesPerSec);
+	bypassed = true;
+	bypassEnd = capture.underruns.Expected();
+
+	if (!jitterBuffer || jitter.Retime(span.frames, now, span.timestamp)) {
+		Emit(span);
+	}
+	return true;
+}
+
+// Callers must hold the output mutex
+void AudioCaptureSource::Deliver(SessionCapture &capture,
+				 const CaptureOutput &output)
+{
+	uint64_t now = os_gettime_ns();
+	if (!capture.retired) {
+		UpdateSwap(now);
+	}
+	if (capture.retired) {
+		pool.Release(output.buffer);
+		return;
+	}
+
+	if (Unmixed(capture)) {
+		Output(output);
+		pool.Release(output.buffer);
+		bypassed = true;
+		bypassEnd = capture.underruns.Expected();
+		return;
+	}
+
+	if (bypassed) {
+		// Carry on exactly where the unmixed output stopped
+		mixer.Reset(bypassEnd);
+		for (auto &other : captures) {
+			if (!other->incoming) {
+				mixer.Hold(other->input, now);
+			}
+		}
+		bypassed = false;
+	}
+
+	mixer.Push(capture.input, output.data, output.frames, output.timestamp,
+		   now);
+	pool.Release(output.buffer);
+
+	if (capture.incoming) {
+		// First output from a new session, fade it in from here
+		capture.incoming = false;
+		crossfadeAt = std::max(crossfadeAt,
+				       mixer.Fade(capture.input, 1.0f,
+						  crossfadeFrames));
+		UpdateSwap(now);
+	}
+
+	CaptureOutput mixed;
+	while (mixer.Mix(now, pool, mixed)) {
+		Output(mixed);
+		pool.Release(mixed.buffer);
+	}
+}
+
+// Callers must hold the output mutex
+void AudioCaptureSource::Output(const CaptureOutput &output)
+{
+	if (!jitterBuffer) {
+		Emit(output);
+		return;
+	}
+
+	CaptureOutput timed;
+	jitter.Process(output, os_gettime_ns(), pool, timed);
+	if (timed.frames) {
+		Emit(timed);
+	}
+	pool.Release(timed.buffer);
+}
+
+/* Covers for output that's overdue until this worker looks again, so a
+ * hitch shows up as silence on time rather than audio in OBS's past. */
+void AudioCaptureSource::Conceal(SessionCapture &capture)
+{
+	std::lock_guard<std::mutex> lock(outputMutex);
+	if (capture.retired) {
+		return;
+	}
+
+	uint64_t ahead = capture.worker->Interval() * 1000000ULL;
+	CaptureOutput silence;
+	while (jitter.Conceal(os_gettime_ns(), ahead, pool, silence)) {
+		Emit(silence);
+		pool.Release(silence.buffer);
+	}
+}
+
+// Callers must hold the output mutex
+void AudioCaptureSource::Emit(const CaptureOutput &output)
+{
+	obs_source_audio audio = {};
+	for (uint32_t c = 0; c < output.channels; c++) {
+		audio.data[c] = reinterpret_cast<const uint8_t *>(output.data[c]);
+	}
+	audio.frames = output.frames;
+	audio.speakers = speakers;
+	audio.format = format;
+	audio.samples_per_sec = output.samplesPerSec;
+	audio.timestamp = output.timestamp;
+
+	obs_source_output_audio(source, &audio);
+
+	if (loudnessMeter && meter.Process(output.data, output.frames)) {
+		PublishLoudness();
+	}
+}
+
+void AudioCaptureSource::Emit(const CaptureSpan &span)
+{
+	obs_source_audio audio = {};
+	audio.data[0] = span.data;
+	audio.frames = span.frames;
+	audio.speakers = speakers;
+	audio.format = NativeAudioFormat(span.sampleFormat);
+	audio.samples_per_sec = span.samplesPerSec;
+	audio.timestamp = span.timestamp;
+
+	obs_source_output_audio(source, &audio);
+}
+
+// Callers must hold the output mutex
+void AudioCaptureSource::PublishLoudness()
+{
+	loudness.momentary.store(meter.Momentary(), std::memory_order_relaxed);
+	loudness.shortTerm.store(meter.ShortTerm(), std::memory_order_relaxed);
+	loudness.truePeak.store(meter.TruePeak(), std::memory_order_relaxed);
+	loudness.rms.store(meter.Rms(), std::memory_order_relaxed);
+}
+
+bool AudioCaptureSource::Drain(SessionCapture &capture)
+{
+	CaptureCount(metrics.counters.wakeups);
+
+	if (capture.formatDirty.exchange(false)) {
+		capture.formatSerial = 0;
+	}
+
+	if (capture.retired) {
+		return false;
+	}
+
+	bool worked = capture.stream->Drain([this, &capture](
+						    const CapturePacket &packet) {
+		if (capture.retired) {
+			return;
+		}
+
+		if (packet.formatSerial != capture.formatSerial) {
+			capture.formatSerial = packet.formatSerial;
+			UpdateFormat(capture, *packet.format);
+		}
+
+		ProcessPacket(capture, packet);
+	});
+
+	uint64_t dropped = capture.stream->DroppedFrames();
+	uint64_t overruns = capture.stream->Overruns();
+	CaptureCount(metrics.counters.framesDropped,
+		     dropped - capture.droppedFrames);
+	CaptureCount(metrics.counters.overruns, overruns - capture.overruns);
+	capture.droppedFrames = dropped;
+	capture.overruns = overruns;
+
+	if (jitterBuffer) {
+		Conceal(capture);
+	}
+
+	return worked;
+}
+
+std::string AudioCaptureSource::DescribeMetrics() const
+{
+	std::string text = metrics.Describe();
+	if (loudnessMeter) {
+		char line[160];
+		snprintf(line, sizeof(line),
+			 "\nLoudness: momentary %.1f LUFS, short-term %.1f "
+			 "LUFS, true peak %.1f dBTP, RMS %.1f dBFS",
+			 loudness.momentary.load(), loudness.shortTerm.load(),
+			 loudness.truePeak.load(), loudness.rms.load());
+		text += line;
+	}
+
+	return text;
+}
+
+void AudioCaptureSource::LogMetrics() const
+{
+	std::string text = DescribeMetrics();
+	size_t start = 0;
+
+	binfo("Statistics for '%s':", obs_source_get_name(source));
+	while (start < text.size()) {
+		size_t end = text.find('\n', start);
+		if (end == std::string::npos) {
+			end = text.size();
+		}
+
+		binfo("    %s", text.substr(start, end - start).c_str());
+		start = end + 1;
+	}
+}
 
 #pragma endregion
 #pragma endregion
@@ -132,7 +1139,7 @@ static const char *GetAudioCaptureSourceName(void *)
 static void *CreateAudioCaptureSource(obs_data_t *settings,
 				      obs_source_t *source)
 {
-	return new AudioCaptureSource(settings, source);
+	return new AudioCaptureSource(settings, source, GetHookBackend());
 }
 
 static void DestroyAudioCaptureSource(void *data)
@@ -150,6 +1157,26 @@ static void GetAudioCaptureSourceDefaults(obs_data_t *settings)
 	obs_data_set_default_bool(settings, SETTING_ANTI_CHEAT_HOOK, true);
 	obs_data_set_default_int(settings, SETTING_HOOK_RATE,
 				 static_cast<int>(HookRate::NORMAL));
+	obs_data_set_default_int(settings, SETTING_BATCHING,
+				 static_cast<int>(BatchMode::OFF));
+	obs_data_set_default_int(settings, SETTING_RESAMPLE_QUALITY,
+				 static_cast<int>(ResamplerQuality::MEDIUM));
+	obs_data_set_default_bool(settings, SETTING_SILENCE_GATE, false);
+	obs_data_set_default_double(settings, SETTING_SILENCE_THRESHOLD, -80.0);
+	obs_data_set_default_bool(settings, SETTING_JITTER_BUFFER, true);
+	obs_data_set_default_bool(settings, SETTING_LOUDNESS_METER, false);
+	obs_data_set_default_bool(settings, SETTING_RECORD_TRACE, false);
+	for (uint32_t i = 0; i < AUDIO_CAPTURE_MAX_SESSIONS; i++) {
+		obs_data_set_default_double(
+			settings, SessionSetting(SETTING_GAIN, i).c_str(), 0.0);
+	}
+}
+
+static bool LogAudioCaptureSourceMetrics(obs_properties_t *,
+					 obs_property_t *, void *data)
+{
+	static_cast<AudioCaptureSource *>(data)->LogMetrics();
+	return false;
 }
 
 static obs_properties_t *GetAudioCaptureSourceProperties(void *data)
@@ -157,27 +1184,48 @@ static obs_properties_t *GetAudioCaptureSourceProperties(void *data)
 	obs_properties_t *props = obs_properties_create();
 	obs_property_t *p;
 
-	p = obs_properties_add_list(props, SETTING_SESSION, TEXT_SESSION,
-				    OBS_COMBO_TYPE_LIST,
-				    OBS_COMBO_FORMAT_STRING);
-	obs_property_list_add_string(p, "", "");
+	std::shared_ptr<const SessionSnapshot> snapshot =
+		GetHookBackend()->Sessions();
+
+	// Every slot but the first is only there to be mixed in
+	for (uint32_t i = 0; i < AUDIO_CAPTURE_MAX_SESSIONS; i++) {
+		DStr sessionText;
+		DStr gainText;
+
+		if (i) {
+			dstr_printf(sessionText, "%s %u", TEXT_SESSION, i + 1);
+			dstr_printf(gainText, "%s %u", TEXT_GAIN, i + 1);
+		} else {
+			dstr_copy(sessionText, TEXT_SESSION);
+			dstr_copy(gainText, TEXT_GAIN);
+		}
 
-	std::vector<AudioSessionInfo> sessions = GetAudioSessions();
+		p = obs_properties_add_list(
+			props, SessionSetting(SETTING_SESSION, i).c_str(),
+			sessionText, OBS_COMBO_TYPE_LIST,
+			OBS_COMBO_FORMAT_STRING);
+		obs_property_list_add_string(p, "", "");
 
-	for (auto session : sessions) {
-		DStr desc;
-		DStr id;
+		for (auto session : snapshot->sessions) {
+			DStr desc;
+			DStr id;
 
-		if (session.sessionName.empty()) {
-			session.sessionName = "Unnamed Session";
+			if (session.sessionName.empty()) {
+				session.sessionName = "Unnamed Session";
+			}
+
+			dstr_printf(desc, "[%s]: %s (%s)", session.exe.c_str(),
+				    session.sessionName.c_str(),
+				    session.deviceName.c_str());
+			dstr_printf(id, "%s::%s", session.deviceId.c_str(),
+				    session.sessionId.c_str());
+			obs_property_list_add_string(p, desc, id);
 		}
 
-		dstr_printf(desc, "[%s]: %s (%s)", session.exe.c_str(),
-			    session.sessionName.c_str(),
-			    session.deviceName.c_str());
-		dstr_printf(id, "%s::%s", session.deviceId.c_str(),
-			    session.sessionId.c_str());
-		obs_property_list_add_string(p, desc, id);
+		p = obs_properties_add_float_slider(
+			props, SessionSetting(SETTING_GAIN, i).c_str(),
+			gainText, -30.0, 12.0, 0.1);
+		obs_property_float_set_suffix(p, " dB");
 	}
 
 	p = obs_properties_add_bool(props, SETTING_ANTI_CHEAT_HOOK,
@@ -194,6 +1242,52 @@ static obs_properties_t *GetAudioCaptureSourceProperties(void *data)
 	obs_property_list_add_int(p, TEXT_HOOK_RATE_FASTEST,
 				  static_cast<int>(HookRate::FASTEST));
 
+	p = obs_properties_add_list(props, SETTING_BATCHING, TEXT_BATCHING,
+				    OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p, TEXT_BATCHING_OFF,
+				  static_cast<int>(BatchMode::OFF));
+	obs_property_list_add_int(p, TEXT_BATCHING_LOW_LATENCY,
+				  static_cast<int>(BatchMode::LOW_LATENCY));
+	obs_property_list_add_int(p, TEXT_BATCHING_BALANCED,
+				  static_cast<int>(BatchMode::BALANCED));
+	obs_property_list_add_int(p, TEXT_BATCHING_THROUGHPUT,
+				  static_cast<int>(BatchMode::THROUGHPUT));
+
+	p = obs_properties_add_list(props, SETTING_RESAMPLE_QUALITY,
+				    TEXT_RESAMPLE_QUALITY, OBS_COMBO_TYPE_LIST,
+				    OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(p, TEXT_RESAMPLE_QUALITY_LOW,
+				  static_cast<int>(ResamplerQuality::LOW));
+	obs_property_list_add_int(p, TEXT_RESAMPLE_QUALITY_MEDIUM,
+				  static_cast<int>(ResamplerQuality::MEDIUM));
+	obs_property_list_add_int(p, TEXT_RESAMPLE_QUALITY_HIGH,
+				  static_cast<int>(ResamplerQuality::HIGH));
+
+	obs_properties_add_bool(props, SETTING_SILENCE_GATE, TEXT_SILENCE_GATE);
+	p = obs_properties_add_float_slider(props, SETTING_SILENCE_THRESHOLD,
+					    TEXT_SILENCE_THRESHOLD, -100.0,
+					    -30.0, 1.0);
+	obs_property_float_set_suffix(p, " dB");
+	obs_properties_add_bool(props, SETTING_JITTER_BUFFER,
+				TEXT_JITTER_BUFFER);
+	obs_properties_add_bool(props, SETTING_LOUDNESS_METER,
+				TEXT_LOUDNESS_METER);
+	obs_properties_add_bool(props, SETTING_RECORD_TRACE,
+				TEXT_RECORD_TRACE);
+
+	if (data) {
+		AudioCaptureSource *capture =
+			static_cast<AudioCaptureSource *>(data);
+		p = obs_properties_add_text(props, SETTING_STATISTICS,
+					    TEXT_STATISTICS, OBS_TEXT_INFO);
+		obs_property_set_long_description(
+			p, capture->DescribeMetrics().c_str());
+
+		obs_properties_add_button2(props, SETTING_LOG_STATISTICS,
+					   TEXT_LOG_STATISTICS,
+					   LogAudioCaptureSourceMetrics, data);
+	}
+
 	return props;
 }
 
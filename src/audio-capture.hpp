@@ -20,40 +20,189 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 #include <obs-module.h>
 
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "audio-hook/audio-hook-info.hpp"
+#include "audio/loudness-meter.hpp"
+#include "audio/peak-scan.hpp"
+#include "capture/capture-backend.hpp"
+#include "capture/capture-metrics.hpp"
+#include "capture/capture-pipeline.hpp"
+#include "capture/capture-worker.hpp"
+#include "capture/frame-pool.hpp"
+#include "capture/jitter-buffer.hpp"
+#include "capture/session-mixer.hpp"
+#include "capture/silence-gate.hpp"
+
+// Sessions one source can mix together
+#define AUDIO_CAPTURE_MAX_SESSIONS 4
 
 /* Fuck C++ for having literally the worst implementation of enumerated
  * types in any language I've ever used */
 enum class HookRate { SLOW, NORMAL, FAST, FASTEST };
 
-class AudioCaptureSource {
-	obs_source_t *source;
+// How long the hook coalesces audio for before waking the worker
+enum class BatchMode { OFF, LOW_LATENCY, BALANCED, THROUGHPUT };
+
+/* What a session setting falls back on once the session it names is gone,
+ * so a restarted game is picked up again without anyone touching the
+ * settings. Taken from whatever the setting last attached to. */
+struct SessionRule {
+	std::string exe;
+	std::string sessionName;
+	/* Processes started before this one aren't followed, so a second
+	 * instance that was already running isn't taken over. Unknown for
+	 * rules read back from the settings. */
+	uint64_t processCreateTime = 0;
+};
 
+/* One selected session. Each has its own stream, pipeline and worker and
+ * only meets the others in the mixer. */
+struct SessionCapture {
 	std::string session;
 	std::string sessionId;
 	std::string deviceId;
+	// Which of the source's session settings this came from
+	uint32_t slot = 0;
+
+	// Which process's instance of the session is attached
+	std::string instanceId;
+	uint32_t processId = 0;
+	std::unique_ptr<CaptureStream> stream;
+	// Set if a rule brought this in, until its first sample is logged
+	uint64_t reboundAt = 0;
+
+	// Mixer input, held for as long as the capture is around
+	uint32_t input = 0;
+	/* Swap state. Incoming captures fade in with their first output,
+	 * outgoing ones fade out once every incoming one has started. */
+	bool incoming = false;
+	bool outgoing = false;
+	bool fadingOut = false;
+	// Off the list and waiting to be torn down, nothing more to deliver
+	std::atomic<bool> retired{false};
+
+	uint32_t formatSerial = 0;
+	CapturePipeline pipeline;
+	std::atomic<bool> formatDirty{false};
+
+	// Only set while the source has the gate turned on
+	PeakScanFunc peakScan = nullptr;
+	SilenceGate gate;
+
+	std::unique_ptr<CaptureWorker> worker;
+
+	// Last totals seen from the stream, so only the difference is counted
+	uint64_t droppedFrames = 0;
+	uint64_t overruns = 0;
+	UnderrunTracker underruns;
+};
+
+// Copied out of the meter after every block, readable from any thread
+struct LoudnessLevels {
+	std::atomic<float> momentary{0.0f};
+	std::atomic<float> shortTerm{0.0f};
+	std::atomic<float> truePeak{0.0f};
+	std::atomic<float> rms{0.0f};
+};
+
+class AudioCaptureSource {
+	obs_source_t *source;
 
+	// Serializes Switch between settings updates and session changes
+	std::mutex switchMutex;
+	// As the settings have them, and as the rules have since moved them
+	std::vector<std::string> configured;
+	std::vector<std::string> sessions;
+	std::vector<SessionRule> rules;
+	// When each slot was last moved by its rule
+	std::vector<uint64_t> rebound;
+	uint64_t subscription = 0;
+	float gains[AUDIO_CAPTURE_MAX_SESSIONS];
+
+	// What mixed output goes to OBS as, guarded by the output mutex
 	speaker_layout speakers;
 	audio_format format;
-	uint32_t samplesPerSec;
 
 	bool anticheatHook;
+	// Only applies to captures attached from then on
+	bool recordTrace = false;
 	HookRate hookRate;
-
-	void Start();
+	BatchMode batchMode = BatchMode::OFF;
+
+	std::shared_ptr<CaptureBackend> backend;
+	std::vector<std::unique_ptr<SessionCapture>> captures;
+	std::atomic<ResamplerQuality> resampleQuality{ResamplerQuality::MEDIUM};
+	std::atomic<bool> silenceGate{false};
+	std::atomic<float> silenceThreshold{-80.0f};
+	std::atomic<bool> jitterBuffer{true};
+	std::atomic<bool> loudnessMeter{false};
+
+	// Serializes the workers from here to obs_source_output_audio
+	std::mutex outputMutex;
+	SessionMixer mixer;
+	FramePool pool;
+	uint32_t crossfadeFrames = 0;
+	// Set when the last output skipped the mixer, and where it ended
+	bool bypassed = false;
+	uint64_t bypassEnd = 0;
+	// Last stop before OBS, sees everything that's output
+	JitterBuffer jitter;
+	// Measures whatever the jitter buffer lets out, as it goes
+	LoudnessMeter meter;
+	LoudnessLevels loudness;
+
+	// When the current swap began and where its fades line up
+	uint64_t swapStarted = 0;
+	int64_t crossfadeAt = 0;
+	// Teardown of retired captures, off whichever thread retired them
+	std::vector<std::future<void>> retiring;
+
+	CaptureMetrics metrics;
+
+	bool Resolve(const SessionSnapshot &snapshot);
+	bool Relaunched(const SessionSnapshot &snapshot);
+	void Rebind();
+	std::unique_ptr<SessionCapture> Attach(const SessionSnapshot &snapshot,
+					       uint32_t slot);
+	void Switch();
+	void UpdateSwap(uint64_t now);
+	void Retire(std::vector<std::unique_ptr<SessionCapture>> list);
 	void Stop();
 
-public:
-	// Code smell?
-	static AudioRenderClientOffsets offsets32;
-	static AudioRenderClientOffsets offsets64;
+	void UpdateFormat(SessionCapture &capture,
+			  const AudioRingFormatInfo &info);
+	void ProcessPacket(SessionCapture &capture,
+			   const CapturePacket &packet);
+	void Advance(SessionCapture &capture, uint64_t timestamp,
+		     uint32_t frames, uint32_t samplesPerSec);
+	bool Unmixed(const SessionCapture &capture) const;
+	bool Passthrough(SessionCapture &capture, const CapturePacket &packet);
+	void Deliver(SessionCapture &capture, const CaptureOutput &output);
+	void Output(const CaptureOutput &output);
+	void Conceal(SessionCapture &capture);
+	void Emit(const CaptureOutput &output);
+	void Emit(const CaptureSpan &span);
+	void PublishLoudness();
+	bool Drain(SessionCapture &capture);
 
-	AudioCaptureSource(obs_data_t *settings, obs_source_t *source);
+public:
+	AudioCaptureSource(obs_data_t *settings, obs_source_t *source,
+			   std::shared_ptr<CaptureBackend> backend);
 	~AudioCaptureSource();
 
 	void Update(obs_data_t *settings);
+
+	std::string DescribeMetrics() const;
+	void LogMetrics() const;
+
+	// -inf until measured, and while the meter is off
+	const LoudnessLevels &Loudness() const { return loudness; }
 };
 
 void RegisterAudioCaptureSource();
\ No newline at end of file
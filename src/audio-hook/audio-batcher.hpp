@@ -0,0 +1,162 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include "audio-ring.hpp"
+
+/* Producer side batching. Engines with 2-3 ms periods call ReleaseBuffer
+ * hundreds of times a second, and if every chunk woke the plugin the
+ * wakeups would cost more than the copying. Chunks are instead appended to
+ * a packet reserved in the ring and only committed once it holds the
+ * header's batchUs worth of audio, or once its oldest chunk has waited
+ * batchDeadlineUs. The caller signals the consumer only when Write()
+ * says a packet went out.
+ *
+ * There's no timer here: the deadline is checked as chunks arrive, so
+ * audio is held back at most the deadline plus one chunk period, and a
+ * stream that stops mid-batch keeps its tail until Flush(). Chunks are
+ * taken to be back to back, which ReleaseBuffer's always are.
+ *
+ * Header-only and free of platform calls like the ring itself. The clock
+ * is whatever the caller passes in: QPC ticks in the hook, nanoseconds in
+ * the plugin. */
+class AudioRingBatcher {
+	AudioRingWriter *writer;
+
+	uint32_t batchUs = 0;
+	uint32_t batchDeadlineUs = 0;
+	uint32_t batchRate = 0;
+	uint32_t packetFrames = 0;
+	uint64_t maxLatency = 0;
+
+	uint8_t *staged = nullptr;
+	uint32_t stagedCapacity = 0;
+	uint32_t stagedSize = 0;
+	uint32_t stagedFrames = 0;
+	uint32_t stagedFlags = 0;
+	uint64_t stagedTimestamp = 0;
+	uint64_t stagedSince = 0;
+
+public:
+	explicit AudioRingBatcher(AudioRingWriter &writer) : writer(&writer) {}
+
+	/* Picks up the plugin's settings from the header. `ticksPerSecond` is
+	 * the rate of the clock handed to Write(). Cheap enough to call for
+	 * every chunk, which is how changes get picked up live. */
+	void Configure(const AudioRingHeader *header, uint64_t ticksPerSecond)
+	{
+		uint32_t us = header->batchUs.load(std::memory_order_relaxed);
+		uint32_t deadlineUs =
+			header->batchDeadlineUs.load(std::memory_order_relaxed);
+		uint32_t rate = writer->Format().samplesPerSec;
+
+		if (us == batchUs && deadlineUs == batchDeadlineUs &&
+		    rate == batchRate)
+			return;
+
+		batchUs = us;
+		batchDeadlineUs = deadlineUs;
+		batchRate = rate;
+		packetFrames = static_cast<uint32_t>(
+			static_cast<uint64_t>(rate) * us / 1000000);
+		maxLatency = ticksPerSecond / 1000000 * deadlineUs +
+			     ticksPerSecond % 1000000 * deadlineUs / 1000000;
+	}
+
+	bool Enabled() const { return packetFrames > 1; }
+	uint32_t StagedFrames() const { return stagedFrames; }
+
+	/* Adds one chunk. Returns true if that committed a packet, in which
+	 * case the consumer should be woken if it's waiting. A chunk the ring
+	 * has no room for is dropped and counted like any other overrun. */
+	bool Write(const void *payload, uint32_t size, uint32_t frames,
+		   uint64_t timestamp, uint64_t now, uint32_t flags = 0)
+	{
+		if (!frames)
+			return false;
+
+		if (!Enabled()) {
+			bool flushed = Flush();
+			return writer->Write(payload, size, frames, timestamp,
+					     flags) ||
+			       flushed;
+		}
+
+		bool committed = false;
+
+		if (staged && (stagedSize + size > stagedCapacity ||
+			       flags != stagedFlags))
+			committed = Flush();
+
+		if (!staged) {
+			// Room for a chunk more than the packet needs, so an
+			// uneven chunk doesn't cut the packet short
+			uint32_t capacity = 2 * packetFrames * (size / frames);
+			if (capacity < size)
+				capacity = size;
+
+			staged = writer->Reserve(capacity);
+			if (!staged) {
+				writer->Drop(frames);
+				return committed;
+			}
+
+			stagedCapacity = capacity;
+			stagedFlags = flags;
+			stagedTimestamp = timestamp;
+			stagedSince = now;
+		}
+
+		memcpy(staged + stagedSize, payload, size);
+		stagedSize += size;
+		stagedFrames += frames;
+
+		if (stagedFrames >= packetFrames ||
+		    now - stagedSince >= maxLatency)
+			committed = Flush() || committed;
+
+		return committed;
+	}
+
+	// For producers that get a chance to look without new audio
+	bool Poll(uint64_t now)
+	{
+		if (staged && now - stagedSince >= maxLatency)
+			return Flush();
+		return false;
+	}
+
+	// Commits whatever is staged, before a format change for one
+	bool Flush()
+	{
+		if (!staged)
+			return false;
+
+		writer->Truncate(stagedSize);
+		writer->Commit(stagedFrames, stagedTimestamp, stagedFlags);
+
+		staged = nullptr;
+		stagedSize = 0;
+		stagedFrames = 0;
+		return true;
+	}
+};
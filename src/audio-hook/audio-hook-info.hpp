@@ -18,6 +18,7 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
 // Not sure how necessary this is
@@ -28,4 +29,110 @@ struct AudioRenderClientOffsets {
 	uint32_t releaseBuffer;
 };
 
+/* Shared memory transport between the hooked ReleaseBuffer and the plugin.
+ * The mapping is named AUDIO_RING_NAME followed by the target's process id
+ * and holds an AudioRingHeader followed by `capacity` bytes of packet data.
+ * Everything in here is fixed width so 32-bit games and 64-bit OBS agree on
+ * the layout. The producer sets the auto-reset event named AUDIO_RING_EVENT_NAME
+ * plus the process id after a commit, but only while the consumer says it's
+ * waiting on it. With batching on it commits (and so signals) a lot less
+ * often, see AudioRingBatcher. */
+#define AUDIO_RING_NAME L"WinAudioSessionCapture_Ring_"
+#define AUDIO_RING_EVENT_NAME L"WinAudioSessionCapture_Wake_"
+#define AUDIO_RING_MAGIC 0x52534157 // 'WASR'
+#define AUDIO_RING_VERSION 2
+#define AUDIO_RING_CAPACITY (1 << 20)
+
+#define AUDIO_RING_CACHE_LINE 64
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+	      "Ring positions must be plain 32-bit words");
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+	      "Ring positions must be lock-free to live in shared memory");
+
+enum AudioRingFormat : uint32_t {
+	AUDIO_RING_FORMAT_UNKNOWN,
+	AUDIO_RING_FORMAT_PCM,
+	AUDIO_RING_FORMAT_FLOAT,
+};
+
+/* Sent in-band as the payload of an AUDIO_RING_PACKET_FORMAT packet, ahead
+ * of the first packet carrying its serial. Packets already queued keep the
+ * format that was current when they were written. */
+struct AudioRingFormatInfo {
+	uint32_t tag;
+	uint32_t samplesPerSec;
+	uint32_t channelMask;
+	uint16_t channels;
+	uint16_t bitsPerSample;
+	uint16_t validBitsPerSample;
+	uint16_t blockAlign;
+	uint32_t reserved;
+};
+
+/* Producer and consumer positions live on their own cache lines so the game's
+ * audio thread never fights the plugin over a line. Positions are free-running
+ * byte counters; wrap-around is handled by masking with capacity - 1. */
+struct AudioRingHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t capacity;
+	// Serial of the last format record the producer published
+	std::atomic<uint32_t> formatSerial;
+	// Was the format before it moved in-band, keeps the line filled
+	uint8_t reserved[sizeof(AudioRingFormatInfo)];
+	/* Filled in by the plugin once it has resolved them for the target's
+	 * bitness; the hook mustn't patch anything until offsetsReady is set */
+	AudioRenderClientOffsets offsets;
+	std::atomic<uint32_t> offsetsReady;
+	/* Also the plugin's: how long a packet the hook should coalesce
+	 * ReleaseBuffer chunks into, and how long it may hold audio back doing
+	 * so. Zero commits every chunk as it comes. Fills the line exactly. */
+	std::atomic<uint32_t> batchUs;
+	std::atomic<uint32_t> batchDeadlineUs;
+
+	// Producer line
+	std::atomic<uint32_t> writePos;
+	std::atomic<uint32_t> overruns;
+	std::atomic<uint32_t> droppedFrames;
+	std::atomic<uint32_t> producerAlive;
+	uint8_t pad1[AUDIO_RING_CACHE_LINE - 16];
+
+	// Consumer line
+	std::atomic<uint32_t> readPos;
+	std::atomic<uint32_t> consumerAlive;
+	std::atomic<uint32_t> consumerWaiting;
+	/* Set by a consumer that attached without having seen the current
+	 * format; the producer sends the record again with its next packet */
+	std::atomic<uint32_t> formatRequest;
+	uint8_t pad2[AUDIO_RING_CACHE_LINE - 16];
+};
+
+/* Each packet in the data region starts with one of these, padded up to
+ * AUDIO_RING_PACKET_ALIGN. A size of AUDIO_RING_PACKET_WRAP means the rest of
+ * the region is unused and the next packet starts back at offset zero. */
+#define AUDIO_RING_PACKET_ALIGN 8
+#define AUDIO_RING_PACKET_WRAP 0xFFFFFFFF
+
+/* Flag on a packet with no frames whose payload is an AudioRingFormatInfo.
+ * Readers take these in themselves and never hand them out. */
+#define AUDIO_RING_PACKET_FORMAT 0x80000000
+
+struct AudioRingPacket {
+	uint32_t size;
+	uint32_t frames;
+	// QueryPerformanceCounter at ReleaseBuffer, or 0 if the hook has none
+	uint64_t timestamp;
+	uint32_t formatSerial;
+	uint32_t flags;
+};
+
 #pragma pack(pop)
+
+static_assert(sizeof(AudioRingFormatInfo) == 24,
+	      "AudioRingFormatInfo layout must match across bitness");
+static_assert(sizeof(AudioRingHeader) == 3 * AUDIO_RING_CACHE_LINE,
+	      "AudioRingHeader layout must match across bitness");
+static_assert(sizeof(AudioRingPacket) == 24,
+	      "AudioRingPacket layout must match across bitness");
@@ -0,0 +1,385 @@
+/*
+Windows Audio Session Capture Plugin for OBS Studio
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "audio-hook-info.hpp"
+
+/* Single-producer/single-consumer packet ring over an AudioRingHeader.
+ * Header-only and free of any platform calls so the hook, the plugin and
+ * anything else that maps the region can share it.
+ *
+ * The producer never waits: if a packet doesn't fit it is dropped and counted
+ * in `overruns`/`droppedFrames`. */
+
+static inline uint32_t AudioRingAlign(uint32_t size)
+{
+	return (size + AUDIO_RING_PACKET_ALIGN - 1) &
+	       ~static_cast<uint32_t>(AUDIO_RING_PACKET_ALIGN - 1);
+}
+
+static inline size_t AudioRingRegionSize(uint32_t capacity)
+{
+	return sizeof(AudioRingHeader) + capacity;
+}
+
+static inline uint8_t *AudioRingData(AudioRingHeader *header)
+{
+	return reinterpret_cast<uint8_t *>(header) + header->headerSize;
+}
+
+// Capacity must be a power of two and larger than any single packet
+static inline void AudioRingInitialize(AudioRingHeader *header,
+				       uint32_t capacity)
+{
+	memset(static_cast<void *>(header), 0, sizeof(AudioRingHeader));
+	header->magic = AUDIO_RING_MAGIC;
+	header->version = AUDIO_RING_VERSION;
+	header->headerSize = sizeof(AudioRingHeader);
+	header->capacity = capacity;
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+static inline bool AudioRingValid(const AudioRingHeader *header)
+{
+	return header->magic == AUDIO_RING_MAGIC &&
+	       header->version == AUDIO_RING_VERSION &&
+	       header->headerSize == sizeof(AudioRingHeader) &&
+	       header->capacity != 0 &&
+	       (header->capacity & (header->capacity - 1)) == 0;
+}
+
+class AudioRingWriter {
+	AudioRingHeader *header = nullptr;
+	uint8_t *data = nullptr;
+	uint32_t mask = 0;
+	uint32_t writePos = 0;
+	uint32_t formatSerial = 0;
+	AudioRingFormatInfo format = {};
+	bool formatPending = false;
+
+	// Reserve() without the format record in front
+	uint8_t *Place(uint32_t size)
+	{
+		uint32_t total = AudioRingAlign(
+			static_cast<uint32_t>(sizeof(AudioRingPacket)) + size);
+		uint32_t offset = writePos & mask;
+		uint32_t tail = header->capacity - offset;
+		uint32_t needed = total;
+
+		// Packets never straddle the end of the region
+		if (tail < total)
+			needed += tail;
+		if (total > header->capacity || needed > FreeSpace())
+			return nullptr;
+
+		if (tail < total) {
+			AudioRingPacket *wrap =
+				reinterpret_cast<AudioRingPacket *>(data +
+								    offset);
+			wrap->size = AUDIO_RING_PACKET_WRAP;
+			writePos += tail;
+			offset = 0;
+		}
+
+		AudioRingPacket *packet =
+			reinterpret_cast<AudioRingPacket *>(data + offset);
+		packet->size = size;
+		return reinterpret_cast<uint8_t *>(packet + 1);
+	}
+
+	/* Gets the format record out ahead of the packet about to be reserved.
+	 * False if there wasn't room for it, in which case that packet can't
+	 * go either or it'd be read with the old format. */
+	bool PublishFormat()
+	{
+		// Nothing to send again before the first SetFormat()
+		if (header->formatRequest.load(std::memory_order_relaxed) &&
+		    format.samplesPerSec) {
+			header->formatRequest.store(0,
+						    std::memory_order_relaxed);
+			formatPending = true;
+		}
+		if (!formatPending)
+			return true;
+
+		uint8_t *dst = Place(sizeof(AudioRingFormatInfo));
+		if (!dst)
+			return false;
+
+		memcpy(dst, &format, sizeof(AudioRingFormatInfo));
+		Commit(0, 0, AUDIO_RING_PACKET_FORMAT);
+		header->formatSerial.store(formatSerial,
+					   std::memory_order_relaxed);
+		formatPending = false;
+		return true;
+	}
+
+public:
+	AudioRingWriter() = default;
+	explicit AudioRingWriter(AudioRingHeader *header) { Attach(header); }
+
+	void Attach(AudioRingHeader *newHeader)
+	{
+		header = newHeader;
+		data = AudioRingData(header);
+		mask = header->capacity - 1;
+		writePos = header->writePos.load(std::memory_order_relaxed);
+		formatSerial =
+			header->formatSerial.load(std::memory_order_relaxed);
+		header->producerAlive.store(1, std::memory_order_release);
+	}
+
+	void Detach()
+	{
+		if (header)
+			header->producerAlive.store(0,
+						    std::memory_order_release);
+		header = nullptr;
+	}
+
+	bool Attached() const { return header != nullptr; }
+	const AudioRingFormatInfo &Format() const { return format; }
+
+	/* Applies to every packet reserved from here on. The record goes into
+	 * the ring with the next one, so whatever is still queued is read
+	 * with the format it was written in. Not while a packet is reserved. */
+	void SetFormat(const AudioRingFormatInfo &newFormat)
+	{
+		format = newFormat;
+		formatSerial++;
+		if (!formatSerial)
+			formatSerial++;
+		formatPending = true;
+	}
+
+	uint32_t FreeSpace() const
+	{
+		uint32_t readPos =
+			header->readPos.load(std::memory_order_acquire);
+		return header->capacity - (writePos - readPos);
+	}
+
+	/* Reserves space for a packet of `size` bytes and returns a pointer to
+	 * its payload, or nullptr if there's no room. Nothing is visible to the
+	 * consumer until Commit(). */
+	uint8_t *Reserve(uint32_t size)
+	{
+		if (!PublishFormat())
+			return nullptr;
+		return Place(size);
+	}
+
+	/* Shrinks the packet last reserved, for producers that reserve room
+	 * for the most they might write. Only before Commit(). */
+	void Truncate(uint32_t size)
+	{
+		reinterpret_cast<AudioRingPacket *>(data + (writePos & mask))
+			->size = size;
+	}
+
+	void Commit(uint32_t frames, uint64_t timestamp, uint32_t flags = 0)
+	{
+		AudioRingPacket *packet = reinterpret_cast<AudioRingPacket *>(
+			data + (writePos & mask));
+		packet->frames = frames;
+		packet->timestamp = timestamp;
+		packet->formatSerial = formatSerial;
+		packet->flags = flags;
+
+		writePos += AudioRingAlign(static_cast<uint32_t>(
+					sizeof(AudioRingPacket)) +
+				packet->size);
+		header->writePos.store(writePos, std::memory_order_release);
+	}
+
+	/* True if the consumer went to sleep and needs the wake event set.
+	 * Pairs with AudioRingReader::Sleep() so a commit is never missed. */
+	bool ConsumerWaiting() const
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return header->consumerWaiting.load(
+			       std::memory_order_relaxed) != 0;
+	}
+
+	// Counts a packet the caller couldn't fit
+	void Drop(uint32_t frames)
+	{
+		header->overruns.fetch_add(1, std::memory_order_relaxed);
+		header->droppedFrames.fetch_add(frames,
+						std::memory_order_relaxed);
+	}
+
+	bool Write(const void *payload, uint32_t size, uint32_t frames,
+		   uint64_t timestamp, uint32_t flags = 0)
+	{
+		uint8_t *dst = Reserve(size);
+		if (!dst) {
+			Drop(frames);
+			return false;
+		}
+
+		memcpy(dst, payload, size);
+		Commit(frames, timestamp, flags);
+		return true;
+	}
+};
+
+/* `format` is the reader's copy of the last record before the packet, or
+ * null if the reader attached after it and hasn't been sent another */
+struct AudioRingView {
+	const uint8_t *data;
+	uint32_t size;
+	uint32_t frames;
+	uint64_t timestamp;
+	uint32_t formatSerial;
+	uint32_t flags;
+	const AudioRingFormatInfo *format;
+};
+
+class AudioRingReader {
+	AudioRingHeader *header = nullptr;
+	const uint8_t *data = nullptr;
+	uint32_t mask = 0;
+	uint32_t readPos = 0;
+	uint32_t pending = 0;
+	uint32_t formatSerial = 0;
+	AudioRingFormatInfo format = {};
+
+public:
+	AudioRingReader() = default;
+	explicit AudioRingReader(AudioRingHeader *header) { Attach(header); }
+
+	void Attach(AudioRingHeader *newHeader)
+	{
+		header = newHeader;
+		data = AudioRingData(header);
+		mask = header->capacity - 1;
+		readPos = header->readPos.load(std::memory_order_relaxed);
+		pending = 0;
+		formatSerial = 0;
+		header->formatRequest.store(1, std::memory_order_relaxed);
+		header->consumerAlive.store(1, std::memory_order_release);
+	}
+
+	void Detach()
+	{
+		if (header)
+			header->consumerAlive.store(0,
+						    std::memory_order_release);
+		header = nullptr;
+	}
+
+	bool Attached() const { return header != nullptr; }
+	AudioRingHeader *Header() const { return header; }
+
+	uint32_t Available() const
+	{
+		return header->writePos.load(std::memory_order_acquire) -
+		       readPos;
+	}
+
+	/* Looks at the next packet without consuming it. The view points
+	 * straight into shared memory and stays valid until Release(). */
+	bool Peek(AudioRingView &view)
+	{
+		uint32_t writePos =
+			header->writePos.load(std::memory_order_acquire);
+
+		while (writePos != readPos) {
+			uint32_t offset = readPos & mask;
+			const AudioRingPacket *packet =
+				reinterpret_cast<const AudioRingPacket *>(
+					data + offset);
+
+			if (packet->size == AUDIO_RING_PACKET_WRAP) {
+				readPos += header->capacity - offset;
+				continue;
+			}
+
+			uint32_t total = AudioRingAlign(
+				static_cast<uint32_t>(sizeof(AudioRingPacket)) +
+				packet->size);
+
+			if (packet->flags & AUDIO_RING_PACKET_FORMAT) {
+				if (packet->size >=
+				    sizeof(AudioRingFormatInfo)) {
+					memcpy(&format, packet + 1,
+					       sizeof(AudioRingFormatInfo));
+					formatSerial = packet->formatSerial;
+				}
+				readPos += total;
+				header->readPos.store(
+					readPos, std::memory_order_release);
+				continue;
+			}
+
+			view.data =
+				reinterpret_cast<const uint8_t *>(packet + 1);
+			view.size = packet->size;
+			view.frames = packet->frames;
+			view.timestamp = packet->timestamp;
+			view.formatSerial = packet->formatSerial;
+			view.flags = packet->flags;
+			view.format = nullptr;
+			if (formatSerial &&
+			    packet->formatSerial == formatSerial)
+				view.format = &format;
+			pending = total;
+			return true;
+		}
+
+		return false;
+	}
+
+	// Hands the last peeked packet's space back to the producer
+	void Release()
+	{
+		readPos += pending;
+		pending = 0;
+		header->readPos.store(readPos, std::memory_order_release);
+	}
+
+	/* Marks the consumer as about to wait on the wake event. Returns false
+	 * if something was committed in the meantime and it shouldn't. */
+	bool Sleep()
+	{
+		header->consumerWaiting.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		return Available() == 0;
+	}
+
+	void Wake()
+	{
+		header->consumerWaiting.store(0, std::memory_order_relaxed);
+	}
+
+	/* Throws away everything queued, e.g. after a stall. Walks the packets
+	 * rather than jumping to the end so no format record is missed. */
+	void Flush()
+	{
+		AudioRingView view;
+		while (Peek(view))
+			Release();
+	}
+};
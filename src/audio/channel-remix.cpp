@@ -0,0 +1,357 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "channel-remix.hpp"
+
+#include <cstring>
+
+#ifdef AUDIO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define MAX_ROUTE_DEPTH 4
+
+static uint32_t CountBits(uint32_t mask)
+{
+	uint32_t count = 0;
+	for (; mask; mask &= mask - 1)
+		count++;
+	return count;
+}
+
+// Keeps only the lowest `count` bits that are set
+static uint32_t TrimMask(uint32_t mask, uint32_t count)
+{
+	uint32_t result = 0;
+	for (; mask && count; count--) {
+		uint32_t bit = mask & (~mask + 1);
+		result |= bit;
+		mask &= ~bit;
+	}
+	return result;
+}
+
+static uint32_t MaskIndex(uint32_t mask, uint32_t speaker)
+{
+	return CountBits(mask & (speaker - 1));
+}
+
+#pragma region Kernels
+static void RemixScalar(const float *const *in, float *const *out,
+			const RemixTap (*taps)[REMIX_MAX_INPUTS],
+			const uint32_t *tapCount, uint32_t outChannels,
+			size_t frames)
+{
+	for (uint32_t o = 0; o < outChannels; o++) {
+		const RemixTap *tap = taps[o];
+		float *dst = out[o];
+
+		if (!tapCount[o]) {
+			memset(dst, 0, frames * sizeof(float));
+			continue;
+		}
+
+		const float *src = in[tap[0].input];
+		float gain = tap[0].gain;
+		for (size_t i = 0; i < frames; i++)
+			dst[i] = src[i] * gain;
+
+		for (uint32_t t = 1; t < tapCount[o]; t++) {
+			src = in[tap[t].input];
+			gain = tap[t].gain;
+			for (size_t i = 0; i < frames; i++)
+				dst[i] += src[i] * gain;
+		}
+	}
+}
+
+#ifdef AUDIO_SIMD_X86
+static void RemixSSE2(const float *const *in, float *const *out,
+		      const RemixTap (*taps)[REMIX_MAX_INPUTS],
+		      const uint32_t *tapCount, uint32_t outChannels,
+		      size_t frames)
+{
+	size_t vecFrames = frames & ~static_cast<size_t>(3);
+
+	for (uint32_t o = 0; o < outChannels; o++) {
+		const RemixTap *tap = taps[o];
+		uint32_t count = tapCount[o];
+		float *dst = out[o];
+
+		if (!count) {
+			memset(dst, 0, frames * sizeof(float));
+			continue;
+		}
+
+		// Keep the sum in a register across every tap for this output
+		for (size_t i = 0; i < vecFrames; i += 4) {
+			__m128 acc = _mm_mul_ps(_mm_loadu_ps(in[tap[0].input] + i),
+						_mm_set1_ps(tap[0].gain));
+			for (uint32_t t = 1; t < count; t++) {
+				acc = _mm_add_ps(
+					acc,
+					_mm_mul_ps(_mm_loadu_ps(in[tap[t].input] +
+								i),
+						   _mm_set1_ps(tap[t].gain)));
+			}
+			_mm_storeu_ps(dst + i, acc);
+		}
+
+		for (size_t i = vecFrames; i < frames; i++) {
+			float acc = in[tap[0].input][i] * tap[0].gain;
+			for (uint32_t t = 1; t < count; t++)
+				acc += in[tap[t].input][i] * tap[t].gain;
+			dst[i] = acc;
+		}
+	}
+}
+
+AUDIO_TARGET_AVX2
+static void RemixAVX2(const float *const *in, float *const *out,
+		      const RemixTap (*taps)[REMIX_MAX_INPUTS],
+		      const uint32_t *tapCount, uint32_t outChannels,
+		      size_t frames)
+{
+	size_t vecFrames = frames & ~static_cast<size_t>(7);
+
+	for (uint32_t o = 0; o < outChannels; o++) {
+		const RemixTap *tap = taps[o];
+		uint32_t count = tapCount[o];
+		float *dst = out[o];
+
+		if (!count) {
+			memset(dst, 0, frames * sizeof(float));
+			continue;
+		}
+
+		for (size_t i = 0; i < vecFrames; i += 8) {
+			__m256 acc = _mm256_mul_ps(
+				_mm256_loadu_ps(in[tap[0].input] + i),
+				_mm256_set1_ps(tap[0].gain));
+			for (uint32_t t = 1; t < count; t++) {
+				acc = _mm256_fmadd_ps(
+					_mm256_loadu_ps(in[tap[t].input] + i),
+					_mm256_set1_ps(tap[t].gain), acc);
+			}
+			_mm256_storeu_ps(dst + i, acc);
+		}
+
+		for (size_t i = vecFrames; i < frames; i++) {
+			float acc = in[tap[0].input][i] * tap[0].gain;
+			for (uint32_t t = 1; t < count; t++)
+				acc += in[tap[t].input][i] * tap[t].gain;
+			dst[i] = acc;
+		}
+	}
+}
+#endif
+#pragma endregion
+
+uint32_t ChannelRemix::DefaultMask(uint32_t channels)
+{
+	// Same guesses OBS makes when it casts a channel count to a layout
+	switch (channels) {
+	case 1:
+		return REMIX_SPEAKER_FC;
+	case 2:
+		return REMIX_SPEAKER_FL | REMIX_SPEAKER_FR;
+	case 3:
+		return REMIX_SPEAKER_FL | REMIX_SPEAKER_FR | REMIX_SPEAKER_LFE;
+	case 4:
+		return REMIX_SPEAKER_FL | REMIX_SPEAKER_FR | REMIX_SPEAKER_FC |
+		       REMIX_SPEAKER_BC;
+	case 5:
+		return REMIX_SPEAKER_FL | REMIX_SPEAKER_FR | REMIX_SPEAKER_FC |
+		       REMIX_SPEAKER_LFE | REMIX_SPEAKER_BC;
+	case 6:
+		return REMIX_SPEAKER_FL | REMIX_SPEAKER_FR | REMIX_SPEAKER_FC |
+		       REMIX_SPEAKER_LFE | REMIX_SPEAKER_BL | REMIX_SPEAKER_BR;
+	case 7:
+		return REMIX_SPEAKER_FL | REMIX_SPEAKER_FR | REMIX_SPEAKER_FC |
+		       REMIX_SPEAKER_LFE | REMIX_SPEAKER_BC | REMIX_SPEAKER_SL |
+		       REMIX_SPEAKER_SR;
+	case 8:
+		return REMIX_SPEAKER_FL | REMIX_SPEAKER_FR | REMIX_SPEAKER_FC |
+		       REMIX_SPEAKER_LFE | REMIX_SPEAKER_BL | REMIX_SPEAKER_BR |
+		       REMIX_SPEAKER_SL | REMIX_SPEAKER_SR;
+	}
+
+	return 0;
+}
+
+/* Sends `speaker` to the output if it exists there, otherwise folds it
+ * into its nearest neighbours following ITU-R BS.775 where it has an
+ * opinion. LFE is dropped when there's nowhere to put it. */
+void ChannelRemix::Route(uint32_t speaker, float gain, int input, int depth)
+{
+	if (outMask & speaker) {
+		matrix[MaskIndex(outMask, speaker)][input] += gain;
+		return;
+	}
+
+	if (depth >= MAX_ROUTE_DEPTH)
+		return;
+
+	depth++;
+
+	switch (speaker) {
+	case REMIX_SPEAKER_FL:
+	case REMIX_SPEAKER_FR:
+		Route(REMIX_SPEAKER_FC, gain * REMIX_MINUS_3DB, input, depth);
+		break;
+	case REMIX_SPEAKER_FC:
+		Route(REMIX_SPEAKER_FL, gain * REMIX_MINUS_3DB, input, depth);
+		Route(REMIX_SPEAKER_FR, gain * REMIX_MINUS_3DB, input, depth);
+		break;
+	case REMIX_SPEAKER_BL:
+		if (outMask & REMIX_SPEAKER_SL)
+			Route(REMIX_SPEAKER_SL, gain, input, depth);
+		else
+			Route(REMIX_SPEAKER_FL, gain * REMIX_MINUS_3DB, input,
+			      depth);
+		break;
+	case REMIX_SPEAKER_BR:
+		if (outMask & REMIX_SPEAKER_SR)
+			Route(REMIX_SPEAKER_SR, gain, input, depth);
+		else
+			Route(REMIX_SPEAKER_FR, gain * REMIX_MINUS_3DB, input,
+			      depth);
+		break;
+	case REMIX_SPEAKER_SL:
+		if (outMask & REMIX_SPEAKER_BL)
+			Route(REMIX_SPEAKER_BL, gain, input, depth);
+		else
+			Route(REMIX_SPEAKER_FL, gain * REMIX_MINUS_3DB, input,
+			      depth);
+		break;
+	case REMIX_SPEAKER_SR:
+		if (outMask & REMIX_SPEAKER_BR)
+			Route(REMIX_SPEAKER_BR, gain, input, depth);
+		else
+			Route(REMIX_SPEAKER_FR, gain * REMIX_MINUS_3DB, input,
+			      depth);
+		break;
+	case REMIX_SPEAKER_BC:
+		if ((outMask & (REMIX_SPEAKER_BL | REMIX_SPEAKER_BR)) ==
+		    (REMIX_SPEAKER_BL | REMIX_SPEAKER_BR)) {
+			Route(REMIX_SPEAKER_BL, gain * REMIX_MINUS_3DB, input,
+			      depth);
+			Route(REMIX_SPEAKER_BR, gain * REMIX_MINUS_3DB, input,
+			      depth);
+		} else if ((outMask & (REMIX_SPEAKER_SL | REMIX_SPEAKER_SR)) ==
+			   (REMIX_SPEAKER_SL | REMIX_SPEAKER_SR)) {
+			Route(REMIX_SPEAKER_SL, gain * REMIX_MINUS_3DB, input,
+			      depth);
+			Route(REMIX_SPEAKER_SR, gain * REMIX_MINUS_3DB, input,
+			      depth);
+		} else {
+			// BS.775 3/1 to 2/0, the surround at -3 dB each side
+			Route(REMIX_SPEAKER_FL, gain * REMIX_MINUS_3DB, input,
+			      depth);
+			Route(REMIX_SPEAKER_FR, gain * REMIX_MINUS_3DB, input,
+			      depth);
+		}
+		break;
+	case REMIX_SPEAKER_FLC:
+		Route(REMIX_SPEAKER_FL, gain, input, depth);
+		break;
+	case REMIX_SPEAKER_FRC:
+		Route(REMIX_SPEAKER_FR, gain, input, depth);
+		break;
+	case REMIX_SPEAKER_TFL:
+		Route(REMIX_SPEAKER_FL, gain, input, depth);
+		break;
+	case REMIX_SPEAKER_TFR:
+		Route(REMIX_SPEAKER_FR, gain, input, depth);
+		break;
+	case REMIX_SPEAKER_TFC:
+		Route(REMIX_SPEAKER_FC, gain, input, depth);
+		break;
+	case REMIX_SPEAKER_TBL:
+		Route(REMIX_SPEAKER_BL, gain, input, depth);
+		break;
+	case REMIX_SPEAKER_TBR:
+		Route(REMIX_SPEAKER_BR, gain, input, depth);
+		break;
+	case REMIX_SPEAKER_TBC:
+		Route(REMIX_SPEAKER_BC, gain, input, depth);
+		break;
+	case REMIX_SPEAKER_TC:
+		Route(REMIX_SPEAKER_FL, gain * REMIX_MINUS_3DB, input, depth);
+		Route(REMIX_SPEAKER_FR, gain * REMIX_MINUS_3DB, input, depth);
+		break;
+	}
+}
+
+bool ChannelRemix::Configure(uint32_t newInMask, uint32_t newInChannels,
+			     uint32_t newOutMask, SimdLevel level)
+{
+	memset(matrix, 0, sizeof(matrix));
+	memset(tapCount, 0, sizeof(tapCount));
+
+	if (newInChannels > REMIX_MAX_INPUTS)
+		newInChannels = REMIX_MAX_INPUTS;
+	if (CountBits(newInMask) < newInChannels &&
+	    DefaultMask(newInChannels))
+		newInMask = DefaultMask(newInChannels);
+
+	inChannels = newInChannels;
+	inMask = TrimMask(newInMask, newInChannels);
+	outMask = TrimMask(newOutMask, REMIX_MAX_OUTPUTS);
+	outChannels = CountBits(outMask);
+	passthrough = inMask == outMask && inChannels == outChannels;
+
+	if (!inChannels || !outChannels) {
+		kernel = nullptr;
+		return false;
+	}
+
+	// Channels past the end of the mask have no position and are dropped
+	int input = 0;
+	for (uint32_t mask = inMask; mask; mask &= mask - 1, input++)
+		Route(mask & (~mask + 1), 1.0f, input, 0);
+
+	for (uint32_t o = 0; o < outChannels; o++) {
+		for (uint32_t i = 0; i < inChannels; i++) {
+			if (matrix[o][i] != 0.0f) {
+				RemixTap &tap = taps[o][tapCount[o]++];
+				tap.input = i;
+				tap.gain = matrix[o][i];
+			}
+		}
+	}
+
+	kernel = RemixScalar;
+#ifdef AUDIO_SIMD_X86
+	if (level == SimdLevel::AVX2)
+		kernel = RemixAVX2;
+	else if (level == SimdLevel::SSE2)
+		kernel = RemixSSE2;
+#else
+	(void)level;
+#endif
+
+	return true;
+}
+
+void ChannelRemix::Process(const float *const *in, float *const *out,
+			   size_t frames) const
+{
+	if (kernel)
+		kernel(in, out, taps, tapCount, outChannels, frames);
+}
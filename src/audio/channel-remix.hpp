@@ -0,0 +1,105 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu-features.hpp"
+
+/* Same bit values as the SPEAKER_* masks in WAVEFORMATEXTENSIBLE. Channels
+ * are always stored in ascending bit order, which lines up with OBS' own
+ * ordering for every speaker_layout it supports. */
+#define REMIX_SPEAKER_FL 0x1
+#define REMIX_SPEAKER_FR 0x2
+#define REMIX_SPEAKER_FC 0x4
+#define REMIX_SPEAKER_LFE 0x8
+#define REMIX_SPEAKER_BL 0x10
+#define REMIX_SPEAKER_BR 0x20
+#define REMIX_SPEAKER_FLC 0x40
+#define REMIX_SPEAKER_FRC 0x80
+#define REMIX_SPEAKER_BC 0x100
+#define REMIX_SPEAKER_SL 0x200
+#define REMIX_SPEAKER_SR 0x400
+#define REMIX_SPEAKER_TC 0x800
+#define REMIX_SPEAKER_TFL 0x1000
+#define REMIX_SPEAKER_TFC 0x2000
+#define REMIX_SPEAKER_TFR 0x4000
+#define REMIX_SPEAKER_TBL 0x8000
+#define REMIX_SPEAKER_TBC 0x10000
+#define REMIX_SPEAKER_TBR 0x20000
+
+#define REMIX_MAX_INPUTS 18
+#define REMIX_MAX_OUTPUTS 8
+
+// ITU-R BS.775 fold-down gain, -3 dB
+#define REMIX_MINUS_3DB 0.70710678f
+
+struct RemixTap {
+	uint32_t input;
+	float gain;
+};
+
+typedef void (*RemixKernel)(const float *const *in, float *const *out,
+			    const RemixTap (*taps)[REMIX_MAX_INPUTS],
+			    const uint32_t *tapCount, uint32_t outChannels,
+			    size_t frames);
+
+/* Builds the mix matrix once per format pair, then applies it as a list of
+ * non-zero taps per output so the per-frame work has no decisions left in
+ * it. Process() must not be given the same buffers for input and output. */
+class ChannelRemix {
+	uint32_t inMask = 0;
+	uint32_t outMask = 0;
+	uint32_t inChannels = 0;
+	uint32_t outChannels = 0;
+	bool passthrough = false;
+
+	float matrix[REMIX_MAX_OUTPUTS][REMIX_MAX_INPUTS] = {};
+	RemixTap taps[REMIX_MAX_OUTPUTS][REMIX_MAX_INPUTS] = {};
+	uint32_t tapCount[REMIX_MAX_OUTPUTS] = {};
+
+	RemixKernel kernel = nullptr;
+
+	void Route(uint32_t speaker, float gain, int input, int depth);
+
+public:
+	static uint32_t DefaultMask(uint32_t channels);
+
+	/* A zero or short mask is filled in from DefaultMask(). Returns false
+	 * if either side has no usable channels. */
+	bool Configure(uint32_t inMask, uint32_t inChannels, uint32_t outMask,
+		       SimdLevel level = GetSimdLevel());
+
+	uint32_t InputChannels() const { return inChannels; }
+	uint32_t OutputChannels() const { return outChannels; }
+	uint32_t InputMask() const { return inMask; }
+	uint32_t OutputMask() const { return outMask; }
+
+	// True when the input already is the output, channel for channel
+	bool Passthrough() const { return passthrough; }
+
+	float Coefficient(uint32_t output, uint32_t input) const
+	{
+		return matrix[output][input];
+	}
+
+	void Process(const float *const *in, float *const *out,
+		     size_t frames) const;
+};
@@ -0,0 +1,100 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "cpu-features.hpp"
+
+#include <cstdint>
+
+#ifdef AUDIO_SIMD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void CpuId(int leaf, int subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuidex(info, leaf, subleaf);
+	for (int i = 0; i < 4; i++) {
+		regs[i] = static_cast<uint32_t>(info[i]);
+	}
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t XGetBv()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+}
+
+static CpuFeatures DetectCpuFeatures()
+{
+	CpuFeatures features = {};
+	uint32_t regs[4];
+
+	CpuId(0, 0, regs);
+	uint32_t maxLeaf = regs[0];
+
+	CpuId(1, 0, regs);
+	features.sse2 = (regs[3] & (1u << 26)) != 0;
+
+	bool osxsave = (regs[2] & (1u << 27)) != 0;
+	bool avx = (regs[2] & (1u << 28)) != 0;
+	bool fma = (regs[2] & (1u << 12)) != 0;
+
+	// The OS has to be saving YMM state too, not just the CPU supporting it
+	if (maxLeaf >= 7 && osxsave && avx && fma && (XGetBv() & 0x6) == 0x6) {
+		CpuId(7, 0, regs);
+		features.avx2 = (regs[1] & (1u << 5)) != 0;
+	}
+
+	return features;
+}
+#else
+static CpuFeatures DetectCpuFeatures()
+{
+	CpuFeatures features = {};
+	return features;
+}
+#endif
+
+const CpuFeatures &GetCpuFeatures()
+{
+	static const CpuFeatures features = DetectCpuFeatures();
+	return features;
+}
+
+SimdLevel GetSimdLevel()
+{
+	const CpuFeatures &features = GetCpuFeatures();
+
+	if (features.avx2)
+		return SimdLevel::AVX2;
+	if (features.sse2)
+		return SimdLevel::SSE2;
+	return SimdLevel::SCALAR;
+}
@@ -0,0 +1,44 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || \
+	defined(__x86_64__)
+#define AUDIO_SIMD_X86 1
+#endif
+
+/* MSVC will happily emit AVX2 intrinsics anywhere, GCC and Clang need to be
+ * told per function. Anything marked with this must only be reached after
+ * checking GetCpuFeatures(). */
+#if defined(AUDIO_SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+#define AUDIO_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define AUDIO_TARGET_AVX2
+#endif
+
+struct CpuFeatures {
+	bool sse2;
+	bool avx2;
+};
+
+// Kernels take one of these so tests and benchmarks can pin a specific path
+enum class SimdLevel { SCALAR, SSE2, AVX2 };
+
+const CpuFeatures &GetCpuFeatures();
+SimdLevel GetSimdLevel();
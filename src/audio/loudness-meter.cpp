@@ -0,0 +1,466 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "loudness-meter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef AUDIO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+/* BS.1770-4 Annex 2, the four phases of the 48 tap interpolator. They're
+ * specified at 48 kHz but only ever relative to the input rate. */
+static const float truePeakTaps[4][TRUE_PEAK_TAPS] = {
+	{0.0017089843750f, 0.0109863281250f, -0.0196533203125f,
+	 0.0332031250000f, -0.0594482421875f, 0.1373291015625f,
+	 0.9721679687500f, -0.1022949218750f, 0.0476074218750f,
+	 -0.0266113281250f, 0.0148925781250f, -0.0083007812500f},
+	{-0.0291748046875f, 0.0292968750000f, -0.0517578125000f,
+	 0.0891113281250f, -0.1665039062500f, 0.4650878906250f,
+	 0.7797851562500f, -0.2003173828125f, 0.1015625000000f,
+	 -0.0582275390625f, 0.0330810546875f, -0.0189208984375f},
+	{-0.0189208984375f, 0.0330810546875f, -0.0582275390625f,
+	 0.1015625000000f, -0.2003173828125f, 0.7797851562500f,
+	 0.4650878906250f, -0.1665039062500f, 0.0891113281250f,
+	 -0.0517578125000f, 0.0292968750000f, -0.0291748046875f},
+	{-0.0083007812500f, 0.0148925781250f, -0.0266113281250f,
+	 0.0476074218750f, -0.1022949218750f, 0.9721679687500f,
+	 0.1373291015625f, -0.0594482421875f, 0.0332031250000f,
+	 -0.0196533203125f, 0.0109863281250f, 0.0017089843750f},
+};
+
+// Filter state decays into denormals after a while of silence
+#define STATE_FLOOR 1e-30
+
+#pragma region Scalar
+static void FilterScalar(const LoudnessFilter &f, const float *const *in,
+			 size_t frames, double *const *state, double *energy)
+{
+	const float *x = in[0];
+	double *s = state[0];
+	double z0 = s[0], z1 = s[1], z2 = s[2], z3 = s[3];
+	double sum = 0.0;
+
+	// Transposed direct form II, one stage after the other
+	for (size_t i = 0; i < frames; i++) {
+		double v = x[i];
+		double y = f.b[0][0] * v + z0;
+		z0 = f.b[0][1] * v - f.a[0][0] * y + z1;
+		z1 = f.b[0][2] * v - f.a[0][1] * y;
+
+		double w = f.b[1][0] * y + z2;
+		z2 = f.b[1][1] * y - f.a[1][0] * w + z3;
+		z3 = f.b[1][2] * y - f.a[1][1] * w;
+		sum += w * w;
+	}
+
+	s[0] = z0;
+	s[1] = z1;
+	s[2] = z2;
+	s[3] = z3;
+	energy[0] = sum;
+}
+
+static void FilterPairScalar(const LoudnessFilter &f, const float *const *in,
+			     size_t frames, double *const *state,
+			     double *energy)
+{
+	FilterScalar(f, in, frames, state, energy);
+	FilterScalar(f, in + 1, frames, state + 1, energy + 1);
+}
+
+static float TruePeakScalar(const float *in, size_t frames)
+{
+	float peak = 0.0f;
+
+	for (size_t i = 0; i < frames; i++) {
+		for (int p = 0; p < 4; p++) {
+			float acc = 0.0f;
+			for (int k = 0; k < TRUE_PEAK_TAPS; k++)
+				acc += truePeakTaps[p][k] * in[i - k];
+			peak = std::max(peak, fabsf(acc));
+		}
+	}
+
+	return peak;
+}
+
+static double SumSquaresScalar(const float *in, size_t frames)
+{
+	double sum = 0.0;
+	for (size_t i = 0; i < frames; i++)
+		sum += static_cast<double>(in[i]) * in[i];
+	return sum;
+}
+#pragma endregion
+
+#ifdef AUDIO_SIMD_X86
+#pragma region SSE2
+static double HorizontalSum(__m128d v)
+{
+	return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+// Two channels through the same cascade, one in each lane
+static void FilterPairSSE2(const LoudnessFilter &f, const float *const *in,
+			   size_t frames, double *const *state, double *energy)
+{
+	const float *x0 = in[0];
+	const float *x1 = in[1];
+	const __m128d b00 = _mm_set1_pd(f.b[0][0]);
+	const __m128d b01 = _mm_set1_pd(f.b[0][1]);
+	const __m128d b02 = _mm_set1_pd(f.b[0][2]);
+	const __m128d a00 = _mm_set1_pd(f.a[0][0]);
+	const __m128d a01 = _mm_set1_pd(f.a[0][1]);
+	const __m128d b10 = _mm_set1_pd(f.b[1][0]);
+	const __m128d b11 = _mm_set1_pd(f.b[1][1]);
+	const __m128d b12 = _mm_set1_pd(f.b[1][2]);
+	const __m128d a10 = _mm_set1_pd(f.a[1][0]);
+	const __m128d a11 = _mm_set1_pd(f.a[1][1]);
+
+	__m128d z0 = _mm_setr_pd(state[0][0], state[1][0]);
+	__m128d z1 = _mm_setr_pd(state[0][1], state[1][1]);
+	__m128d z2 = _mm_setr_pd(state[0][2], state[1][2]);
+	__m128d z3 = _mm_setr_pd(state[0][3], state[1][3]);
+	__m128d sum = _mm_setzero_pd();
+
+	for (size_t i = 0; i < frames; i++) {
+		__m128d v = _mm_setr_pd(x0[i], x1[i]);
+		__m128d y = _mm_add_pd(_mm_mul_pd(b00, v), z0);
+		z0 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b01, v),
+					   _mm_mul_pd(a00, y)),
+				z1);
+		z1 = _mm_sub_pd(_mm_mul_pd(b02, v), _mm_mul_pd(a01, y));
+
+		__m128d w = _mm_add_pd(_mm_mul_pd(b10, y), z2);
+		z2 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b11, y),
+					   _mm_mul_pd(a10, w)),
+				z3);
+		z3 = _mm_sub_pd(_mm_mul_pd(b12, y), _mm_mul_pd(a11, w));
+		sum = _mm_add_pd(sum, _mm_mul_pd(w, w));
+	}
+
+	__m128d lanes[5] = {z0, z1, z2, z3, sum};
+	for (int k = 0; k < 5; k++) {
+		double out[2];
+		_mm_storeu_pd(out, lanes[k]);
+		if (k < 4) {
+			state[0][k] = out[0];
+			state[1][k] = out[1];
+		} else {
+			energy[0] = out[0];
+			energy[1] = out[1];
+		}
+	}
+}
+
+// All four phases of one output frame in a vector
+static float TruePeakSSE2(const float *in, size_t frames)
+{
+	__m128 taps[TRUE_PEAK_TAPS];
+	for (int k = 0; k < TRUE_PEAK_TAPS; k++)
+		taps[k] = _mm_setr_ps(truePeakTaps[0][k], truePeakTaps[1][k],
+				      truePeakTaps[2][k], truePeakTaps[3][k]);
+
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 peak = _mm_setzero_ps();
+
+	for (size_t i = 0; i < frames; i++) {
+		__m128 acc = _mm_mul_ps(taps[0], _mm_set1_ps(in[i]));
+		for (int k = 1; k < TRUE_PEAK_TAPS; k++)
+			acc = _mm_add_ps(acc, _mm_mul_ps(taps[k], _mm_set1_ps(
+								  in[i - k])));
+		peak = _mm_max_ps(peak, _mm_and_ps(acc, mask));
+	}
+
+	peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+	peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+	return _mm_cvtss_f32(peak);
+}
+
+static double SumSquaresSSE2(const float *in, size_t frames)
+{
+	__m128d a = _mm_setzero_pd();
+	__m128d b = _mm_setzero_pd();
+	size_t i = 0;
+
+	for (; i + 4 <= frames; i += 4) {
+		__m128 x = _mm_loadu_ps(in + i);
+		__m128d lo = _mm_cvtps_pd(x);
+		__m128d hi = _mm_cvtps_pd(_mm_movehl_ps(x, x));
+		a = _mm_add_pd(a, _mm_mul_pd(lo, lo));
+		b = _mm_add_pd(b, _mm_mul_pd(hi, hi));
+	}
+
+	return HorizontalSum(_mm_add_pd(a, b)) +
+	       SumSquaresScalar(in + i, frames - i);
+}
+#pragma endregion
+
+#pragma region AVX2
+// Two output frames a step, all four phases of each
+AUDIO_TARGET_AVX2
+static float TruePeakAVX2(const float *in, size_t frames)
+{
+	__m256 taps[TRUE_PEAK_TAPS];
+	for (int k = 0; k < TRUE_PEAK_TAPS; k++)
+		taps[k] = _mm256_setr_ps(
+			truePeakTaps[0][k], truePeakTaps[1][k],
+			truePeakTaps[2][k], truePeakTaps[3][k],
+			truePeakTaps[0][k], truePeakTaps[1][k],
+			truePeakTaps[2][k], truePeakTaps[3][k]);
+
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	__m256 peak = _mm256_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 2 <= frames; i += 2) {
+		__m256 acc = _mm256_setzero_ps();
+		for (int k = 0; k < TRUE_PEAK_TAPS; k++) {
+			__m256 x = _mm256_insertf128_ps(
+				_mm256_castps128_ps256(_mm_set1_ps(in[i - k])),
+				_mm_set1_ps(in[i + 1 - k]), 1);
+			acc = _mm256_fmadd_ps(taps[k], x, acc);
+		}
+		peak = _mm256_max_ps(peak, _mm256_and_ps(acc, mask));
+	}
+
+	__m128 half = _mm_max_ps(_mm256_castps256_ps128(peak),
+				 _mm256_extractf128_ps(peak, 1));
+	half = _mm_max_ps(half, _mm_movehl_ps(half, half));
+	half = _mm_max_ss(half, _mm_shuffle_ps(half, half, 1));
+	float result = _mm_cvtss_f32(half);
+
+	float tail = TruePeakScalar(in + i, frames - i);
+	return tail > result ? tail : result;
+}
+
+AUDIO_TARGET_AVX2
+static double SumSquaresAVX2(const float *in, size_t frames)
+{
+	__m256d a = _mm256_setzero_pd();
+	__m256d b = _mm256_setzero_pd();
+	size_t i = 0;
+
+	for (; i + 8 <= frames; i += 8) {
+		__m256d lo = _mm256_cvtps_pd(_mm_loadu_ps(in + i));
+		__m256d hi = _mm256_cvtps_pd(_mm_loadu_ps(in + i + 4));
+		a = _mm256_fmadd_pd(lo, lo, a);
+		b = _mm256_fmadd_pd(hi, hi, b);
+	}
+
+	a = _mm256_add_pd(a, b);
+	__m128d sum = _mm_add_pd(_mm256_castpd256_pd128(a),
+				 _mm256_extractf128_pd(a, 1));
+	return HorizontalSum(sum) + SumSquaresScalar(in + i, frames - i);
+}
+#pragma endregion
+#endif
+
+#pragma region Meter
+// The K-weighting for any rate, from the analog prototypes of both stages
+static LoudnessFilter KWeighting(uint32_t samplesPerSec)
+{
+	const double pi = 3.14159265358979323846;
+	LoudnessFilter filter;
+
+	double f0 = 1681.974450955533;
+	double gain = 3.999843853973347;
+	double q = 0.7071752369554196;
+	double k = tan(pi * f0 / samplesPerSec);
+	double vh = pow(10.0, gain / 20.0);
+	double vb = pow(vh, 0.4996667741545416);
+	double a0 = 1.0 + k / q + k * k;
+	filter.b[0][0] = (vh + vb * k / q + k * k) / a0;
+	filter.b[0][1] = 2.0 * (k * k - vh) / a0;
+	filter.b[0][2] = (vh - vb * k / q + k * k) / a0;
+	filter.a[0][0] = 2.0 * (k * k - 1.0) / a0;
+	filter.a[0][1] = (1.0 - k / q + k * k) / a0;
+
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(pi * f0 / samplesPerSec);
+	a0 = 1.0 + k / q + k * k;
+	filter.b[1][0] = 1.0;
+	filter.b[1][1] = -2.0;
+	filter.b[1][2] = 1.0;
+	filter.a[1][0] = 2.0 * (k * k - 1.0) / a0;
+	filter.a[1][1] = (1.0 - k / q + k * k) / a0;
+
+	return filter;
+}
+
+void LoudnessMeter::Configure(uint32_t newChannels, uint32_t samplesPerSec,
+			      const float *newWeights, SimdLevel level)
+{
+	channels = std::min(newChannels,
+			    static_cast<uint32_t>(LOUDNESS_MAX_CHANNELS));
+	blockFrames = samplesPerSec * LOUDNESS_BLOCK_MS / 1000;
+	for (uint32_t c = 0; c < channels; c++)
+		weights[c] = newWeights[c];
+
+	filter = KWeighting(samplesPerSec);
+	history.assign(channels * (TRUE_PEAK_TAPS - 1 + blockFrames), 0.0f);
+
+	filterPair = FilterPairScalar;
+	filterOne = FilterScalar;
+	truePeak = TruePeakScalar;
+	sumSquares = SumSquaresScalar;
+#ifdef AUDIO_SIMD_X86
+	if (level != SimdLevel::SCALAR) {
+		filterPair = FilterPairSSE2;
+		truePeak = TruePeakSSE2;
+		sumSquares = SumSquaresSSE2;
+	}
+	if (level == SimdLevel::AVX2) {
+		truePeak = TruePeakAVX2;
+		sumSquares = SumSquaresAVX2;
+	}
+#else
+	(void)level;
+#endif
+
+	Reset();
+}
+
+void LoudnessMeter::Reset()
+{
+	memset(state, 0, sizeof(state));
+	std::fill(history.begin(), history.end(), 0.0f);
+
+	fill = 0;
+	energy = 0.0;
+	squares = 0.0;
+	peak = 0.0f;
+	head = 0;
+	blocks = 0;
+
+	momentary = -INFINITY;
+	shortTerm = -INFINITY;
+	rms = -INFINITY;
+	truePeakDb = -INFINITY;
+}
+
+bool LoudnessMeter::Process(const float *const *data, uint32_t frames)
+{
+	if (!channels)
+		return false;
+
+	const float *at[LOUDNESS_MAX_CHANNELS];
+	bool moved = false;
+
+	for (uint32_t done = 0; done < frames;) {
+		uint32_t count = std::min(frames - done, blockFrames - fill);
+		for (uint32_t c = 0; c < channels; c++)
+			at[c] = data[c] + done;
+
+		Measure(at, count);
+		fill += count;
+		done += count;
+
+		if (fill == blockFrames) {
+			FinishBlock();
+			moved = true;
+		}
+	}
+
+	return moved;
+}
+
+// Never crosses a block boundary
+void LoudnessMeter::Measure(const float *const *data, uint32_t frames)
+{
+	double *rows[LOUDNESS_MAX_CHANNELS];
+	double sums[LOUDNESS_MAX_CHANNELS];
+	for (uint32_t c = 0; c < channels; c++)
+		rows[c] = state[c];
+
+	uint32_t c = 0;
+	for (; c + 2 <= channels; c += 2)
+		filterPair(filter, data + c, frames, rows + c, sums + c);
+	for (; c < channels; c++)
+		filterOne(filter, data + c, frames, rows + c, sums + c);
+
+	size_t stride = TRUE_PEAK_TAPS - 1 + blockFrames;
+	for (c = 0; c < channels; c++) {
+		energy += weights[c] * sums[c];
+		squares += sumSquares(data[c], frames);
+
+		// The interpolator reads back into the previous call's frames
+		float *line = history.data() + c * stride;
+		memcpy(line + TRUE_PEAK_TAPS - 1, data[c],
+		       frames * sizeof(float));
+		peak = std::max(peak, truePeak(line + TRUE_PEAK_TAPS - 1,
+					       frames));
+		memmove(line, line + frames,
+			(TRUE_PEAK_TAPS - 1) * sizeof(float));
+
+		for (int k = 0; k < 4; k++) {
+			if (fabs(state[c][k]) < STATE_FLOOR)
+				state[c][k] = 0.0;
+		}
+	}
+}
+
+void LoudnessMeter::FinishBlock()
+{
+	energies[head] = energy;
+	squareSums[head] = squares;
+	peaks[head] = peak;
+	head = (head + 1) % LOUDNESS_SHORT_TERM_BLOCKS;
+	blocks = std::min(blocks + 1,
+			  static_cast<uint32_t>(LOUDNESS_SHORT_TERM_BLOCKS));
+
+	fill = 0;
+	energy = 0.0;
+	squares = 0.0;
+	peak = 0.0f;
+
+	double momentaryEnergy = 0.0, shortTermEnergy = 0.0;
+	double momentarySquares = 0.0;
+	float highest = 0.0f;
+	uint32_t momentaryBlocks =
+		std::min(blocks, static_cast<uint32_t>(
+					 LOUDNESS_MOMENTARY_BLOCKS));
+
+	for (uint32_t i = 0; i < blocks; i++) {
+		uint32_t index = (head + LOUDNESS_SHORT_TERM_BLOCKS - 1 - i) %
+				 LOUDNESS_SHORT_TERM_BLOCKS;
+		shortTermEnergy += energies[index];
+		highest = std::max(highest, peaks[index]);
+		if (i < momentaryBlocks) {
+			momentaryEnergy += energies[index];
+			momentarySquares += squareSums[index];
+		}
+	}
+
+	// log10 of zero is -inf, which is what silence should read
+	double frames = static_cast<double>(blockFrames);
+	momentary = static_cast<float>(
+		-0.691 +
+		10.0 * log10(momentaryEnergy / (momentaryBlocks * frames)));
+	shortTerm = static_cast<float>(
+		-0.691 + 10.0 * log10(shortTermEnergy / (blocks * frames)));
+	rms = static_cast<float>(10.0 * log10(momentarySquares /
+					     (momentaryBlocks * frames *
+					      channels)));
+	truePeakDb = static_cast<float>(20.0 * log10(highest));
+}
+#pragma endregion
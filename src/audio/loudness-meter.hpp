@@ -0,0 +1,111 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cpu-features.hpp"
+
+#define LOUDNESS_MAX_CHANNELS 8
+// Gating blocks; momentary spans 4 of them and short-term 30
+#define LOUDNESS_BLOCK_MS 100
+#define LOUDNESS_MOMENTARY_BLOCKS 4
+#define LOUDNESS_SHORT_TERM_BLOCKS 30
+// Per phase of the 4x true-peak interpolator
+#define TRUE_PEAK_TAPS 12
+
+// Both BS.1770 K-weighting stages, the shelf and then the high-pass
+struct LoudnessFilter {
+	double b[2][3];
+	double a[2][2];
+};
+
+/* BS.1770-4 momentary and short-term loudness, true peak and plain RMS
+ * over planar float, as it goes out. Readings move every 100 ms block;
+ * until a window has filled it only covers the blocks there are.
+ *
+ * The K-weighting is recursive so it runs in double, two channels a
+ * vector; the true-peak interpolator and the RMS sums are the parts wide
+ * enough to vectorize properly. */
+class LoudnessMeter {
+	typedef void (*FilterFunc)(const LoudnessFilter &filter,
+				   const float *const *in, size_t frames,
+				   double *const *state, double *energy);
+	typedef float (*TruePeakFunc)(const float *in, size_t frames);
+	typedef double (*SumSquaresFunc)(const float *in, size_t frames);
+
+	uint32_t channels = 0;
+	uint32_t blockFrames = 0;
+	double weights[LOUDNESS_MAX_CHANNELS];
+
+	LoudnessFilter filter;
+	double state[LOUDNESS_MAX_CHANNELS][4];
+	// Per channel, the interpolator's history followed by room for a block
+	std::vector<float> history;
+
+	FilterFunc filterPair = nullptr;
+	FilterFunc filterOne = nullptr;
+	TruePeakFunc truePeak = nullptr;
+	SumSquaresFunc sumSquares = nullptr;
+
+	// The block being filled
+	uint32_t fill = 0;
+	double energy = 0.0;
+	double squares = 0.0;
+	float peak = 0.0f;
+
+	// The last short-term window's worth of finished blocks
+	double energies[LOUDNESS_SHORT_TERM_BLOCKS];
+	double squareSums[LOUDNESS_SHORT_TERM_BLOCKS];
+	float peaks[LOUDNESS_SHORT_TERM_BLOCKS];
+	uint32_t head = 0;
+	uint32_t blocks = 0;
+
+	float momentary;
+	float shortTerm;
+	float rms;
+	float truePeakDb;
+
+	void Measure(const float *const *data, uint32_t frames);
+	void FinishBlock();
+
+public:
+	/* `weights` are the BS.1770 channel weights, 1 for front channels,
+	 * 1.41 for surrounds and 0 to leave out the LFE */
+	void Configure(uint32_t channels, uint32_t samplesPerSec,
+		       const float *weights, SimdLevel level);
+	void Configure(uint32_t channels, uint32_t samplesPerSec,
+		       const float *weights)
+	{
+		Configure(channels, samplesPerSec, weights, GetSimdLevel());
+	}
+	void Reset();
+
+	// Returns true if a block finished and the readings moved
+	bool Process(const float *const *data, uint32_t frames);
+
+	// LUFS, -inf for digital silence
+	float Momentary() const { return momentary; }
+	float ShortTerm() const { return shortTerm; }
+	// dBFS over the momentary window, across every channel
+	float Rms() const { return rms; }
+	// dBTP, the highest over the short-term window
+	float TruePeak() const { return truePeakDb; }
+};
@@ -0,0 +1,150 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "mix.hpp"
+
+#ifdef AUDIO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#pragma region Kernels
+static void MixScalar(float *dst, const float *src, float gain, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] += src[i] * gain;
+}
+
+#ifdef AUDIO_SIMD_X86
+static void MixSSE2(float *dst, const float *src, float gain, size_t count)
+{
+	size_t vecCount = count & ~static_cast<size_t>(7);
+	__m128 g = _mm_set1_ps(gain);
+
+	// Two vectors a step so the adds aren't waiting on each other
+	for (size_t i = 0; i < vecCount; i += 8) {
+		__m128 a = _mm_add_ps(_mm_loadu_ps(dst + i),
+				      _mm_mul_ps(_mm_loadu_ps(src + i), g));
+		__m128 b = _mm_add_ps(_mm_loadu_ps(dst + i + 4),
+				      _mm_mul_ps(_mm_loadu_ps(src + i + 4), g));
+		_mm_storeu_ps(dst + i, a);
+		_mm_storeu_ps(dst + i + 4, b);
+	}
+
+	MixScalar(dst + vecCount, src + vecCount, gain, count - vecCount);
+}
+
+AUDIO_TARGET_AVX2
+static void MixAVX2(float *dst, const float *src, float gain, size_t count)
+{
+	size_t vecCount = count & ~static_cast<size_t>(15);
+	__m256 g = _mm256_set1_ps(gain);
+
+	for (size_t i = 0; i < vecCount; i += 16) {
+		__m256 a = _mm256_fmadd_ps(_mm256_loadu_ps(src + i), g,
+					   _mm256_loadu_ps(dst + i));
+		__m256 b = _mm256_fmadd_ps(_mm256_loadu_ps(src + i + 8), g,
+					   _mm256_loadu_ps(dst + i + 8));
+		_mm256_storeu_ps(dst + i, a);
+		_mm256_storeu_ps(dst + i + 8, b);
+	}
+
+	MixScalar(dst + vecCount, src + vecCount, gain, count - vecCount);
+}
+#endif
+
+static void RampScalar(float *dst, const float *src, float gain, float step,
+		       size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] += src[i] * (gain + step * static_cast<float>(i));
+}
+
+#ifdef AUDIO_SIMD_X86
+/* The gain is worked out from the index every vector rather than stepped,
+ * so long fades don't pick up rounding error along the way */
+static void RampSSE2(float *dst, const float *src, float gain, float step,
+		     size_t count)
+{
+	size_t vecCount = count & ~static_cast<size_t>(3);
+	__m128 offsets = _mm_mul_ps(_mm_set1_ps(step),
+				    _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+
+	for (size_t i = 0; i < vecCount; i += 4) {
+		__m128 g = _mm_add_ps(
+			_mm_set1_ps(gain + step * static_cast<float>(i)),
+			offsets);
+		_mm_storeu_ps(dst + i,
+			      _mm_add_ps(_mm_loadu_ps(dst + i),
+					 _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+	}
+
+	RampScalar(dst + vecCount, src + vecCount,
+		   gain + step * static_cast<float>(vecCount), step,
+		   count - vecCount);
+}
+
+AUDIO_TARGET_AVX2
+static void RampAVX2(float *dst, const float *src, float gain, float step,
+		     size_t count)
+{
+	size_t vecCount = count & ~static_cast<size_t>(7);
+	__m256 offsets = _mm256_mul_ps(
+		_mm256_set1_ps(step),
+		_mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+
+	for (size_t i = 0; i < vecCount; i += 8) {
+		__m256 g = _mm256_add_ps(
+			_mm256_set1_ps(gain + step * static_cast<float>(i)),
+			offsets);
+		_mm256_storeu_ps(dst + i,
+				 _mm256_fmadd_ps(_mm256_loadu_ps(src + i), g,
+						 _mm256_loadu_ps(dst + i)));
+	}
+
+	RampScalar(dst + vecCount, src + vecCount,
+		   gain + step * static_cast<float>(vecCount), step,
+		   count - vecCount);
+}
+#endif
+#pragma endregion
+
+MixAccumulateFunc GetMixAccumulate(SimdLevel level)
+{
+#ifdef AUDIO_SIMD_X86
+	if (level == SimdLevel::AVX2)
+		return MixAVX2;
+	if (level == SimdLevel::SSE2)
+		return MixSSE2;
+#else
+	(void)level;
+#endif
+	return MixScalar;
+}
+
+MixRampFunc GetMixRamp(SimdLevel level)
+{
+#ifdef AUDIO_SIMD_X86
+	if (level == SimdLevel::AVX2)
+		return RampAVX2;
+	if (level == SimdLevel::SSE2)
+		return RampSSE2;
+#else
+	(void)level;
+#endif
+	return RampScalar;
+}
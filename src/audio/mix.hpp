@@ -0,0 +1,45 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstddef>
+
+#include "cpu-features.hpp"
+
+// dst[i] += src[i] * gain
+typedef void (*MixAccumulateFunc)(float *dst, const float *src, float gain,
+				  size_t count);
+
+MixAccumulateFunc GetMixAccumulate(SimdLevel level);
+
+static inline MixAccumulateFunc GetMixAccumulate()
+{
+	return GetMixAccumulate(GetSimdLevel());
+}
+
+// dst[i] += src[i] * (gain + step * i), for fades
+typedef void (*MixRampFunc)(float *dst, const float *src, float gain,
+			    float step, size_t count);
+
+MixRampFunc GetMixRamp(SimdLevel level);
+
+static inline MixRampFunc GetMixRamp()
+{
+	return GetMixRamp(GetSimdLevel());
+}
@@ -0,0 +1,275 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "peak-scan.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#ifdef AUDIO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define SCALE_S16 (1.0f / 32768.0f)
+#define SCALE_S24 (1.0f / 8388608.0f)
+#define SCALE_S32 (1.0f / 2147483648.0f)
+
+#pragma region Scalar
+static uint32_t PeakS16Raw(const int16_t *in, size_t samples)
+{
+	uint32_t peak = 0;
+	for (size_t i = 0; i < samples; i++) {
+		int32_t value = in[i];
+		uint32_t magnitude = value < 0 ? -value : value;
+		if (magnitude > peak)
+			peak = magnitude;
+	}
+	return peak;
+}
+
+static uint32_t PeakS32Raw(const int32_t *in, size_t samples)
+{
+	uint32_t peak = 0;
+	for (size_t i = 0; i < samples; i++) {
+		// Unsigned negate so INT32_MIN comes out as 2^31
+		uint32_t value = static_cast<uint32_t>(in[i]);
+		uint32_t magnitude = in[i] < 0 ? 0u - value : value;
+		if (magnitude > peak)
+			peak = magnitude;
+	}
+	return peak;
+}
+
+static float PeakF32Raw(const float *in, size_t samples)
+{
+	float peak = 0.0f;
+	for (size_t i = 0; i < samples; i++) {
+		float magnitude = fabsf(in[i]);
+		if (magnitude > peak)
+			peak = magnitude;
+	}
+	return peak;
+}
+
+static float PeakS16Scalar(const void *src, size_t samples)
+{
+	return PeakS16Raw(static_cast<const int16_t *>(src), samples) *
+	       SCALE_S16;
+}
+
+static float PeakS24Scalar(const void *src, size_t samples)
+{
+	const uint8_t *in = static_cast<const uint8_t *>(src);
+	uint32_t peak = 0;
+
+	for (size_t i = 0; i < samples; i++, in += 3) {
+		uint32_t value = (static_cast<uint32_t>(in[0]) << 8) |
+				 (static_cast<uint32_t>(in[1]) << 16) |
+				 (static_cast<uint32_t>(in[2]) << 24);
+		int32_t sample = static_cast<int32_t>(value) >> 8;
+		uint32_t magnitude = sample < 0 ? -sample : sample;
+		if (magnitude > peak)
+			peak = magnitude;
+	}
+
+	return peak * SCALE_S24;
+}
+
+static float PeakS32Scalar(const void *src, size_t samples)
+{
+	return PeakS32Raw(static_cast<const int32_t *>(src), samples) *
+	       SCALE_S32;
+}
+
+static float PeakF32Scalar(const void *src, size_t samples)
+{
+	return PeakF32Raw(static_cast<const float *>(src), samples);
+}
+#pragma endregion
+
+#ifdef AUDIO_SIMD_X86
+#pragma region SSE2
+static float PeakS16SSE2(const void *src, size_t samples)
+{
+	const int16_t *in = static_cast<const int16_t *>(src);
+	const __m128i bias = _mm_set1_epi16(-32768);
+	__m128i peak = bias;
+	size_t i = 0;
+
+	/* (x ^ sign) - sign wraps -32768 to 0x8000, which is right read as
+	 * unsigned. SSE2 only has a signed max, so compare with the top bit
+	 * flipped and flip it back at the end. */
+	for (; i + 8 <= samples; i += 8) {
+		__m128i x = _mm_loadu_si128(
+			reinterpret_cast<const __m128i *>(in + i));
+		__m128i sign = _mm_srai_epi16(x, 15);
+		__m128i magnitude = _mm_sub_epi16(_mm_xor_si128(x, sign), sign);
+		peak = _mm_max_epi16(peak, _mm_xor_si128(magnitude, bias));
+	}
+
+	peak = _mm_max_epi16(peak, _mm_srli_si128(peak, 8));
+	peak = _mm_max_epi16(peak, _mm_srli_si128(peak, 4));
+	peak = _mm_max_epi16(peak, _mm_srli_si128(peak, 2));
+	uint32_t result = static_cast<uint16_t>(
+		_mm_cvtsi128_si32(_mm_xor_si128(peak, bias)));
+
+	uint32_t tail = PeakS16Raw(in + i, samples - i);
+	return (tail > result ? tail : result) * SCALE_S16;
+}
+
+static float PeakF32SSE2(const void *src, size_t samples)
+{
+	const float *in = static_cast<const float *>(src);
+	const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 peak = _mm_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 4 <= samples; i += 4)
+		peak = _mm_max_ps(peak, _mm_and_ps(_mm_loadu_ps(in + i), mask));
+
+	peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+	peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+	float result = _mm_cvtss_f32(peak);
+
+	float tail = PeakF32Raw(in + i, samples - i);
+	return tail > result ? tail : result;
+}
+#pragma endregion
+
+#pragma region AVX2
+AUDIO_TARGET_AVX2
+static float PeakS16AVX2(const void *src, size_t samples)
+{
+	const int16_t *in = static_cast<const int16_t *>(src);
+	__m256i peak = _mm256_setzero_si256();
+	size_t i = 0;
+
+	// abs(-32768) is 0x8000 which is right when compared unsigned
+	for (; i + 16 <= samples; i += 16) {
+		__m256i x = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i *>(in + i));
+		peak = _mm256_max_epu16(peak, _mm256_abs_epi16(x));
+	}
+
+	__m128i half = _mm_max_epu16(_mm256_castsi256_si128(peak),
+				     _mm256_extracti128_si256(peak, 1));
+	half = _mm_max_epu16(half, _mm_srli_si128(half, 8));
+	half = _mm_max_epu16(half, _mm_srli_si128(half, 4));
+	half = _mm_max_epu16(half, _mm_srli_si128(half, 2));
+	uint32_t result = static_cast<uint16_t>(_mm_cvtsi128_si32(half));
+
+	uint32_t tail = PeakS16Raw(in + i, samples - i);
+	return (tail > result ? tail : result) * SCALE_S16;
+}
+
+AUDIO_TARGET_AVX2
+static float PeakS32AVX2(const void *src, size_t samples)
+{
+	const int32_t *in = static_cast<const int32_t *>(src);
+	__m256i peak = _mm256_setzero_si256();
+	size_t i = 0;
+
+	for (; i + 8 <= samples; i += 8) {
+		__m256i x = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i *>(in + i));
+		peak = _mm256_max_epu32(peak, _mm256_abs_epi32(x));
+	}
+
+	__m128i half = _mm_max_epu32(_mm256_castsi256_si128(peak),
+				     _mm256_extracti128_si256(peak, 1));
+	half = _mm_max_epu32(half, _mm_srli_si128(half, 8));
+	half = _mm_max_epu32(half, _mm_srli_si128(half, 4));
+	uint32_t result = static_cast<uint32_t>(_mm_cvtsi128_si32(half));
+
+	uint32_t tail = PeakS32Raw(in + i, samples - i);
+	return (tail > result ? tail : result) * SCALE_S32;
+}
+
+AUDIO_TARGET_AVX2
+static float PeakF32AVX2(const void *src, size_t samples)
+{
+	const float *in = static_cast<const float *>(src);
+	const __m256 mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	__m256 a = _mm256_setzero_ps();
+	__m256 b = _mm256_setzero_ps();
+	size_t i = 0;
+
+	for (; i + 16 <= samples; i += 16) {
+		a = _mm256_max_ps(a, _mm256_and_ps(_mm256_loadu_ps(in + i),
+						   mask));
+		b = _mm256_max_ps(b, _mm256_and_ps(_mm256_loadu_ps(in + i + 8),
+						   mask));
+	}
+
+	a = _mm256_max_ps(a, b);
+	__m128 peak = _mm_max_ps(_mm256_castps256_ps128(a),
+				 _mm256_extractf128_ps(a, 1));
+	peak = _mm_max_ps(peak, _mm_movehl_ps(peak, peak));
+	peak = _mm_max_ss(peak, _mm_shuffle_ps(peak, peak, 1));
+	float result = _mm_cvtss_f32(peak);
+
+	float tail = PeakF32Raw(in + i, samples - i);
+	return tail > result ? tail : result;
+}
+#pragma endregion
+#endif
+
+PeakScanFunc GetPeakScan(SampleFormat format, SimdLevel level)
+{
+#ifdef AUDIO_SIMD_X86
+	if (level == SimdLevel::AVX2) {
+		switch (format) {
+		case SampleFormat::S16:
+			return PeakS16AVX2;
+		case SampleFormat::S32:
+			return PeakS32AVX2;
+		case SampleFormat::F32:
+			return PeakF32AVX2;
+		default:
+			break;
+		}
+	}
+
+	if (level != SimdLevel::SCALAR) {
+		switch (format) {
+		case SampleFormat::S16:
+			return PeakS16SSE2;
+		case SampleFormat::F32:
+			return PeakF32SSE2;
+		default:
+			break;
+		}
+	}
+#else
+	(void)level;
+#endif
+
+	switch (format) {
+	case SampleFormat::S16:
+		return PeakS16Scalar;
+	case SampleFormat::S24:
+		return PeakS24Scalar;
+	case SampleFormat::S32:
+		return PeakS32Scalar;
+	case SampleFormat::F32:
+		return PeakF32Scalar;
+	default:
+		return nullptr;
+	}
+}
@@ -0,0 +1,36 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstddef>
+
+#include "cpu-features.hpp"
+#include "sample-convert.hpp"
+
+/* Largest absolute sample in an interleaved buffer, scaled so full scale
+ * is 1.0. Straight off the raw data so silence can be spotted before any
+ * conversion work is done. */
+typedef float (*PeakScanFunc)(const void *src, size_t samples);
+
+PeakScanFunc GetPeakScan(SampleFormat format, SimdLevel level);
+
+static inline PeakScanFunc GetPeakScan(SampleFormat format)
+{
+	return GetPeakScan(format, GetSimdLevel());
+}
@@ -0,0 +1,324 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "resampler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+#ifdef AUDIO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Input frames copied into the history at a time
+#define RESAMPLER_BLOCK 1024
+// Anything needing more phases than this isn't a rate pair worth supporting
+#define RESAMPLER_MAX_PHASES 4096
+// Only reached decimating by more than 8x at HIGH, past it the band widens
+#define RESAMPLER_MAX_TAPS 1024
+
+/* Passband edge as a fraction of the lower of the two Nyquists, and the
+ * stopband attenuation. The stopband always starts right at that Nyquist,
+ * so nothing above it folds back into the output band. */
+struct QualityParams {
+	double passband;
+	double attenuation;
+};
+
+static const QualityParams qualityParams[] = {
+	{0.87, 60.0},
+	{0.90, 80.0},
+	{0.94, 100.0},
+};
+
+#pragma region Filter Design
+static uint32_t Gcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// Zeroth order modified Bessel function, for the Kaiser window
+static double BesselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+/* Kaiser's estimates for the window: its length from the attenuation and
+ * the transition width, here in input frames with the width relative to
+ * the input Nyquist, and its shape from the attenuation alone */
+static uint32_t KaiserTaps(double attenuation, double transition)
+{
+	double taps = (attenuation - 7.95) / (7.18 * transition) + 1.0;
+	uint32_t rounded = (static_cast<uint32_t>(std::ceil(taps)) + 7) & ~7u;
+	return std::min(rounded, static_cast<uint32_t>(RESAMPLER_MAX_TAPS));
+}
+
+static double KaiserBeta(double attenuation)
+{
+	if (attenuation > 50.0)
+		return 0.1102 * (attenuation - 8.7);
+	if (attenuation >= 21.0)
+		return 0.5842 * std::pow(attenuation - 21.0, 0.4) +
+		       0.07886 * (attenuation - 21.0);
+	return 0.0;
+}
+
+static std::shared_ptr<const ResamplerBank>
+DesignBank(uint32_t up, uint32_t down, const QualityParams &params)
+{
+	const double pi = 3.14159265358979323846;
+
+	/* Band edges relative to the input Nyquist. Decimating moves them
+	 * down by up/down, which narrows the transition by as much and so
+	 * takes down/up times the taps. */
+	double scale = up < down ? double(up) / down : 1.0;
+	double transition = (1.0 - params.passband) * scale;
+	double cutoff = (1.0 + params.passband) / 2.0 * scale;
+	uint32_t taps = KaiserTaps(params.attenuation, transition);
+	double beta = KaiserBeta(params.attenuation);
+
+	std::shared_ptr<ResamplerBank> bank(new ResamplerBank);
+	bank->up = up;
+	bank->down = down;
+	bank->taps = taps;
+	bank->coefficients.resize(static_cast<size_t>(up) * taps);
+
+	double half = taps / 2.0;
+	double norm = BesselI0(beta);
+
+	for (uint32_t p = 0; p < up; p++) {
+		float *h = &bank->coefficients[static_cast<size_t>(p) * taps];
+		double frac = double(p) / up;
+		double sum = 0.0;
+
+		for (uint32_t k = 0; k < taps; k++) {
+			double x = double(k) - (half - 1.0) - frac;
+			double r = x / half;
+			double window = 0.0;
+			if (r * r < 1.0)
+				window = BesselI0(beta *
+						  std::sqrt(1.0 - r * r)) /
+					 norm;
+			double sinc = x == 0.0 ? 1.0
+					       : std::sin(pi * cutoff * x) /
+							 (pi * cutoff * x);
+			double value = cutoff * sinc * window;
+			h[k] = static_cast<float>(value);
+			sum += value;
+		}
+
+		// Unity gain at DC for every phase, otherwise it buzzes at up/down
+		for (uint32_t k = 0; k < taps; k++)
+			h[k] = static_cast<float>(h[k] / sum);
+	}
+
+	return bank;
+}
+
+static std::shared_ptr<const ResamplerBank>
+GetBank(uint32_t up, uint32_t down, ResamplerQuality quality)
+{
+	typedef std::tuple<uint32_t, uint32_t, int> Key;
+	static std::mutex mutex;
+	static std::map<Key, std::weak_ptr<const ResamplerBank>> banks;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	Key key(up, down, static_cast<int>(quality));
+
+	std::shared_ptr<const ResamplerBank> bank = banks[key].lock();
+	if (!bank) {
+		bank = DesignBank(up, down,
+				  qualityParams[static_cast<int>(quality)]);
+		banks[key] = bank;
+	}
+
+	return bank;
+}
+#pragma endregion
+
+#pragma region Kernels
+static float DotScalar(const float *x, const float *h, uint32_t taps)
+{
+	float sum = 0.0f;
+	for (uint32_t k = 0; k < taps; k++)
+		sum += x[k] * h[k];
+	return sum;
+}
+
+#ifdef AUDIO_SIMD_X86
+static float DotSSE2(const float *x, const float *h, uint32_t taps)
+{
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+
+	for (uint32_t k = 0; k < taps; k += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x + k),
+						   _mm_loadu_ps(h + k)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x + k + 4),
+						   _mm_loadu_ps(h + k + 4)));
+	}
+
+	__m128 acc = _mm_add_ps(acc0, acc1);
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	return _mm_cvtss_f32(acc);
+}
+
+AUDIO_TARGET_AVX2
+static float DotAVX2(const float *x, const float *h, uint32_t taps)
+{
+	__m256 acc = _mm256_setzero_ps();
+
+	for (uint32_t k = 0; k < taps; k += 8)
+		acc = _mm256_fmadd_ps(_mm256_loadu_ps(x + k),
+				      _mm256_loadu_ps(h + k), acc);
+
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+				_mm256_extractf128_ps(acc, 1));
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+#endif
+#pragma endregion
+
+bool Resampler::Configure(uint32_t newInRate, uint32_t newOutRate,
+			  uint32_t newChannels, ResamplerQuality quality,
+			  SimdLevel level)
+{
+	bank.reset();
+	inRate = newInRate;
+	outRate = newOutRate;
+	channels = newChannels;
+
+	if (!inRate || !outRate || !channels ||
+	    channels > RESAMPLER_MAX_CHANNELS)
+		return false;
+
+	uint32_t gcd = Gcd(inRate, outRate);
+	uint32_t up = outRate / gcd;
+	uint32_t down = inRate / gcd;
+	if (up > RESAMPLER_MAX_PHASES)
+		return false;
+
+	bank = GetBank(up, down, quality);
+
+	dot = DotScalar;
+#ifdef AUDIO_SIMD_X86
+	if (level == SimdLevel::AVX2)
+		dot = DotAVX2;
+	else if (level == SimdLevel::SSE2)
+		dot = DotSSE2;
+#else
+	(void)level;
+#endif
+
+	for (uint32_t c = 0; c < channels; c++)
+		history[c].assign(bank->taps + RESAMPLER_BLOCK, 0.0f);
+
+	Reset();
+	return true;
+}
+
+void Resampler::Reset()
+{
+	if (!bank)
+		return;
+
+	// Start with a full window of silence so output begins immediately
+	for (uint32_t c = 0; c < channels; c++)
+		std::fill(history[c].begin(), history[c].end(), 0.0f);
+	buffered = bank->taps - 1;
+	index = 0;
+	phase = 0;
+}
+
+size_t Resampler::MaxOutput(size_t frames) const
+{
+	if (!bank)
+		return 0;
+
+	uint64_t total = static_cast<uint64_t>(frames + bank->taps) *
+			 bank->up;
+	return static_cast<size_t>(total / bank->down) + 1;
+}
+
+size_t Resampler::Process(const float *const *in, size_t frames,
+			  float *const *out, size_t capacity)
+{
+	if (!bank)
+		return 0;
+
+	const uint32_t taps = bank->taps;
+	const uint32_t up = bank->up;
+	const uint32_t down = bank->down;
+	size_t produced = 0;
+
+	for (size_t consumed = 0; consumed < frames;) {
+		size_t count = frames - consumed;
+		if (count > RESAMPLER_BLOCK)
+			count = RESAMPLER_BLOCK;
+
+		for (uint32_t c = 0; c < channels; c++)
+			memcpy(history[c].data() + buffered, in[c] + consumed,
+			       count * sizeof(float));
+		buffered += count;
+		consumed += count;
+
+		while (index + taps <= buffered && produced < capacity) {
+			const float *h = bank->Phase(phase);
+			for (uint32_t c = 0; c < channels; c++)
+				out[c][produced] =
+					dot(history[c].data() + index, h, taps);
+			produced++;
+
+			phase += down;
+			index += phase / up;
+			phase %= up;
+		}
+
+		// Out of room, drop whatever can't fit in the history anyway
+		if (index + taps <= buffered)
+			index = buffered - (taps - 1);
+
+		// Slide what the next output still needs back to the front
+		size_t keep = buffered > index ? buffered - index : 0;
+		for (uint32_t c = 0; c < channels; c++)
+			memmove(history[c].data(), history[c].data() + index,
+				keep * sizeof(float));
+		index = index > buffered ? index - buffered : 0;
+		buffered = keep;
+	}
+
+	return produced;
+}
@@ -0,0 +1,85 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "cpu-features.hpp"
+
+#define RESAMPLER_MAX_CHANNELS 8
+
+enum class ResamplerQuality { LOW, MEDIUM, HIGH };
+
+/* One Kaiser-windowed sinc per output phase, taps padded out to a multiple
+ * of 8 so the dot product kernels never need a tail. Banks are immutable and
+ * shared by every resampler using the same rate pair and quality. */
+struct ResamplerBank {
+	uint32_t up;
+	uint32_t down;
+	uint32_t taps;
+	std::vector<float> coefficients;
+
+	const float *Phase(uint32_t phase) const
+	{
+		return coefficients.data() + phase * taps;
+	}
+};
+
+typedef float (*ResamplerDotFunc)(const float *x, const float *h,
+				  uint32_t taps);
+
+/* Streaming rational resampler. State is carried across calls so chunks
+ * can be any size, and nothing is allocated after Configure(). */
+class Resampler {
+	std::shared_ptr<const ResamplerBank> bank;
+	ResamplerDotFunc dot = nullptr;
+
+	uint32_t inRate = 0;
+	uint32_t outRate = 0;
+	uint32_t channels = 0;
+
+	std::vector<float> history[RESAMPLER_MAX_CHANNELS];
+	size_t buffered = 0;
+	size_t index = 0;
+	uint32_t phase = 0;
+
+public:
+	bool Configure(uint32_t inRate, uint32_t outRate, uint32_t channels,
+		       ResamplerQuality quality,
+		       SimdLevel level = GetSimdLevel());
+	void Reset();
+
+	bool Passthrough() const { return inRate == outRate; }
+	uint32_t InputRate() const { return inRate; }
+	uint32_t OutputRate() const { return outRate; }
+
+	// Group delay in input frames
+	uint32_t Latency() const { return bank ? bank->taps / 2 : 0; }
+
+	// Upper bound on what Process() can produce for `frames` of input
+	size_t MaxOutput(size_t frames) const;
+
+	/* Returns the number of frames written to `out`. Give it at least
+	 * MaxOutput(frames) of room or output will be cut short. */
+	size_t Process(const float *const *in, size_t frames, float *const *out,
+		       size_t capacity);
+};
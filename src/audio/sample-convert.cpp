@@ -0,0 +1,411 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "sample-convert.hpp"
+
+#include <cstring>
+
+#ifdef AUDIO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Powers of two, so the multiply never rounds
+#define SCALE_S16 (1.0f / 32768.0f)
+#define SCALE_S24 (1.0f / 8388608.0f)
+#define SCALE_S32 (1.0f / 2147483648.0f)
+
+// Planar output goes through a stack block so nothing is allocated per call
+#define PLANAR_BLOCK_SAMPLES 2048
+
+static inline int32_t LoadS24(const uint8_t *p)
+{
+	uint32_t value = (static_cast<uint32_t>(p[0]) << 8) |
+			 (static_cast<uint32_t>(p[1]) << 16) |
+			 (static_cast<uint32_t>(p[2]) << 24);
+	return static_cast<int32_t>(value) >> 8;
+}
+
+#pragma region Scalar
+static void ConvertS16Scalar(const void *src, float *dst, size_t samples)
+{
+	const int16_t *in = static_cast<const int16_t *>(src);
+	for (size_t i = 0; i < samples; i++)
+		dst[i] = static_cast<float>(in[i]) * SCALE_S16;
+}
+
+static void ConvertS24Scalar(const void *src, float *dst, size_t samples)
+{
+	const uint8_t *in = static_cast<const uint8_t *>(src);
+	for (size_t i = 0; i < samples; i++)
+		dst[i] = static_cast<float>(LoadS24(in + i * 3)) * SCALE_S24;
+}
+
+static void ConvertS32Scalar(const void *src, float *dst, size_t samples)
+{
+	const int32_t *in = static_cast<const int32_t *>(src);
+	for (size_t i = 0; i < samples; i++)
+		dst[i] = static_cast<float>(in[i]) * SCALE_S32;
+}
+
+static void ConvertF32(const void *src, float *dst, size_t samples)
+{
+	memcpy(dst, src, samples * sizeof(float));
+}
+
+static void DeinterleaveScalar(const float *src, float *const *dst,
+			       uint32_t channels, size_t offset, size_t frames)
+{
+	for (uint32_t c = 0; c < channels; c++) {
+		float *out = dst[c] + offset;
+		const float *in = src + c;
+		for (size_t i = 0; i < frames; i++)
+			out[i] = in[i * channels];
+	}
+}
+#pragma endregion
+
+#ifdef AUDIO_SIMD_X86
+#pragma region SSE2
+static void ConvertS16SSE2(const void *src, float *dst, size_t samples)
+{
+	const int16_t *in = static_cast<const int16_t *>(src);
+	const __m128 scale = _mm_set1_ps(SCALE_S16);
+	size_t i = 0;
+
+	for (; i + 8 <= samples; i += 8) {
+		__m128i x = _mm_loadu_si128(
+			reinterpret_cast<const __m128i *>(in + i));
+		// Duplicate each word then shift it back down to sign extend
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(dst + i + 4,
+			      _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+
+	ConvertS16Scalar(in + i, dst + i, samples - i);
+}
+
+static void ConvertS24SSE2(const void *src, float *dst, size_t samples)
+{
+	const uint8_t *in = static_cast<const uint8_t *>(src);
+	const __m128 scale = _mm_set1_ps(SCALE_S24);
+	size_t i = 0;
+
+	// No byte shuffle in SSE2, so gather the words by hand
+	for (; i + 4 <= samples; i += 4) {
+		const uint8_t *p = in + i * 3;
+		__m128i x = _mm_setr_epi32(LoadS24(p), LoadS24(p + 3),
+					   LoadS24(p + 6), LoadS24(p + 9));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+	}
+
+	ConvertS24Scalar(in + i * 3, dst + i, samples - i);
+}
+
+static void ConvertS32SSE2(const void *src, float *dst, size_t samples)
+{
+	const int32_t *in = static_cast<const int32_t *>(src);
+	const __m128 scale = _mm_set1_ps(SCALE_S32);
+	size_t i = 0;
+
+	for (; i + 4 <= samples; i += 4) {
+		__m128i x = _mm_loadu_si128(
+			reinterpret_cast<const __m128i *>(in + i));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(x), scale));
+	}
+
+	ConvertS32Scalar(in + i, dst + i, samples - i);
+}
+
+static void DeinterleaveSSE2(const float *src, float *const *dst,
+			     uint32_t channels, size_t offset, size_t frames)
+{
+	if (channels != 2) {
+		DeinterleaveScalar(src, dst, channels, offset, frames);
+		return;
+	}
+
+	float *left = dst[0] + offset;
+	float *right = dst[1] + offset;
+	size_t i = 0;
+
+	for (; i + 4 <= frames; i += 4) {
+		__m128 a = _mm_loadu_ps(src + i * 2);
+		__m128 b = _mm_loadu_ps(src + i * 2 + 4);
+		_mm_storeu_ps(left + i,
+			      _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(right + i,
+			      _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+
+	float *rest[2] = {left, right};
+	DeinterleaveScalar(src + i * 2, rest, 2, i, frames - i);
+}
+#pragma endregion
+
+#pragma region AVX2
+AUDIO_TARGET_AVX2
+static void ConvertS16AVX2(const void *src, float *dst, size_t samples)
+{
+	const int16_t *in = static_cast<const int16_t *>(src);
+	const __m256 scale = _mm256_set1_ps(SCALE_S16);
+	size_t i = 0;
+
+	for (; i + 8 <= samples; i += 8) {
+		__m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128(
+			reinterpret_cast<const __m128i *>(in + i)));
+		_mm256_storeu_ps(dst + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+	}
+
+	ConvertS16Scalar(in + i, dst + i, samples - i);
+}
+
+AUDIO_TARGET_AVX2
+static void ConvertS24AVX2(const void *src, float *dst, size_t samples)
+{
+	const uint8_t *in = static_cast<const uint8_t *>(src);
+	const __m256 scale = _mm256_set1_ps(SCALE_S24);
+	/* Each lane holds four packed samples in its low 12 bytes. Move them
+	 * into the top three bytes of each dword and shift back down. */
+	const __m256i shuffle = _mm256_setr_epi8(
+		-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1,
+		2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+	size_t i = 0;
+
+	// The second load reads 4 bytes past the 8 samples, stay clear of the end
+	for (; i + 10 <= samples; i += 8) {
+		const uint8_t *p = in + i * 3;
+		__m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+		__m128i hi = _mm_loadu_si128(
+			reinterpret_cast<const __m128i *>(p + 12));
+		__m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo),
+						    hi, 1);
+		x = _mm256_srai_epi32(_mm256_shuffle_epi8(x, shuffle), 8);
+		_mm256_storeu_ps(dst + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+	}
+
+	ConvertS24Scalar(in + i * 3, dst + i, samples - i);
+}
+
+AUDIO_TARGET_AVX2
+static void ConvertS32AVX2(const void *src, float *dst, size_t samples)
+{
+	const int32_t *in = static_cast<const int32_t *>(src);
+	const __m256 scale = _mm256_set1_ps(SCALE_S32);
+	size_t i = 0;
+
+	for (; i + 8 <= samples; i += 8) {
+		__m256i x = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i *>(in + i));
+		_mm256_storeu_ps(dst + i,
+				 _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale));
+	}
+
+	ConvertS32Scalar(in + i, dst + i, samples - i);
+}
+
+AUDIO_TARGET_AVX2
+static void Deinterleave8AVX2(const float *src, float *const *dst,
+			      size_t offset, size_t frames)
+{
+	size_t i = 0;
+
+	// 8x8 transpose, one 7.1 frame per row
+	for (; i + 8 <= frames; i += 8) {
+		const float *p = src + i * 8;
+		__m256 r0 = _mm256_loadu_ps(p);
+		__m256 r1 = _mm256_loadu_ps(p + 8);
+		__m256 r2 = _mm256_loadu_ps(p + 16);
+		__m256 r3 = _mm256_loadu_ps(p + 24);
+		__m256 r4 = _mm256_loadu_ps(p + 32);
+		__m256 r5 = _mm256_loadu_ps(p + 40);
+		__m256 r6 = _mm256_loadu_ps(p + 48);
+		__m256 r7 = _mm256_loadu_ps(p + 56);
+
+		__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+		__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+		__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+		__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+		__m256 t4 = _mm256_unpacklo_ps(r4, r5);
+		__m256 t5 = _mm256_unpackhi_ps(r4, r5);
+		__m256 t6 = _mm256_unpacklo_ps(r6, r7);
+		__m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+		__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+		size_t o = offset + i;
+		_mm256_storeu_ps(dst[0] + o, _mm256_permute2f128_ps(s0, s4, 0x20));
+		_mm256_storeu_ps(dst[1] + o, _mm256_permute2f128_ps(s1, s5, 0x20));
+		_mm256_storeu_ps(dst[2] + o, _mm256_permute2f128_ps(s2, s6, 0x20));
+		_mm256_storeu_ps(dst[3] + o, _mm256_permute2f128_ps(s3, s7, 0x20));
+		_mm256_storeu_ps(dst[4] + o, _mm256_permute2f128_ps(s0, s4, 0x31));
+		_mm256_storeu_ps(dst[5] + o, _mm256_permute2f128_ps(s1, s5, 0x31));
+		_mm256_storeu_ps(dst[6] + o, _mm256_permute2f128_ps(s2, s6, 0x31));
+		_mm256_storeu_ps(dst[7] + o, _mm256_permute2f128_ps(s3, s7, 0x31));
+	}
+
+	DeinterleaveScalar(src + i * 8, dst, 8, offset + i, frames - i);
+}
+
+static void DeinterleaveAVX2(const float *src, float *const *dst,
+			     uint32_t channels, size_t offset, size_t frames)
+{
+	if (channels == 8)
+		Deinterleave8AVX2(src, dst, offset, frames);
+	else
+		DeinterleaveSSE2(src, dst, channels, offset, frames);
+}
+#pragma endregion
+#endif
+
+#pragma region Planar
+typedef void (*DeinterleaveFunc)(const float *src, float *const *dst,
+				 uint32_t channels, size_t offset,
+				 size_t frames);
+
+template<InterleavedConvertFunc Convert, DeinterleaveFunc Deinterleave,
+	 size_t SampleBytes>
+static void ConvertPlanar(const void *src, float *const *dst,
+			  uint32_t channels, size_t frames)
+{
+	float block[PLANAR_BLOCK_SAMPLES];
+	const uint8_t *in = static_cast<const uint8_t *>(src);
+
+	if (!channels)
+		return;
+
+	// Too wide for a whole frame per block, a block of channels at a time
+	if (channels > PLANAR_BLOCK_SAMPLES) {
+		for (size_t frame = 0; frame < frames; frame++) {
+			for (uint32_t first = 0; first < channels;) {
+				uint32_t count = channels - first;
+				if (count > PLANAR_BLOCK_SAMPLES)
+					count = PLANAR_BLOCK_SAMPLES;
+
+				Convert(in + (frame * channels + first) *
+						     SampleBytes,
+					block, count);
+				Deinterleave(block, dst + first, count, frame,
+					     1);
+				first += count;
+			}
+		}
+		return;
+	}
+
+	size_t blockFrames = PLANAR_BLOCK_SAMPLES / channels;
+	for (size_t done = 0; done < frames;) {
+		size_t count = frames - done;
+		if (count > blockFrames)
+			count = blockFrames;
+
+		Convert(in + done * channels * SampleBytes, block,
+			count * channels);
+		Deinterleave(block, dst, channels, done, count);
+		done += count;
+	}
+}
+
+// Float input is already what we want, only the layout needs changing
+template<DeinterleaveFunc Deinterleave>
+static void ConvertPlanarF32(const void *src, float *const *dst,
+			     uint32_t channels, size_t frames)
+{
+	Deinterleave(static_cast<const float *>(src), dst, channels, 0,
+		     frames);
+}
+#pragma endregion
+
+size_t SampleFormatBytes(SampleFormat format)
+{
+	switch (format) {
+	case SampleFormat::S16:
+		return 2;
+	case SampleFormat::S24:
+		return 3;
+	case SampleFormat::S32:
+	case SampleFormat::F32:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+#define CONVERTER(convert, deinterleave, bytes)                              \
+	{                                                                    \
+		convert, ConvertPlanar<convert, deinterleave, bytes>         \
+	}
+#define CONVERTER_F32(deinterleave)                         \
+	{                                                   \
+		ConvertF32, ConvertPlanarF32<deinterleave>  \
+	}
+
+SampleConverter GetSampleConverter(SampleFormat format, SimdLevel level)
+{
+	SampleConverter none = {nullptr, nullptr};
+
+#ifdef AUDIO_SIMD_X86
+	if (level == SimdLevel::AVX2) {
+		static const SampleConverter avx2[] = {
+			CONVERTER(ConvertS16AVX2, DeinterleaveAVX2, 2),
+			CONVERTER(ConvertS24AVX2, DeinterleaveAVX2, 3),
+			CONVERTER(ConvertS32AVX2, DeinterleaveAVX2, 4),
+			CONVERTER_F32(DeinterleaveAVX2),
+		};
+
+		return format == SampleFormat::UNKNOWN
+			       ? none
+			       : avx2[static_cast<int>(format) - 1];
+	}
+
+	if (level == SimdLevel::SSE2) {
+		static const SampleConverter sse2[] = {
+			CONVERTER(ConvertS16SSE2, DeinterleaveSSE2, 2),
+			CONVERTER(ConvertS24SSE2, DeinterleaveSSE2, 3),
+			CONVERTER(ConvertS32SSE2, DeinterleaveSSE2, 4),
+			CONVERTER_F32(DeinterleaveSSE2),
+		};
+
+		return format == SampleFormat::UNKNOWN
+			       ? none
+			       : sse2[static_cast<int>(format) - 1];
+	}
+#endif
+
+	static const SampleConverter scalar[] = {
+		CONVERTER(ConvertS16Scalar, DeinterleaveScalar, 2),
+		CONVERTER(ConvertS24Scalar, DeinterleaveScalar, 3),
+		CONVERTER(ConvertS32Scalar, DeinterleaveScalar, 4),
+		CONVERTER_F32(DeinterleaveScalar),
+	};
+
+	(void)level;
+	return format == SampleFormat::UNKNOWN
+		       ? none
+		       : scalar[static_cast<int>(format) - 1];
+}
@@ -0,0 +1,47 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu-features.hpp"
+
+/* Interleaved integer/float input to float output. Every kernel produces
+ * bit-identical results to the scalar path regardless of SIMD level. */
+enum class SampleFormat { UNKNOWN, S16, S24, S32, F32 };
+
+typedef void (*InterleavedConvertFunc)(const void *src, float *dst,
+				       size_t samples);
+typedef void (*PlanarConvertFunc)(const void *src, float *const *dst,
+				  uint32_t channels, size_t frames);
+
+struct SampleConverter {
+	InterleavedConvertFunc interleaved;
+	PlanarConvertFunc planar;
+};
+
+size_t SampleFormatBytes(SampleFormat format);
+
+SampleConverter GetSampleConverter(SampleFormat format, SimdLevel level);
+
+static inline SampleConverter GetSampleConverter(SampleFormat format)
+{
+	return GetSampleConverter(format, GetSimdLevel());
+}
@@ -0,0 +1,286 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "attach-scheduler.hpp"
+
+#include <algorithm>
+#include <vector>
+
+AttachScheduler::AttachScheduler(AttachSchedulerConfig config,
+				 std::function<uint64_t()> clock)
+	: config(config), clock(std::move(clock))
+{
+	if (!this->config.attemptsPerSecond)
+		this->config.attemptsPerSecond = 1;
+
+	// Start with a full second's worth so the first burst isn't held up
+	tokens = this->config.attemptsPerSecond;
+	refilled = this->clock();
+}
+
+void AttachScheduler::SetNotify(std::function<void()> notify)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	this->notify = std::move(notify);
+}
+
+// Callers must hold the mutex
+void AttachScheduler::Refill(uint64_t now)
+{
+	if (now <= refilled)
+		return;
+
+	double rate = config.attemptsPerSecond;
+	tokens = std::min(rate, tokens + (now - refilled) * rate / 1e9);
+	refilled = now;
+}
+
+uint64_t AttachScheduler::Submit(AttachTarget target)
+{
+	std::function<void()> wake;
+	uint64_t id;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		id = ++nextId;
+		Entry &entry = entries[id];
+		entry.target = std::move(target);
+		entry.submitted = clock();
+		entry.due = entry.submitted;
+		entry.backoff = config.backoffNs;
+		queue.insert(QueueKey(entry.due, id));
+
+		wake = notify;
+	}
+
+	if (wake)
+		wake();
+	return id;
+}
+
+void AttachScheduler::Cancel(uint64_t id)
+{
+	Lock lock(mutex);
+
+	auto it = entries.find(id);
+	if (it == entries.end())
+		return;
+
+	Entry &entry = it->second;
+	if (!entry.running) {
+		if (!entry.parked)
+			queue.erase(QueueKey(entry.due, id));
+		entries.erase(it);
+		return;
+	}
+
+	// Whoever is running the callback drops it, unless that's us
+	entry.cancelled = true;
+	if (entry.caller == std::this_thread::get_id())
+		return;
+	done.wait(lock, [this, id]() { return !entries.count(id); });
+}
+
+void AttachScheduler::SetOffsets(bool is32Bit,
+				 const AudioRenderClientOffsets &offsets)
+{
+	std::function<void()> wake;
+	{
+		Lock lock(mutex);
+
+		Lane &lane = lanes[is32Bit];
+		lane.offsets = offsets;
+		lane.state = offsets.getBuffer && offsets.releaseBuffer
+				     ? LaneState::READY
+				     : LaneState::UNAVAILABLE;
+
+		uint64_t now = clock();
+		std::vector<uint64_t> dropped;
+		for (auto &it : entries) {
+			Entry &entry = it.second;
+			if (!entry.parked || entry.is32Bit != is32Bit)
+				continue;
+
+			entry.parked = false;
+			if (lane.state == LaneState::READY) {
+				entry.due = now;
+				queue.insert(QueueKey(now, it.first));
+			} else {
+				dropped.push_back(it.first);
+			}
+		}
+
+		// Dropping unlocks, so anything may have gone in the meantime
+		for (uint64_t id : dropped) {
+			auto it = entries.find(id);
+			if (it != entries.end())
+				Drop(id, it->second, lock);
+		}
+
+		wake = notify;
+	}
+
+	if (wake)
+		wake();
+}
+
+/* Runs one of the entry's callbacks with the lock released. Returns false
+ * if the entry was cancelled meanwhile, in which case it's gone. */
+bool AttachScheduler::Call(uint64_t id, Entry &entry, Lock &lock,
+			   const std::function<void()> &callback)
+{
+	entry.running = true;
+	entry.caller = std::this_thread::get_id();
+	lock.unlock();
+
+	callback();
+
+	lock.lock();
+	entry.running = false;
+	entry.caller = std::thread::id();
+	if (!entry.cancelled)
+		return true;
+
+	entries.erase(id);
+	done.notify_all();
+	return false;
+}
+
+// Callers must hold the lock, the entry is gone if it was dropped
+void AttachScheduler::Retry(uint64_t id, Entry &entry, uint64_t now,
+			    Lock &lock)
+{
+	entry.failures++;
+	if (config.maxAttempts && entry.failures >= config.maxAttempts) {
+		Drop(id, entry, lock);
+		return;
+	}
+
+	stats.retries++;
+	entry.due = now + entry.backoff;
+	entry.backoff = std::min(entry.backoff * 2, config.maxBackoffNs);
+	queue.insert(QueueKey(entry.due, id));
+}
+
+// Callers must hold the lock, the entry is gone once this returns
+void AttachScheduler::Drop(uint64_t id, Entry &entry, Lock &lock)
+{
+	stats.givenUp++;
+	if (entry.target.failed &&
+	    !Call(id, entry, lock, entry.target.failed))
+		return;
+	entries.erase(id);
+}
+
+// Callers must hold the lock and have taken the entry off the queue
+void AttachScheduler::Attempt(uint64_t id, Entry &entry, uint64_t now,
+			      Lock &lock)
+{
+	stats.attempts++;
+
+	if (!entry.probed) {
+		bool probed = false;
+		bool is32Bit = false;
+		if (!Call(id, entry, lock, [&entry, &probed, &is32Bit]() {
+			    probed = entry.target.probe(is32Bit);
+		    }))
+			return;
+		if (!probed) {
+			Retry(id, entry, now, lock);
+			return;
+		}
+		entry.probed = true;
+		entry.is32Bit = is32Bit;
+	}
+
+	// Checked after the probe, in case the offsets came in during it
+	Lane &lane = lanes[entry.is32Bit];
+	switch (lane.state) {
+	case LaneState::PENDING:
+		entry.parked = true;
+		return;
+	case LaneState::UNAVAILABLE:
+		Drop(id, entry, lock);
+		return;
+	case LaneState::READY:
+		break;
+	}
+
+	AudioRenderClientOffsets offsets = lane.offsets;
+	AttachResult result = AttachResult::RETRY;
+	if (!Call(id, entry, lock, [&entry, &offsets, &result]() {
+		    result = entry.target.attach(offsets, entry.is32Bit);
+	    }))
+		return;
+
+	switch (result) {
+	case AttachResult::ATTACHED:
+		stats.attached++;
+		latency.Record(now - entry.submitted);
+		entries.erase(id);
+		break;
+	case AttachResult::RETRY:
+		Retry(id, entry, now, lock);
+		break;
+	case AttachResult::GIVE_UP:
+		Drop(id, entry, lock);
+		break;
+	}
+}
+
+uint64_t AttachScheduler::RunDue()
+{
+	Lock lock(mutex);
+
+	for (;;) {
+		// Callbacks take time, so every attempt gets a fresh now
+		uint64_t now = clock();
+		Refill(now);
+
+		if (queue.empty())
+			return 0;
+
+		QueueKey next = *queue.begin();
+		if (next.first > now)
+			return next.first;
+
+		// Come back once there's a whole token again
+		if (tokens < 1.0) {
+			stats.deferred++;
+			double wait = (1.0 - tokens) * 1e9 /
+				      config.attemptsPerSecond;
+			return now + static_cast<uint64_t>(wait) + 1;
+		}
+
+		tokens -= 1.0;
+		queue.erase(queue.begin());
+		Attempt(next.second, entries[next.second], now, lock);
+	}
+}
+
+size_t AttachScheduler::Pending() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return entries.size();
+}
+
+AttachSchedulerStats AttachScheduler::Stats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
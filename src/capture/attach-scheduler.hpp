@@ -0,0 +1,161 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <utility>
+
+#include "audio-hook/audio-hook-info.hpp"
+#include "capture-metrics.hpp"
+#include "capture-worker.hpp"
+
+enum class AttachResult {
+	ATTACHED,
+	// Try again after the target's next backoff
+	RETRY,
+	// Never going to work, don't bother again
+	GIVE_UP,
+};
+
+struct AttachTarget {
+	// Works out the target's bitness, false if that can't be done yet
+	std::function<bool(bool &is32Bit)> probe;
+	// Hands the target the offsets for its bitness
+	std::function<AttachResult(const AudioRenderClientOffsets &offsets,
+				   bool is32Bit)>
+		attach;
+	// Called at most once, when the scheduler gives up on the target
+	std::function<void()> failed;
+};
+
+struct AttachSchedulerConfig {
+	// Across every target, probes and attaches alike
+	uint32_t attemptsPerSecond = 20;
+	uint64_t backoffNs = 250000000ULL;
+	uint64_t maxBackoffNs = 30000000000ULL;
+	// Failed attempts before giving up, 0 to never give up
+	uint32_t maxAttempts = 10;
+};
+
+struct AttachSchedulerStats {
+	uint64_t attempts = 0;
+	uint64_t attached = 0;
+	uint64_t retries = 0;
+	uint64_t givenUp = 0;
+	// Times a due target had to wait on the budget instead
+	uint64_t deferred = 0;
+};
+
+/* Decides when each pending target gets its next attach attempt. Targets
+ * wait in one queue ordered by when they're due, each backs off on its own
+ * after a failure, and every attempt comes out of a shared per-second
+ * budget so a scene full of sources can't hammer a dozen processes at once.
+ *
+ * A target that has been probed but whose bitness has no offsets yet is
+ * parked until SetOffsets() makes that side ready, without spending any
+ * more of the budget in the meantime.
+ *
+ * Nothing here runs on its own: the owner calls RunDue() and waits until
+ * the time it returns or until the notify callback fires. Target callbacks
+ * run with the scheduler's lock released, so they may call back into it,
+ * cancelling their own target included. */
+class AttachScheduler {
+	enum class LaneState { PENDING, READY, UNAVAILABLE };
+
+	struct Lane {
+		LaneState state = LaneState::PENDING;
+		AudioRenderClientOffsets offsets = {};
+	};
+
+	struct Entry {
+		AttachTarget target;
+		uint64_t submitted = 0;
+		uint64_t due = 0;
+		uint64_t backoff = 0;
+		uint32_t failures = 0;
+		bool probed = false;
+		bool is32Bit = false;
+		bool parked = false;
+		// Inside one of its callbacks, and on which thread
+		bool running = false;
+		std::thread::id caller;
+		// Cancelled while running, dropped once its callback returns
+		bool cancelled = false;
+	};
+
+	typedef std::pair<uint64_t, uint64_t> QueueKey;
+
+	AttachSchedulerConfig config;
+	std::function<uint64_t()> clock;
+	std::function<void()> notify;
+
+	mutable std::mutex mutex;
+	std::condition_variable done;
+	std::map<uint64_t, Entry> entries;
+	// (due, id), so ties go first come first served
+	std::set<QueueKey> queue;
+	Lane lanes[2];
+	uint64_t nextId = 0;
+
+	double tokens;
+	uint64_t refilled;
+
+	AttachSchedulerStats stats;
+	LatencyHistogram latency;
+
+	typedef std::unique_lock<std::mutex> Lock;
+
+	void Refill(uint64_t now);
+	bool Call(uint64_t id, Entry &entry, Lock &lock,
+		  const std::function<void()> &callback);
+	void Attempt(uint64_t id, Entry &entry, uint64_t now, Lock &lock);
+	void Retry(uint64_t id, Entry &entry, uint64_t now, Lock &lock);
+	void Drop(uint64_t id, Entry &entry, Lock &lock);
+
+public:
+	explicit AttachScheduler(
+		AttachSchedulerConfig config = AttachSchedulerConfig(),
+		std::function<uint64_t()> clock = CaptureClockNs);
+
+	// Called without the lock whenever RunDue() should run sooner
+	void SetNotify(std::function<void()> notify);
+
+	uint64_t Submit(AttachTarget target);
+	/* Once this returns none of the target's callbacks are running, other
+	 * than the one it's called from, if it's called from one */
+	void Cancel(uint64_t id);
+
+	/* Offsets for one bitness, once they're known. Null entry points mean
+	 * that side can never be hooked, so its targets are given up on. */
+	void SetOffsets(bool is32Bit, const AudioRenderClientOffsets &offsets);
+
+	// Runs every attempt that's due, returns when to call again, 0 if idle
+	uint64_t RunDue();
+
+	size_t Pending() const;
+	AttachSchedulerStats Stats() const;
+	// Submit to attached, in nanoseconds
+	const LatencyHistogram &AttachLatency() const { return latency; }
+};
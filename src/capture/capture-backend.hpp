@@ -0,0 +1,94 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "audio-hook/audio-hook-info.hpp"
+#include "capture-worker.hpp"
+#include "session-registry.hpp"
+
+/* A packet as handed out by a stream. Data is only valid for the duration
+ * of the sink call; the timestamp is already in nanoseconds on the clock
+ * the backend's consumer outputs against. */
+struct CapturePacket {
+	const uint8_t *data;
+	uint32_t size;
+	uint32_t frames;
+	uint64_t timestamp;
+	uint32_t formatSerial;
+	const AudioRingFormatInfo *format;
+};
+
+typedef std::function<void(const CapturePacket &)> CaptureSink;
+
+// One attached session. Detaching is destroying it.
+class CaptureStream {
+public:
+	virtual ~CaptureStream() = default;
+
+	virtual std::shared_ptr<CaptureWaker> Waker() const = 0;
+
+	/* Hands everything queued to the sink and leaves the stream ready for
+	 * its waker to fire again. Returns true if anything was delivered.
+	 * Only ever called by its worker, one drain at a time. */
+	virtual bool Drain(const CaptureSink &sink) = 0;
+
+	// Frames the producer had to throw away since attaching
+	virtual uint64_t DroppedFrames() const { return 0; }
+	// Packets that didn't fit, same lifetime
+	virtual uint64_t Overruns() const { return 0; }
+
+	/* Asks the producer to coalesce audio into packets of about packetUs,
+	 * holding it back no longer than deadlineUs. Zero turns it off.
+	 * Producers that can't batch just ignore it. */
+	virtual void SetBatching(uint32_t packetUs, uint32_t deadlineUs)
+	{
+		(void)packetUs;
+		(void)deadlineUs;
+	}
+};
+
+/* Where sessions come from and how to get at their audio. The plugin
+ * proper uses the WASAPI hook backend, anything that wants to drive the
+ * pipeline without a game running can plug in another. */
+class CaptureBackend {
+public:
+	virtual ~CaptureBackend() = default;
+
+	virtual const char *Name() const = 0;
+
+	virtual std::shared_ptr<const SessionSnapshot> Sessions() = 0;
+
+	/* Calls the listener whenever Sessions() changes, from whichever
+	 * thread noticed. Returns 0 if the sessions never change, otherwise
+	 * an id for Unsubscribe(). */
+	virtual uint64_t Subscribe(SessionListener listener)
+	{
+		(void)listener;
+		return 0;
+	}
+	virtual void Unsubscribe(uint64_t id) { (void)id; }
+
+	// Returns nullptr if the session can't be captured right now
+	virtual std::unique_ptr<CaptureStream>
+	Attach(const SessionRecord &session) = 0;
+};
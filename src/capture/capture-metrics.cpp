@@ -0,0 +1,180 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "capture-metrics.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static uint32_t HighestBit(uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+#ifdef _WIN64
+	_BitScanReverse64(&index, value);
+#else
+	if (value >> 32) {
+		_BitScanReverse(&index, static_cast<uint32_t>(value >> 32));
+		index += 32;
+	} else {
+		_BitScanReverse(&index, static_cast<uint32_t>(value));
+	}
+#endif
+	return index;
+#else
+	return 63 - __builtin_clzll(value);
+#endif
+}
+
+#pragma region Histogram
+LatencyHistogram::LatencyHistogram()
+{
+	Reset();
+}
+
+uint32_t LatencyHistogram::BucketIndex(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_COUNT)
+		return static_cast<uint32_t>(value);
+
+	uint32_t msb = HighestBit(value);
+	if (msb > HISTOGRAM_MAX_BITS)
+		return HISTOGRAM_BUCKETS - 1;
+
+	uint32_t shift = msb - HISTOGRAM_SUB_BITS;
+	return (shift + 1) * HISTOGRAM_SUB_COUNT +
+	       static_cast<uint32_t>((value >> shift) &
+				     (HISTOGRAM_SUB_COUNT - 1));
+}
+
+// Middle of the bucket's range
+uint64_t LatencyHistogram::BucketValue(uint32_t index)
+{
+	if (index < HISTOGRAM_SUB_COUNT)
+		return index;
+
+	uint32_t shift = index / HISTOGRAM_SUB_COUNT - 1;
+	uint64_t sub = index % HISTOGRAM_SUB_COUNT;
+	return ((HISTOGRAM_SUB_COUNT + sub) << shift) +
+	       ((1ULL << shift) >> 1);
+}
+
+void LatencyHistogram::Record(uint64_t value)
+{
+	buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(value, std::memory_order_relaxed);
+
+	uint64_t current = max.load(std::memory_order_relaxed);
+	while (value > current &&
+	       !max.compare_exchange_weak(current, value,
+					  std::memory_order_relaxed)) {
+	}
+}
+
+void LatencyHistogram::Reset()
+{
+	for (auto &bucket : buckets)
+		bucket.store(0, std::memory_order_relaxed);
+	count.store(0, std::memory_order_relaxed);
+	total.store(0, std::memory_order_relaxed);
+	max.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::Mean() const
+{
+	uint64_t n = Count();
+	return n ? static_cast<double>(total.load(std::memory_order_relaxed)) /
+			   n
+		 : 0.0;
+}
+
+uint64_t LatencyHistogram::Percentile(double percentile) const
+{
+	uint64_t n = Count();
+	if (!n)
+		return 0;
+
+	uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * n + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if (seen >= rank) {
+			uint64_t value = BucketValue(i);
+			return value < Max() ? value : Max();
+		}
+	}
+
+	return Max();
+}
+#pragma endregion
+
+bool UnderrunTracker::Advance(uint64_t timestamp, uint32_t frames,
+			      uint32_t samplesPerSec)
+{
+	bool late = expected && timestamp > expected + UNDERRUN_NS;
+	expected = timestamp + static_cast<uint64_t>(frames) * 1000000000ULL /
+				       samplesPerSec;
+	return late;
+}
+
+void CaptureMetrics::Reset()
+{
+	counters.framesCaptured = 0;
+	counters.framesDropped = 0;
+	counters.overruns = 0;
+	counters.underruns = 0;
+	counters.wakeups = 0;
+	counters.bytesCopied = 0;
+	counters.framesGated = 0;
+	counters.framesNative = 0;
+	latency.Reset();
+	processing.Reset();
+}
+
+std::string CaptureMetrics::Describe() const
+{
+	char text[512];
+
+	snprintf(text, sizeof(text),
+		 "Frames: %" PRIu64 " captured, %" PRIu64
+		 " passed through, %" PRIu64 " dropped, %" PRIu64 " gated\n"
+		 "Overruns: %" PRIu64 ", underruns: %" PRIu64 "\n"
+		 "Wakeups: %" PRIu64 ", copied: %.1f MiB\n"
+		 "Hook to output: p50 %.2f ms, p99 %.2f ms, max %.2f ms\n"
+		 "Processing: p50 %.1f us, p99 %.1f us, max %.1f us",
+		 counters.framesCaptured.load(), counters.framesNative.load(),
+		 counters.framesDropped.load(), counters.framesGated.load(),
+		 counters.overruns.load(), counters.underruns.load(),
+		 counters.wakeups.load(),
+		 counters.bytesCopied.load() / (1024.0 * 1024.0),
+		 latency.Percentile(50.0) / 1000000.0,
+		 latency.Percentile(99.0) / 1000000.0, latency.Max() / 1000000.0,
+		 processing.Percentile(50.0) / 1000.0,
+		 processing.Percentile(99.0) / 1000.0,
+		 processing.Max() / 1000.0);
+
+	return text;
+}
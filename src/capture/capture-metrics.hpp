@@ -0,0 +1,109 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// 16 sub-buckets per power of two, so any value is off by at most ~6%
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+// Up to 2^40 ns, about 18 minutes; anything longer lands in the last one
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS \
+	((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 2) * HISTOGRAM_SUB_COUNT)
+
+// Output starting this much later than the last one ended is an underrun
+#define UNDERRUN_NS 10000000ULL
+
+/* HDR-style log-linear histogram. Recording is a bit scan and a relaxed
+ * add, so it's fine on every packet from any number of threads. Readers
+ * get a consistent enough picture without stopping the writers. */
+class LatencyHistogram {
+	std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+	std::atomic<uint64_t> count{0};
+	std::atomic<uint64_t> total{0};
+	std::atomic<uint64_t> max{0};
+
+	static uint32_t BucketIndex(uint64_t value);
+	static uint64_t BucketValue(uint32_t index);
+
+public:
+	LatencyHistogram();
+
+	LatencyHistogram(const LatencyHistogram &) = delete;
+	LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+	void Record(uint64_t value);
+	void Reset();
+
+	uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+	uint64_t Max() const { return max.load(std::memory_order_relaxed); }
+	double Mean() const;
+	// `percentile` is 0-100, returns 0 for an empty histogram
+	uint64_t Percentile(double percentile) const;
+};
+
+struct CaptureCounters {
+	std::atomic<uint64_t> framesCaptured{0};
+	std::atomic<uint64_t> framesDropped{0};
+	std::atomic<uint64_t> overruns{0};
+	std::atomic<uint64_t> underruns{0};
+	std::atomic<uint64_t> wakeups{0};
+	std::atomic<uint64_t> bytesCopied{0};
+	// Skipped as silence before any processing
+	std::atomic<uint64_t> framesGated{0};
+	// Handed to the output straight from the stream, never converted
+	std::atomic<uint64_t> framesNative{0};
+};
+
+/* Where the next output should start if nothing went missing. Timestamps
+ * that wobble by less than UNDERRUN_NS are jitter, not gaps. */
+class UnderrunTracker {
+	uint64_t expected = 0;
+
+public:
+	// Returns true if this output left a gap after the previous one
+	bool Advance(uint64_t timestamp, uint32_t frames,
+		     uint32_t samplesPerSec);
+	// Forget the last output, so a gap on purpose isn't counted
+	void Reset() { expected = 0; }
+
+	uint64_t Expected() const { return expected; }
+};
+
+// Everything a source keeps about its own cost, all in nanoseconds
+struct CaptureMetrics {
+	CaptureCounters counters;
+	// Hook timestamp to the frames being handed to the output
+	LatencyHistogram latency;
+	// Pipeline and output time for one packet
+	LatencyHistogram processing;
+
+	// One line per group, for the log or an info property
+	std::string Describe() const;
+	void Reset();
+};
+
+static inline void CaptureCount(std::atomic<uint64_t> &counter,
+				uint64_t amount = 1)
+{
+	counter.fetch_add(amount, std::memory_order_relaxed);
+}
@@ -0,0 +1,193 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "capture-pipeline.hpp"
+
+#include <cstring>
+
+SampleFormat GetRingSampleFormat(const AudioRingFormatInfo &info)
+{
+	if (info.tag == AUDIO_RING_FORMAT_FLOAT && info.bitsPerSample == 32)
+		return SampleFormat::F32;
+
+	if (info.tag == AUDIO_RING_FORMAT_PCM) {
+		switch (info.bitsPerSample) {
+		case 16:
+			return SampleFormat::S16;
+		case 24:
+			return SampleFormat::S24;
+		case 32:
+			return SampleFormat::S32;
+		}
+	}
+
+	return SampleFormat::UNKNOWN;
+}
+
+/* The interleaved formats OBS's audio_format has room for, minus unsigned
+ * 8-bit which no ring carries. There's no 24-bit either. */
+static const SampleFormat nativeFormats[] = {
+	SampleFormat::S16,
+	SampleFormat::S32,
+	SampleFormat::F32,
+};
+
+bool IsNativeSampleFormat(SampleFormat format)
+{
+	for (SampleFormat native : nativeFormats) {
+		if (native == format)
+			return true;
+	}
+
+	return false;
+}
+
+bool CapturePipeline::Configure(const AudioRingFormatInfo &info,
+				uint32_t outMask, uint32_t outRate,
+				ResamplerQuality quality)
+{
+	sampleFormat = GetRingSampleFormat(info);
+	native = false;
+
+	converter = GetSampleConverter(sampleFormat);
+	channels = info.channels;
+	frameBytes = info.blockAlign;
+	inputRate = info.samplesPerSec;
+	clock.Reset(inputRate);
+
+	if (!converter.planar || channels == 0 ||
+	    channels > REMIX_MAX_INPUTS ||
+	    frameBytes != channels * SampleFormatBytes(sampleFormat) ||
+	    !remix.Configure(info.channelMask, channels, outMask) ||
+	    !resampler.Configure(inputRate, outRate, remix.OutputChannels(),
+				 quality)) {
+		converter = {};
+		return false;
+	}
+
+	native = IsNativeSampleFormat(sampleFormat) && remix.Passthrough() &&
+		 resampler.Passthrough();
+	return true;
+}
+
+void CapturePipeline::Reset()
+{
+	converter = {};
+	native = false;
+}
+
+/* Resampled output lags its input by the filter's group delay. There's no
+ * filter at all when the rates match, so nothing to take off. */
+uint64_t CapturePipeline::Timestamp(const CapturePacket &packet)
+{
+	uint64_t timestamp = clock.Update(packet.timestamp, packet.frames);
+	if (resampler.Passthrough())
+		return timestamp;
+
+	uint64_t delay = resampler.Latency() * 1000000000ULL / inputRate;
+	return timestamp > delay ? timestamp - delay : 0;
+}
+
+bool CapturePipeline::Span(const CapturePacket &packet, CaptureSpan &span)
+{
+	if (!native || packet.size < packet.frames * frameBytes ||
+	    !packet.frames)
+		return false;
+
+	span.data = packet.data;
+	span.sampleFormat = sampleFormat;
+	span.channels = channels;
+	span.frames = packet.frames;
+	span.samplesPerSec = inputRate;
+	span.timestamp = Timestamp(packet);
+	return true;
+}
+
+bool CapturePipeline::Process(const CapturePacket &packet, FramePool &pool,
+			      CaptureOutput &output)
+{
+	if (!converter.planar || packet.size < packet.frames * frameBytes ||
+	    !packet.frames)
+		return false;
+
+	uint32_t outChannels = remix.OutputChannels();
+	bool resampling = !resampler.Passthrough();
+	bool remixing = !remix.Passthrough();
+
+	uint32_t frames = packet.frames;
+	uint32_t capacity =
+		resampling ? static_cast<uint32_t>(resampler.MaxOutput(frames))
+			   : frames;
+	FrameBuffer *buffer = pool.Acquire(capacity);
+	if (buffer->channels < outChannels) {
+		pool.Release(buffer);
+		return false;
+	}
+
+	// Only the stages before the last one need scratch space
+	float *dst[REMIX_MAX_INPUTS];
+	for (uint32_t c = 0; c < channels; c++) {
+		if (!remixing && !resampling) {
+			dst[c] = buffer->data[c];
+			continue;
+		}
+		if (planes[c].size() < frames)
+			planes[c].resize(frames);
+		dst[c] = planes[c].data();
+	}
+
+	uint64_t timestamp = Timestamp(packet);
+
+	converter.planar(packet.data, dst, channels, frames);
+
+	float *out[REMIX_MAX_OUTPUTS];
+	if (!remixing) {
+		memcpy(out, dst, outChannels * sizeof(float *));
+	} else {
+		for (uint32_t c = 0; c < outChannels; c++) {
+			if (resampling) {
+				if (remixPlanes[c].size() < frames)
+					remixPlanes[c].resize(frames);
+				out[c] = remixPlanes[c].data();
+			} else {
+				out[c] = buffer->data[c];
+			}
+		}
+		remix.Process(dst, out, frames);
+	}
+
+	if (resampling) {
+		frames = static_cast<uint32_t>(resampler.Process(
+			out, frames, buffer->data, capacity));
+		memcpy(out, buffer->data, outChannels * sizeof(float *));
+	}
+
+	if (!frames) {
+		pool.Release(buffer);
+		return false;
+	}
+
+	output.buffer = buffer;
+	for (uint32_t c = 0; c < outChannels; c++)
+		output.data[c] = out[c];
+	output.channels = outChannels;
+	output.frames = frames;
+	output.samplesPerSec = resampler.OutputRate();
+	output.timestamp = timestamp;
+	return true;
+}
@@ -0,0 +1,105 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "audio/channel-remix.hpp"
+#include "audio/resampler.hpp"
+#include "audio/sample-convert.hpp"
+#include "capture-backend.hpp"
+#include "clock-sync.hpp"
+#include "frame-pool.hpp"
+
+/* Planar float. The frames live in `buffer`, which belongs to whoever got
+ * the output until they hand it back to the pool it came from. */
+struct CaptureOutput {
+	FrameBuffer *buffer;
+	const float *data[REMIX_MAX_OUTPUTS];
+	uint32_t channels;
+	uint32_t frames;
+	uint32_t samplesPerSec;
+	uint64_t timestamp;
+};
+
+/* A packet the consumer takes as it is, interleaved and pointing straight
+ * into the stream. Only valid for as long as the packet is. */
+struct CaptureSpan {
+	const uint8_t *data;
+	SampleFormat sampleFormat;
+	uint32_t channels;
+	uint32_t frames;
+	uint32_t samplesPerSec;
+	uint64_t timestamp;
+};
+
+/* Everything between a stream's raw packets and what the consumer outputs:
+ * sample conversion, remixing to the output layout, resampling to the
+ * output rate and timestamp smoothing. Knows nothing about OBS or WASAPI so
+ * it runs the same behind any backend. */
+class CapturePipeline {
+	uint32_t channels = 0;
+	size_t frameBytes = 0;
+	uint32_t inputRate = 0;
+	SampleConverter converter = {};
+	SampleFormat sampleFormat = SampleFormat::UNKNOWN;
+	bool native = false;
+
+	// Scratch for whichever stages aren't last, only ever grows
+	std::vector<float> planes[REMIX_MAX_INPUTS];
+	std::vector<float> remixPlanes[REMIX_MAX_OUTPUTS];
+	ChannelRemix remix;
+	Resampler resampler;
+	ClockSync clock;
+
+	// Smoothed, less whatever delay the stages add
+	uint64_t Timestamp(const CapturePacket &packet);
+
+public:
+	/* Returns false if the input format or conversion isn't supported, in
+	 * which case packets are ignored until the next successful call */
+	bool Configure(const AudioRingFormatInfo &info, uint32_t outMask,
+		       uint32_t outRate, ResamplerQuality quality);
+	void Reset();
+
+	bool Configured() const { return converter.planar != nullptr; }
+	/* Already in the output layout and rate and in a format the consumer
+	 * takes interleaved, so Span() can stand in for Process() */
+	bool Native() const { return native; }
+
+	/* The last stage writes straight into a buffer from `pool`, which must
+	 * have at least OutputChannels(). Returns false if the packet produced
+	 * no output, in which case nothing needs releasing. */
+	bool Process(const CapturePacket &packet, FramePool &pool,
+		     CaptureOutput &output);
+	/* Only for Native() formats. Moves the clock along like Process()
+	 * would, so the two can take turns on the same stream. */
+	bool Span(const CapturePacket &packet, CaptureSpan &span);
+
+	uint32_t InputRate() const { return inputRate; }
+	uint32_t OutputChannels() const { return remix.OutputChannels(); }
+	const ChannelRemix &Remix() const { return remix; }
+	const Resampler &Resample() const { return resampler; }
+	const ClockSync &Clock() const { return clock; }
+};
+
+SampleFormat GetRingSampleFormat(const AudioRingFormatInfo &info);
+// Whether OBS takes `format` interleaved without us converting it first
+bool IsNativeSampleFormat(SampleFormat format);
@@ -0,0 +1,193 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "capture-trace.hpp"
+
+#include <cstring>
+
+static_assert(sizeof(CaptureTraceHeader) % CAPTURE_TRACE_ALIGN == 0,
+	      "Records have to start aligned");
+static_assert(sizeof(CaptureTraceRecord) % CAPTURE_TRACE_ALIGN == 0,
+	      "Payloads have to start aligned");
+
+static size_t TraceAlign(size_t size)
+{
+	return (size + CAPTURE_TRACE_ALIGN - 1) &
+	       ~static_cast<size_t>(CAPTURE_TRACE_ALIGN - 1);
+}
+
+#pragma region Writer
+bool CaptureTraceWriter::Open(FILE *newFile, uint32_t processId,
+			      const std::string &exe, uint64_t startNs)
+{
+	Close();
+
+	file = newFile;
+	if (!file)
+		return false;
+
+	// Records are small, let stdio batch them up
+	setvbuf(file, nullptr, _IOFBF, 1 << 16);
+
+	CaptureTraceHeader header = {};
+	header.magic = CAPTURE_TRACE_MAGIC;
+	header.version = CAPTURE_TRACE_VERSION;
+	header.headerSize = sizeof(CaptureTraceHeader);
+	header.processId = processId;
+	header.startNs = startNs;
+	strncpy(header.exe, exe.c_str(), sizeof(header.exe) - 1);
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		Close();
+		return false;
+	}
+
+	bytes = sizeof(header);
+	return true;
+}
+
+void CaptureTraceWriter::Close()
+{
+	if (file)
+		fclose(file);
+	file = nullptr;
+}
+
+bool CaptureTraceWriter::Write(CaptureTraceType type, uint64_t arrival,
+			       const void *head, uint32_t headSize,
+			       const void *data, uint32_t dataSize)
+{
+	static const uint8_t padding[CAPTURE_TRACE_ALIGN] = {};
+
+	if (!file)
+		return false;
+
+	CaptureTraceRecord record;
+	record.type = type;
+	record.size = headSize + dataSize;
+	record.arrival = arrival;
+	size_t pad = TraceAlign(record.size) - record.size;
+
+	if (fwrite(&record, sizeof(record), 1, file) != 1 ||
+	    fwrite(head, headSize, 1, file) != 1 ||
+	    (dataSize && fwrite(data, dataSize, 1, file) != 1) ||
+	    (pad && fwrite(padding, pad, 1, file) != 1)) {
+		Close();
+		return false;
+	}
+
+	bytes += sizeof(record) + record.size + pad;
+	return true;
+}
+
+bool CaptureTraceWriter::Format(uint64_t arrival, uint32_t formatSerial,
+				const AudioRingFormatInfo &format)
+{
+	CaptureTraceFormat head = {};
+	head.formatSerial = formatSerial;
+	head.format = format;
+	return Write(CaptureTraceType::FORMAT, arrival, &head, sizeof(head),
+		     nullptr, 0);
+}
+
+bool CaptureTraceWriter::Packet(uint64_t arrival, const CapturePacket &packet)
+{
+	CaptureTracePacket head;
+	head.timestamp = packet.timestamp;
+	head.frames = packet.frames;
+	head.formatSerial = packet.formatSerial;
+	return Write(CaptureTraceType::PACKET, arrival, &head, sizeof(head),
+		     packet.data, packet.size);
+}
+
+bool CaptureTraceWriter::Counters(uint64_t arrival, uint64_t droppedFrames,
+				  uint64_t overruns)
+{
+	CaptureTraceCounters head;
+	head.droppedFrames = droppedFrames;
+	head.overruns = overruns;
+	return Write(CaptureTraceType::COUNTERS, arrival, &head, sizeof(head),
+		     nullptr, 0);
+}
+#pragma endregion
+
+#pragma region Reader
+bool CaptureTraceReader::Attach(const void *newData, size_t newSize)
+{
+	const CaptureTraceHeader *header =
+		static_cast<const CaptureTraceHeader *>(newData);
+
+	data = nullptr;
+	size = 0;
+	offset = 0;
+
+	if (newSize < sizeof(CaptureTraceHeader) ||
+	    header->magic != CAPTURE_TRACE_MAGIC ||
+	    header->version != CAPTURE_TRACE_VERSION ||
+	    header->headerSize < sizeof(CaptureTraceHeader) ||
+	    header->headerSize % CAPTURE_TRACE_ALIGN != 0 ||
+	    header->headerSize > newSize)
+		return false;
+
+	data = static_cast<const uint8_t *>(newData);
+	size = newSize;
+	offset = header->headerSize;
+	return true;
+}
+
+void CaptureTraceReader::Rewind()
+{
+	if (data)
+		offset = Header().headerSize;
+}
+
+bool CaptureTraceReader::Next(CaptureTraceEntry &entry)
+{
+	if (!data || size - offset < sizeof(CaptureTraceRecord))
+		return false;
+
+	const CaptureTraceRecord *record =
+		reinterpret_cast<const CaptureTraceRecord *>(data + offset);
+	size_t length = sizeof(CaptureTraceRecord) + TraceAlign(record->size);
+	if (size - offset < length)
+		return false;
+
+	entry.type = record->type;
+	entry.arrival = record->arrival;
+	entry.payload = reinterpret_cast<const uint8_t *>(record + 1);
+	entry.size = record->size;
+	offset += length;
+	return true;
+}
+#pragma endregion
+
+bool LoadCaptureTrace(const std::string &path, std::vector<uint8_t> &data)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	data.clear();
+	uint8_t chunk[1 << 16];
+	size_t read;
+	while ((read = fread(chunk, 1, sizeof(chunk), file)) != 0)
+		data.insert(data.end(), chunk, chunk + read);
+
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
@@ -0,0 +1,139 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "capture-backend.hpp"
+
+/* On-disk record of what a stream handed out: the raw packets, their
+ * timestamps, format changes and the ring's drop counters, each stamped
+ * with when the consumer got it. A header, then records back to back, all
+ * little-endian and 8-byte aligned so a mapped file can be read in place.
+ * Only ever appended to; a recording cut short ends at its last whole
+ * record. */
+#define CAPTURE_TRACE_MAGIC 0x52544341 // "ACTR"
+#define CAPTURE_TRACE_VERSION 1
+#define CAPTURE_TRACE_ALIGN 8
+
+enum class CaptureTraceType : uint32_t {
+	FORMAT = 1,
+	PACKET = 2,
+	COUNTERS = 3,
+};
+
+struct CaptureTraceHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t processId;
+	// Consumer clock when recording started
+	uint64_t startNs;
+	char exe[48];
+};
+
+struct CaptureTraceRecord {
+	CaptureTraceType type;
+	// Payload bytes that follow, not counting alignment padding
+	uint32_t size;
+	// Consumer clock when the stream handed it out
+	uint64_t arrival;
+};
+
+struct CaptureTraceFormat {
+	uint32_t formatSerial;
+	uint32_t reserved;
+	AudioRingFormatInfo format;
+};
+
+// Followed by the packet's bytes
+struct CaptureTracePacket {
+	uint64_t timestamp;
+	uint32_t frames;
+	uint32_t formatSerial;
+};
+
+// Totals since attaching, written whenever they change
+struct CaptureTraceCounters {
+	uint64_t droppedFrames;
+	uint64_t overruns;
+};
+
+class CaptureTraceWriter {
+	FILE *file = nullptr;
+	uint64_t bytes = 0;
+
+	bool Write(CaptureTraceType type, uint64_t arrival, const void *head,
+		   uint32_t headSize, const void *data, uint32_t dataSize);
+
+public:
+	CaptureTraceWriter() = default;
+	~CaptureTraceWriter() { Close(); }
+
+	CaptureTraceWriter(const CaptureTraceWriter &) = delete;
+	CaptureTraceWriter &operator=(const CaptureTraceWriter &) = delete;
+
+	/* Takes over `newFile`, opened for writing by whoever knows how to
+	 * open paths on the platform. Closes it on failure. */
+	bool Open(FILE *newFile, uint32_t processId, const std::string &exe,
+		  uint64_t startNs);
+	void Close();
+	bool IsOpen() const { return file != nullptr; }
+	uint64_t Bytes() const { return bytes; }
+
+	// Each returns false once writing failed, the file is closed then
+	bool Format(uint64_t arrival, uint32_t formatSerial,
+		    const AudioRingFormatInfo &format);
+	bool Packet(uint64_t arrival, const CapturePacket &packet);
+	bool Counters(uint64_t arrival, uint64_t droppedFrames,
+		      uint64_t overruns);
+};
+
+struct CaptureTraceEntry {
+	CaptureTraceType type;
+	uint64_t arrival;
+	const uint8_t *payload;
+	uint32_t size;
+};
+
+/* Walks a trace in memory, mapped or loaded. Entries point into it and
+ * stay valid for as long as it does. */
+class CaptureTraceReader {
+	const uint8_t *data = nullptr;
+	size_t size = 0;
+	size_t offset = 0;
+
+public:
+	// Returns false if it isn't a trace this version can read
+	bool Attach(const void *data, size_t size);
+	void Rewind();
+
+	const CaptureTraceHeader &Header() const
+	{
+		return *reinterpret_cast<const CaptureTraceHeader *>(data);
+	}
+
+	// Returns false at the end, including a partly written last record
+	bool Next(CaptureTraceEntry &entry);
+};
+
+bool LoadCaptureTrace(const std::string &path, std::vector<uint8_t> &data);
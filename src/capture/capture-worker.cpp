@@ -0,0 +1,352 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "capture-worker.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+uint64_t CaptureClockNs()
+{
+	return static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch())
+			.count());
+}
+
+void LocalWaker::SetListener(std::function<void()> listener)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	this->listener = std::move(listener);
+}
+
+void LocalWaker::Signal()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (listener)
+		listener();
+}
+
+#pragma region Worker
+CaptureWorker::CaptureWorker(std::shared_ptr<CaptureWaker> waker,
+			     std::function<bool()> drain, uint32_t intervalMs,
+			     std::shared_ptr<CapturePool> pool)
+	: pool(pool ? std::move(pool) : GetCapturePool()),
+	  waker(std::move(waker)),
+	  drain(std::move(drain)),
+	  interval(std::max<uint32_t>(intervalMs, 1))
+{
+	startTime = CaptureClockNs();
+	this->pool->Add(this);
+}
+
+CaptureWorker::~CaptureWorker()
+{
+	pool->Remove(this);
+}
+
+void CaptureWorker::SetInterval(uint32_t intervalMs)
+{
+	interval = std::max<uint32_t>(intervalMs, 1);
+	pool->Reschedule();
+}
+
+double CaptureWorker::WakeupsPerSecond() const
+{
+	double elapsed = (CaptureClockNs() - startTime) / 1000000000.0;
+	uint64_t wakeups = stats.signalledWakeups.load() +
+			   stats.timeoutWakeups.load();
+	return elapsed > 0.0 ? wakeups / elapsed : 0.0;
+}
+#pragma endregion
+
+#pragma region Pool
+static void StoreMax(std::atomic<uint64_t> &max, uint64_t value)
+{
+	if (value > max.load(std::memory_order_relaxed))
+		max.store(value, std::memory_order_relaxed);
+}
+
+CapturePool::CapturePool(size_t threads)
+{
+	// Never just the one, or a single long drain holds up everyone else
+	if (!threads)
+		threads = std::max(std::thread::hardware_concurrency(), 2u);
+
+	running.reset(new std::atomic<CaptureWorker *>[threads]);
+	for (size_t i = 0; i < threads; i++) {
+		queues.emplace_back(new Queue());
+		running[i] = nullptr;
+	}
+
+	for (size_t i = 0; i < threads; i++)
+		this->threads.emplace_back(&CapturePool::Run, this, i);
+	timer = std::thread(&CapturePool::RunTimer, this);
+}
+
+CapturePool::~CapturePool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work.notify_all();
+	deadlines.notify_all();
+
+	for (auto &thread : threads)
+		thread.join();
+	timer.join();
+}
+
+void CapturePool::Add(CaptureWorker *worker)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		worker->home = nextHome++ % queues.size();
+		worker->lastRun = CaptureClockNs();
+		workers.push_back(worker);
+	}
+	deadlines.notify_one();
+
+	// Not under the mutex, the listener takes it
+	worker->waker->SetListener(
+		[this, worker]() { Schedule(worker, true); });
+
+	/* Streams only signal a consumer that has drained and gone to sleep,
+	 * so without this the first packet waits out a whole interval */
+	Schedule(worker, false);
+}
+
+void CapturePool::Remove(CaptureWorker *worker)
+{
+	worker->waker->SetListener(nullptr);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	workers.erase(std::find(workers.begin(), workers.end(), worker));
+
+	// Whatever's queued or running still has to finish
+	removals++;
+	idle.wait(lock, [this, worker]() {
+		if (worker->state != CaptureWorker::IDLE)
+			return false;
+		for (size_t i = 0; i < queues.size(); i++) {
+			if (running[i] == worker)
+				return false;
+		}
+		return true;
+	});
+	removals--;
+}
+
+void CapturePool::Reschedule()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	deadlines.notify_one();
+}
+
+void CapturePool::Schedule(CaptureWorker *worker, bool signalled)
+{
+	if (!Enqueue(worker, signalled))
+		return;
+
+	if (sleeping) {
+		std::lock_guard<std::mutex> lock(mutex);
+		work.notify_one();
+	}
+}
+
+/* Returns true if it went into a queue, false if it's queued already or
+ * is running and will go round again once it's done */
+bool CapturePool::Enqueue(CaptureWorker *worker, bool signalled)
+{
+	for (;;) {
+		int state = worker->state;
+		if (state == CaptureWorker::QUEUED ||
+		    state == CaptureWorker::RERUN)
+			return false;
+
+		if (state == CaptureWorker::RUNNING) {
+			if (worker->state.compare_exchange_weak(
+				    state, CaptureWorker::RERUN))
+				return false;
+			continue;
+		}
+
+		if (worker->state.compare_exchange_weak(state,
+							CaptureWorker::QUEUED))
+			break;
+	}
+
+	worker->queuedAt = CaptureClockNs();
+	worker->signalled = signalled;
+
+	// Overdue ones go first, anything signalled waits its turn
+	Queue &queue = *queues[worker->home];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (signalled)
+			queue.workers.push_back(worker);
+		else
+			queue.workers.push_front(worker);
+	}
+	queued++;
+	return true;
+}
+
+// Its own queue from the front, anyone else's from the back
+bool CapturePool::Pop(size_t index, CaptureWorker *&worker)
+{
+	for (size_t i = 0; i < queues.size(); i++) {
+		Queue &queue = *queues[(index + i) % queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.workers.empty())
+			continue;
+
+		if (i == 0) {
+			worker = queue.workers.front();
+			queue.workers.pop_front();
+		} else {
+			worker = queue.workers.back();
+			queue.workers.pop_back();
+		}
+		queued--;
+		return true;
+	}
+
+	return false;
+}
+
+void CapturePool::Execute(size_t index, CaptureWorker *worker)
+{
+	running[index] = worker;
+	worker->state = CaptureWorker::RUNNING;
+
+	uint64_t start = CaptureClockNs();
+	uint64_t queuedAt = worker->queuedAt;
+	bool signalled = worker->signalled;
+	bool worked = worker->drain();
+	uint64_t end = CaptureClockNs();
+	worker->lastRun = end;
+
+	CaptureWorkerStats &stats = worker->stats;
+	if (signalled)
+		stats.signalledWakeups.fetch_add(1, std::memory_order_relaxed);
+	else
+		stats.timeoutWakeups.fetch_add(1, std::memory_order_relaxed);
+	if (!worked)
+		stats.idleWakeups.fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t latency = end - queuedAt;
+	stats.lastLatencyNs.store(latency, std::memory_order_relaxed);
+	stats.totalLatencyNs.fetch_add(latency, std::memory_order_relaxed);
+	StoreMax(stats.maxLatencyNs, latency);
+	StoreMax(stats.maxQueuedNs, start - queuedAt);
+
+	// Signalled again while it was draining, so straight to the back
+	int state = CaptureWorker::RUNNING;
+	if (!worker->state.compare_exchange_strong(state,
+						   CaptureWorker::IDLE)) {
+		worker->queuedAt = end;
+		worker->signalled = true;
+		worker->state = CaptureWorker::QUEUED;
+
+		Queue &queue = *queues[worker->home];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.workers.push_back(worker);
+		}
+		queued++;
+	}
+
+	// The worker may be gone as soon as this is cleared
+	running[index] = nullptr;
+	if (removals) {
+		std::lock_guard<std::mutex> lock(mutex);
+		idle.notify_all();
+	}
+}
+
+void CapturePool::Run(size_t index)
+{
+	for (;;) {
+		CaptureWorker *worker;
+		if (Pop(index, worker)) {
+			Execute(index, worker);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		sleeping++;
+		work.wait(lock, [this]() { return stopping || queued; });
+		sleeping--;
+		if (stopping)
+			break;
+	}
+}
+
+void CapturePool::RunTimer()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		uint64_t now = CaptureClockNs();
+		uint64_t next = 0;
+		bool overdue = false;
+
+		for (CaptureWorker *worker : workers) {
+			uint64_t interval = worker->interval * 1000000ULL;
+			uint64_t due = worker->lastRun + interval;
+
+			// One that's queued or running already is on its way
+			if (due <= now) {
+				if (worker->state == CaptureWorker::IDLE &&
+				    Enqueue(worker, false))
+					overdue = true;
+				due = now + interval;
+			}
+
+			if (!next || due < next)
+				next = due;
+		}
+
+		if (overdue)
+			work.notify_all();
+
+		// Same clock as CaptureClockNs()
+		if (next)
+			deadlines.wait_until(
+				lock, std::chrono::steady_clock::time_point() +
+					      std::chrono::nanoseconds(next));
+		else
+			deadlines.wait(lock);
+	}
+}
+#pragma endregion
+
+std::shared_ptr<CapturePool> GetCapturePool()
+{
+	static std::mutex mutex;
+	static std::weak_ptr<CapturePool> shared;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<CapturePool> pool = shared.lock();
+	if (!pool) {
+		pool = std::make_shared<CapturePool>();
+		shared = pool;
+	}
+	return pool;
+}
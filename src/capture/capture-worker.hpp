@@ -0,0 +1,176 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Whatever the producer uses to poke the consumer. On Windows that's the
+ * named event next to the ring, in-process it's a plain call.
+ *
+ * Nothing sleeps on a waker; the pool asks to be called instead. The
+ * listener runs on whichever thread noticed the signal, so it has to be
+ * quick. Once SetListener() returns the old listener isn't running and
+ * won't be called again. */
+class CaptureWaker {
+public:
+	virtual ~CaptureWaker() = default;
+
+	virtual void SetListener(std::function<void()> listener) = 0;
+	virtual void Signal() = 0;
+};
+
+class LocalWaker : public CaptureWaker {
+	std::mutex mutex;
+	std::function<void()> listener;
+
+public:
+	void SetListener(std::function<void()> listener) override;
+	void Signal() override;
+};
+
+struct CaptureWorkerStats {
+	std::atomic<uint64_t> signalledWakeups{0};
+	std::atomic<uint64_t> timeoutWakeups{0};
+	// Wakeups where the drain found nothing to do
+	std::atomic<uint64_t> idleWakeups{0};
+
+	// Signal to end of drain, time spent queued included
+	std::atomic<uint64_t> lastLatencyNs{0};
+	std::atomic<uint64_t> maxLatencyNs{0};
+	std::atomic<uint64_t> totalLatencyNs{0};
+	// Longest it waited for a free thread
+	std::atomic<uint64_t> maxQueuedNs{0};
+};
+
+class CapturePool;
+
+/* One capture's place in the pool. It's drained whenever its waker fires
+ * and at least once every interval regardless, as a backstop for missed
+ * signals or a producer that never signals at all. Intervals are 1 ms at
+ * the least, as 0 would keep the deadline thread spinning. The drain
+ * callback returns true if it found anything to process, and never runs
+ * on two threads at once. */
+class CaptureWorker {
+	friend class CapturePool;
+
+	enum State { IDLE, QUEUED, RUNNING, RERUN };
+
+	std::shared_ptr<CapturePool> pool;
+	std::shared_ptr<CaptureWaker> waker;
+	std::function<bool()> drain;
+	std::atomic<uint32_t> interval;
+
+	// Everything below belongs to the pool
+	std::atomic<int> state{IDLE};
+	std::atomic<bool> removing{false};
+	// Set when a signal queued it, rather than its deadline
+	std::atomic<bool> signalled{false};
+	std::atomic<uint64_t> queuedAt{0};
+	std::atomic<uint64_t> lastRun{0};
+	size_t home = 0;
+
+	CaptureWorkerStats stats;
+	uint64_t startTime = 0;
+
+public:
+	CaptureWorker(std::shared_ptr<CaptureWaker> waker,
+		      std::function<bool()> drain, uint32_t intervalMs,
+		      std::shared_ptr<CapturePool> pool = nullptr);
+	// Never from inside its own drain
+	~CaptureWorker();
+
+	CaptureWorker(const CaptureWorker &) = delete;
+	CaptureWorker &operator=(const CaptureWorker &) = delete;
+
+	void SetInterval(uint32_t intervalMs);
+	uint32_t Interval() const { return interval; }
+
+	const CaptureWorkerStats &Stats() const { return stats; }
+	double WakeupsPerSecond() const;
+};
+
+/* Drains every capture on a thread per core instead of a thread each.
+ * Every thread has its own queue and steals from the others once it runs
+ * dry, so one game flooding a queue doesn't hold up the captures behind
+ * it. A capture that keeps signalling goes to the back of its queue after
+ * every drain, and one whose deadline has passed goes to the front.
+ *
+ * Deadlines are kept by one more thread that sleeps until the earliest
+ * one; a capture that's drained on signal keeps pushing its own back. */
+class CapturePool {
+	struct Queue {
+		std::mutex mutex;
+		std::deque<CaptureWorker *> workers;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> threads;
+	std::thread timer;
+	// What each thread is draining, so Remove() knows when it's done
+	std::unique_ptr<std::atomic<CaptureWorker *>[]> running;
+
+	// Guards everything below, the queues have their own
+	std::mutex mutex;
+	std::condition_variable work;
+	std::condition_variable idle;
+	std::condition_variable deadlines;
+	std::vector<CaptureWorker *> workers;
+	size_t nextHome = 0;
+	bool stopping = false;
+
+	std::atomic<uint64_t> queued{0};
+	std::atomic<uint32_t> sleeping{0};
+	std::atomic<uint32_t> removals{0};
+
+	bool Enqueue(CaptureWorker *worker, bool signalled);
+	bool Pop(size_t index, CaptureWorker *&worker);
+	void Execute(size_t index, CaptureWorker *worker);
+	void Run(size_t index);
+	void RunTimer();
+
+public:
+	// 0 for one thread per core, two at the least
+	explicit CapturePool(size_t threads = 0);
+	~CapturePool();
+
+	CapturePool(const CapturePool &) = delete;
+	CapturePool &operator=(const CapturePool &) = delete;
+
+	size_t Threads() const { return threads.size(); }
+
+	void Add(CaptureWorker *worker);
+	// Waits out a drain that's already running
+	void Remove(CaptureWorker *worker);
+	void Schedule(CaptureWorker *worker, bool signalled);
+	// Deadlines changed, look at them again
+	void Reschedule();
+};
+
+// Shared by every source, it goes away with the last worker
+std::shared_ptr<CapturePool> GetCapturePool();
+
+uint64_t CaptureClockNs();
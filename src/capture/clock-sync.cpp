@@ -0,0 +1,109 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "clock-sync.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// The loop is never allowed to believe a clock is off by more than this
+#define MAX_DRIFT_PPM 1000.0
+/* The loop's own period follows the jitter by a few hundred ppm, what's
+ * reported is that averaged over about this long */
+#define DRIFT_AVERAGE_S 10.0
+
+ClockSync::ClockSync(double bandwidth, uint32_t resyncMs)
+	: bandwidth(bandwidth),
+	  resyncNs(static_cast<uint64_t>(resyncMs) * 1000000)
+{
+}
+
+void ClockSync::Reset(uint32_t samplesPerSec)
+{
+	nominalNsPerFrame = samplesPerSec ? 1000000000.0 / samplesPerSec : 0.0;
+	nsPerFrame = nominalNsPerFrame;
+	averagePpm = 0.0;
+	locked = false;
+	lastError = 0.0;
+	maxError = 0.0;
+}
+
+void ClockSync::Lock(uint64_t timestamp, uint32_t frames)
+{
+	origin = static_cast<double>(timestamp);
+	next = origin + frames * nsPerFrame;
+	totalFrames = frames;
+	locked = true;
+}
+
+uint64_t ClockSync::Update(uint64_t timestamp, uint32_t frames)
+{
+	if (!nominalNsPerFrame || !frames)
+		return timestamp;
+
+	if (!locked) {
+		Lock(timestamp, frames);
+		return timestamp;
+	}
+
+	double error = static_cast<double>(timestamp) - next;
+	if (std::fabs(error) > static_cast<double>(resyncNs)) {
+		resyncs++;
+		nsPerFrame = nominalNsPerFrame;
+		Lock(timestamp, frames);
+		return timestamp;
+	}
+
+	double start = next;
+
+	// Loop gains scale with how much time this packet covers
+	const double pi = 3.14159265358979323846;
+	double omega = 2.0 * pi * bandwidth * frames * nominalNsPerFrame /
+		       1000000000.0;
+	double b = std::sqrt(2.0) * omega;
+	double c = omega * omega;
+
+	next += frames * nsPerFrame + b * error;
+	nsPerFrame += c * error / frames;
+
+	double limit = nominalNsPerFrame * MAX_DRIFT_PPM / 1000000.0;
+	if (nsPerFrame > nominalNsPerFrame + limit)
+		nsPerFrame = nominalNsPerFrame + limit;
+	else if (nsPerFrame < nominalNsPerFrame - limit)
+		nsPerFrame = nominalNsPerFrame - limit;
+
+	double ppm = (nsPerFrame / nominalNsPerFrame - 1.0) * 1000000.0;
+	double weight = frames * nominalNsPerFrame / 1000000000.0 /
+			DRIFT_AVERAGE_S;
+	averagePpm += (ppm - averagePpm) * std::min(weight, 1.0);
+
+	totalFrames += frames;
+	lastError = error;
+	if (std::fabs(error) > maxError)
+		maxError = std::fabs(error);
+
+	return static_cast<uint64_t>(start);
+}
+
+int64_t ClockSync::SkewNs() const
+{
+	if (!locked)
+		return 0;
+	return static_cast<int64_t>(next -
+				    (origin + totalFrames * nominalNsPerFrame));
+}
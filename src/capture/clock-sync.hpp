@@ -0,0 +1,68 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/* Turns bursty producer timestamps into a smooth timeline for OBS.
+ *
+ * A second order delay-locked loop tracks the producer's real frame
+ * period. Each packet's timestamp is the loop's prediction for where it
+ * should start, not the raw time it turned up, so device period bursts and
+ * scheduling jitter never reach OBS. What's left is the genuine drift
+ * between the game's audio clock and ours, reported as ppm and accumulated
+ * skew against the nominal rate. */
+class ClockSync {
+	double bandwidth;
+	uint64_t resyncNs;
+
+	double nominalNsPerFrame = 0.0;
+	double nsPerFrame = 0.0;
+	double averagePpm = 0.0;
+	double next = 0.0;
+	double origin = 0.0;
+	uint64_t totalFrames = 0;
+	bool locked = false;
+
+	double lastError = 0.0;
+	double maxError = 0.0;
+	uint64_t resyncs = 0;
+
+	void Lock(uint64_t timestamp, uint32_t frames);
+
+public:
+	/* Bandwidth is in Hz; lower rejects more jitter but takes longer to
+	 * settle. Errors larger than resyncMs are treated as discontinuities
+	 * (stalls, device changes) rather than drift. */
+	explicit ClockSync(double bandwidth = 0.5, uint32_t resyncMs = 100);
+
+	void Reset(uint32_t samplesPerSec);
+
+	// Returns the smoothed timestamp of the first frame in the packet
+	uint64_t Update(uint64_t timestamp, uint32_t frames);
+
+	bool Locked() const { return locked; }
+	// Averaged over seconds, the loop's own period is far noisier
+	double DriftPpm() const { return averagePpm; }
+	// Smoothed timeline minus where the nominal rate says we should be
+	int64_t SkewNs() const;
+	double LastErrorNs() const { return lastError; }
+	double MaxErrorNs() const { return maxError; }
+	uint64_t Resyncs() const { return resyncs; }
+};
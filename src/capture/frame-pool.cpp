@@ -0,0 +1,112 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "frame-pool.hpp"
+
+#define FRAME_POOL_ALIGN 64
+
+static size_t AlignFrames(size_t frames)
+{
+	size_t perLine = FRAME_POOL_ALIGN / sizeof(float);
+	return (frames + perLine - 1) & ~(perLine - 1);
+}
+
+void FramePool::Configure(uint32_t newChannels, uint32_t samplesPerSec,
+			  uint32_t ms)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	channels = newChannels < REMIX_MAX_OUTPUTS ? newChannels
+						   : REMIX_MAX_OUTPUTS;
+	slabFrames = static_cast<uint32_t>(
+		AlignFrames(static_cast<size_t>(samplesPerSec) * ms / 1000));
+
+	freeList = nullptr;
+	slabs.clear();
+	stats.inUse = 0;
+	stats.highWater = 0;
+}
+
+FrameBuffer *FramePool::Allocate(uint32_t frames, bool pooled)
+{
+	size_t stride = AlignFrames(frames);
+	std::unique_ptr<FrameBuffer> buffer(new FrameBuffer());
+
+	buffer->storage.reset(new uint8_t[stride * channels * sizeof(float) +
+					  FRAME_POOL_ALIGN]);
+	uintptr_t base = reinterpret_cast<uintptr_t>(buffer->storage.get());
+	base = (base + FRAME_POOL_ALIGN - 1) &
+	       ~static_cast<uintptr_t>(FRAME_POOL_ALIGN - 1);
+
+	for (uint32_t c = 0; c < channels; c++)
+		buffer->data[c] = reinterpret_cast<float *>(base) + c * stride;
+	buffer->channels = channels;
+	buffer->capacity = static_cast<uint32_t>(stride);
+	buffer->next = nullptr;
+	buffer->pooled = pooled;
+
+	stats.allocations.fetch_add(1, std::memory_order_relaxed);
+
+	if (!pooled)
+		return buffer.release();
+
+	slabs.push_back(std::move(buffer));
+	stats.slabs.fetch_add(1, std::memory_order_relaxed);
+	return slabs.back().get();
+}
+
+FrameBuffer *FramePool::Acquire(uint32_t frames)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	FrameBuffer *buffer;
+
+	if (frames > slabFrames) {
+		stats.oversized.fetch_add(1, std::memory_order_relaxed);
+		buffer = Allocate(frames, false);
+	} else if (freeList) {
+		buffer = freeList;
+		freeList = buffer->next;
+	} else {
+		buffer = Allocate(slabFrames, true);
+	}
+
+	stats.acquires.fetch_add(1, std::memory_order_relaxed);
+	uint32_t inUse = stats.inUse.fetch_add(1, std::memory_order_relaxed) +
+			 1;
+	if (inUse > stats.highWater.load(std::memory_order_relaxed))
+		stats.highWater.store(inUse, std::memory_order_relaxed);
+
+	return buffer;
+}
+
+void FramePool::Release(FrameBuffer *buffer)
+{
+	if (!buffer)
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.inUse.fetch_sub(1, std::memory_order_relaxed);
+
+	if (!buffer->pooled) {
+		delete buffer;
+		return;
+	}
+
+	buffer->next = freeList;
+	freeList = buffer;
+}
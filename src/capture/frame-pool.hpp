@@ -0,0 +1,82 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "audio/channel-remix.hpp"
+
+/* Planar float frames on their way to the output. `data` points into one
+ * slab shared by all channels, each plane aligned for the widest SIMD
+ * path. */
+struct FrameBuffer {
+	float *data[REMIX_MAX_OUTPUTS];
+	uint32_t channels;
+	uint32_t capacity;
+
+	std::unique_ptr<uint8_t[]> storage;
+	FrameBuffer *next;
+	bool pooled;
+};
+
+struct FramePoolStats {
+	// Buffers allocated, pooled or not; the steady state should add none
+	std::atomic<uint64_t> allocations{0};
+	std::atomic<uint64_t> slabs{0};
+	// Requests bigger than a slab, served and freed one-off
+	std::atomic<uint64_t> oversized{0};
+	std::atomic<uint64_t> acquires{0};
+	std::atomic<uint32_t> inUse{0};
+	std::atomic<uint32_t> highWater{0};
+};
+
+/* Recycles output buffers between whoever fills them on a capture worker
+ * and the call that hands them to OBS. Slabs are sized once from the
+ * output rate and channel count, so once enough exist for the deepest
+ * point in the pipeline nothing is allocated again. */
+class FramePool {
+	std::mutex mutex;
+	FrameBuffer *freeList = nullptr;
+	std::vector<std::unique_ptr<FrameBuffer>> slabs;
+
+	uint32_t channels = 0;
+	uint32_t slabFrames = 0;
+
+	FramePoolStats stats;
+
+	FrameBuffer *Allocate(uint32_t frames, bool pooled);
+
+public:
+	/* Each slab holds `ms` of planar float audio. Must not be called while
+	 * any buffer is still out. */
+	void Configure(uint32_t channels, uint32_t samplesPerSec,
+		       uint32_t ms = 50);
+
+	uint32_t Channels() const { return channels; }
+	uint32_t SlabFrames() const { return slabFrames; }
+
+	FrameBuffer *Acquire(uint32_t frames);
+	void Release(FrameBuffer *buffer);
+
+	const FramePoolStats &Stats() const { return stats; }
+};
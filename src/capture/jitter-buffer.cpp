@@ -0,0 +1,274 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "jitter-buffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/* Linear interpolation from one length to a slightly shorter one. The
+ * first and last frames stay put so neighbouring blocks still join up. */
+static void Squeeze(const float *src, uint32_t srcFrames, float *dst,
+		    uint32_t dstFrames)
+{
+	double step = static_cast<double>(srcFrames - 1) / (dstFrames - 1);
+
+	for (uint32_t i = 0; i < dstFrames; i++) {
+		double position = i * step;
+		uint32_t j = static_cast<uint32_t>(position);
+		uint32_t k = std::min(j + 1, srcFrames - 1);
+		float frac = static_cast<float>(position - j);
+		dst[i] = src[j] + (src[k] - src[j]) * frac;
+	}
+}
+
+void JitterBuffer::Configure(uint32_t newChannels, uint32_t newSamplesPerSec,
+			     uint32_t minMs, uint32_t maxMs, uint32_t windowMs,
+			     uint32_t marginMs, double newStretch)
+{
+	channels = std::min<uint32_t>(newChannels, REMIX_MAX_OUTPUTS);
+	samplesPerSec = newSamplesPerSec;
+	minNs = minMs * 1000000ULL;
+	maxNs = std::max(maxMs, minMs) * 1000000ULL;
+	marginNs = marginMs * 1000000ULL;
+	bucketNs = std::max<uint64_t>(windowMs * 1000000ULL / JITTER_BUCKETS,
+				      1);
+	toleranceNs = 5000000ULL;
+	stretch = newStretch;
+	Reset();
+}
+
+void JitterBuffer::Reset()
+{
+	memset(peaks, 0, sizeof(peaks));
+	bucket = 0;
+	bucketStart = 0;
+	meanAge = 0.0;
+	deviation = 0.0;
+
+	started = false;
+	outputFrames = 0;
+	concealedNs = 0;
+	stretchCredit = 0.0;
+	delayNs = 0;
+	targetNs = 0;
+}
+
+uint64_t JitterBuffer::FramesToNs(uint64_t frames) const
+{
+	return frames / samplesPerSec * 1000000000ULL +
+	       frames % samplesPerSec * 1000000000ULL / samplesPerSec;
+}
+
+uint64_t JitterBuffer::NsToFrames(uint64_t ns) const
+{
+	return ns / 1000000000ULL * samplesPerSec +
+	       ns % 1000000000ULL * samplesPerSec / 1000000000ULL;
+}
+
+void JitterBuffer::Observe(uint64_t age, uint64_t now)
+{
+	if (!bucketStart) {
+		bucketStart = now;
+	} else if (now - bucketStart >= bucketNs) {
+		// Slices that went by without a block are simply empty
+		uint64_t elapsed = (now - bucketStart) / bucketNs;
+		uint64_t cleared = std::min<uint64_t>(elapsed, JITTER_BUCKETS);
+		for (uint64_t i = 0; i < cleared; i++) {
+			bucket = (bucket + 1) % JITTER_BUCKETS;
+			peaks[bucket] = 0;
+		}
+		bucketStart += elapsed * bucketNs;
+	}
+
+	peaks[bucket] = std::max(peaks[bucket], age);
+
+	double error = static_cast<double>(age) - meanAge;
+	meanAge += error / 64.0;
+	deviation += (std::fabs(error) - deviation) / 64.0;
+}
+
+uint64_t JitterBuffer::Target() const
+{
+	uint64_t peak = 0;
+	for (uint32_t i = 0; i < JITTER_BUCKETS; i++)
+		peak = std::max(peak, peaks[i]);
+
+	return std::min(std::max(peak + marginNs, minNs), maxNs);
+}
+
+bool JitterBuffer::Place(uint32_t frames, uint64_t timestamp,
+			 uint64_t arrival, bool squeeze, uint64_t &stamp,
+			 uint32_t &drop)
+{
+	uint64_t age = arrival > timestamp ? arrival - timestamp : 0;
+	Observe(age, arrival);
+	uint64_t target = Target();
+	targetNs = target;
+	stats.blocks.fetch_add(1, std::memory_order_relaxed);
+
+	if (age > maxNs) {
+		// Too old to play on time at any delay we allow
+		stats.droppedFrames.fetch_add(frames,
+					      std::memory_order_relaxed);
+		return false;
+	}
+
+	uint64_t distance = timestamp > expected ? timestamp - expected
+						 : expected - timestamp;
+	if (!started || distance > toleranceNs) {
+		// A gap in the input is a gap in the output
+		uint64_t delay = target;
+		if (started) {
+			delay = std::max<uint64_t>(delay, delayNs);
+
+			/* Out of order, and the output has already gone
+			 * past its slot. Playing it now would overlap. */
+			if (timestamp + delay <
+			    origin + FramesToNs(outputFrames)) {
+				stats.late.fetch_add(1,
+						     std::memory_order_relaxed);
+				stats.droppedFrames.fetch_add(
+					frames, std::memory_order_relaxed);
+				return false;
+			}
+
+			stats.restarts.fetch_add(1, std::memory_order_relaxed);
+		}
+		origin = timestamp + delay;
+		outputFrames = 0;
+		started = true;
+	} else if (origin + FramesToNs(outputFrames) < arrival) {
+		/* Overdue and not covered in time. Silence stamped in the past
+		 * would only make things worse, start over further out. */
+		stats.late.fetch_add(1, std::memory_order_relaxed);
+		origin = timestamp + target;
+		outputFrames = 0;
+	}
+	expected = timestamp + FramesToNs(frames);
+	concealedNs = 0;
+
+	stamp = origin + FramesToNs(outputFrames);
+	uint64_t delay = stamp > timestamp ? stamp - timestamp : 0;
+	drop = 0;
+
+	if (squeeze && delay > target + marginNs && frames > 2) {
+		// Leaves at least two frames so the ends still line up
+		stretchCredit += frames * stretch;
+		uint64_t excess = NsToFrames(delay - target);
+		drop = static_cast<uint32_t>(std::min<double>(
+			std::min<uint64_t>(excess, frames - 2),
+			std::floor(stretchCredit)));
+		stretchCredit -= drop;
+		stats.droppedFrames.fetch_add(drop, std::memory_order_relaxed);
+	} else {
+		stretchCredit = 0.0;
+	}
+
+	outputFrames += frames - drop;
+	uint64_t end = origin + FramesToNs(outputFrames);
+	delayNs = end > expected ? end - expected : 0;
+	return true;
+}
+
+void JitterBuffer::Process(const CaptureOutput &input, uint64_t arrival,
+			   FramePool &pool, CaptureOutput &output)
+{
+	output = input;
+	output.buffer = nullptr;
+	if (!input.frames || !samplesPerSec)
+		return;
+
+	uint64_t stamp;
+	uint32_t drop;
+	if (!Place(input.frames, input.timestamp, arrival, true, stamp,
+		   drop)) {
+		output.frames = 0;
+		return;
+	}
+
+	if (drop) {
+		uint32_t frames = input.frames - drop;
+		FrameBuffer *buffer = pool.Acquire(frames);
+
+		for (uint32_t c = 0; c < channels; c++)
+			Squeeze(input.data[c], input.frames, buffer->data[c],
+				frames);
+
+		output.buffer = buffer;
+		for (uint32_t c = 0; c < channels; c++)
+			output.data[c] = buffer->data[c];
+		output.frames = frames;
+	}
+
+	output.timestamp = stamp;
+}
+
+bool JitterBuffer::Retime(uint32_t frames, uint64_t arrival,
+			  uint64_t &timestamp)
+{
+	uint32_t drop;
+	return frames && samplesPerSec &&
+	       Place(frames, timestamp, arrival, false, timestamp, drop);
+}
+
+bool JitterBuffer::Settled() const
+{
+	return delayNs <= targetNs + marginNs;
+}
+
+bool JitterBuffer::Conceal(uint64_t now, uint64_t ahead, FramePool &pool,
+			   CaptureOutput &output)
+{
+	if (!started || concealedNs >= maxNs)
+		return false;
+
+	// Only once it's overdue, it may still turn up in the meantime
+	uint64_t next = origin + FramesToNs(outputFrames);
+	if (!concealedNs && now + marginNs <= next)
+		return false;
+
+	uint64_t until = now + ahead + marginNs;
+	if (until <= next)
+		return false;
+
+	uint64_t frames = std::min<uint64_t>(
+		std::min(NsToFrames(until - next),
+			 NsToFrames(maxNs - concealedNs)),
+		pool.SlabFrames());
+	if (!frames)
+		return false;
+
+	FrameBuffer *buffer = pool.Acquire(static_cast<uint32_t>(frames));
+	for (uint32_t c = 0; c < channels; c++)
+		memset(buffer->data[c], 0, frames * sizeof(float));
+
+	output.buffer = buffer;
+	for (uint32_t c = 0; c < channels; c++)
+		output.data[c] = buffer->data[c];
+	output.channels = channels;
+	output.frames = static_cast<uint32_t>(frames);
+	output.samplesPerSec = samplesPerSec;
+	output.timestamp = next;
+
+	outputFrames += frames;
+	concealedNs += FramesToNs(frames);
+	stats.concealedFrames.fetch_add(frames, std::memory_order_relaxed);
+	return true;
+}
@@ -0,0 +1,121 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "capture-pipeline.hpp"
+
+#define JITTER_BUCKETS 8
+
+struct JitterBufferStats {
+	std::atomic<uint64_t> blocks{0};
+	// Silence put out on time while nothing arrived
+	std::atomic<uint64_t> concealedFrames{0};
+	// Blocks that turned up after their slot even so
+	std::atomic<uint64_t> late{0};
+	// Squeezed out while the delay shrinks, or too old to play
+	std::atomic<uint64_t> droppedFrames{0};
+	// Breaks in the input timeline, where the output starts over
+	std::atomic<uint64_t> restarts{0};
+};
+
+/* Re-times output on a contiguous timeline of its own, `delay` behind the
+ * capture clock. A game's audio thread stutters through loads and shader
+ * compiles, and anything stamped in OBS's past makes OBS grow its
+ * buffering for good. So the delay is kept just above the worst
+ * capture-to-arrival age seen over the last `windowMs`.
+ *
+ * When a block is overdue, Conceal() puts out silence in its place on
+ * time, and the block carries on after it whenever it does turn up: the
+ * delay grows by however long the hitch was. Once the window forgets the
+ * hitch the delay shrinks back by squeezing at most `stretch` of each
+ * block's length out of it, a pitch change that is hard to hear. Stalls
+ * longer than the maximum delay are left as gaps, they're the session
+ * going quiet rather than a hitch. A block that turns up out of order,
+ * once the output has moved past its slot, is dropped as late.
+ *
+ * Free of any platform calls, arrival times are passed in so recorded or
+ * made up traces replay exactly. Not thread safe. */
+class JitterBuffer {
+	uint32_t channels = 0;
+	uint32_t samplesPerSec = 0;
+	uint64_t minNs = 0;
+	uint64_t maxNs = 0;
+	uint64_t marginNs = 0;
+	uint64_t bucketNs = 0;
+	uint64_t toleranceNs = 0;
+	double stretch = 0.0;
+
+	// Peak age per slice of the window, newest at `bucket`
+	uint64_t peaks[JITTER_BUCKETS] = {};
+	uint32_t bucket = 0;
+	uint64_t bucketStart = 0;
+	double meanAge = 0.0;
+	double deviation = 0.0;
+
+	bool started = false;
+	uint64_t expected = 0;
+	uint64_t origin = 0;
+	uint64_t outputFrames = 0;
+	uint64_t concealedNs = 0;
+	double stretchCredit = 0.0;
+
+	std::atomic<uint64_t> delayNs{0};
+	std::atomic<uint64_t> targetNs{0};
+	JitterBufferStats stats;
+
+	uint64_t FramesToNs(uint64_t frames) const;
+	uint64_t NsToFrames(uint64_t ns) const;
+	void Observe(uint64_t age, uint64_t now);
+	uint64_t Target() const;
+	bool Place(uint32_t frames, uint64_t timestamp, uint64_t arrival,
+		   bool squeeze, uint64_t &stamp, uint32_t &drop);
+
+public:
+	void Configure(uint32_t channels, uint32_t samplesPerSec,
+		       uint32_t minMs = 0, uint32_t maxMs = 250,
+		       uint32_t windowMs = 4000, uint32_t marginMs = 2,
+		       double stretch = 0.01);
+	void Reset();
+
+	/* `arrival` is when `input` became available, on the same clock as
+	 * its timestamp. Output either shares the input's buffer (and has a
+	 * null `buffer`) or comes from `pool` and has to be released. Blocks
+	 * too old or too late to play at all come back with no frames. */
+	void Process(const CaptureOutput &input, uint64_t arrival,
+		     FramePool &pool, CaptureOutput &output);
+	/* Re-times output that can't be touched, so never squeezes. Returns
+	 * false for blocks too old or too late to play. */
+	bool Retime(uint32_t frames, uint64_t arrival, uint64_t &timestamp);
+	/* Silence for output that's overdue at `now`, enough to last until
+	 * the caller looks again `ahead` later. At most one slab at a time,
+	 * so call until it returns false. */
+	bool Conceal(uint64_t now, uint64_t ahead, FramePool &pool,
+		     CaptureOutput &output);
+
+	uint64_t DelayNs() const { return delayNs; }
+	uint64_t TargetNs() const { return targetNs; }
+	// Nothing left to squeeze out, Retime() loses nothing
+	bool Settled() const;
+	// Average deviation of arrival age, i.e. how jittery delivery is
+	double JitterNs() const { return deviation; }
+	const JitterBufferStats &Stats() const { return stats; }
+};
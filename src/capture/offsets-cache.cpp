@@ -0,0 +1,71 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "offsets-cache.hpp"
+
+OffsetsCache::OffsetsCache(std::unique_ptr<OffsetsStore> store,
+			   ModuleIdentityProvider identify)
+	: store(std::move(store)), identify(std::move(identify))
+{
+}
+
+// Only worth working out once per launch, callers must hold the mutex
+const ModuleIdentity &OffsetsCache::Identity(bool is32bit)
+{
+	if (!identified[is32bit]) {
+		identities[is32bit] = identify(is32bit);
+		identified[is32bit] = true;
+	}
+
+	return identities[is32bit];
+}
+
+bool OffsetsCache::Load(bool is32bit, AudioRenderClientOffsets &offsets)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const ModuleIdentity &identity = Identity(is32bit);
+	CachedOffsets entry;
+
+	if (!identity.Valid() || !store->Read(is32bit, entry))
+		return false;
+
+	if (entry.identity.version != identity.version ||
+	    entry.identity.hash != identity.hash)
+		return false;
+
+	if (!entry.offsets.getBuffer || !entry.offsets.releaseBuffer)
+		return false;
+
+	offsets = entry.offsets;
+	return true;
+}
+
+void OffsetsCache::Save(bool is32bit, const AudioRenderClientOffsets &offsets)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	const ModuleIdentity &identity = Identity(is32bit);
+
+	// Never cache a failure, or a result we can't tell apart from the next
+	if (!identity.Valid() || !offsets.getBuffer || !offsets.releaseBuffer)
+		return;
+
+	CachedOffsets entry;
+	entry.identity = identity;
+	entry.offsets = offsets;
+	store->Write(is32bit, entry);
+}
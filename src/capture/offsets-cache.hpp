@@ -0,0 +1,76 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "audio-hook/audio-hook-info.hpp"
+
+// Which audioses.dll the offsets were resolved against
+struct ModuleIdentity {
+	std::string version;
+	uint64_t hash = 0;
+
+	bool Valid() const { return !version.empty() && hash != 0; }
+};
+
+typedef std::function<ModuleIdentity(bool is32bit)> ModuleIdentityProvider;
+
+struct CachedOffsets {
+	ModuleIdentity identity;
+	AudioRenderClientOffsets offsets = {};
+};
+
+/* Where the cache keeps one entry per bitness between launches. Only ever
+ * called with the cache's mutex held. */
+class OffsetsStore {
+public:
+	virtual ~OffsetsStore() = default;
+
+	// False when there's nothing stored for that bitness
+	virtual bool Read(bool is32bit, CachedOffsets &entry) = 0;
+	virtual void Write(bool is32bit, const CachedOffsets &entry) = 0;
+};
+
+/* Remembers resolved offsets across launches so the get-audio-offsets
+ * helpers only have to run after Windows updates audioses.dll. Safe to use
+ * from both resolver threads at once. */
+class OffsetsCache {
+	std::unique_ptr<OffsetsStore> store;
+	ModuleIdentityProvider identify;
+
+	std::mutex mutex;
+	ModuleIdentity identities[2];
+	bool identified[2] = {};
+
+	const ModuleIdentity &Identity(bool is32bit);
+
+public:
+	OffsetsCache(std::unique_ptr<OffsetsStore> store,
+		     ModuleIdentityProvider identify);
+
+	// False on a miss, including when the module has changed since
+	bool Load(bool is32bit, AudioRenderClientOffsets &offsets);
+	// Failed resolves, null offsets or an unknown module, are never kept
+	void Save(bool is32bit, const AudioRenderClientOffsets &offsets);
+};
@@ -0,0 +1,80 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "ring-stream.hpp"
+
+bool RingCaptureStream::Drain(const CaptureSink &sink)
+{
+	bool worked = false;
+	AudioRingView view;
+
+	// Keep going until the ring is empty *after* telling the producer
+	do {
+		ring.Wake();
+		Poll();
+
+		while (ring.Peek(view)) {
+			// Attached mid-stream, the producer resends the format
+			if (!view.format) {
+				ring.Release();
+				continue;
+			}
+
+			CapturePacket packet;
+			packet.data = view.data;
+			packet.size = view.size;
+			packet.frames = view.frames;
+			packet.timestamp = Timestamp(view);
+			packet.formatSerial = view.formatSerial;
+			packet.format = view.format;
+
+			sink(packet);
+			ring.Release();
+			worked = true;
+		}
+	} while (!ring.Sleep());
+
+	return worked;
+}
+
+uint64_t RingCaptureStream::DroppedFrames() const
+{
+	if (!ring.Attached())
+		return 0;
+
+	return ring.Header()->droppedFrames.load(std::memory_order_relaxed);
+}
+
+uint64_t RingCaptureStream::Overruns() const
+{
+	if (!ring.Attached())
+		return 0;
+
+	return ring.Header()->overruns.load(std::memory_order_relaxed);
+}
+
+// Read by the producer whenever it next writes, see AudioRingBatcher
+void RingCaptureStream::SetBatching(uint32_t packetUs, uint32_t deadlineUs)
+{
+	if (!ring.Attached())
+		return;
+
+	AudioRingHeader *header = ring.Header();
+	header->batchUs.store(packetUs, std::memory_order_relaxed);
+	header->batchDeadlineUs.store(deadlineUs, std::memory_order_relaxed);
+}
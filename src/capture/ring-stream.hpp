@@ -0,0 +1,48 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <memory>
+
+#include "audio-hook/audio-ring.hpp"
+#include "capture-backend.hpp"
+
+/* Common consumer side for any backend whose producer writes into an
+ * AudioRing, whether that's shared memory filled by the hook or a heap
+ * region filled by a thread in this process. */
+class RingCaptureStream : public CaptureStream {
+protected:
+	AudioRingReader ring;
+	std::shared_ptr<CaptureWaker> waker;
+
+	// Runs at the start of every drain pass
+	virtual void Poll() {}
+
+	// Converts a packet's raw timestamp to the consumer's clock
+	virtual uint64_t Timestamp(const AudioRingView &packet) = 0;
+
+public:
+	~RingCaptureStream() override { ring.Detach(); }
+
+	std::shared_ptr<CaptureWaker> Waker() const override { return waker; }
+	bool Drain(const CaptureSink &sink) override;
+	uint64_t DroppedFrames() const override;
+	uint64_t Overruns() const override;
+	void SetBatching(uint32_t packetUs, uint32_t deadlineUs) override;
+};
@@ -0,0 +1,355 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "session-mixer.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+void SessionMixer::Configure(uint32_t newChannels, uint32_t newSamplesPerSec,
+			     uint32_t inputCount, uint32_t staleMs,
+			     uint32_t toleranceMs, SimdLevel level)
+{
+	channels = std::min<uint32_t>(newChannels, REMIX_MAX_OUTPUTS);
+	samplesPerSec = newSamplesPerSec;
+	staleNs = staleMs * 1000000ULL;
+	tolerance = static_cast<int64_t>(samplesPerSec) * toleranceMs / 1000;
+	horizon = static_cast<int64_t>(samplesPerSec) * staleMs / 1000;
+	accumulate = GetMixAccumulate(level);
+	ramp = GetMixRamp(level);
+
+	inputs.clear();
+	inputs.resize(std::min<uint32_t>(inputCount, MIXER_MAX_INPUTS));
+	Reset();
+}
+
+void SessionMixer::Reset()
+{
+	// Gains and envelopes are settings rather than state, they stay
+	for (auto &input : inputs) {
+		input.head = 0;
+		input.filled = 0;
+		input.started = false;
+		input.fadeFrames = 0;
+	}
+
+	anchored = false;
+	cursor = 0;
+}
+
+void SessionMixer::Reset(uint64_t timestamp)
+{
+	Reset();
+	anchored = true;
+	origin = timestamp;
+}
+
+void SessionMixer::SetGain(uint32_t input, float gain)
+{
+	if (input < inputs.size())
+		inputs[input].gain = gain;
+}
+
+void SessionMixer::ResetInput(uint32_t index)
+{
+	if (index >= inputs.size())
+		return;
+
+	Input &input = inputs[index];
+	input.head = 0;
+	input.filled = 0;
+	input.started = false;
+	input.envelope = 1.0f;
+	input.fadeFrames = 0;
+}
+
+size_t SessionMixer::Queued(uint32_t input) const
+{
+	return input < inputs.size() ? inputs[input].filled : 0;
+}
+
+void SessionMixer::Hold(uint32_t index, uint64_t now)
+{
+	if (index >= inputs.size() || inputs[index].filled)
+		return;
+
+	Input &input = inputs[index];
+	input.started = true;
+	input.start = cursor;
+	input.lastPush = now;
+}
+
+void SessionMixer::SetEnvelope(uint32_t input, float level)
+{
+	if (input >= inputs.size())
+		return;
+
+	inputs[input].envelope = level;
+	inputs[input].fadeFrames = 0;
+}
+
+int64_t SessionMixer::Fade(uint32_t index, float level, uint32_t frames)
+{
+	if (index >= inputs.size())
+		return cursor;
+
+	const Input &input = inputs[index];
+	return Fade(index, level, frames, input.filled ? input.start : cursor);
+}
+
+int64_t SessionMixer::Fade(uint32_t index, float level, uint32_t frames,
+			   int64_t at)
+{
+	int64_t start = std::max(at, cursor);
+	if (index >= inputs.size())
+		return start;
+
+	Input &input = inputs[index];
+	input.fadeFrom = EnvelopeAt(input, start);
+	input.envelope = level;
+	input.fadeStart = start;
+	input.fadeFrames = frames;
+	return start;
+}
+
+bool SessionMixer::Fading(uint32_t input) const
+{
+	return input < inputs.size() && inputs[input].fadeFrames != 0;
+}
+
+float SessionMixer::Envelope(uint32_t input) const
+{
+	return input < inputs.size() ? inputs[input].envelope : 0.0f;
+}
+
+float SessionMixer::EnvelopeAt(const Input &input, int64_t position) const
+{
+	if (!input.fadeFrames || position >= input.fadeStart + input.fadeFrames)
+		return input.envelope;
+	if (position <= input.fadeStart)
+		return input.fadeFrom;
+
+	return input.fadeFrom + (input.envelope - input.fadeFrom) *
+					static_cast<float>(position -
+							   input.fadeStart) /
+					static_cast<float>(input.fadeFrames);
+}
+
+int64_t SessionMixer::Position(uint64_t timestamp) const
+{
+	int64_t delta = static_cast<int64_t>(timestamp - origin);
+	// Split to keep the multiply from overflowing on long sessions
+	int64_t seconds = delta / 1000000000LL;
+	int64_t rest = delta % 1000000000LL;
+	return seconds * samplesPerSec + rest * samplesPerSec / 1000000000LL;
+}
+
+void SessionMixer::Append(Input &input, const float *const *data,
+			  size_t offset, size_t frames)
+{
+	size_t capacity = input.planes[0].size();
+
+	if (input.head + input.filled + frames > capacity) {
+		// Slide what's left to the front before growing anything
+		if (input.head) {
+			for (uint32_t c = 0; c < channels; c++)
+				memmove(input.planes[c].data(),
+					input.planes[c].data() + input.head,
+					input.filled * sizeof(float));
+			input.head = 0;
+		}
+
+		if (input.filled + frames > capacity) {
+			for (uint32_t c = 0; c < channels; c++)
+				input.planes[c].resize(input.filled + frames);
+		}
+	}
+
+	for (uint32_t c = 0; c < channels; c++) {
+		float *dst = input.planes[c].data() + input.head + input.filled;
+		if (data)
+			memcpy(dst, data[c] + offset, frames * sizeof(float));
+		else
+			memset(dst, 0, frames * sizeof(float));
+	}
+	input.filled += frames;
+}
+
+void SessionMixer::Consume(Input &input, int64_t until)
+{
+	if (until <= input.start)
+		return;
+
+	size_t drop = static_cast<size_t>(until - input.start);
+	if (drop >= input.filled) {
+		input.head = 0;
+		input.filled = 0;
+	} else {
+		input.head += drop;
+		input.filled -= drop;
+	}
+	input.start = until;
+}
+
+void SessionMixer::Push(uint32_t index, const float *const *data,
+			uint32_t frames, uint64_t timestamp, uint64_t now)
+{
+	if (index >= inputs.size() || !frames)
+		return;
+
+	Input &input = inputs[index];
+	bool stale = now > input.lastPush && now - input.lastPush > staleNs;
+	input.lastPush = now;
+
+	if (!anchored) {
+		anchored = true;
+		origin = timestamp;
+		cursor = 0;
+	}
+
+	int64_t position = Position(timestamp);
+	size_t skip = 0;
+
+	int64_t error = input.started ? position - input.End() : 0;
+
+	/* Having been mixed right up to its end doesn't make an input any less
+	 * contiguous, only going stale does. A gap past the horizon (a stall,
+	 * a clock change) is too long to fill, so the input starts over there
+	 * and drops what it had queued. */
+	if (!input.started || (!input.filled && stale) || error > horizon) {
+		input.started = true;
+		input.head = 0;
+		input.filled = 0;
+		input.start = position;
+	} else if (error > tolerance) {
+		// A real gap, keep the timeline honest with silence
+		Append(input, nullptr, 0, static_cast<size_t>(error));
+	} else if (error < -tolerance) {
+		// Overlaps what's queued, only keep the new part
+		int64_t overlap = -error;
+		if (overlap >= frames)
+			return;
+		skip = static_cast<size_t>(overlap);
+	}
+
+	Append(input, data, skip, frames - skip);
+
+	// Anything already behind the output is too late to hear
+	Consume(input, cursor);
+}
+
+// Adds [from, to) of an input's queue in at buffer position from - cursor
+void SessionMixer::Accumulate(const Input &input, FrameBuffer *buffer,
+			      int64_t from, int64_t to)
+{
+	int64_t fadeEnd = input.fadeStart + input.fadeFrames;
+
+	// At most three runs: before, during and after the fade
+	while (from < to) {
+		size_t src = input.head + static_cast<size_t>(from - input.start);
+		size_t dst = static_cast<size_t>(from - cursor);
+		int64_t end = to;
+		float gain = input.gain * input.envelope;
+		float step = 0.0f;
+
+		if (input.fadeFrames && from < input.fadeStart) {
+			end = std::min(to, input.fadeStart);
+			gain = input.gain * input.fadeFrom;
+		} else if (input.fadeFrames && from < fadeEnd) {
+			end = std::min(to, fadeEnd);
+			gain = input.gain * EnvelopeAt(input, from);
+			step = input.gain * (input.envelope - input.fadeFrom) /
+			       static_cast<float>(input.fadeFrames);
+		}
+
+		size_t count = static_cast<size_t>(end - from);
+		for (uint32_t c = 0; c < channels; c++) {
+			if (step != 0.0f)
+				ramp(buffer->data[c] + dst,
+				     input.planes[c].data() + src, gain, step,
+				     count);
+			else if (gain != 0.0f)
+				accumulate(buffer->data[c] + dst,
+					   input.planes[c].data() + src, gain,
+					   count);
+		}
+		from = end;
+	}
+}
+
+bool SessionMixer::Mix(uint64_t now, FramePool &pool, CaptureOutput &output)
+{
+	int64_t target = 0;
+	int64_t earliest = 0;
+	bool live = false;
+
+	for (const auto &input : inputs) {
+		if (!input.started ||
+		    (now > input.lastPush && now - input.lastPush > staleNs))
+			continue;
+
+		target = live ? std::min(target, input.End()) : input.End();
+		earliest = live ? std::min(earliest, input.start) : input.start;
+		live = true;
+	}
+
+	// Every input resynced past the horizon, follow rather than fill
+	if (live && earliest - cursor > horizon)
+		cursor = earliest;
+
+	if (!live || target <= cursor || pool.Channels() < channels)
+		return false;
+
+	target = std::min<int64_t>(target, cursor + pool.SlabFrames());
+	size_t frames = static_cast<size_t>(target - cursor);
+
+	FrameBuffer *buffer = pool.Acquire(static_cast<uint32_t>(frames));
+	for (uint32_t c = 0; c < channels; c++)
+		memset(buffer->data[c], 0, frames * sizeof(float));
+
+	for (auto &input : inputs) {
+		if (!input.filled || input.End() <= cursor ||
+		    input.start >= target)
+			continue;
+
+		Accumulate(input, buffer, std::max(input.start, cursor),
+			   std::min(input.End(), target));
+		Consume(input, target);
+	}
+
+	for (auto &input : inputs) {
+		if (input.fadeFrames &&
+		    input.fadeStart + input.fadeFrames <= target)
+			input.fadeFrames = 0;
+	}
+
+	output.buffer = buffer;
+	for (uint32_t c = 0; c < channels; c++)
+		output.data[c] = buffer->data[c];
+	output.channels = channels;
+	output.frames = static_cast<uint32_t>(frames);
+	output.samplesPerSec = samplesPerSec;
+	output.timestamp = origin +
+			   static_cast<uint64_t>(cursor / samplesPerSec) *
+				   1000000000ULL +
+			   static_cast<uint64_t>(cursor % samplesPerSec) *
+				   1000000000ULL / samplesPerSec;
+
+	cursor = target;
+	return true;
+}
@@ -0,0 +1,126 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "audio/mix.hpp"
+#include "capture-pipeline.hpp"
+
+#define MIXER_MAX_INPUTS 16
+
+/* Lines up several sessions' pipeline output on one timeline and sums
+ * them. Everything is already planar float at the output rate and layout,
+ * so an input is just a queue of frames anchored at a timeline position.
+ *
+ * Output only advances as far as every live input has delivered. Sessions
+ * go quiet without warning (WASAPI stops calling ReleaseBuffer on silence)
+ * so an input that hasn't pushed for `staleNs` no longer holds the others
+ * back and simply contributes silence until it comes back.
+ *
+ * On top of its gain every input has an envelope that can be faded on the
+ * output timeline, so switching sessions crossfades to the sample.
+ *
+ * Not thread safe, callers serialize Push() and Mix(). */
+class SessionMixer {
+	struct Input {
+		std::vector<float> planes[REMIX_MAX_OUTPUTS];
+		size_t head = 0;
+		size_t filled = 0;
+		int64_t start = 0;
+		uint64_t lastPush = 0;
+		float gain = 1.0f;
+		bool started = false;
+
+		// Level once any fade is over, fading while fadeFrames is set
+		float envelope = 1.0f;
+		float fadeFrom = 1.0f;
+		int64_t fadeStart = 0;
+		int64_t fadeFrames = 0;
+
+		int64_t End() const
+		{
+			return start + static_cast<int64_t>(filled);
+		}
+	};
+
+	uint32_t channels = 0;
+	uint32_t samplesPerSec = 0;
+	uint64_t staleNs = 0;
+	int64_t tolerance = 0;
+	// Largest jump bridged with silence, staleNs in frames
+	int64_t horizon = 0;
+
+	std::vector<Input> inputs;
+	MixAccumulateFunc accumulate = nullptr;
+	MixRampFunc ramp = nullptr;
+
+	bool anchored = false;
+	uint64_t origin = 0;
+	int64_t cursor = 0;
+
+	int64_t Position(uint64_t timestamp) const;
+	void Append(Input &input, const float *const *data, size_t offset,
+		    size_t frames);
+	void Consume(Input &input, int64_t until);
+	float EnvelopeAt(const Input &input, int64_t position) const;
+	void Accumulate(const Input &input, FrameBuffer *buffer, int64_t from,
+			int64_t to);
+
+public:
+	/* Inputs whose timestamps stray from where their queue ends by less
+	 * than toleranceMs are treated as contiguous. Gaps up to staleMs are
+	 * filled with silence, past that the input starts over at the new
+	 * timestamp and the mix follows once nothing else holds it back. */
+	void Configure(uint32_t channels, uint32_t samplesPerSec,
+		       uint32_t inputs, uint32_t staleMs = 100,
+		       uint32_t toleranceMs = 5,
+		       SimdLevel level = GetSimdLevel());
+	void Reset();
+	// Resets and carries on the timeline from `timestamp`
+	void Reset(uint64_t timestamp);
+
+	uint32_t Inputs() const { return static_cast<uint32_t>(inputs.size()); }
+	void SetGain(uint32_t input, float gain);
+	// Drops anything queued and forgets the input ever started
+	void ResetInput(uint32_t input);
+	size_t Queued(uint32_t input) const;
+	/* Has output wait for an input that hasn't pushed since a reset, as
+	 * long as it isn't stale */
+	void Hold(uint32_t input, uint64_t now);
+
+	/* Fade() ramps the envelope to `level` over `frames` of output. It
+	 * starts at `at` on the mix timeline, or where the input's queued audio
+	 * does, but never before the next mixed frame. Returns where it starts
+	 * so other inputs can be lined up with it. */
+	void SetEnvelope(uint32_t input, float level);
+	int64_t Fade(uint32_t input, float level, uint32_t frames);
+	int64_t Fade(uint32_t input, float level, uint32_t frames, int64_t at);
+	bool Fading(uint32_t input) const;
+	float Envelope(uint32_t input) const;
+
+	void Push(uint32_t input, const float *const *data, uint32_t frames,
+		  uint64_t timestamp, uint64_t now);
+
+	/* Mixes into a buffer from `pool`, at most one slab at a time so call
+	 * until it returns false. Returns false if no input has anything past
+	 * the last mix yet. */
+	bool Mix(uint64_t now, FramePool &pool, CaptureOutput &output);
+};
@@ -0,0 +1,326 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "session-registry.hpp"
+
+const SessionRecord *SessionSnapshot::Find(const std::string &sessionId,
+					   const std::string &deviceId) const
+{
+	const SessionRecord *newest = nullptr;
+
+	for (const auto &record : sessions) {
+		if (record.sessionId != sessionId ||
+		    record.deviceId != deviceId)
+			continue;
+		if (!newest ||
+		    record.processCreateTime > newest->processCreateTime)
+			newest = &record;
+	}
+
+	return newest;
+}
+
+const SessionRecord *
+SessionSnapshot::FindInstance(const std::string &instanceId,
+			      const std::string &deviceId) const
+{
+	for (const auto &record : sessions) {
+		if (record.instanceId == instanceId &&
+		    record.deviceId == deviceId)
+			return &record;
+	}
+
+	return nullptr;
+}
+
+const SessionRecord *
+SessionSnapshot::Successor(const std::string &instanceId,
+			   const std::string &sessionId,
+			   const std::string &deviceId) const
+{
+	if (FindInstance(instanceId, deviceId))
+		return nullptr;
+
+	const SessionRecord *next = Find(sessionId, deviceId);
+	return next && next->processId ? next : nullptr;
+}
+
+SessionRegistry::SessionRegistry()
+	: snapshot(std::make_shared<SessionSnapshot>())
+{
+}
+
+// Callers must hold the mutex
+void SessionRegistry::Publish()
+{
+	std::shared_ptr<SessionSnapshot> next =
+		std::make_shared<SessionSnapshot>();
+	next->generation = ++generation;
+	next->sessions.reserve(sessions.size());
+	for (const auto &entry : sessions)
+		next->sessions.push_back(entry.second);
+
+	std::atomic_store(&snapshot,
+			  std::shared_ptr<const SessionSnapshot>(next));
+}
+
+// The listener this thread is inside of, so it can unsubscribe itself
+static thread_local const void *currentListener = nullptr;
+
+// Callers must not hold the mutex
+void SessionRegistry::Notify()
+{
+	std::vector<std::shared_ptr<Listener>> copy;
+	std::unique_lock<std::mutex> lock(listenerMutex);
+	copy.reserve(listeners.size());
+	for (const auto &entry : listeners)
+		copy.push_back(entry.second);
+
+	for (const auto &listener : copy) {
+		// Unsubscribed by an earlier one in this same pass
+		if (listener->removed)
+			continue;
+
+		listener->calls++;
+		lock.unlock();
+
+		const void *outer = currentListener;
+		currentListener = listener.get();
+		listener->callback();
+		currentListener = outer;
+
+		lock.lock();
+		if (--listener->calls == 0 && listener->removed)
+			listenerDone.notify_all();
+	}
+}
+
+void SessionRegistry::Reset(const std::vector<SessionRecord> &scan)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		sessions.clear();
+		for (const auto &record : scan) {
+			sessions[SessionKey(record.instanceId,
+					    record.deviceId)] = record;
+			if (!record.deviceName.empty())
+				deviceNames[record.deviceId] =
+					record.deviceName;
+		}
+
+		Publish();
+	}
+
+	Notify();
+}
+
+bool SessionRegistry::AddSession(const SessionRecord &record)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		SessionKey key(record.instanceId, record.deviceId);
+
+		auto it = sessions.find(key);
+		if (it != sessions.end() &&
+		    it->second.sessionId == record.sessionId &&
+		    it->second.sessionName == record.sessionName &&
+		    it->second.processId == record.processId &&
+		    it->second.processCreateTime == record.processCreateTime &&
+		    it->second.deviceName == record.deviceName &&
+		    it->second.exe == record.exe)
+			return false;
+
+		sessions[key] = record;
+		Publish();
+	}
+
+	Notify();
+	return true;
+}
+
+bool SessionRegistry::RemoveSession(const std::string &instanceId,
+				    const std::string &deviceId)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (!sessions.erase(SessionKey(instanceId, deviceId)))
+			return false;
+
+		Publish();
+	}
+
+	Notify();
+	return true;
+}
+
+bool SessionRegistry::RemoveDevice(const std::string &deviceId)
+{
+	bool changed = false;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto it = sessions.begin(); it != sessions.end();) {
+			if (it->first.second == deviceId) {
+				it = sessions.erase(it);
+				changed = true;
+			} else {
+				++it;
+			}
+		}
+
+		deviceNames.erase(deviceId);
+
+		if (changed)
+			Publish();
+	}
+
+	if (changed)
+		Notify();
+	return changed;
+}
+
+bool SessionRegistry::RenameDevice(const std::string &deviceId,
+				   const std::string &name)
+{
+	bool changed = false;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		deviceNames[deviceId] = name;
+		for (auto &entry : sessions) {
+			if (entry.first.second == deviceId &&
+			    entry.second.deviceName != name) {
+				entry.second.deviceName = name;
+				changed = true;
+			}
+		}
+
+		if (changed)
+			Publish();
+	}
+
+	if (changed)
+		Notify();
+	return changed;
+}
+
+bool SessionRegistry::RemoveProcess(uint32_t processId,
+				    uint64_t processCreateTime)
+{
+	bool changed = false;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (auto it = sessions.begin(); it != sessions.end();) {
+			if (it->second.processId == processId &&
+			    it->second.processCreateTime ==
+				    processCreateTime) {
+				it = sessions.erase(it);
+				changed = true;
+			} else {
+				++it;
+			}
+		}
+
+		exeNames.erase(ProcessKey(processId, processCreateTime));
+
+		if (changed)
+			Publish();
+	}
+
+	if (changed)
+		Notify();
+	return changed;
+}
+
+/* The fetches run without the lock held; two threads racing on the same
+ * miss just both fetch, which is cheaper than serialising every lookup. */
+std::string
+SessionRegistry::DeviceName(const std::string &deviceId,
+			    const std::function<std::string()> &fetch)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = deviceNames.find(deviceId);
+		if (it != deviceNames.end())
+			return it->second;
+	}
+
+	std::string name = fetch();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	deviceNames[deviceId] = name;
+	return name;
+}
+
+std::string SessionRegistry::ExeName(uint32_t processId,
+				     uint64_t processCreateTime,
+				     const std::function<std::string()> &fetch)
+{
+	ProcessKey key(processId, processCreateTime);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = exeNames.find(key);
+		if (it != exeNames.end())
+			return it->second;
+	}
+
+	std::string name = fetch();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	exeNames[key] = name;
+	return name;
+}
+
+std::shared_ptr<const SessionSnapshot> SessionRegistry::Snapshot() const
+{
+	return std::atomic_load(&snapshot);
+}
+
+uint64_t SessionRegistry::Subscribe(SessionListener listener)
+{
+	std::lock_guard<std::mutex> lock(listenerMutex);
+	uint64_t id = ++nextListener;
+	listeners[id] = std::make_shared<Listener>();
+	listeners[id]->callback = std::move(listener);
+	return id;
+}
+
+void SessionRegistry::Unsubscribe(uint64_t id)
+{
+	std::unique_lock<std::mutex> lock(listenerMutex);
+	auto it = listeners.find(id);
+	if (it == listeners.end())
+		return;
+
+	std::shared_ptr<Listener> listener = it->second;
+	listener->removed = true;
+	listeners.erase(it);
+
+	// Wait out calls on other threads, but not the one we're inside
+	uint32_t own = currentListener == listener.get() ? 1 : 0;
+	listenerDone.wait(lock, [&listener, own]() {
+		return listener->calls <= own;
+	});
+}
@@ -0,0 +1,128 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct SessionRecord {
+	std::string sessionName;
+	std::string sessionId;
+	/* Every instance of an exe shares the session id, the instance id is
+	 * this process's alone */
+	std::string instanceId;
+
+	std::string deviceName;
+	std::string deviceId;
+
+	uint32_t processId = 0;
+	// Together with the pid this survives pid reuse
+	uint64_t processCreateTime = 0;
+	std::string exe;
+};
+
+struct SessionSnapshot {
+	uint64_t generation = 0;
+	std::vector<SessionRecord> sessions;
+
+	// The newest instance of the session, if there are several
+	const SessionRecord *Find(const std::string &sessionId,
+				  const std::string &deviceId) const;
+	const SessionRecord *FindInstance(const std::string &instanceId,
+					  const std::string &deviceId) const;
+	/* The instance a capture of `instanceId` should move to once its
+	 * process is gone and the session carries on in another, as it does
+	 * across a game restarting. Null while it's still running. */
+	const SessionRecord *Successor(const std::string &instanceId,
+				       const std::string &sessionId,
+				       const std::string &deviceId) const;
+};
+
+typedef std::function<void()> SessionListener;
+
+/* Long-lived view of every render session. One full scan seeds it, after
+ * that whoever owns the platform notifications feeds it diffs. Readers only
+ * ever see immutable snapshots and never touch the writer's lock.
+ *
+ * Device and exe names are cached here as well, since fetching them is the
+ * expensive part of a scan (property stores and OpenProcess). */
+class SessionRegistry {
+	// Instance id and device id
+	typedef std::pair<std::string, std::string> SessionKey;
+	typedef std::pair<uint32_t, uint64_t> ProcessKey;
+
+	mutable std::mutex mutex;
+	std::map<SessionKey, SessionRecord> sessions;
+	std::map<std::string, std::string> deviceNames;
+	std::map<ProcessKey, std::string> exeNames;
+	uint64_t generation = 0;
+
+	std::shared_ptr<const SessionSnapshot> snapshot;
+
+	struct Listener {
+		SessionListener callback;
+		bool removed = false;
+		// Threads inside the callback right now
+		uint32_t calls = 0;
+	};
+
+	/* Separate so listeners can take the snapshot they're told about.
+	 * Only guards the list, callbacks always run without it. */
+	std::mutex listenerMutex;
+	std::condition_variable listenerDone;
+	std::map<uint64_t, std::shared_ptr<Listener>> listeners;
+	uint64_t nextListener = 0;
+
+	void Publish();
+	void Notify();
+
+public:
+	SessionRegistry();
+
+	void Reset(const std::vector<SessionRecord> &scan);
+
+	// Each returns false if it changed nothing, and publishes otherwise
+	bool AddSession(const SessionRecord &record);
+	bool RemoveSession(const std::string &instanceId,
+			   const std::string &deviceId);
+	bool RemoveDevice(const std::string &deviceId);
+	bool RenameDevice(const std::string &deviceId, const std::string &name);
+	bool RemoveProcess(uint32_t processId, uint64_t processCreateTime);
+
+	std::string DeviceName(const std::string &deviceId,
+			       const std::function<std::string()> &fetch);
+	std::string ExeName(uint32_t processId, uint64_t processCreateTime,
+			    const std::function<std::string()> &fetch);
+
+	std::shared_ptr<const SessionSnapshot> Snapshot() const;
+
+	/* Listeners run on the writer's thread after every publish, with no
+	 * lock held, so they may subscribe and unsubscribe themselves or each
+	 * other. Once Unsubscribe() returns, the listener is done and won't be
+	 * called again, unless it's the one calling Unsubscribe(). */
+	uint64_t Subscribe(SessionListener listener);
+	void Unsubscribe(uint64_t id);
+};
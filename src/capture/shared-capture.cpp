@@ -0,0 +1,418 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "shared-capture.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#include "audio-hook/audio-hook-info.hpp"
+#include "capture-worker.hpp"
+
+// As deep as the hook's ring, so readers get the same slack
+#define SHARED_CAPTURE_CAPACITY AUDIO_RING_CAPACITY
+
+// A packet in the fan-out ring, followed by its bytes
+struct SharedPacket {
+	uint32_t size;
+	uint32_t frames;
+	uint64_t timestamp;
+	uint32_t formatSerial;
+	uint32_t reserved;
+	AudioRingFormatInfo format;
+};
+
+static uint32_t SharedAlign(uint32_t size)
+{
+	return (size + AUDIO_RING_PACKET_ALIGN - 1) &
+	       ~static_cast<uint32_t>(AUDIO_RING_PACKET_ALIGN - 1);
+}
+
+/* Listens on the session's own waker while its stream is the one draining
+ * and only on a private one while it's just reading the fan-out */
+class SharedWaker : public CaptureWaker {
+	std::shared_ptr<CaptureWaker> inner;
+	LocalWaker own;
+
+	std::mutex mutex;
+	std::function<void()> listener;
+	std::atomic<bool> primary{false};
+
+public:
+	explicit SharedWaker(std::shared_ptr<CaptureWaker> inner)
+		: inner(std::move(inner))
+	{
+	}
+
+	void SetListener(std::function<void()> listener) override
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->listener = listener;
+		own.SetListener(listener);
+		if (primary)
+			inner->SetListener(std::move(listener));
+	}
+
+	void Signal() override { own.Signal(); }
+
+	/* Hands the session's waker to this stream. The caller signals it
+	 * once the capture's lock is released, to drain whatever built up
+	 * since the last one left. */
+	void Promote()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		primary = true;
+		inner->SetListener(listener);
+	}
+
+	bool Primary() const { return primary; }
+};
+
+class SharedStream;
+
+class SharedCapture {
+	std::unique_ptr<CaptureStream> inner;
+
+	// Guards the stream list and the writing side of the fan-out
+	std::mutex mutex;
+	// The first one drains `inner`
+	std::vector<SharedStream *> streams;
+	// Lets a lone stream skip the lock
+	std::atomic<size_t> streamCount{0};
+
+	// Only allocated once a second stream joins
+	std::vector<uint64_t> region;
+	uint8_t *data = nullptr;
+	std::atomic<uint64_t> writePos{0};
+
+	uint64_t ReadPos(const SharedStream &writer) const;
+	bool Publish(const SharedStream &writer, const CapturePacket &packet);
+	bool DrainFanout(SharedStream &stream, const CaptureSink &sink);
+
+public:
+	explicit SharedCapture(std::unique_ptr<CaptureStream> inner);
+
+	std::shared_ptr<CaptureWaker> Waker() const { return inner->Waker(); }
+	CaptureStream &Inner() { return *inner; }
+
+	void Join(SharedStream *stream);
+	void Leave(SharedStream *stream);
+	bool Drain(SharedStream &stream, const CaptureSink &sink);
+};
+
+class SharedStream : public CaptureStream {
+	std::shared_ptr<SharedCapture> capture;
+
+public:
+	std::shared_ptr<SharedWaker> waker;
+	// Next fan-out position to read, only ever moved by this stream
+	std::atomic<uint64_t> cursor{0};
+	// Packets the fan-out had no room for while this stream was reading it
+	std::atomic<uint64_t> missedFrames{0};
+	std::atomic<uint64_t> missed{0};
+
+	explicit SharedStream(std::shared_ptr<SharedCapture> capture)
+		: capture(std::move(capture))
+	{
+		waker = std::make_shared<SharedWaker>(this->capture->Waker());
+		this->capture->Join(this);
+	}
+
+	~SharedStream() override { capture->Leave(this); }
+
+	std::shared_ptr<CaptureWaker> Waker() const override { return waker; }
+
+	bool Drain(const CaptureSink &sink) override
+	{
+		return capture->Drain(*this, sink);
+	}
+
+	uint64_t DroppedFrames() const override
+	{
+		return capture->Inner().DroppedFrames() + missedFrames;
+	}
+
+	uint64_t Overruns() const override
+	{
+		return capture->Inner().Overruns() + missed;
+	}
+
+	void SetBatching(uint32_t packetUs, uint32_t deadlineUs) override
+	{
+		capture->Inner().SetBatching(packetUs, deadlineUs);
+	}
+};
+
+#pragma region Shared Capture
+SharedCapture::SharedCapture(std::unique_ptr<CaptureStream> inner)
+	: inner(std::move(inner))
+{
+}
+
+void SharedCapture::Join(SharedStream *stream)
+{
+	std::shared_ptr<SharedWaker> promoted;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!streams.empty() && region.empty()) {
+			region.resize(SHARED_CAPTURE_CAPACITY /
+				      sizeof(uint64_t));
+			data = reinterpret_cast<uint8_t *>(region.data());
+		}
+
+		stream->cursor = writePos.load();
+		streams.push_back(stream);
+		streamCount = streams.size();
+		if (streams.size() == 1) {
+			promoted = stream->waker;
+			promoted->Promote();
+		}
+	}
+
+	if (promoted)
+		promoted->Signal();
+}
+
+void SharedCapture::Leave(SharedStream *stream)
+{
+	std::shared_ptr<SharedWaker> promoted;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = std::find(streams.begin(), streams.end(), stream);
+		if (it == streams.end())
+			return;
+
+		bool draining = it == streams.begin();
+		streams.erase(it);
+		streamCount = streams.size();
+		if (draining && !streams.empty()) {
+			promoted = streams.front()->waker;
+			promoted->Promote();
+		}
+	}
+
+	if (promoted)
+		promoted->Signal();
+}
+
+// Oldest position any reader still needs. Callers must hold the mutex.
+uint64_t SharedCapture::ReadPos(const SharedStream &writer) const
+{
+	uint64_t readPos = writePos.load(std::memory_order_relaxed);
+	for (const SharedStream *stream : streams) {
+		if (stream != &writer)
+			readPos = std::min(readPos, stream->cursor.load(
+						std::memory_order_acquire));
+	}
+	return readPos;
+}
+
+/* Copies the packet into the fan-out if anyone else is reading it. Takes
+ * the lock just for the copy, so streams can join and leave meanwhile. */
+bool SharedCapture::Publish(const SharedStream &writer,
+			    const CapturePacket &packet)
+{
+	if (streamCount.load(std::memory_order_relaxed) < 2)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (streams.size() < 2)
+		return false;
+
+	uint64_t pos = writePos.load(std::memory_order_relaxed);
+	uint32_t total = SharedAlign(
+		static_cast<uint32_t>(sizeof(SharedPacket)) + packet.size);
+	uint32_t offset = static_cast<uint32_t>(pos) &
+			  (SHARED_CAPTURE_CAPACITY - 1);
+	uint32_t tail = SHARED_CAPTURE_CAPACITY - offset;
+	uint64_t needed = tail < total ? total + tail : total;
+
+	if (total > SHARED_CAPTURE_CAPACITY ||
+	    needed > SHARED_CAPTURE_CAPACITY - (pos - ReadPos(writer))) {
+		for (SharedStream *stream : streams) {
+			if (stream == &writer)
+				continue;
+			stream->missed.fetch_add(1, std::memory_order_relaxed);
+			stream->missedFrames.fetch_add(
+				packet.frames, std::memory_order_relaxed);
+		}
+		return false;
+	}
+
+	// Packets never straddle the end, same as the hook's ring
+	if (tail < total) {
+		reinterpret_cast<SharedPacket *>(data + offset)->size =
+			AUDIO_RING_PACKET_WRAP;
+		pos += tail;
+		offset = 0;
+	}
+
+	SharedPacket *out = reinterpret_cast<SharedPacket *>(data + offset);
+	out->size = packet.size;
+	out->frames = packet.frames;
+	out->timestamp = packet.timestamp;
+	out->formatSerial = packet.formatSerial;
+	out->reserved = 0;
+	out->format = *packet.format;
+	memcpy(out + 1, packet.data, packet.size);
+
+	writePos.store(pos + total, std::memory_order_release);
+	return true;
+}
+
+bool SharedCapture::DrainFanout(SharedStream &stream, const CaptureSink &sink)
+{
+	uint64_t end = writePos.load(std::memory_order_acquire);
+	uint64_t pos = stream.cursor.load(std::memory_order_relaxed);
+	bool worked = false;
+
+	while (pos != end) {
+		uint32_t offset = static_cast<uint32_t>(pos) &
+				  (SHARED_CAPTURE_CAPACITY - 1);
+		const SharedPacket *in =
+			reinterpret_cast<const SharedPacket *>(data + offset);
+		if (in->size == AUDIO_RING_PACKET_WRAP) {
+			pos += SHARED_CAPTURE_CAPACITY - offset;
+			continue;
+		}
+
+		CapturePacket packet;
+		packet.data = reinterpret_cast<const uint8_t *>(in + 1);
+		packet.size = in->size;
+		packet.frames = in->frames;
+		packet.timestamp = in->timestamp;
+		packet.formatSerial = in->formatSerial;
+		packet.format = &in->format;
+		sink(packet);
+
+		pos += SharedAlign(static_cast<uint32_t>(sizeof(SharedPacket)) +
+				   in->size);
+		stream.cursor.store(pos, std::memory_order_release);
+		worked = true;
+	}
+
+	stream.cursor.store(pos, std::memory_order_release);
+	return worked;
+}
+
+bool SharedCapture::Drain(SharedStream &stream, const CaptureSink &sink)
+{
+	// Whatever was published before it took over, too
+	bool worked = DrainFanout(stream, sink);
+	if (!stream.waker->Primary())
+		return worked;
+
+	/* Only the primary stream gets here, so the inner stream is never
+	 * drained twice at once. Neither it nor the sink runs under the lock,
+	 * a sink is free to attach or detach streams of this same session. */
+	bool published = false;
+	worked |= inner->Drain([&](const CapturePacket &packet) {
+		if (Publish(stream, packet))
+			published = true;
+		sink(packet);
+	});
+
+	// Its own packets are already taken care of
+	stream.cursor.store(writePos.load(std::memory_order_acquire),
+			    std::memory_order_release);
+
+	if (published) {
+		std::vector<std::shared_ptr<SharedWaker>> others;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (SharedStream *other : streams) {
+				if (other != &stream)
+					others.push_back(other->waker);
+			}
+		}
+		for (const std::shared_ptr<SharedWaker> &other : others)
+			other->Signal();
+	}
+
+	return worked;
+}
+#pragma endregion
+
+SharedCaptureBackend::SharedCaptureBackend(
+	std::shared_ptr<CaptureBackend> inner)
+	: inner(std::move(inner))
+{
+}
+
+std::unique_ptr<CaptureStream>
+SharedCaptureBackend::Attach(const SessionRecord &session)
+{
+	CaptureKey key(session.deviceId, session.instanceId);
+	std::shared_ptr<SharedCapture> capture;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	for (auto it = captures.begin(); it != captures.end();) {
+		if (!it->second.attaching && it->second.capture.expired())
+			it = captures.erase(it);
+		else
+			++it;
+	}
+
+	// Someone else attaching this session is waited for, not repeated
+	for (;;) {
+		CaptureEntry &entry = captures[key];
+		capture = entry.capture.lock();
+		if (capture) {
+			lock.unlock();
+			return std::unique_ptr<CaptureStream>(
+				new SharedStream(capture));
+		}
+		if (!entry.attaching)
+			break;
+		attached.wait(lock);
+	}
+
+	captures[key].attaching = true;
+	lock.unlock();
+
+	std::unique_ptr<CaptureStream> stream = inner->Attach(session);
+	if (stream)
+		capture = std::make_shared<SharedCapture>(std::move(stream));
+
+	lock.lock();
+	if (capture) {
+		CaptureEntry &entry = captures[key];
+		entry.capture = capture;
+		entry.attaching = false;
+	} else {
+		captures.erase(key);
+	}
+	lock.unlock();
+	attached.notify_all();
+
+	if (!capture)
+		return nullptr;
+	return std::unique_ptr<CaptureStream>(new SharedStream(capture));
+}
+
+size_t SharedCaptureBackend::Captures()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	size_t count = 0;
+	for (auto &entry : captures) {
+		if (!entry.second.capture.expired())
+			count++;
+	}
+	return count;
+}
@@ -0,0 +1,78 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "capture-backend.hpp"
+
+class SharedCapture;
+
+/* Makes sure every session is attached once, however many sources capture
+ * it. The first stream attached to a session drains the real one and hands
+ * its packets straight on. While others are attached too, each packet is
+ * also copied once into a fan-out ring they all read through cursors of
+ * their own. The session is detached when its last stream is destroyed,
+ * and if that's the one draining, the next in line takes over.
+ *
+ * A stream that falls a whole ring behind makes the others lose packets
+ * too, since nothing is overwritten before everyone has read it.
+ *
+ * Nothing outside calls back in under a lock: the inner backend attaches,
+ * the inner stream drains and sinks run with the locks released. */
+class SharedCaptureBackend : public CaptureBackend {
+	typedef std::pair<std::string, std::string> CaptureKey;
+
+	struct CaptureEntry {
+		std::weak_ptr<SharedCapture> capture;
+		// Being attached by the inner backend right now
+		bool attaching = false;
+	};
+
+	std::shared_ptr<CaptureBackend> inner;
+	std::mutex mutex;
+	std::condition_variable attached;
+	std::map<CaptureKey, CaptureEntry> captures;
+
+public:
+	explicit SharedCaptureBackend(std::shared_ptr<CaptureBackend> inner);
+
+	const char *Name() const override { return inner->Name(); }
+
+	std::shared_ptr<const SessionSnapshot> Sessions() override
+	{
+		return inner->Sessions();
+	}
+
+	uint64_t Subscribe(SessionListener listener) override
+	{
+		return inner->Subscribe(std::move(listener));
+	}
+	void Unsubscribe(uint64_t id) override { inner->Unsubscribe(id); }
+
+	std::unique_ptr<CaptureStream>
+	Attach(const SessionRecord &session) override;
+
+	// Sessions currently attached, not counting their extra streams
+	size_t Captures();
+};
@@ -0,0 +1,70 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "silence-gate.hpp"
+
+#include <cmath>
+
+static float DbToLinear(float db)
+{
+	return powf(10.0f, db / 20.0f);
+}
+
+void SilenceGate::Configure(float thresholdDb, uint32_t samplesPerSec,
+			    uint32_t holdMs, float hysteresisDb)
+{
+	closeThreshold = DbToLinear(thresholdDb);
+	openThreshold = DbToLinear(thresholdDb + hysteresisDb);
+	holdFrames = static_cast<uint64_t>(samplesPerSec) * holdMs / 1000;
+	Reset();
+}
+
+void SilenceGate::Reset()
+{
+	open = true;
+	quietFrames = 0;
+}
+
+bool SilenceGate::Process(float peak, uint32_t frames)
+{
+	if (!open) {
+		if (peak <= openThreshold) {
+			gatedFrames += frames;
+			return false;
+		}
+
+		open = true;
+		quietFrames = 0;
+		return true;
+	}
+
+	if (peak > closeThreshold) {
+		quietFrames = 0;
+		return true;
+	}
+
+	// Still let the hold period through so tails aren't clipped
+	quietFrames += frames;
+	if (quietFrames < holdFrames)
+		return true;
+
+	open = false;
+	closings++;
+	gatedFrames += frames;
+	return false;
+}
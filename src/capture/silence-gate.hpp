@@ -0,0 +1,52 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/* Decides per packet whether there's anything worth processing. The gate
+ * closes only after `holdMs` of peaks below the threshold and reopens as
+ * soon as a peak clears it by the hysteresis margin, so quiet passages in
+ * actual content don't chatter it open and shut.
+ *
+ * Closing doesn't emit anything; the consumer just sees a timestamp gap,
+ * the same as when a session stops rendering altogether. */
+class SilenceGate {
+	float closeThreshold = 0.0f;
+	float openThreshold = 0.0f;
+	uint64_t holdFrames = 0;
+
+	bool open = true;
+	uint64_t quietFrames = 0;
+
+	uint64_t gatedFrames = 0;
+	uint64_t closings = 0;
+
+public:
+	void Configure(float thresholdDb, uint32_t samplesPerSec,
+		       uint32_t holdMs = 250, float hysteresisDb = 6.0f);
+	void Reset();
+
+	// Returns false if the packet should be skipped
+	bool Process(float peak, uint32_t frames);
+
+	bool Open() const { return open; }
+	uint64_t GatedFrames() const { return gatedFrames; }
+	uint64_t Closings() const { return closings; }
+};
@@ -0,0 +1,372 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "synthetic-backend.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#include "audio-hook/audio-batcher.hpp"
+#include "ring-stream.hpp"
+
+#define SYNTHETIC_DEVICE_ID "synthetic"
+#define SYNTHETIC_SESSION_PREFIX "synthetic-"
+
+static const double TWO_PI = 6.283185307179586;
+
+class SyntheticStream : public RingCaptureStream {
+	SyntheticSessionConfig config;
+	std::shared_ptr<SyntheticStats> stats;
+
+	std::vector<uint64_t> region;
+	AudioRingWriter writer;
+	AudioRingBatcher batcher{writer};
+	std::vector<uint8_t> chunk;
+	std::vector<double> phases;
+
+	std::atomic<bool> stopping{false};
+	std::thread thread;
+
+	void Run();
+	void Fill(uint8_t *dst, const AudioRingFormatInfo &format,
+		  uint32_t frames, bool silent);
+	void Nudge();
+	void WriteBatched(const AudioRingFormatInfo &format, uint32_t frames,
+			  uint64_t packet, uint64_t timestamp);
+
+protected:
+	uint64_t Timestamp(const AudioRingView &packet) override;
+
+public:
+	SyntheticStream(const SyntheticSessionConfig &config,
+			std::shared_ptr<SyntheticStats> stats);
+	~SyntheticStream() override;
+};
+
+SyntheticStream::SyntheticStream(const SyntheticSessionConfig &config,
+				 std::shared_ptr<SyntheticStats> stats)
+	: config(config), stats(std::move(stats))
+{
+	size_t bytes = AudioRingRegionSize(config.capacity);
+	region.resize((bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+
+	AudioRingHeader *header =
+		reinterpret_cast<AudioRingHeader *>(region.data());
+	AudioRingInitialize(header, config.capacity);
+
+	writer.Attach(header);
+	writer.SetFormat(config.format);
+	ring.Attach(header);
+	waker = std::make_shared<LocalWaker>();
+
+	thread = std::thread(&SyntheticStream::Run, this);
+}
+
+SyntheticStream::~SyntheticStream()
+{
+	stopping = true;
+	if (thread.joinable())
+		thread.join();
+
+	// Before the region goes away, not after like the base would
+	writer.Detach();
+	ring.Detach();
+}
+
+uint64_t SyntheticStream::Timestamp(const AudioRingView &packet)
+{
+	if (packet.timestamp)
+		return packet.timestamp;
+
+	// Same fallback the hook backend uses for packets without one
+	uint32_t rate = packet.format->samplesPerSec;
+	if (!rate)
+		return CaptureClockNs();
+	return CaptureClockNs() - packet.frames * 1000000000ULL / rate;
+}
+
+void SyntheticStream::Nudge()
+{
+	if (writer.ConsumerWaiting())
+		waker->Signal();
+}
+
+void SyntheticStream::Fill(uint8_t *dst, const AudioRingFormatInfo &format,
+			   uint32_t frames, bool silent)
+{
+	if (silent) {
+		memset(dst, 0, frames * format.blockAlign);
+		return;
+	}
+
+	uint32_t bytes = format.bitsPerSample / 8;
+	bool isFloat = format.tag == AUDIO_RING_FORMAT_FLOAT;
+
+	if (phases.size() < format.channels)
+		phases.resize(format.channels, 0.0);
+
+	for (uint32_t c = 0; c < format.channels; c++) {
+		// A different pitch per channel makes remix mistakes audible
+		double step = TWO_PI * 220.0 * (c + 1) / format.samplesPerSec;
+		double phase = phases[c];
+		uint8_t *out = dst + c * bytes;
+
+		for (uint32_t i = 0; i < frames; i++) {
+			double sample = 0.5 * sin(phase);
+			phase += step;
+
+			if (isFloat) {
+				float value = static_cast<float>(sample);
+				memcpy(out, &value, sizeof(value));
+			} else if (bytes == 2) {
+				int16_t value =
+					static_cast<int16_t>(sample * 32767.0);
+				memcpy(out, &value, sizeof(value));
+			} else if (bytes == 3) {
+				int32_t value = static_cast<int32_t>(
+					sample * 8388607.0);
+				out[0] = static_cast<uint8_t>(value);
+				out[1] = static_cast<uint8_t>(value >> 8);
+				out[2] = static_cast<uint8_t>(value >> 16);
+			} else if (bytes == 4) {
+				int32_t value = static_cast<int32_t>(
+					sample * 2147483647.0);
+				memcpy(out, &value, sizeof(value));
+			}
+
+			out += format.blockAlign;
+		}
+
+		phases[c] = fmod(phase, TWO_PI);
+	}
+}
+
+/* The way the hook writes with batching on: every packet is a chunk copied
+ * into the batch being built, and the consumer only hears about it when
+ * the batch goes out */
+void SyntheticStream::WriteBatched(const AudioRingFormatInfo &format,
+				   uint32_t frames, uint64_t packet,
+				   uint64_t timestamp)
+{
+	if (config.dropEvery && (packet + 1) % config.dropEvery == 0) {
+		stats->faultDrops.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	if (config.zeroTimestampEvery &&
+	    (packet + 1) % config.zeroTimestampEvery == 0)
+		timestamp = 0;
+
+	bool silent = config.silenceEvery &&
+		      packet % config.silenceEvery < config.silencePackets;
+
+	uint32_t size = frames * format.blockAlign;
+	chunk.resize(size);
+	Fill(chunk.data(), format, frames, silent);
+
+	uint32_t overruns =
+		ring.Header()->overruns.load(std::memory_order_relaxed);
+	if (batcher.Write(chunk.data(), size, frames, timestamp,
+			  CaptureClockNs()))
+		Nudge();
+
+	if (ring.Header()->overruns.load(std::memory_order_relaxed) !=
+	    overruns) {
+		stats->overruns.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	stats->packets.fetch_add(1, std::memory_order_relaxed);
+	stats->frames.fetch_add(frames, std::memory_order_relaxed);
+}
+
+void SyntheticStream::Run()
+{
+	std::mt19937 rng(config.processId);
+	std::uniform_int_distribution<uint32_t> jitter(0, config.jitterUs);
+	std::uniform_int_distribution<uint32_t> spread(
+		0, 2 * std::min(config.packetJitterFrames,
+				config.packetFrames - 1));
+
+	uint64_t start = CaptureClockNs();
+	uint64_t mediaTime = start;
+	uint64_t packet = 0;
+	uint64_t bursts = 0;
+	bool alternate = false;
+
+	while (!stopping) {
+		for (uint32_t i = 0; i < config.burstPackets && !stopping;
+		     i++, packet++) {
+			if (config.formatEvery && config.altFormat.channels &&
+			    packet && packet % config.formatEvery == 0) {
+				// Nothing may be reserved when the format changes
+				batcher.Flush();
+				alternate = !alternate;
+				writer.SetFormat(alternate ? config.altFormat
+							   : config.format);
+				stats->formatChanges.fetch_add(
+					1, std::memory_order_relaxed);
+			}
+
+			const AudioRingFormatInfo &format =
+				alternate ? config.altFormat : config.format;
+			uint32_t frames = config.packetFrames;
+			if (config.packetJitterFrames)
+				frames += spread(rng) -
+					  std::min(config.packetJitterFrames,
+						   config.packetFrames - 1);
+
+			uint64_t packetTime = mediaTime;
+			mediaTime += frames * 1000000000ULL /
+				     format.samplesPerSec;
+
+			batcher.Configure(ring.Header(), 1000000000ULL);
+			if (batcher.Enabled()) {
+				WriteBatched(format, frames, packet,
+					     packetTime + jitter(rng) * 1000ULL);
+				continue;
+			}
+
+			uint8_t *dst = writer.Reserve(frames * format.blockAlign);
+
+			// Flat out, a full ring means wait rather than drop
+			while (!dst && config.speed <= 0.0 && !stopping) {
+				Nudge();
+				std::this_thread::yield();
+				dst = writer.Reserve(frames * format.blockAlign);
+			}
+
+			if (!dst) {
+				writer.Drop(frames);
+				stats->overruns.fetch_add(
+					1, std::memory_order_relaxed);
+			} else if (config.dropEvery &&
+				   (packet + 1) % config.dropEvery == 0) {
+				// Lost before it reached the ring, so the ring never knows
+				stats->faultDrops.fetch_add(
+					1, std::memory_order_relaxed);
+			} else {
+				uint64_t timestamp =
+					packetTime + jitter(rng) * 1000ULL;
+				if (config.zeroTimestampEvery &&
+				    (packet + 1) % config.zeroTimestampEvery ==
+					    0)
+					timestamp = 0;
+
+				bool silent =
+					config.silenceEvery &&
+					packet % config.silenceEvery <
+						config.silencePackets;
+
+				Fill(dst, format, frames, silent);
+				writer.Commit(frames, timestamp);
+				stats->packets.fetch_add(
+					1, std::memory_order_relaxed);
+				stats->frames.fetch_add(
+					frames, std::memory_order_relaxed);
+			}
+		}
+
+		// Batched packets were signalled as they went out
+		if (!batcher.Enabled())
+			Nudge();
+
+		if (config.stallEvery && ++bursts % config.stallEvery == 0) {
+			stats->stalls.fetch_add(1, std::memory_order_relaxed);
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(config.stallMs));
+		}
+
+		if (config.speed > 0.0) {
+			uint64_t target =
+				start + static_cast<uint64_t>(
+						(mediaTime - start) /
+						config.speed);
+			uint64_t now = CaptureClockNs();
+			if (target > now)
+				std::this_thread::sleep_for(
+					std::chrono::nanoseconds(target - now));
+		}
+	}
+}
+
+SyntheticBackend::SyntheticBackend(
+	std::vector<SyntheticSessionConfig> newConfigs)
+	: configs(std::move(newConfigs))
+{
+	for (size_t i = 0; i < configs.size(); i++) {
+		SyntheticSessionConfig &config = configs[i];
+		if (!config.processId)
+			config.processId = static_cast<uint32_t>(i + 1);
+
+		SessionRecord record;
+		record.sessionName = config.name;
+		record.sessionId = SYNTHETIC_SESSION_PREFIX + std::to_string(i);
+		record.instanceId = record.sessionId + "/0";
+		record.deviceName = "Synthetic Device";
+		record.deviceId = SYNTHETIC_DEVICE_ID;
+		record.processId = config.processId;
+		record.exe = config.exe;
+		records.push_back(record);
+
+		stats.push_back(std::make_shared<SyntheticStats>());
+	}
+
+	launches.resize(configs.size(), 0);
+	registry.Reset(records);
+}
+
+std::unique_ptr<CaptureStream>
+SyntheticBackend::Attach(const SessionRecord &session)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (size_t i = 0; i < configs.size(); i++) {
+		if (records[i].instanceId == session.instanceId &&
+		    session.deviceId == SYNTHETIC_DEVICE_ID)
+			return std::unique_ptr<CaptureStream>(
+				new SyntheticStream(configs[i], stats[i]));
+	}
+
+	return nullptr;
+}
+
+void SyntheticBackend::Relaunch(size_t index)
+{
+	SessionRecord previous;
+	SessionRecord next;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		SessionRecord &record = records[index];
+		previous = record;
+
+		// Far enough along that it can't land on another session's
+		record.processId += static_cast<uint32_t>(configs.size());
+		record.processCreateTime = ++launches[index];
+		record.instanceId = record.sessionId + "/" +
+				    std::to_string(launches[index]);
+		next = record;
+	}
+
+	registry.RemoveProcess(previous.processId, previous.processCreateTime);
+	registry.AddSession(next);
+}
@@ -0,0 +1,118 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "capture-backend.hpp"
+
+/* One fake session. The producer writes a sine per channel into an
+ * in-process ring exactly the way the hook would, so everything from the
+ * ring onwards runs the real code. */
+struct SyntheticSessionConfig {
+	std::string name = "Synthetic Session";
+	std::string exe = "synthetic.exe";
+	uint32_t processId = 0;
+
+	AudioRingFormatInfo format = {AUDIO_RING_FORMAT_FLOAT, 48000, 0x3, 2,
+				      32, 32, 8, 0};
+	// Switched to every `formatEvery` packets and back again, if set
+	AudioRingFormatInfo altFormat = {};
+	uint32_t formatEvery = 0;
+
+	uint32_t packetFrames = 480;
+	/* Packets vary by up to this many frames either way, like engines
+	 * whose periods don't line up with the device's */
+	uint32_t packetJitterFrames = 0;
+	// Packets committed back to back before the producer sleeps again
+	uint32_t burstPackets = 1;
+	// Multiple of real time; 0 runs as fast as the consumer keeps up
+	double speed = 1.0;
+	uint32_t capacity = AUDIO_RING_CAPACITY;
+
+	// Every `silenceEvery` packets, `silencePackets` of digital silence
+	uint32_t silenceEvery = 0;
+	uint32_t silencePackets = 0;
+
+	// Faults
+	uint32_t dropEvery = 0;
+	uint32_t jitterUs = 0;
+	uint32_t stallEvery = 0;
+	uint32_t stallMs = 0;
+	uint32_t zeroTimestampEvery = 0;
+};
+
+struct SyntheticStats {
+	std::atomic<uint64_t> packets{0};
+	std::atomic<uint64_t> frames{0};
+	std::atomic<uint64_t> faultDrops{0};
+	std::atomic<uint64_t> overruns{0};
+	std::atomic<uint64_t> formatChanges{0};
+	std::atomic<uint64_t> stalls{0};
+};
+
+/* Sessions are all on device "synthetic" with ids "synthetic-<index>" and
+ * instance ids "synthetic-<index>/<launch>". Attaching starts a producer,
+ * destroying the stream stops it. Timestamps are media time on
+ * CaptureClockNs(), so at speeds other than 1 they run ahead of or behind
+ * the wall clock. */
+class SyntheticBackend : public CaptureBackend {
+	std::vector<SyntheticSessionConfig> configs;
+	std::vector<std::shared_ptr<SyntheticStats>> stats;
+
+	std::mutex mutex;
+	std::vector<SessionRecord> records;
+	std::vector<uint32_t> launches;
+	SessionRegistry registry;
+
+public:
+	explicit SyntheticBackend(std::vector<SyntheticSessionConfig> configs);
+
+	const char *Name() const override { return "synthetic"; }
+
+	std::shared_ptr<const SessionSnapshot> Sessions() override
+	{
+		return registry.Snapshot();
+	}
+
+	uint64_t Subscribe(SessionListener listener) override
+	{
+		return registry.Subscribe(std::move(listener));
+	}
+	void Unsubscribe(uint64_t id) override { registry.Unsubscribe(id); }
+
+	std::unique_ptr<CaptureStream>
+	Attach(const SessionRecord &session) override;
+
+	/* Replaces the session's instance with one of a new process under the
+	 * same session id, the way a game being restarted would. Streams
+	 * attached to the old one keep going until they're destroyed. */
+	void Relaunch(size_t index);
+
+	// Accumulated over every stream attached to the session
+	const SyntheticStats &Stats(size_t index) const
+	{
+		return *stats[index];
+	}
+};
@@ -0,0 +1,279 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "trace-backend.hpp"
+
+#include <algorithm>
+
+#define TRACE_DEVICE_ID "trace"
+#define TRACE_SESSION_PREFIX "trace-"
+// Packets per drain when replaying, so one drain never hogs the output
+#define TRACE_DRAIN_PACKETS 64
+
+#pragma region Recording
+TracingStream::TracingStream(std::unique_ptr<CaptureStream> inner, FILE *file,
+			     const SessionRecord &session)
+	: inner(std::move(inner))
+{
+	writer.Open(file, session.processId, session.exe, CaptureClockNs());
+}
+
+bool TracingStream::Drain(const CaptureSink &sink)
+{
+	bool worked = inner->Drain([this, &sink](const CapturePacket &packet) {
+		if (writer.IsOpen()) {
+			uint64_t arrival = CaptureClockNs();
+			if (!formatWritten ||
+			    packet.formatSerial != formatSerial) {
+				formatWritten = true;
+				formatSerial = packet.formatSerial;
+				writer.Format(arrival, formatSerial,
+					      *packet.format);
+			}
+			writer.Packet(arrival, packet);
+		}
+
+		sink(packet);
+	});
+
+	uint64_t dropped = inner->DroppedFrames();
+	uint64_t overrun = inner->Overruns();
+	if (dropped != droppedFrames || overrun != overruns) {
+		droppedFrames = dropped;
+		overruns = overrun;
+		writer.Counters(CaptureClockNs(), dropped, overrun);
+	}
+
+	return worked;
+}
+#pragma endregion
+
+#pragma region Replay
+class TraceStream : public CaptureStream {
+	std::shared_ptr<const std::vector<uint8_t>> trace;
+	CaptureTraceReader reader;
+	std::shared_ptr<LocalWaker> waker;
+	double speed;
+
+	uint64_t start;
+	uint64_t traceStart;
+
+	CaptureTraceEntry next = {};
+	bool pending = false;
+	AudioRingFormatInfo format = {};
+	uint32_t formatSerial = 0;
+	uint64_t droppedFrames = 0;
+	uint64_t overruns = 0;
+
+	// Packets captured before recording started stay that far before
+	uint64_t Rebase(uint64_t time) const
+	{
+		return time >= traceStart ? start + (time - traceStart)
+					  : start - (traceStart - time);
+	}
+
+public:
+	TraceStream(std::shared_ptr<const std::vector<uint8_t>> trace,
+		    double speed);
+
+	std::shared_ptr<CaptureWaker> Waker() const override { return waker; }
+	bool Drain(const CaptureSink &sink) override;
+	uint64_t DroppedFrames() const override { return droppedFrames; }
+	uint64_t Overruns() const override { return overruns; }
+};
+
+TraceStream::TraceStream(std::shared_ptr<const std::vector<uint8_t>> trace,
+			 double speed)
+	: trace(std::move(trace)),
+	  waker(std::make_shared<LocalWaker>()),
+	  speed(speed)
+{
+	reader.Attach(this->trace->data(), this->trace->size());
+	start = CaptureClockNs();
+	traceStart = reader.Header().startNs;
+}
+
+bool TraceStream::Drain(const CaptureSink &sink)
+{
+	uint64_t limit = UINT64_MAX;
+	if (speed > 0.0)
+		limit = traceStart +
+			static_cast<uint64_t>((CaptureClockNs() - start) *
+					      speed);
+
+	uint32_t packets = 0;
+	while (packets < TRACE_DRAIN_PACKETS) {
+		if (!pending && !reader.Next(next))
+			return packets != 0;
+
+		pending = next.arrival > limit;
+		if (pending)
+			return packets != 0;
+
+		switch (next.type) {
+		case CaptureTraceType::FORMAT: {
+			const CaptureTraceFormat *record =
+				reinterpret_cast<const CaptureTraceFormat *>(
+					next.payload);
+			format = record->format;
+			formatSerial = record->formatSerial;
+			break;
+		}
+
+		case CaptureTraceType::PACKET: {
+			const CaptureTracePacket *record =
+				reinterpret_cast<const CaptureTracePacket *>(
+					next.payload);
+			CapturePacket packet;
+			packet.data = next.payload + sizeof(*record);
+			packet.size = next.size - sizeof(*record);
+			packet.frames = record->frames;
+			packet.timestamp = Rebase(record->timestamp);
+			packet.formatSerial = record->formatSerial;
+			packet.format = &format;
+			sink(packet);
+			packets++;
+			break;
+		}
+
+		case CaptureTraceType::COUNTERS: {
+			const CaptureTraceCounters *record =
+				reinterpret_cast<const CaptureTraceCounters *>(
+					next.payload);
+			droppedFrames = record->droppedFrames;
+			overruns = record->overruns;
+			break;
+		}
+		}
+	}
+
+	// More is due already, come straight back for it
+	waker->Signal();
+	return true;
+}
+
+TraceBackend::TraceBackend(const std::vector<std::string> &paths,
+			   double speed)
+	: speed(speed)
+{
+	std::shared_ptr<SessionSnapshot> sessions =
+		std::make_shared<SessionSnapshot>();
+	sessions->generation = 1;
+
+	for (const std::string &path : paths) {
+		std::shared_ptr<std::vector<uint8_t>> data =
+			std::make_shared<std::vector<uint8_t>>();
+		CaptureTraceReader reader;
+		if (!LoadCaptureTrace(path, *data) ||
+		    !reader.Attach(data->data(), data->size()))
+			continue;
+
+		const CaptureTraceHeader &header = reader.Header();
+		size_t index = traces.size();
+
+		SessionRecord record;
+		record.exe = std::string(
+			header.exe, std::find(header.exe,
+					      header.exe + sizeof(header.exe),
+					      '\0'));
+		record.sessionName = path;
+		record.sessionId = TRACE_SESSION_PREFIX + std::to_string(index);
+		record.instanceId = record.sessionId;
+		record.deviceName = "Capture Traces";
+		record.deviceId = TRACE_DEVICE_ID;
+		record.processId = header.processId
+					   ? header.processId
+					   : static_cast<uint32_t>(index + 1);
+		sessions->sessions.push_back(record);
+
+		traces.push_back(data);
+	}
+
+	snapshot = sessions;
+}
+
+std::unique_ptr<CaptureStream>
+TraceBackend::Attach(const SessionRecord &session)
+{
+	for (size_t i = 0; i < traces.size(); i++) {
+		if (snapshot->sessions[i].instanceId == session.instanceId &&
+		    session.deviceId == TRACE_DEVICE_ID)
+			return std::unique_ptr<CaptureStream>(
+				new TraceStream(traces[i], speed));
+	}
+
+	return nullptr;
+}
+
+bool ReplayCaptureTrace(CaptureTraceReader &reader, uint32_t outMask,
+			uint32_t outRate, ResamplerQuality quality,
+			TraceReplayStats &stats,
+			const std::function<void(const CaptureOutput &)> &sink)
+{
+	CapturePipeline pipeline;
+	FramePool pool;
+	AudioRingFormatInfo format = {};
+	CaptureTraceEntry entry;
+
+	reader.Rewind();
+	while (reader.Next(entry)) {
+		if (entry.type == CaptureTraceType::FORMAT) {
+			format = reinterpret_cast<const CaptureTraceFormat *>(
+					 entry.payload)
+					 ->format;
+			if (pipeline.Configure(format, outMask, outRate,
+					       quality) &&
+			    pool.Channels() != pipeline.OutputChannels())
+				pool.Configure(pipeline.OutputChannels(),
+					       outRate);
+			stats.formatChanges++;
+			continue;
+		}
+
+		if (entry.type != CaptureTraceType::PACKET)
+			continue;
+
+		const CaptureTracePacket *record =
+			reinterpret_cast<const CaptureTracePacket *>(
+				entry.payload);
+		CapturePacket packet;
+		packet.data = entry.payload + sizeof(*record);
+		packet.size = entry.size - sizeof(*record);
+		packet.frames = record->frames;
+		packet.timestamp = record->timestamp;
+		packet.formatSerial = record->formatSerial;
+		packet.format = &format;
+
+		uint64_t begin = CaptureClockNs();
+		CaptureOutput output;
+		bool produced = pipeline.Process(packet, pool, output);
+		stats.processingNs += CaptureClockNs() - begin;
+
+		stats.packets++;
+		stats.frames += packet.frames;
+		if (!produced)
+			continue;
+
+		stats.outputFrames += output.frames;
+		if (sink)
+			sink(output);
+		pool.Release(output.buffer);
+	}
+
+	return stats.outputFrames != 0;
+}
+#pragma endregion
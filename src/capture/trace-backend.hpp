@@ -0,0 +1,114 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "capture-backend.hpp"
+#include "capture-pipeline.hpp"
+#include "capture-trace.hpp"
+
+/* Records everything another stream hands out while passing it on
+ * untouched. Recording stops for good at the first failed write, the
+ * capture itself carries on. */
+class TracingStream : public CaptureStream {
+	std::unique_ptr<CaptureStream> inner;
+	CaptureTraceWriter writer;
+
+	bool formatWritten = false;
+	uint32_t formatSerial = 0;
+	uint64_t droppedFrames = 0;
+	uint64_t overruns = 0;
+
+public:
+	// Takes over `file` like CaptureTraceWriter::Open()
+	TracingStream(std::unique_ptr<CaptureStream> inner, FILE *file,
+		      const SessionRecord &session);
+
+	bool Recording() const { return writer.IsOpen(); }
+	uint64_t Bytes() const { return writer.Bytes(); }
+
+	std::shared_ptr<CaptureWaker> Waker() const override
+	{
+		return inner->Waker();
+	}
+
+	bool Drain(const CaptureSink &sink) override;
+
+	uint64_t DroppedFrames() const override
+	{
+		return inner->DroppedFrames();
+	}
+
+	uint64_t Overruns() const override { return inner->Overruns(); }
+
+	void SetBatching(uint32_t packetUs, uint32_t deadlineUs) override
+	{
+		inner->SetBatching(packetUs, deadlineUs);
+	}
+};
+
+/* Plays recorded traces back as sessions on device "trace" with ids
+ * "trace-<index>", in the order given. Files that aren't traces are left
+ * out. Timestamps keep their spacing but start from when the stream was
+ * attached, so consumers see them as current. At `speed` 1 packets come
+ * out when they originally arrived, 0 replays as fast as the consumer
+ * drains. */
+class TraceBackend : public CaptureBackend {
+	std::vector<std::shared_ptr<const std::vector<uint8_t>>> traces;
+	std::shared_ptr<const SessionSnapshot> snapshot;
+	double speed;
+
+public:
+	explicit TraceBackend(const std::vector<std::string> &paths,
+			      double speed = 0.0);
+
+	const char *Name() const override { return "trace"; }
+
+	std::shared_ptr<const SessionSnapshot> Sessions() override
+	{
+		return snapshot;
+	}
+
+	std::unique_ptr<CaptureStream>
+	Attach(const SessionRecord &session) override;
+};
+
+struct TraceReplayStats {
+	uint64_t packets = 0;
+	uint64_t frames = 0;
+	uint64_t outputFrames = 0;
+	uint64_t formatChanges = 0;
+	// Spent in the pipeline, not counting the sink
+	uint64_t processingNs = 0;
+};
+
+/* Runs a whole trace through a pipeline set up the way a source would set
+ * it up, on the calling thread and as fast as it goes. Deterministic, so
+ * the output is the same on every run and every machine with the same
+ * SIMD level. Returns false if no packet could be processed. */
+bool ReplayCaptureTrace(CaptureTraceReader &reader, uint32_t outMask,
+			uint32_t outRate, ResamplerQuality quality,
+			TraceReplayStats &stats,
+			const std::function<void(const CaptureOutput &)> &sink =
+				nullptr);
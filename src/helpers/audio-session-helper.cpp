@@ -111,6 +111,7 @@ static std::vector<AudioSessionInfo> GetAudioSessionsInternal()
 			ComPtr<IAudioSessionControl> session1;
 			CoTaskMemPtr<WCHAR> wSessionName;
 			CoTaskMemPtr<WCHAR> wSessionId;
+			CoTaskMemPtr<WCHAR> wInstanceId;
 			DWORD processId;
 			AudioSessionInfo info;
 
@@ -132,12 +133,18 @@ static std::vector<AudioSessionInfo> GetAudioSessionsInternal()
 			if (FAILED(hr))
 				continue;
 
+			hr = session2->GetSessionInstanceIdentifier(
+				&wInstanceId);
+			if (FAILED(hr))
+				continue;
+
 			hr = session2->GetProcessId(&processId);
 			if (FAILED(hr))
 				continue;
 
 			info.sessionName = StringFromLPWSTR(wSessionName);
 			info.sessionId = StringFromLPWSTR(wSessionId);
+			info.instanceId = StringFromLPWSTR(wInstanceId);
 			info.deviceName = deviceName;
 			info.deviceId = deviceId;
 			info.processId = processId;
@@ -30,6 +30,7 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 struct AudioSessionInfo {
 	std::string sessionName;
 	std::string sessionId;
+	std::string instanceId;
 
 	std::string deviceName;
 	std::string deviceId;
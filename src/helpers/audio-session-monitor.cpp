@@ -0,0 +1,670 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "audio-session-monitor.hpp"
+
+#include "audio-session-helper.hpp"
+
+#include <util/base.h>
+#include <util/windows/ComPtr.hpp>
+#include <util/windows/CoTaskMemPtr.hpp>
+#include <util/windows/WinHandle.hpp>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "plugin-macros.hpp"
+#include "windows-helper.hpp"
+
+class AudioSessionMonitor;
+
+struct MonitorEvent {
+	enum Type {
+		DEVICE_ADDED,
+		DEVICE_REMOVED,
+		DEVICE_RENAMED,
+		SESSION_CREATED,
+		SESSION_EXPIRED,
+	} type;
+
+	std::string deviceId;
+	std::string instanceId;
+	ComPtr<IAudioSessionControl> session;
+};
+
+#pragma region Notification Sinks
+// Just enough IUnknown to hand out as a callback
+template<class Interface> class NotificationSink : public Interface {
+	std::atomic<ULONG> refs{1};
+
+public:
+	virtual ~NotificationSink() = default;
+
+	ULONG STDMETHODCALLTYPE AddRef() override { return ++refs; }
+
+	ULONG STDMETHODCALLTYPE Release() override
+	{
+		ULONG count = --refs;
+		if (!count)
+			delete this;
+		return count;
+	}
+
+	HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid,
+						 void **ppv) override
+	{
+		if (riid == __uuidof(IUnknown) || riid == __uuidof(Interface)) {
+			*ppv = static_cast<Interface *>(this);
+			AddRef();
+			return S_OK;
+		}
+
+		*ppv = nullptr;
+		return E_NOINTERFACE;
+	}
+};
+
+/* These all run on whatever thread WASAPI feels like, and aren't allowed
+ * to block or call back into it. They only queue work for the monitor. */
+class DeviceNotifier : public NotificationSink<IMMNotificationClient> {
+	AudioSessionMonitor *monitor;
+
+public:
+	DeviceNotifier(AudioSessionMonitor *monitor) : monitor(monitor) {}
+
+	HRESULT STDMETHODCALLTYPE OnDeviceStateChanged(LPCWSTR id,
+						       DWORD state) override;
+	HRESULT STDMETHODCALLTYPE OnDeviceAdded(LPCWSTR id) override;
+	HRESULT STDMETHODCALLTYPE OnDeviceRemoved(LPCWSTR id) override;
+	HRESULT STDMETHODCALLTYPE OnDefaultDeviceChanged(EDataFlow, ERole,
+							 LPCWSTR) override
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE
+	OnPropertyValueChanged(LPCWSTR id, const PROPERTYKEY key) override;
+};
+
+class SessionNotifier : public NotificationSink<IAudioSessionNotification> {
+	AudioSessionMonitor *monitor;
+	std::string deviceId;
+
+public:
+	SessionNotifier(AudioSessionMonitor *monitor, std::string deviceId)
+		: monitor(monitor), deviceId(std::move(deviceId))
+	{
+	}
+
+	HRESULT STDMETHODCALLTYPE
+	OnSessionCreated(IAudioSessionControl *session) override;
+};
+
+class SessionEvents : public NotificationSink<IAudioSessionEvents> {
+	AudioSessionMonitor *monitor;
+	std::string deviceId;
+	std::string instanceId;
+
+	void Expired();
+
+public:
+	SessionEvents(AudioSessionMonitor *monitor, std::string deviceId,
+		      std::string instanceId)
+		: monitor(monitor),
+		  deviceId(std::move(deviceId)),
+		  instanceId(std::move(instanceId))
+	{
+	}
+
+	HRESULT STDMETHODCALLTYPE OnDisplayNameChanged(LPCWSTR,
+						       LPCGUID) override
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnIconPathChanged(LPCWSTR, LPCGUID) override
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnSimpleVolumeChanged(float, BOOL,
+							LPCGUID) override
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnChannelVolumeChanged(DWORD, float *, DWORD,
+							 LPCGUID) override
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE OnGroupingParamChanged(LPCGUID,
+							 LPCGUID) override
+	{
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE
+	OnStateChanged(AudioSessionState state) override
+	{
+		if (state == AudioSessionStateExpired)
+			Expired();
+		return S_OK;
+	}
+	HRESULT STDMETHODCALLTYPE
+	OnSessionDisconnected(AudioSessionDisconnectReason) override
+	{
+		Expired();
+		return S_OK;
+	}
+};
+#pragma endregion
+
+#pragma region Monitor
+class AudioSessionMonitor {
+	struct DeviceEntry {
+		ComPtr<IAudioSessionManager2> manager;
+		ComPtr<SessionNotifier> notifier;
+	};
+
+	struct SessionEntry {
+		ComPtr<IAudioSessionControl> control;
+		ComPtr<SessionEvents> events;
+	};
+
+	// Device id and instance id
+	typedef std::pair<std::string, std::string> SessionKey;
+
+	SessionRegistry &registry;
+
+	std::thread thread;
+	WinHandle wake;
+	std::atomic<bool> stopping{false};
+
+	std::mutex queueMutex;
+	std::vector<MonitorEvent> queue;
+
+	// Everything below is only touched on the monitor thread
+	ComPtr<IMMDeviceEnumerator> enumerator;
+	ComPtr<DeviceNotifier> deviceNotifier;
+	std::map<std::string, DeviceEntry> devices;
+	std::map<SessionKey, SessionEntry> sessions;
+
+	void Run();
+	void FullScan();
+	void Shutdown();
+	void Process(MonitorEvent &event);
+
+	bool AddDevice(IMMDevice *device, std::vector<SessionRecord> *scan);
+	void DropDevice(const std::string &deviceId);
+	bool AddSession(const std::string &deviceId, IAudioSessionControl *control,
+			SessionRecord &record);
+	void DropSession(const std::string &deviceId,
+			 const std::string &instanceId);
+
+public:
+	AudioSessionMonitor(SessionRegistry &registry);
+	~AudioSessionMonitor();
+
+	void Post(MonitorEvent event);
+};
+
+AudioSessionMonitor::AudioSessionMonitor(SessionRegistry &registry)
+	: registry(registry)
+{
+	wake = CreateEventW(nullptr, false, false, nullptr);
+	thread = std::thread(&AudioSessionMonitor::Run, this);
+}
+
+AudioSessionMonitor::~AudioSessionMonitor()
+{
+	stopping = true;
+	SetEvent(wake);
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+void AudioSessionMonitor::Post(MonitorEvent event)
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queue.push_back(std::move(event));
+	}
+	SetEvent(wake);
+}
+
+void AudioSessionMonitor::Run()
+{
+	HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	if (FAILED(hr)) {
+		bwarn("Session monitor failed to initialize COM: %lX", hr);
+		return;
+	}
+
+	FullScan();
+
+	std::vector<MonitorEvent> events;
+	while (!stopping) {
+		WaitForSingleObject(wake, INFINITE);
+
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			events.swap(queue);
+		}
+
+		for (auto &event : events) {
+			if (stopping)
+				break;
+			Process(event);
+		}
+		events.clear();
+	}
+
+	Shutdown();
+	CoUninitialize();
+}
+
+void AudioSessionMonitor::FullScan()
+{
+	ComPtr<IMMDeviceCollection> collection;
+	std::vector<SessionRecord> scan;
+	UINT count = 0;
+	HRESULT hr;
+
+	hr = CoCreateInstance(__uuidof(MMDeviceEnumerator), nullptr,
+			      CLSCTX_ALL, IID_PPV_ARGS(&enumerator));
+	if (FAILED(hr)) {
+		bwarn("Session monitor failed to create enumerator: %lX", hr);
+		registry.Reset(scan);
+		return;
+	}
+
+	*deviceNotifier.Assign() = new DeviceNotifier(this);
+	hr = enumerator->RegisterEndpointNotificationCallback(deviceNotifier);
+	if (FAILED(hr)) {
+		bwarn("Failed to register for device notifications: %lX", hr);
+	}
+
+	hr = enumerator->EnumAudioEndpoints(eRender, DEVICE_STATE_ACTIVE,
+					    &collection);
+	if (SUCCEEDED(hr)) {
+		collection->GetCount(&count);
+	}
+
+	for (UINT i = 0; i < count; i++) {
+		ComPtr<IMMDevice> device;
+		if (SUCCEEDED(collection->Item(i, &device))) {
+			AddDevice(device, &scan);
+		}
+	}
+
+	registry.Reset(scan);
+}
+
+void AudioSessionMonitor::Shutdown()
+{
+	for (auto &entry : sessions) {
+		entry.second.control->UnregisterAudioSessionNotification(
+			entry.second.events);
+	}
+	sessions.clear();
+
+	for (auto &entry : devices) {
+		entry.second.manager->UnregisterSessionNotification(
+			entry.second.notifier);
+	}
+	devices.clear();
+
+	if (enumerator && deviceNotifier) {
+		enumerator->UnregisterEndpointNotificationCallback(
+			deviceNotifier);
+	}
+	deviceNotifier.Clear();
+	enumerator.Clear();
+}
+
+/* Registers for the device's session notifications and picks up whatever
+ * sessions it already has. With `scan` they're collected for a bulk reset,
+ * otherwise they go straight into the registry. */
+bool AudioSessionMonitor::AddDevice(IMMDevice *device,
+				    std::vector<SessionRecord> *scan)
+{
+	CoTaskMemPtr<WCHAR> wDeviceId;
+	ComPtr<IAudioSessionEnumerator> enumSessions;
+	DeviceEntry entry;
+	int count = 0;
+	HRESULT hr;
+
+	hr = device->GetId(&wDeviceId);
+	if (FAILED(hr) || !wDeviceId || !*wDeviceId)
+		return false;
+
+	std::string deviceId = StringFromLPWSTR(wDeviceId);
+	if (devices.count(deviceId))
+		return true;
+
+	ComQIPtr<IMMEndpoint> endpoint(device);
+	EDataFlow flow;
+	if (!endpoint || FAILED(endpoint->GetDataFlow(&flow)) ||
+	    flow != eRender)
+		return false;
+
+	std::string deviceName = registry.DeviceName(
+		deviceId, [device]() { return GetDeviceName(device); });
+
+	hr = device->Activate(__uuidof(IAudioSessionManager2), CLSCTX_ALL,
+			      nullptr,
+			      reinterpret_cast<void **>(entry.manager.Assign()));
+	if (FAILED(hr))
+		return false;
+
+	// Notifications aren't delivered until the enumerator has been asked for
+	hr = entry.manager->GetSessionEnumerator(&enumSessions);
+	if (FAILED(hr))
+		return false;
+
+	*entry.notifier.Assign() = new SessionNotifier(this, deviceId);
+	hr = entry.manager->RegisterSessionNotification(entry.notifier);
+	if (FAILED(hr))
+		bwarn("Failed to register for session notifications: %lX", hr);
+
+	devices[deviceId] = entry;
+
+	enumSessions->GetCount(&count);
+	for (int i = 0; i < count; i++) {
+		ComPtr<IAudioSessionControl> control;
+		SessionRecord record;
+
+		if (FAILED(enumSessions->GetSession(i, &control)))
+			continue;
+
+		record.deviceId = deviceId;
+		record.deviceName = deviceName;
+		if (!AddSession(deviceId, control, record))
+			continue;
+
+		if (scan)
+			scan->push_back(record);
+		else
+			registry.AddSession(record);
+	}
+
+	return true;
+}
+
+void AudioSessionMonitor::DropDevice(const std::string &deviceId)
+{
+	for (auto it = sessions.begin(); it != sessions.end();) {
+		if (it->first.first == deviceId) {
+			it->second.control->UnregisterAudioSessionNotification(
+				it->second.events);
+			it = sessions.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	auto it = devices.find(deviceId);
+	if (it != devices.end()) {
+		it->second.manager->UnregisterSessionNotification(
+			it->second.notifier);
+		devices.erase(it);
+	}
+
+	registry.RemoveDevice(deviceId);
+}
+
+static uint64_t GetProcessCreateTime(DWORD pid)
+{
+	WinHandle process =
+		OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid);
+	FILETIME created, exited, kernel, user;
+
+	if (!process.Valid() ||
+	    !GetProcessTimes(process, &created, &exited, &kernel, &user))
+		return 0;
+
+	return (static_cast<uint64_t>(created.dwHighDateTime) << 32) |
+	       created.dwLowDateTime;
+}
+
+// Fills in the session half of `record` and starts watching for its expiry
+bool AudioSessionMonitor::AddSession(const std::string &deviceId,
+				     IAudioSessionControl *control,
+				     SessionRecord &record)
+{
+	CoTaskMemPtr<WCHAR> wSessionName;
+	CoTaskMemPtr<WCHAR> wSessionId;
+	CoTaskMemPtr<WCHAR> wInstanceId;
+	AudioSessionState state;
+	DWORD processId;
+
+	ComQIPtr<IAudioSessionControl2> control2(control);
+	if (!control2 || control2->IsSystemSoundsSession() == S_OK)
+		return false;
+
+	if (FAILED(control2->GetState(&state)) ||
+	    state == AudioSessionStateExpired)
+		return false;
+
+	if (FAILED(control2->GetDisplayName(&wSessionName)) ||
+	    FAILED(control2->GetSessionIdentifier(&wSessionId)) ||
+	    FAILED(control2->GetSessionInstanceIdentifier(&wInstanceId)) ||
+	    FAILED(control2->GetProcessId(&processId)))
+		return false;
+
+	record.sessionName = StringFromLPWSTR(wSessionName);
+	record.sessionId = StringFromLPWSTR(wSessionId);
+	record.instanceId = StringFromLPWSTR(wInstanceId);
+	record.processId = processId;
+	record.processCreateTime = GetProcessCreateTime(processId);
+	record.exe = registry.ExeName(
+		processId, record.processCreateTime,
+		[processId]() { return GetProcessExeName(processId); });
+
+	SessionKey key(deviceId, record.instanceId);
+	if (!sessions.count(key)) {
+		SessionEntry entry;
+		entry.control = control;
+		*entry.events.Assign() =
+			new SessionEvents(this, deviceId, record.instanceId);
+		control->RegisterAudioSessionNotification(entry.events);
+		sessions[key] = entry;
+	}
+
+	return true;
+}
+
+void AudioSessionMonitor::DropSession(const std::string &deviceId,
+				      const std::string &instanceId)
+{
+	auto it = sessions.find(SessionKey(deviceId, instanceId));
+	if (it != sessions.end()) {
+		it->second.control->UnregisterAudioSessionNotification(
+			it->second.events);
+		sessions.erase(it);
+	}
+
+	registry.RemoveSession(instanceId, deviceId);
+}
+
+void AudioSessionMonitor::Process(MonitorEvent &event)
+{
+	switch (event.type) {
+	case MonitorEvent::DEVICE_ADDED: {
+		ComPtr<IMMDevice> device;
+		std::wstring id(event.deviceId.begin(), event.deviceId.end());
+		if (enumerator &&
+		    SUCCEEDED(enumerator->GetDevice(id.c_str(), &device)))
+			AddDevice(device, nullptr);
+		break;
+	}
+	case MonitorEvent::DEVICE_REMOVED:
+		DropDevice(event.deviceId);
+		break;
+	case MonitorEvent::DEVICE_RENAMED: {
+		ComPtr<IMMDevice> device;
+		std::wstring id(event.deviceId.begin(), event.deviceId.end());
+		if (enumerator &&
+		    SUCCEEDED(enumerator->GetDevice(id.c_str(), &device)))
+			registry.RenameDevice(event.deviceId,
+					      GetDeviceName(device));
+		break;
+	}
+	case MonitorEvent::SESSION_CREATED: {
+		SessionRecord record;
+		record.deviceId = event.deviceId;
+		record.deviceName = registry.DeviceName(
+			event.deviceId, [this, &event]() {
+				ComPtr<IMMDevice> device;
+				std::wstring id(event.deviceId.begin(),
+						event.deviceId.end());
+				if (!enumerator ||
+				    FAILED(enumerator->GetDevice(id.c_str(),
+								 &device)))
+					return std::string();
+				return GetDeviceName(device);
+			});
+		if (AddSession(event.deviceId, event.session, record))
+			registry.AddSession(record);
+		break;
+	}
+	case MonitorEvent::SESSION_EXPIRED:
+		DropSession(event.deviceId, event.instanceId);
+		break;
+	}
+}
+#pragma endregion
+
+#pragma region Sink Implementations
+// Device ids are plain ASCII, so no need for the full UTF-8 dance
+static std::string DeviceIdString(LPCWSTR id)
+{
+	std::string result;
+	for (; id && *id; id++)
+		result.push_back(static_cast<char>(*id));
+	return result;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceNotifier::OnDeviceStateChanged(LPCWSTR id,
+							       DWORD state)
+{
+	MonitorEvent event;
+	event.type = state == DEVICE_STATE_ACTIVE ? MonitorEvent::DEVICE_ADDED
+						  : MonitorEvent::DEVICE_REMOVED;
+	event.deviceId = DeviceIdString(id);
+	monitor->Post(std::move(event));
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceNotifier::OnDeviceAdded(LPCWSTR id)
+{
+	MonitorEvent event;
+	event.type = MonitorEvent::DEVICE_ADDED;
+	event.deviceId = DeviceIdString(id);
+	monitor->Post(std::move(event));
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE DeviceNotifier::OnDeviceRemoved(LPCWSTR id)
+{
+	MonitorEvent event;
+	event.type = MonitorEvent::DEVICE_REMOVED;
+	event.deviceId = DeviceIdString(id);
+	monitor->Post(std::move(event));
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE
+DeviceNotifier::OnPropertyValueChanged(LPCWSTR id, const PROPERTYKEY key)
+{
+	if (key.fmtid == PKEY_Device_FriendlyName.fmtid &&
+	    key.pid == PKEY_Device_FriendlyName.pid) {
+		MonitorEvent event;
+		event.type = MonitorEvent::DEVICE_RENAMED;
+		event.deviceId = DeviceIdString(id);
+		monitor->Post(std::move(event));
+	}
+	return S_OK;
+}
+
+HRESULT STDMETHODCALLTYPE
+SessionNotifier::OnSessionCreated(IAudioSessionControl *session)
+{
+	MonitorEvent event;
+	event.type = MonitorEvent::SESSION_CREATED;
+	event.deviceId = deviceId;
+	event.session = session;
+	monitor->Post(std::move(event));
+	return S_OK;
+}
+
+void SessionEvents::Expired()
+{
+	MonitorEvent event;
+	event.type = MonitorEvent::SESSION_EXPIRED;
+	event.deviceId = deviceId;
+	event.instanceId = instanceId;
+	monitor->Post(std::move(event));
+}
+#pragma endregion
+
+static SessionRegistry registry;
+static std::unique_ptr<AudioSessionMonitor> monitor;
+
+void StartAudioSessionMonitor()
+{
+	if (!monitor) {
+		monitor.reset(new AudioSessionMonitor(registry));
+	}
+}
+
+void StopAudioSessionMonitor()
+{
+	monitor.reset();
+}
+
+SessionRegistry &GetSessionRegistry()
+{
+	return registry;
+}
+
+std::shared_ptr<const SessionSnapshot> GetAudioSessionSnapshot()
+{
+	std::shared_ptr<const SessionSnapshot> snapshot = registry.Snapshot();
+	if (snapshot->generation) {
+		return snapshot;
+	}
+
+	std::shared_ptr<SessionSnapshot> scan =
+		std::make_shared<SessionSnapshot>();
+	for (const auto &info : GetAudioSessions()) {
+		SessionRecord record;
+		record.sessionName = info.sessionName;
+		record.sessionId = info.sessionId;
+		record.instanceId = info.instanceId;
+		record.deviceName = info.deviceName;
+		record.deviceId = info.deviceId;
+		record.processId = info.processId;
+		record.exe = info.exe;
+		scan->sessions.push_back(record);
+	}
+
+	return scan;
+}
@@ -0,0 +1,34 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <memory>
+
+#include "capture/session-registry.hpp"
+
+/* Keeps the plugin-wide SessionRegistry current from WASAPI device and
+ * session notifications, so nothing has to enumerate on demand anymore. */
+void StartAudioSessionMonitor();
+void StopAudioSessionMonitor();
+
+SessionRegistry &GetSessionRegistry();
+
+/* Cheap, never blocks on COM. Falls back to a one-off synchronous scan if
+ * called before the monitor has finished its first one. */
+std::shared_ptr<const SessionSnapshot> GetAudioSessionSnapshot();
@@ -0,0 +1,44 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "shared-memory.hpp"
+
+// Creates the mapping if it doesn't exist yet, otherwise opens the existing one
+SharedMemory::SharedMemory(const wchar_t *name, size_t size) : size(size)
+{
+	ULARGE_INTEGER mappingSize;
+	mappingSize.QuadPart = size;
+
+	mapping = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr,
+				     PAGE_READWRITE, mappingSize.HighPart,
+				     mappingSize.LowPart, name);
+	if (!mapping.Valid()) {
+		throw GetLastError();
+	}
+
+	view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	if (!view) {
+		throw GetLastError();
+	}
+}
+
+SharedMemory::~SharedMemory()
+{
+	if (view) {
+		UnmapViewOfFile(view);
+	}
+}
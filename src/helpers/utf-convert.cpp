@@ -0,0 +1,181 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#include "utf-convert.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#ifdef AUDIO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Units converted on the stack before falling back to the heap
+#define STACK_UNITS 256
+
+#pragma region Scalar
+/* Encodes whatever starts at src[i], which isn't ASCII, and moves `i` past
+ * it. Returns the bytes written. */
+static size_t EncodeCodePoint(const char16_t *src, size_t length, size_t &i,
+			      char *out)
+{
+	uint32_t unit = src[i++];
+
+	if (unit < 0x800) {
+		out[0] = static_cast<char>(0xC0 | (unit >> 6));
+		out[1] = static_cast<char>(0x80 | (unit & 0x3F));
+		return 2;
+	}
+
+	if (unit >= 0xD800 && unit <= 0xDFFF) {
+		uint32_t low = i < length ? src[i] : 0;
+		if (unit <= 0xDBFF && low >= 0xDC00 && low <= 0xDFFF) {
+			i++;
+			uint32_t code = 0x10000 + ((unit - 0xD800) << 10) +
+					(low - 0xDC00);
+			out[0] = static_cast<char>(0xF0 | (code >> 18));
+			out[1] = static_cast<char>(0x80 |
+						   ((code >> 12) & 0x3F));
+			out[2] = static_cast<char>(0x80 |
+						   ((code >> 6) & 0x3F));
+			out[3] = static_cast<char>(0x80 | (code & 0x3F));
+			return 4;
+		}
+		unit = 0xFFFD;
+	}
+
+	out[0] = static_cast<char>(0xE0 | (unit >> 12));
+	out[1] = static_cast<char>(0x80 | ((unit >> 6) & 0x3F));
+	out[2] = static_cast<char>(0x80 | (unit & 0x3F));
+	return 3;
+}
+
+/* Up to `end`, though a surrogate pair may take it one unit past. Returns
+ * where it stopped. */
+static size_t ConvertScalar(const char16_t *src, size_t length, size_t i,
+			    size_t end, char *&out)
+{
+	while (i < end) {
+		if (src[i] < 0x80)
+			*out++ = static_cast<char>(src[i++]);
+		else
+			out += EncodeCodePoint(src, length, i, out);
+	}
+	return i;
+}
+
+static size_t Utf16ToUtf8Scalar(const char16_t *src, size_t length,
+				char *dst)
+{
+	char *out = dst;
+	ConvertScalar(src, length, 0, length, out);
+	return out - dst;
+}
+#pragma endregion
+
+#ifdef AUDIO_SIMD_X86
+#pragma region SSE2
+/* 16 ASCII units a step, narrowed with a saturating pack. Anything else
+ * goes through the scalar path a vector's worth at a time before the fast
+ * path gets another go, so mostly non-ASCII text doesn't pay for a vector
+ * check on every unit. */
+static size_t Utf16ToUtf8SSE2(const char16_t *src, size_t length, char *dst)
+{
+	const __m128i high = _mm_set1_epi16(static_cast<short>(0xFF80));
+	const __m128i zero = _mm_setzero_si128();
+	char *out = dst;
+	size_t i = 0;
+
+	while (i < length) {
+		for (; i + 16 <= length; i += 16, out += 16) {
+			__m128i a = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(src + i));
+			__m128i b = _mm_loadu_si128(
+				reinterpret_cast<const __m128i *>(src + i + 8));
+			__m128i wide = _mm_and_si128(_mm_or_si128(a, b), high);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(wide, zero)) !=
+			    0xFFFF)
+				break;
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+					 _mm_packus_epi16(a, b));
+		}
+
+		size_t end = i + 16 < length ? i + 16 : length;
+		i = ConvertScalar(src, length, i, end, out);
+	}
+
+	return out - dst;
+}
+#pragma endregion
+
+#pragma region AVX2
+AUDIO_TARGET_AVX2
+static size_t Utf16ToUtf8AVX2(const char16_t *src, size_t length, char *dst)
+{
+	const __m256i high = _mm256_set1_epi16(static_cast<short>(0xFF80));
+	char *out = dst;
+	size_t i = 0;
+
+	while (i < length) {
+		for (; i + 32 <= length; i += 32, out += 32) {
+			__m256i a = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i *>(src + i));
+			__m256i b = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i *>(src + i +
+								  16));
+			if (!_mm256_testz_si256(_mm256_or_si256(a, b), high))
+				break;
+			// Packs per lane, so the halves need putting in order
+			__m256i packed = _mm256_permute4x64_epi64(
+				_mm256_packus_epi16(a, b), 0xD8);
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(out),
+					    packed);
+		}
+
+		size_t end = i + 32 < length ? i + 32 : length;
+		i = ConvertScalar(src, length, i, end, out);
+	}
+
+	return out - dst;
+}
+#pragma endregion
+#endif
+
+Utf16ToUtf8Func GetUtf16ToUtf8(SimdLevel level)
+{
+#ifdef AUDIO_SIMD_X86
+	if (level == SimdLevel::AVX2)
+		return Utf16ToUtf8AVX2;
+	if (level == SimdLevel::SSE2)
+		return Utf16ToUtf8SSE2;
+#else
+	(void)level;
+#endif
+	return Utf16ToUtf8Scalar;
+}
+
+std::string Utf16ToUtf8(const char16_t *src, size_t length)
+{
+	if (length <= STACK_UNITS) {
+		char buffer[UTF8_MAX_BYTES(STACK_UNITS)];
+		return std::string(buffer, Utf16ToUtf8(src, length, buffer));
+	}
+
+	std::vector<char> buffer(UTF8_MAX_BYTES(length));
+	return std::string(buffer.data(),
+			   Utf16ToUtf8(src, length, buffer.data()));
+}
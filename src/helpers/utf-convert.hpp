@@ -0,0 +1,46 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "audio/cpu-features.hpp"
+
+// Room a destination needs for `units` of UTF-16, however they decode
+#define UTF8_MAX_BYTES(units) ((units) * 3)
+
+/* Single-pass UTF-16 to UTF-8, no terminator, returning the bytes written.
+ * `dst` needs UTF8_MAX_BYTES(length). Unpaired surrogates come out as
+ * U+FFFD, the same as WideCharToMultiByte leaves them. Almost every name
+ * and id WASAPI hands out is ASCII, which is the part that's vectorized. */
+typedef size_t (*Utf16ToUtf8Func)(const char16_t *src, size_t length,
+				  char *dst);
+
+Utf16ToUtf8Func GetUtf16ToUtf8(SimdLevel level);
+
+static inline size_t Utf16ToUtf8(const char16_t *src, size_t length,
+				 char *dst)
+{
+	static const Utf16ToUtf8Func convert = GetUtf16ToUtf8(GetSimdLevel());
+	return convert(src, length, dst);
+}
+
+/* Converts on the stack for anything name-sized, so the string returned
+ * is the only allocation */
+std::string Utf16ToUtf8(const char16_t *src, size_t length);
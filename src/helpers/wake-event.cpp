@@ -0,0 +1,68 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "wake-event.hpp"
+
+WakeEvent::WakeEvent(const wchar_t *name)
+{
+	event = CreateEventW(nullptr, false, false, name);
+	if (!event.Valid()) {
+		throw GetLastError();
+	}
+}
+
+WakeEvent::~WakeEvent()
+{
+	SetListener(nullptr);
+}
+
+VOID CALLBACK WakeEvent::Fired(PVOID context, BOOLEAN timedOut)
+{
+	(void)timedOut;
+
+	// Only ever changed once this callback can't be running
+	static_cast<WakeEvent *>(context)->listener();
+}
+
+void WakeEvent::SetListener(std::function<void()> listener)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Blocks until a callback that's already running has returned
+	if (wait) {
+		UnregisterWaitEx(wait, INVALID_HANDLE_VALUE);
+		wait = nullptr;
+	}
+
+	this->listener = std::move(listener);
+	if (!this->listener) {
+		return;
+	}
+
+	// The wait consumes the auto-reset, same as a thread waking on it
+	if (!RegisterWaitForSingleObject(&wait, event, Fired, this, INFINITE,
+					 WT_EXECUTEINWAITTHREAD)) {
+		// Left to the worker's interval to notice
+		wait = nullptr;
+	}
+}
+
+void WakeEvent::Signal()
+{
+	SetEvent(event);
+}
@@ -0,0 +1,50 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include <util/windows/WinHandle.hpp>
+
+#include <functional>
+#include <mutex>
+
+#include "capture/capture-worker.hpp"
+
+/* Named auto-reset event the hook sets after committing to the ring. The
+ * listener is called from the system's wait threads, which take up to 63
+ * events each, so a pool draining dozens of sessions doesn't need a thread
+ * blocked on every one of them. */
+class WakeEvent : public CaptureWaker {
+	WinHandle event;
+
+	std::mutex mutex;
+	HANDLE wait = nullptr;
+	std::function<void()> listener;
+
+	static VOID CALLBACK Fired(PVOID context, BOOLEAN timedOut);
+
+public:
+	WakeEvent(const wchar_t *name);
+	~WakeEvent();
+
+	void SetListener(std::function<void()> listener) override;
+	void Signal() override;
+};
@@ -0,0 +1,196 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "wake-eventfd.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <set>
+#include <thread>
+
+/* Waits on every watched eventfd at once. A waker is only called while
+ * it's in `live`, which its destructor leaves under the same mutex, so an
+ * event already returned by epoll_wait can't reach one that's gone. */
+class WakeEventFd::Watcher {
+	int epoll = -1;
+	int stop = -1;
+	std::thread thread;
+
+	std::mutex mutex;
+	std::set<WakeEventFd *> live;
+
+	void Run();
+
+public:
+	Watcher();
+	~Watcher();
+
+	void Insert(WakeEventFd *waker);
+	void Erase(WakeEventFd *waker);
+
+	bool Watch(int fd, WakeEventFd *waker);
+	void Unwatch(int fd);
+
+	// Shared by every waker, it goes away with the last one
+	static std::shared_ptr<Watcher> Get();
+};
+
+WakeEventFd::Watcher::Watcher()
+{
+	epoll = epoll_create1(EPOLL_CLOEXEC);
+	stop = eventfd(0, EFD_CLOEXEC);
+	if (epoll < 0 || stop < 0)
+		throw errno;
+
+	// A null waker tells the thread to go
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.ptr = nullptr;
+	if (epoll_ctl(epoll, EPOLL_CTL_ADD, stop, &event) < 0)
+		throw errno;
+
+	thread = std::thread(&Watcher::Run, this);
+}
+
+WakeEventFd::Watcher::~Watcher()
+{
+	uint64_t one = 1;
+	ssize_t written = write(stop, &one, sizeof(one));
+	(void)written;
+
+	thread.join();
+	close(stop);
+	close(epoll);
+}
+
+void WakeEventFd::Watcher::Run()
+{
+	epoll_event events[64];
+
+	for (;;) {
+		int count = epoll_wait(epoll, events, 64, -1);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int i = 0; i < count; i++) {
+			WakeEventFd *waker =
+				static_cast<WakeEventFd *>(events[i].data.ptr);
+			if (!waker)
+				return;
+			if (live.count(waker))
+				waker->Fired();
+		}
+	}
+}
+
+void WakeEventFd::Watcher::Insert(WakeEventFd *waker)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	live.insert(waker);
+}
+
+// Blocks until a callback that's already running has returned
+void WakeEventFd::Watcher::Erase(WakeEventFd *waker)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	live.erase(waker);
+}
+
+bool WakeEventFd::Watcher::Watch(int fd, WakeEventFd *waker)
+{
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.ptr = waker;
+	return epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == 0;
+}
+
+void WakeEventFd::Watcher::Unwatch(int fd)
+{
+	epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+std::shared_ptr<WakeEventFd::Watcher> WakeEventFd::Watcher::Get()
+{
+	static std::mutex mutex;
+	static std::weak_ptr<Watcher> shared;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<Watcher> watcher = shared.lock();
+	if (!watcher) {
+		watcher = std::make_shared<Watcher>();
+		shared = watcher;
+	}
+	return watcher;
+}
+
+WakeEventFd::WakeEventFd() : watcher(Watcher::Get())
+{
+	fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (fd < 0)
+		throw errno;
+
+	watcher->Insert(this);
+}
+
+WakeEventFd::~WakeEventFd()
+{
+	SetListener(nullptr);
+	watcher->Erase(this);
+	close(fd);
+}
+
+void WakeEventFd::Fired()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// The read resets it, same as a thread waking on an auto-reset event
+	uint64_t count;
+	if (!listener || read(fd, &count, sizeof(count)) != sizeof(count))
+		return;
+
+	listener();
+}
+
+void WakeEventFd::SetListener(std::function<void()> listener)
+{
+	// Held while Fired() runs, so the old listener is done with
+	std::lock_guard<std::mutex> lock(mutex);
+
+	this->listener = std::move(listener);
+	if (this->listener && !watching) {
+		// Left to the worker's interval to notice if this fails
+		watching = watcher->Watch(fd, this);
+	} else if (!this->listener && watching) {
+		watcher->Unwatch(fd);
+		watching = false;
+	}
+}
+
+void WakeEventFd::Signal()
+{
+	uint64_t one = 1;
+	ssize_t written = write(fd, &one, sizeof(one));
+	(void)written;
+}
@@ -0,0 +1,56 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "capture/capture-worker.hpp"
+
+/* WakeEvent's counterpart off Windows: an eventfd the producer writes to,
+ * inherited by a forked producer the way the hook opens the named event.
+ * Listeners are called from one epoll thread shared by every waker, so as
+ * on Windows a pool draining dozens of sessions doesn't need a thread
+ * blocked on each of them. */
+class WakeEventFd : public CaptureWaker {
+	class Watcher;
+
+	std::shared_ptr<Watcher> watcher;
+	int fd = -1;
+
+	std::mutex mutex;
+	bool watching = false;
+	std::function<void()> listener;
+
+	void Fired();
+
+public:
+	WakeEventFd();
+	~WakeEventFd();
+
+	WakeEventFd(const WakeEventFd &) = delete;
+	WakeEventFd &operator=(const WakeEventFd &) = delete;
+
+	// A producer signals by writing a nonzero uint64_t to it
+	int Descriptor() const { return fd; }
+
+	void SetListener(std::function<void()> listener) override;
+	void Signal() override;
+};
@@ -17,27 +17,23 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 */
 
 #include "windows-helper.hpp"
+#include "utf-convert.hpp"
 
+#include <util/bmem.h>
 #include <util/platform.h>
 #include <util/windows/WinHandle.hpp>
 
 #include <psapi.h>
 
+#include <cstdio>
 #include <string>
+#include <vector>
 
-// Borrowed from win-wasapi (enum-wasapi.cpp), in function form
+// WCHAR is UTF-16 on Windows, so it goes straight through
 std::string StringFromLPWSTR(LPWSTR str)
 {
-	std::string result;
-	size_t len_src = wcslen(str);
-	size_t len_dest = os_wcs_to_utf8(str, len_src, nullptr, 0) + 1;
-	result.resize(len_dest);
-	os_wcs_to_utf8(str, len_src, &result[0], len_dest);
-
-	// Need to remove the null-terminator that was improperly copied
-	result.resize(len_dest - 1);
-
-	return result;
+	return Utf16ToUtf8(reinterpret_cast<const char16_t *>(str),
+			   wcslen(str));
 }
 
 std::string GetProcessExeName(DWORD pid)
@@ -56,4 +52,89 @@ std::string GetProcessExeName(DWORD pid)
 	}
 
 	return name;
-}
\ No newline at end of file
+}
+
+bool GetProcessIs32Bit(DWORD pid, bool &is32bit)
+{
+	WinHandle process =
+		OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid);
+	BOOL wow64 = false;
+
+	if (!process.Valid() || !IsWow64Process(process, &wow64)) {
+		return false;
+	}
+
+#ifdef _WIN64
+	is32bit = wow64 != 0;
+#else
+	// On 32-bit Windows nothing is WOW64, and everything is 32-bit
+	BOOL selfWow64 = false;
+	IsWow64Process(GetCurrentProcess(), &selfWow64);
+	is32bit = wow64 || !selfWow64;
+#endif
+
+	return true;
+}
+
+std::string GetSystemModulePath(const wchar_t *module, bool is32bit)
+{
+	WCHAR dir[MAX_PATH];
+	UINT len;
+
+#ifdef _WIN64
+	len = is32bit ? GetSystemWow64DirectoryW(dir, MAX_PATH)
+		      : GetSystemDirectoryW(dir, MAX_PATH);
+#else
+	// A 32-bit process has to go through Sysnative to see the real thing
+	if (is32bit) {
+		len = GetSystemDirectoryW(dir, MAX_PATH);
+	} else {
+		len = GetWindowsDirectoryW(dir, MAX_PATH);
+		if (len && len < MAX_PATH) {
+			wcscat_s(dir, L"\\Sysnative");
+			len = static_cast<UINT>(wcslen(dir));
+		}
+	}
+#endif
+
+	if (!len || len >= MAX_PATH) {
+		return std::string();
+	}
+
+	std::wstring path = std::wstring(dir) + L"\\" + module;
+	return StringFromLPWSTR(&path[0]);
+}
+
+std::string GetFileVersion(const std::string &path)
+{
+	std::string version;
+	wchar_t *wpath = nullptr;
+	os_utf8_to_wcs_ptr(path.c_str(), 0, &wpath);
+	if (!wpath) {
+		return version;
+	}
+
+	DWORD size = GetFileVersionInfoSizeW(wpath, nullptr);
+	if (size) {
+		std::vector<BYTE> data(size);
+		VS_FIXEDFILEINFO *info = nullptr;
+		UINT infoLen = 0;
+
+		if (GetFileVersionInfoW(wpath, 0, size, data.data()) &&
+		    VerQueryValueW(data.data(), L"\\",
+				   reinterpret_cast<void **>(&info),
+				   &infoLen) &&
+		    info) {
+			char buffer[64];
+			snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u",
+				 HIWORD(info->dwFileVersionMS),
+				 LOWORD(info->dwFileVersionMS),
+				 HIWORD(info->dwFileVersionLS),
+				 LOWORD(info->dwFileVersionLS));
+			version = buffer;
+		}
+	}
+
+	bfree(wpath);
+	return version;
+}
@@ -25,4 +25,13 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 std::string StringFromLPWSTR(LPWSTR str);
 
-std::string GetProcessExeName(DWORD pid);
\ No newline at end of file
+std::string GetProcessExeName(DWORD pid);
+
+// Path to a DLL in the system directory for the given bitness
+std::string GetSystemModulePath(const wchar_t *module, bool is32bit);
+
+// False if the process can't be queried
+bool GetProcessIs32Bit(DWORD pid, bool &is32bit);
+
+// "major.minor.build.revision", empty if there's no version resource
+std::string GetFileVersion(const std::string &path);
\ No newline at end of file
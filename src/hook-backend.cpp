@@ -0,0 +1,311 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "hook-backend.hpp"
+
+#include <util/platform.h>
+#include <util/util_uint64.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "capture/attach-scheduler.hpp"
+#include "capture/ring-stream.hpp"
+#include "capture/shared-capture.hpp"
+#include "helpers/audio-session-monitor.hpp"
+#include "helpers/shared-memory.hpp"
+#include "helpers/wake-event.hpp"
+#include "helpers/windows-helper.hpp"
+#include "plugin-macros.hpp"
+
+// Hook timestamps are raw QPC values, os_gettime_ns() is QPC based too
+static uint64_t QpcToNs(uint64_t ticks)
+{
+	static LARGE_INTEGER frequency = {};
+	if (!frequency.QuadPart) {
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	return util_mul_div64(ticks, 1000000000ULL,
+			      static_cast<uint64_t>(frequency.QuadPart));
+}
+
+#pragma region Scheduler
+
+/* The one thread every hook attempt in the plugin goes through. It sleeps
+ * until the scheduler's next due time, or until something new turns up. */
+class HookScheduler {
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool kicked = false;
+	bool stopping = false;
+	std::thread thread;
+
+	void Run();
+
+public:
+	AttachScheduler scheduler;
+
+	HookScheduler();
+	~HookScheduler();
+
+	void Kick();
+};
+
+HookScheduler::HookScheduler()
+{
+	scheduler.SetNotify([this]() { Kick(); });
+	thread = std::thread(&HookScheduler::Run, this);
+}
+
+HookScheduler::~HookScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	cv.notify_one();
+	thread.join();
+
+	AttachSchedulerStats stats = scheduler.Stats();
+	const LatencyHistogram &latency = scheduler.AttachLatency();
+	binfo("Hook attempts: %llu, attached %llu, retried %llu, gave up on "
+	      "%llu, held back %llu times; attached after p50 %.1f ms, "
+	      "max %.1f ms",
+	      static_cast<unsigned long long>(stats.attempts),
+	      static_cast<unsigned long long>(stats.attached),
+	      static_cast<unsigned long long>(stats.retries),
+	      static_cast<unsigned long long>(stats.givenUp),
+	      static_cast<unsigned long long>(stats.deferred),
+	      latency.Percentile(50) / 1000000.0, latency.Max() / 1000000.0);
+}
+
+void HookScheduler::Kick()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		kicked = true;
+	}
+	cv.notify_one();
+}
+
+void HookScheduler::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopping) {
+		kicked = false;
+
+		lock.unlock();
+		uint64_t next = scheduler.RunDue();
+		lock.lock();
+
+		if (kicked || stopping) {
+			continue;
+		}
+
+		if (next) {
+			// Same clock the scheduler runs on
+			cv.wait_until(lock,
+				      std::chrono::steady_clock::time_point() +
+					      std::chrono::nanoseconds(next));
+		} else {
+			cv.wait(lock);
+		}
+	}
+}
+
+static std::mutex hookSchedulerMutex;
+static std::shared_ptr<HookScheduler> hookScheduler;
+
+static std::shared_ptr<HookScheduler> GetHookScheduler()
+{
+	std::lock_guard<std::mutex> lock(hookSchedulerMutex);
+	return hookScheduler;
+}
+
+void StartHookScheduler()
+{
+	std::lock_guard<std::mutex> lock(hookSchedulerMutex);
+	if (!hookScheduler) {
+		hookScheduler = std::make_shared<HookScheduler>();
+	}
+}
+
+// Streams still holding on keep it alive, this only drops the plugin's hold
+void StopHookScheduler()
+{
+	std::shared_ptr<HookScheduler> scheduler;
+	{
+		std::lock_guard<std::mutex> lock(hookSchedulerMutex);
+		scheduler.swap(hookScheduler);
+	}
+}
+
+void SetHookOffsets(bool is32Bit, const AudioRenderClientOffsets &offsets)
+{
+	std::shared_ptr<HookScheduler> scheduler = GetHookScheduler();
+	if (scheduler) {
+		scheduler->scheduler.SetOffsets(is32Bit, offsets);
+	}
+}
+
+#pragma endregion
+
+class HookStream : public RingCaptureStream {
+	uint32_t processId;
+	std::unique_ptr<SharedMemory> memory;
+
+	std::shared_ptr<HookScheduler> scheduler;
+	uint64_t attempt = 0;
+
+	AttachResult AttachOffsets(const AudioRenderClientOffsets &offsets,
+				   bool is32Bit);
+
+protected:
+	uint64_t Timestamp(const AudioRingView &packet) override;
+
+public:
+	// Throws DWORD
+	explicit HookStream(uint32_t processId);
+	~HookStream() override;
+};
+
+HookStream::HookStream(uint32_t processId) : processId(processId)
+{
+	std::wstring name = AUDIO_RING_NAME + std::to_wstring(processId);
+	memory.reset(new SharedMemory(
+		name.c_str(), AudioRingRegionSize(AUDIO_RING_CAPACITY)));
+
+	AudioRingHeader *header =
+		static_cast<AudioRingHeader *>(memory->Data());
+
+	// The hook may have gotten here first, in which case keep its state
+	if (!AudioRingValid(header)) {
+		AudioRingInitialize(header, AUDIO_RING_CAPACITY);
+	}
+
+	std::wstring eventName =
+		AUDIO_RING_EVENT_NAME + std::to_wstring(processId);
+	waker = std::make_shared<WakeEvent>(eventName.c_str());
+
+	ring.Attach(header);
+
+	/* Attaching never blocks on the target or on preinit. The scheduler
+	 * works out the target's bitness and hands the hook its offsets
+	 * through the ring once that side has them. */
+	scheduler = GetHookScheduler();
+	if (!scheduler) {
+		return;
+	}
+
+	uint32_t pid = processId;
+	AttachTarget target;
+	target.probe = [pid](bool &is32Bit) {
+		return GetProcessIs32Bit(pid, is32Bit);
+	};
+	target.attach = [this](const AudioRenderClientOffsets &offsets,
+			       bool is32Bit) {
+		return AttachOffsets(offsets, is32Bit);
+	};
+	target.failed = [pid]() {
+		bwarn("Gave up attaching to %lu",
+		      static_cast<unsigned long>(pid));
+	};
+	attempt = scheduler->scheduler.Submit(std::move(target));
+}
+
+HookStream::~HookStream()
+{
+	// Nothing may touch the ring after this
+	if (scheduler) {
+		scheduler->scheduler.Cancel(attempt);
+	}
+
+	// The mapping has to outlive the detach
+	ring.Detach();
+}
+
+// Runs on the scheduler's thread
+AttachResult HookStream::AttachOffsets(const AudioRenderClientOffsets &offsets,
+				       bool is32Bit)
+{
+	AudioRingHeader *header = ring.Header();
+	header->offsets = offsets;
+	header->offsetsReady.store(1, std::memory_order_release);
+
+	binfo("Attached to %lu (%s-bit)", static_cast<unsigned long>(processId),
+	      is32Bit ? "32" : "64");
+	return AttachResult::ATTACHED;
+}
+
+uint64_t HookStream::Timestamp(const AudioRingView &packet)
+{
+	if (packet.timestamp) {
+		return QpcToNs(packet.timestamp);
+	}
+
+	// A format with no rate is garbage, but don't divide by it
+	uint32_t rate = packet.format->samplesPerSec;
+	if (!rate) {
+		return os_gettime_ns();
+	}
+
+	return os_gettime_ns() -
+	       util_mul_div64(packet.frames, 1000000000ULL, rate);
+}
+
+std::shared_ptr<const SessionSnapshot> HookBackend::Sessions()
+{
+	return GetAudioSessionSnapshot();
+}
+
+uint64_t HookBackend::Subscribe(SessionListener listener)
+{
+	return GetSessionRegistry().Subscribe(std::move(listener));
+}
+
+void HookBackend::Unsubscribe(uint64_t id)
+{
+	GetSessionRegistry().Unsubscribe(id);
+}
+
+std::unique_ptr<CaptureStream>
+HookBackend::Attach(const SessionRecord &session)
+{
+	try {
+		return std::unique_ptr<CaptureStream>(
+			new HookStream(session.processId));
+	} catch (DWORD errorCode) {
+		bwarn("Failed to attach to %lu: %lu",
+		      static_cast<unsigned long>(session.processId), errorCode);
+		return nullptr;
+	}
+}
+
+/* Every source capturing a session shares the one hook and ring, which
+ * only have a single consumer side anyway */
+std::shared_ptr<CaptureBackend> GetHookBackend()
+{
+	static std::shared_ptr<CaptureBackend> backend =
+		std::make_shared<SharedCaptureBackend>(
+			std::make_shared<HookBackend>());
+	return backend;
+}
@@ -0,0 +1,44 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <memory>
+
+#include "capture/capture-backend.hpp"
+
+/* The real thing: sessions come from the WASAPI session monitor and audio
+ * from the ring the hook fills inside the target process. */
+class HookBackend : public CaptureBackend {
+public:
+	const char *Name() const override { return "wasapi-hook"; }
+
+	std::shared_ptr<const SessionSnapshot> Sessions() override;
+	uint64_t Subscribe(SessionListener listener) override;
+	void Unsubscribe(uint64_t id) override;
+	std::unique_ptr<CaptureStream>
+	Attach(const SessionRecord &session) override;
+};
+
+std::shared_ptr<CaptureBackend> GetHookBackend();
+
+/* Every hook attempt goes through one plugin-wide scheduler, which has to
+ * be running before any source attaches. Preinit feeds it the offsets. */
+void StartHookScheduler();
+void StopHookScheduler();
+void SetHookOffsets(bool is32Bit, const AudioRenderClientOffsets &offsets);
@@ -0,0 +1,106 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#include "offsets-config.hpp"
+
+#include <util/config-file.h>
+#include <util/platform.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+static const char *Section(bool is32bit)
+{
+	return is32bit ? "AudioSes32" : "AudioSes64";
+}
+
+uint64_t HashFile(const char *path)
+{
+	FILE *file = os_fopen(path, "rb");
+	if (!file)
+		return 0;
+
+	uint64_t hash = FNV_OFFSET_BASIS;
+	uint8_t buffer[16384];
+	size_t read;
+
+	while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		for (size_t i = 0; i < read; i++) {
+			hash ^= buffer[i];
+			hash *= FNV_PRIME;
+		}
+	}
+
+	fclose(file);
+	return hash;
+}
+
+ConfigOffsetsStore::ConfigOffsetsStore(const char *path) : path(path) {}
+
+bool ConfigOffsetsStore::Read(bool is32bit, CachedOffsets &entry)
+{
+	const char *section = Section(is32bit);
+	config_t *config;
+
+	if (config_open(&config, path.c_str(), CONFIG_OPEN_EXISTING) !=
+	    CONFIG_SUCCESS)
+		return false;
+
+	const char *version = config_get_string(config, section, "version");
+	const char *hash = config_get_string(config, section, "hash");
+	bool found = version && hash;
+
+	if (found) {
+		entry.identity.version = version;
+		entry.identity.hash = strtoull(hash, nullptr, 16);
+		entry.offsets.getBuffer = static_cast<uint32_t>(
+			config_get_uint(config, section, "getBuffer"));
+		entry.offsets.releaseBuffer = static_cast<uint32_t>(
+			config_get_uint(config, section, "releaseBuffer"));
+	}
+
+	config_close(config);
+	return found;
+}
+
+void ConfigOffsetsStore::Write(bool is32bit, const CachedOffsets &entry)
+{
+	const char *section = Section(is32bit);
+	config_t *config;
+
+	if (config_open(&config, path.c_str(), CONFIG_OPEN_ALWAYS) !=
+	    CONFIG_SUCCESS)
+		return;
+
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016" PRIx64, entry.identity.hash);
+
+	config_set_string(config, section, "version",
+			  entry.identity.version.c_str());
+	config_set_string(config, section, "hash", hash);
+	config_set_uint(config, section, "getBuffer", entry.offsets.getBuffer);
+	config_set_uint(config, section, "releaseBuffer",
+			entry.offsets.releaseBuffer);
+
+	config_save_safe(config, "tmp", nullptr);
+	config_close(config);
+}
@@ -0,0 +1,38 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <string>
+
+#include "capture/offsets-cache.hpp"
+
+/* Keeps the offsets cache in an ini file in the module's config directory,
+ * a section per bitness */
+class ConfigOffsetsStore : public OffsetsStore {
+	std::string path;
+
+public:
+	explicit ConfigOffsetsStore(const char *path);
+
+	bool Read(bool is32bit, CachedOffsets &entry) override;
+	void Write(bool is32bit, const CachedOffsets &entry) override;
+};
+
+// FNV-1a over the whole file, zero if it can't be read
+uint64_t HashFile(const char *path);
@@ -21,6 +21,8 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include "plugin-macros.hpp""
 #include "preinit.hpp"
 #include "audio-capture.hpp"
+#include "hook-backend.hpp"
+#include "helpers/audio-session-monitor.hpp"
 
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
@@ -31,7 +33,9 @@ MODULE_EXPORT const char *obs_module_description(void)
 
 bool obs_module_load(void)
 {
+	StartHookScheduler();
 	Preinitialize();
+	StartAudioSessionMonitor();
 	RegisterAudioCaptureSource();
 	binfo("plugin loaded successfully (version %s)", PLUGIN_VERSION);
 	return true;
@@ -39,6 +43,8 @@ bool obs_module_load(void)
 
 void obs_module_unload()
 {
+	StopAudioSessionMonitor();
 	WaitForPreinitialization();
+	StopHookScheduler();
 	binfo("plugin unloaded");
 }
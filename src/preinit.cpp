@@ -23,18 +23,34 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 #include <obs-module.h>
 #include <util/config-file.h>
-#include <util/windows/WinHandle.hpp>
+#include <util/platform.h>
 
+#include <future>
+#include <memory>
 #include <string>
+#include <system_error>
 
 #include "plugin-macros.hpp"
-#include "audio-capture.hpp"
 #include "audio-hook/audio-hook-info.hpp"
+#include "hook-backend.hpp"
+#include "offsets-config.hpp"
 #include "helpers/process-pipe.hpp"
+#include "helpers/windows-helper.hpp"
 
-static WinHandle preinitThread;
+static ModuleIdentity IdentifyAudioSes(bool is32bit)
+{
+	ModuleIdentity identity;
+	std::string path = GetSystemModulePath(L"audioses.dll", is32bit);
+
+	if (!path.empty()) {
+		identity.version = GetFileVersion(path);
+		identity.hash = HashFile(path.c_str());
+	}
 
-static AudioRenderClientOffsets LoadOffsets(bool is32bit)
+	return identity;
+}
+
+static AudioRenderClientOffsets ResolveOffsets(bool is32bit)
 {
 	AudioRenderClientOffsets offsets = {};
 
@@ -79,34 +95,75 @@ end:
 	return offsets;
 }
 
-static DWORD PreinitThread(LPVOID)
+/* Spawning the helpers means bringing up COM and a whole WASAPI client, so
+ * only do it when audioses.dll has changed since the last time */
+static AudioRenderClientOffsets LoadOffsets(OffsetsCache &cache, bool is32bit)
+{
+	AudioRenderClientOffsets offsets = {};
+	uint64_t start = os_gettime_ns();
+
+	if (cache.Load(is32bit, offsets)) {
+		binfo("Using cached %s-bit offsets", is32bit ? "32" : "64");
+		return offsets;
+	}
+
+	offsets = ResolveOffsets(is32bit);
+	cache.Save(is32bit, offsets);
+
+	binfo("Resolved %s-bit offsets in %.1f ms", is32bit ? "32" : "64",
+	      (os_gettime_ns() - start) / 1000000.0);
+	return offsets;
+}
+
+static std::unique_ptr<OffsetsCache> cache;
+static std::shared_future<AudioRenderClientOffsets> offsets32;
+static std::shared_future<AudioRenderClientOffsets> offsets64;
+
+static AudioRenderClientOffsets PreinitTask(bool is32bit)
 {
-	AudioCaptureSource::offsets32 = LoadOffsets(true);
-	AudioCaptureSource::offsets64 = LoadOffsets(false);
-	return 0;
+	AudioRenderClientOffsets offsets = LoadOffsets(*cache, is32bit);
+	SetHookOffsets(is32bit, offsets);
+	return offsets;
 }
 
+/* Both bitnesses resolve at the same time on their own threads. Nothing
+ * waits on them here; each is handed to the hook scheduler when ready. */
 void Preinitialize()
 {
-	if (!preinitThread.Valid()) {
-		preinitThread = CreateThread(nullptr, 0, PreinitThread, nullptr,
-					     0, nullptr);
+	if (offsets32.valid()) {
+		return;
+	}
 
-		if (!preinitThread.Valid()) {
-			bwarn("Failed to Preinitialize: %lu", GetLastError());
-		}
+	char *dir = obs_module_config_path("");
+	char *path = obs_module_config_path("offsets.ini");
+	if (dir) {
+		os_mkdirs(dir);
+	}
+
+	cache.reset(new OffsetsCache(
+		std::unique_ptr<OffsetsStore>(
+			new ConfigOffsetsStore(path ? path : "")),
+		IdentifyAudioSes));
+
+	bfree(dir);
+	bfree(path);
+
+	try {
+		offsets32 = std::async(std::launch::async, PreinitTask, true)
+				    .share();
+		offsets64 = std::async(std::launch::async, PreinitTask, false)
+				    .share();
+	} catch (std::system_error &error) {
+		bwarn("Failed to Preinitialize: %s", error.what());
 	}
 }
 
 void WaitForPreinitialization()
 {
-	static bool initialized = false;
-
-	if (!initialized) {
-		if (preinitThread.Valid()) {
-			WaitForSingleObject(preinitThread, INFINITE);
-			preinitThread = nullptr;
-		}
-		initialized = true;
+	if (offsets32.valid()) {
+		offsets32.wait();
+	}
+	if (offsets64.valid()) {
+		offsets64.wait();
 	}
 }
\ No newline at end of file
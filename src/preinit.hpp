@@ -19,4 +19,5 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #pragma once
 
 void Preinitialize();
+// Only for shutdown, the offsets reach hooks through SetHookOffsets
 void WaitForPreinitialization();
\ No newline at end of file
@@ -0,0 +1,322 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* The attach scheduler on a clock that only moves when told to: backoff
+ * and its cap, the shared budget, giving up, and cancelling a target that
+ * is queued or in the middle of a callback. */
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "capture/attach-scheduler.hpp"
+#include "test-helpers.hpp"
+
+#define MS 1000000ULL
+
+static const AudioRenderClientOffsets offsets64 = {0x3333, 0x4444};
+
+// Records when each callback ran, by the scheduler's clock
+struct FakeTarget {
+	const uint64_t *clock;
+	// Probes fail until this many have been made, attaches return `result`
+	uint32_t failProbes = 0;
+	AttachResult result = AttachResult::ATTACHED;
+
+	std::vector<uint64_t> probes;
+	std::vector<uint64_t> attaches;
+	int failed = 0;
+
+	explicit FakeTarget(const uint64_t *clock) : clock(clock) {}
+
+	AttachTarget Target()
+	{
+		AttachTarget target;
+		target.probe = [this](bool &is32Bit) {
+			probes.push_back(*clock);
+			is32Bit = false;
+			return probes.size() > failProbes;
+		};
+		target.attach = [this](const AudioRenderClientOffsets &offsets,
+				       bool) {
+			TEST_CHECK(offsets.getBuffer == offsets64.getBuffer);
+			attaches.push_back(*clock);
+			return result;
+		};
+		target.failed = [this]() { failed++; };
+		return target;
+	}
+};
+
+static std::unique_ptr<AttachScheduler> MakeScheduler(uint64_t &now,
+						      uint32_t perSecond,
+						      uint32_t maxAttempts)
+{
+	AttachSchedulerConfig config;
+	config.attemptsPerSecond = perSecond;
+	config.backoffNs = 10 * MS;
+	config.maxBackoffNs = 80 * MS;
+	config.maxAttempts = maxAttempts;
+
+	std::unique_ptr<AttachScheduler> scheduler(
+		new AttachScheduler(config, [&now]() { return now; }));
+	scheduler->SetOffsets(false, offsets64);
+	return scheduler;
+}
+
+// Runs everything due, jumping the clock to each time asked for
+static void RunAll(AttachScheduler &scheduler, uint64_t &now, int limit)
+{
+	for (int i = 0; i < limit; i++) {
+		uint64_t next = scheduler.RunDue();
+		if (!next)
+			return;
+		TEST_CHECK(next > now);
+		now = next;
+	}
+}
+
+static void TestBackoff()
+{
+	uint64_t now = 0;
+	std::unique_ptr<AttachScheduler> scheduler =
+		MakeScheduler(now, 1000, 0);
+
+	FakeTarget target(&now);
+	target.failProbes = 7;
+	scheduler->Submit(target.Target());
+	RunAll(*scheduler, now, 20);
+
+	// Doubling from 10 ms until it's held at 80 ms
+	std::vector<uint64_t> expected = {0,       10 * MS,  30 * MS,
+					  70 * MS, 150 * MS, 230 * MS,
+					  310 * MS, 390 * MS};
+	TEST_CHECK(target.probes == expected);
+	TEST_CHECK(target.attaches == std::vector<uint64_t>({390 * MS}));
+	TEST_CHECK(target.failed == 0);
+
+	AttachSchedulerStats stats = scheduler->Stats();
+	TEST_CHECK(stats.attempts == 8);
+	TEST_CHECK(stats.retries == 7);
+	TEST_CHECK(stats.attached == 1);
+	TEST_CHECK(stats.deferred == 0);
+	TEST_CHECK(scheduler->Pending() == 0);
+}
+
+static void TestBudget()
+{
+	uint64_t now = 0;
+	std::unique_ptr<AttachScheduler> scheduler = MakeScheduler(now, 2, 0);
+
+	std::vector<std::unique_ptr<FakeTarget>> targets;
+	for (int i = 0; i < 5; i++) {
+		targets.emplace_back(new FakeTarget(&now));
+		scheduler->Submit(targets.back()->Target());
+	}
+
+	// A second's worth up front, then the rest wait on the budget
+	uint64_t next = scheduler->RunDue();
+	TEST_CHECK(targets[0]->attaches.size() == 1);
+	TEST_CHECK(targets[1]->attaches.size() == 1);
+	TEST_CHECK(targets[2]->probes.empty());
+	TEST_CHECK(next == 500 * MS + 1);
+	TEST_CHECK(scheduler->Stats().deferred == 1);
+
+	// Nothing more before a whole token is back
+	now = 250 * MS;
+	TEST_CHECK(scheduler->RunDue() == 500 * MS + 1);
+	TEST_CHECK(targets[2]->probes.empty());
+
+	RunAll(*scheduler, now, 10);
+	for (int i = 0; i < 5; i++)
+		TEST_CHECK(targets[i]->attaches.size() == 1);
+	TEST_CHECK(targets[2]->attaches[0] == 500 * MS + 1);
+	TEST_CHECK(targets[3]->attaches[0] >= 1000 * MS);
+	TEST_CHECK(targets[4]->attaches[0] >= 1500 * MS);
+	TEST_CHECK(targets[4]->attaches[0] < 1500 * MS + 10);
+
+	AttachSchedulerStats stats = scheduler->Stats();
+	TEST_CHECK(stats.attempts == 5);
+	// At 0, twice at 250 ms, then after each of the next two attaches
+	TEST_CHECK(stats.deferred == 5);
+
+	// Idle time refills up to a second's worth and no further
+	now += 10000 * MS;
+	for (int i = 0; i < 3; i++) {
+		targets.emplace_back(new FakeTarget(&now));
+		scheduler->Submit(targets.back()->Target());
+	}
+	TEST_CHECK(scheduler->RunDue() == now + 500 * MS + 1);
+	TEST_CHECK(targets[7]->probes.empty());
+}
+
+static void TestGiveUp()
+{
+	uint64_t now = 0;
+	std::unique_ptr<AttachScheduler> scheduler =
+		MakeScheduler(now, 1000, 3);
+
+	// Failed probes and attaches that ask to retry both count
+	FakeTarget probing(&now);
+	probing.failProbes = 100;
+	FakeTarget retrying(&now);
+	retrying.result = AttachResult::RETRY;
+	FakeTarget refused(&now);
+	refused.result = AttachResult::GIVE_UP;
+
+	scheduler->Submit(probing.Target());
+	scheduler->Submit(retrying.Target());
+	scheduler->Submit(refused.Target());
+	RunAll(*scheduler, now, 20);
+
+	TEST_CHECK(probing.probes.size() == 3);
+	TEST_CHECK(probing.attaches.empty());
+	TEST_CHECK(retrying.probes.size() == 1);
+	TEST_CHECK(retrying.attaches.size() == 3);
+	TEST_CHECK(refused.attaches.size() == 1);
+	TEST_CHECK(probing.failed == 1);
+	TEST_CHECK(retrying.failed == 1);
+	TEST_CHECK(refused.failed == 1);
+
+	AttachSchedulerStats stats = scheduler->Stats();
+	TEST_CHECK(stats.givenUp == 3);
+	TEST_CHECK(stats.retries == 4);
+	TEST_CHECK(stats.attached == 0);
+	TEST_CHECK(scheduler->Pending() == 0);
+}
+
+static void TestCancelQueued()
+{
+	uint64_t now = 0;
+	std::unique_ptr<AttachScheduler> scheduler =
+		MakeScheduler(now, 1000, 0);
+
+	// Before its first attempt
+	FakeTarget fresh(&now);
+	scheduler->Cancel(scheduler->Submit(fresh.Target()));
+	TEST_CHECK(scheduler->RunDue() == 0);
+	TEST_CHECK(fresh.probes.empty());
+
+	// Waiting out a backoff
+	FakeTarget backing(&now);
+	backing.failProbes = 100;
+	uint64_t id = scheduler->Submit(backing.Target());
+	TEST_CHECK(scheduler->RunDue() == 10 * MS);
+	scheduler->Cancel(id);
+	TEST_CHECK(scheduler->Pending() == 0);
+	now = 10 * MS;
+	TEST_CHECK(scheduler->RunDue() == 0);
+	TEST_CHECK(backing.probes.size() == 1);
+	TEST_CHECK(backing.failed == 0);
+
+	// Parked on offsets that haven't come in
+	AttachSchedulerConfig config;
+	AttachScheduler pending(config, [&now]() { return now; });
+	FakeTarget parked(&now);
+	id = pending.Submit(parked.Target());
+	TEST_CHECK(pending.RunDue() == 0);
+	pending.Cancel(id);
+	pending.SetOffsets(false, offsets64);
+	TEST_CHECK(pending.RunDue() == 0);
+	TEST_CHECK(parked.probes.size() == 1);
+	TEST_CHECK(parked.attaches.empty());
+
+	// Cancelling an id that's already gone is harmless
+	scheduler->Cancel(id);
+	scheduler->Cancel(12345);
+}
+
+/* Callbacks run without the lock: they can call back in, and Cancel()
+ * from elsewhere waits for one that's running */
+static void TestCancelRunning()
+{
+	uint64_t now = 0;
+	std::unique_ptr<AttachScheduler> scheduler =
+		MakeScheduler(now, 1000, 0);
+
+	std::promise<void> entered;
+	std::promise<void> release;
+	std::shared_future<void> released = release.get_future().share();
+	std::atomic<bool> returned{false};
+	int attaches = 0;
+
+	AttachTarget slow;
+	slow.probe = [&](bool &is32Bit) {
+		entered.set_value();
+		released.wait();
+		returned = true;
+		is32Bit = false;
+		return true;
+	};
+	slow.attach = [&](const AudioRenderClientOffsets &, bool) {
+		attaches++;
+		return AttachResult::ATTACHED;
+	};
+	uint64_t id = scheduler->Submit(slow);
+
+	std::thread runner([&]() { scheduler->RunDue(); });
+	entered.get_future().wait();
+
+	// Not blocked on the scheduler while the probe runs
+	TEST_CHECK(scheduler->Pending() == 1);
+	std::future<void> cancel = std::async(std::launch::async, [&]() {
+		scheduler->Cancel(id);
+		TEST_CHECK(returned);
+	});
+	TEST_CHECK(cancel.wait_for(std::chrono::milliseconds(50)) ==
+		   std::future_status::timeout);
+
+	release.set_value();
+	cancel.wait();
+	runner.join();
+	TEST_CHECK(attaches == 0);
+	TEST_CHECK(scheduler->Pending() == 0);
+
+	// A target may submit another and cancel itself from its callback
+	FakeTarget follow(&now);
+	uint64_t self = 0;
+	AttachTarget reentrant;
+	reentrant.probe = [&](bool &is32Bit) {
+		scheduler->Submit(follow.Target());
+		scheduler->Cancel(self);
+		is32Bit = false;
+		return true;
+	};
+	reentrant.attach = [&](const AudioRenderClientOffsets &, bool) {
+		attaches++;
+		return AttachResult::ATTACHED;
+	};
+	self = scheduler->Submit(reentrant);
+	TEST_CHECK(scheduler->RunDue() == 0);
+	TEST_CHECK(attaches == 0);
+	TEST_CHECK(follow.attaches.size() == 1);
+	TEST_CHECK(scheduler->Pending() == 0);
+}
+
+int main()
+{
+	TestBackoff();
+	TestBudget();
+	TestGiveUp();
+	TestCancelQueued();
+	TestCancelRunning();
+
+	return TestResult("attach-scheduler-test");
+}
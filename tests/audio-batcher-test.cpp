@@ -0,0 +1,274 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Producer side batching: chunks gathered into one packet until there's
+ * enough audio or the oldest has waited long enough, passed straight
+ * through when batching is off, and dropped like any other overrun when
+ * the ring is full. --bench counts the packets, and so the wakeups, an
+ * engine with short periods causes with and without it. */
+
+#include <vector>
+
+#include "audio-hook/audio-batcher.hpp"
+#include "test-helpers.hpp"
+
+// The clock handed to the batcher ticks in microseconds here
+#define TICKS 1000000
+// 1 ms of stereo float at 48 kHz
+#define CHUNK_FRAMES 48
+// Any producer flag, the ring only passes them along
+#define TEST_FLAG 0x2
+
+static const AudioRingFormatInfo format = {AUDIO_RING_FORMAT_FLOAT,
+					   48000,
+					   0x3,
+					   2,
+					   32,
+					   32,
+					   8,
+					   0};
+
+struct TestRing {
+	std::vector<uint64_t> region;
+	AudioRingWriter writer;
+	AudioRingReader reader;
+	AudioRingBatcher batcher;
+
+	TestRing(uint32_t capacity, uint32_t batchUs, uint32_t deadlineUs)
+		: region((AudioRingRegionSize(capacity) + 7) / 8),
+		  batcher(writer)
+	{
+		AudioRingInitialize(Header(), capacity);
+		writer.Attach(Header());
+		reader.Attach(Header());
+		writer.SetFormat(format);
+		Configure(batchUs, deadlineUs);
+	}
+
+	AudioRingHeader *Header()
+	{
+		return reinterpret_cast<AudioRingHeader *>(region.data());
+	}
+
+	void Configure(uint32_t batchUs, uint32_t deadlineUs)
+	{
+		Header()->batchUs.store(batchUs);
+		Header()->batchDeadlineUs.store(deadlineUs);
+		batcher.Configure(Header(), TICKS);
+	}
+
+	// Chunk number `n`, every sample set to n, written at n ms
+	bool Write(uint32_t n, uint32_t flags = 0)
+	{
+		float chunk[2 * CHUNK_FRAMES];
+		for (float &sample : chunk)
+			sample = static_cast<float>(n);
+		return batcher.Write(chunk, sizeof(chunk), CHUNK_FRAMES,
+				     n * 1000, n * 1000, flags);
+	}
+
+	/* Next packet should hold chunks first..first+count-1 in order,
+	 * stamped with the first one's time */
+	bool Expect(uint32_t first, uint32_t count)
+	{
+		AudioRingView view;
+		if (!reader.Peek(view))
+			return false;
+
+		bool right = view.frames == count * CHUNK_FRAMES &&
+			     view.size == count * CHUNK_FRAMES * 8 &&
+			     view.timestamp == first * 1000;
+		const float *samples =
+			reinterpret_cast<const float *>(view.data);
+		for (uint32_t i = 0; right && i < view.frames * 2; i++) {
+			uint32_t chunk = first + i / 2 / CHUNK_FRAMES;
+			right = samples[i] == static_cast<float>(chunk);
+		}
+		reader.Release();
+		return right;
+	}
+
+	bool Empty()
+	{
+		AudioRingView view;
+		return !reader.Peek(view);
+	}
+};
+
+static void TestBySize()
+{
+	// 4 ms packets, a deadline too far off to matter
+	TestRing ring(1 << 16, 4000, 100000);
+	TEST_CHECK(ring.batcher.Enabled());
+
+	for (uint32_t n = 0; n < 12; n++)
+		TEST_CHECK(ring.Write(n) == (n % 4 == 3));
+	TEST_CHECK(ring.Expect(0, 4));
+	TEST_CHECK(ring.Expect(4, 4));
+	TEST_CHECK(ring.Expect(8, 4));
+	TEST_CHECK(ring.Empty());
+
+	// A stream that stops mid-batch keeps its tail until flushed
+	TEST_CHECK(!ring.Write(12));
+	TEST_CHECK(ring.batcher.StagedFrames() == CHUNK_FRAMES);
+	TEST_CHECK(ring.Empty());
+	TEST_CHECK(ring.batcher.Flush());
+	TEST_CHECK(!ring.batcher.Flush());
+	TEST_CHECK(ring.Expect(12, 1));
+
+	// Nothing to add adds nothing
+	TEST_CHECK(!ring.batcher.Write(nullptr, 0, 0, 0, 0));
+	TEST_CHECK(ring.batcher.StagedFrames() == 0);
+}
+
+static void TestByDeadline()
+{
+	// 10 ms packets, but nothing waits longer than 2.5 ms
+	TestRing ring(1 << 16, 10000, 2500);
+
+	TEST_CHECK(!ring.Write(0));
+	TEST_CHECK(!ring.Write(1));
+	TEST_CHECK(!ring.Write(2));
+	TEST_CHECK(ring.Write(3));
+	TEST_CHECK(ring.Expect(0, 4));
+
+	// With no new audio, polling sends what's waited long enough
+	TEST_CHECK(!ring.Write(4));
+	TEST_CHECK(!ring.batcher.Poll(6499));
+	TEST_CHECK(ring.batcher.Poll(6500));
+	TEST_CHECK(!ring.batcher.Poll(7000));
+	TEST_CHECK(ring.Expect(4, 1));
+}
+
+static void TestFlags()
+{
+	TestRing ring(1 << 16, 4000, 100000);
+
+	// A change of flags starts a new packet, each keeps its own
+	TEST_CHECK(!ring.Write(0));
+	TEST_CHECK(!ring.Write(1));
+	TEST_CHECK(ring.Write(2, TEST_FLAG));
+	TEST_CHECK(ring.Write(3));
+
+	AudioRingView view;
+	TEST_CHECK(ring.Expect(0, 2));
+	TEST_CHECK(ring.reader.Peek(view));
+	TEST_CHECK(view.flags == TEST_FLAG);
+	TEST_CHECK(view.frames == CHUNK_FRAMES);
+	ring.reader.Release();
+	TEST_CHECK(ring.batcher.StagedFrames() == CHUNK_FRAMES);
+}
+
+static void TestReconfigure()
+{
+	TestRing ring(1 << 16, 0, 0);
+	TEST_CHECK(!ring.batcher.Enabled());
+
+	// Off, every chunk is its own packet
+	TEST_CHECK(ring.Write(0));
+	TEST_CHECK(ring.Write(1));
+	TEST_CHECK(ring.Expect(0, 1));
+	TEST_CHECK(ring.Expect(1, 1));
+
+	// Turned on from the plugin side, picked up on the next chunk
+	ring.Configure(2000, 100000);
+	TEST_CHECK(!ring.Write(2));
+	TEST_CHECK(ring.Write(3));
+	TEST_CHECK(ring.Expect(2, 2));
+
+	// and turned off again with a chunk staged: it goes out first
+	TEST_CHECK(!ring.Write(4));
+	ring.Configure(0, 0);
+	TEST_CHECK(ring.Write(5));
+	TEST_CHECK(ring.Expect(4, 1));
+	TEST_CHECK(ring.Expect(5, 1));
+	TEST_CHECK(ring.Empty());
+}
+
+static void TestFullRing()
+{
+	/* Each packet reserves room for two before it's cut down, so this
+	 * holds a few 4 ms packets and still has a reservation fit at the
+	 * start once it wraps */
+	TestRing ring(8192, 4000, 100000);
+	AudioRingHeader *header = ring.Header();
+
+	uint32_t n = 0;
+	while (header->overruns.load() == 0 && n < 100)
+		ring.Write(n++);
+	TEST_CHECK(header->overruns.load() == 1);
+	TEST_CHECK(header->droppedFrames.load() == CHUNK_FRAMES);
+
+	// Everything that made it in is whole and in order
+	uint32_t first = 0;
+	while (!ring.Empty()) {
+		TEST_CHECK(ring.Expect(first, 4));
+		first += 4;
+	}
+	TEST_CHECK(first > 0 && first == (n - 1) / 4 * 4);
+
+	// Drained, so the next chunk starts a packet again
+	ring.batcher.Flush();
+	TEST_CHECK(!ring.Write(n));
+	TEST_CHECK(ring.batcher.StagedFrames() == CHUNK_FRAMES);
+}
+
+static void Bench()
+{
+	// An engine with 128 frame periods, 375 a second at 48 kHz
+	const uint32_t frames = 128;
+	const uint64_t period = 1000000ULL * frames / 48000;
+	float chunk[2 * frames] = {};
+	static const uint32_t settings[][2] = {
+		{0, 0}, {5000, 10000}, {10000, 20000}, {20000, 40000}};
+
+	for (const auto &setting : settings) {
+		TestRing ring(AUDIO_RING_CAPACITY, setting[0], setting[1]);
+		uint64_t now = 0;
+		uint32_t packets = 0;
+		AudioRingView view;
+
+		double ns = TestBench(
+			[&]() {
+				if (ring.batcher.Write(chunk, sizeof(chunk),
+						       frames, now, now))
+					packets++;
+				now += period;
+				while (ring.reader.Peek(view))
+					ring.reader.Release();
+			},
+			375 * 60, 1);
+
+		printf("batch %2u ms: %u wakeups/s, %.1f ns/chunk\n",
+		       setting[0] / 1000, packets / 60, ns);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	TestBySize();
+	TestByDeadline();
+	TestFlags();
+	TestReconfigure();
+	TestFullRing();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("audio-batcher-test");
+}
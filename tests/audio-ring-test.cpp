@@ -0,0 +1,352 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* The packet ring on its own: format records queued in-band with the audio,
+ * a consumer attaching mid-stream, and a producer in another process over
+ * real shared memory, which is how the hook and the plugin use it. */
+
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "audio-hook/audio-batcher.hpp"
+#include "audio-hook/audio-ring.hpp"
+#include "test-helpers.hpp"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define TEST_CAPACITY 4096
+
+static const AudioRingFormatInfo formatA = {AUDIO_RING_FORMAT_FLOAT,
+					    48000,
+					    0x3,
+					    2,
+					    32,
+					    32,
+					    8,
+					    0};
+static const AudioRingFormatInfo formatB = {AUDIO_RING_FORMAT_PCM,
+					    44100,
+					    0x3F,
+					    6,
+					    16,
+					    16,
+					    12,
+					    0};
+
+struct TestRing {
+	std::vector<uint64_t> region;
+
+	explicit TestRing(uint32_t capacity)
+		: region((AudioRingRegionSize(capacity) + 7) / 8)
+	{
+		AudioRingInitialize(Header(), capacity);
+	}
+
+	AudioRingHeader *Header()
+	{
+		return reinterpret_cast<AudioRingHeader *>(region.data());
+	}
+};
+
+static bool SameFormat(const AudioRingFormatInfo *a,
+		       const AudioRingFormatInfo &b)
+{
+	return a && memcmp(a, &b, sizeof(b)) == 0;
+}
+
+static void TestQueuedFormatChange()
+{
+	TestRing ring(TEST_CAPACITY);
+	AudioRingWriter writer(ring.Header());
+	AudioRingReader reader(ring.Header());
+	uint32_t value;
+
+	writer.SetFormat(formatA);
+	for (value = 0; value < 3; value++)
+		TEST_CHECK(writer.Write(&value, sizeof(value), 1, value + 1));
+
+	// The old packets are still queued when the format changes
+	writer.SetFormat(formatB);
+	for (; value < 6; value++)
+		TEST_CHECK(writer.Write(&value, sizeof(value), 1, value + 1));
+
+	AudioRingView view;
+	uint32_t serials[2] = {};
+	for (uint32_t i = 0; i < 6; i++) {
+		TEST_CHECK(reader.Peek(view));
+		TEST_CHECK(view.size == sizeof(uint32_t));
+		TEST_CHECK(memcmp(view.data, &i, sizeof(i)) == 0);
+		TEST_CHECK(view.timestamp == i + 1);
+		TEST_CHECK(SameFormat(view.format, i < 3 ? formatA : formatB));
+		serials[i / 3] = view.formatSerial;
+		reader.Release();
+	}
+
+	TEST_CHECK(!reader.Peek(view));
+	TEST_CHECK(serials[0] != 0 && serials[1] != serials[0]);
+	TEST_CHECK(ring.Header()->formatSerial.load() == serials[1]);
+}
+
+static void TestLateReader()
+{
+	TestRing ring(TEST_CAPACITY);
+	AudioRingWriter writer(ring.Header());
+	AudioRingReader first(ring.Header());
+	uint32_t value = 7;
+	AudioRingView view;
+
+	writer.SetFormat(formatB);
+	TEST_CHECK(writer.Write(&value, sizeof(value), 1, 1));
+	TEST_CHECK(first.Peek(view) && SameFormat(view.format, formatB));
+	first.Release();
+	first.Detach();
+
+	// Has missed the record, so it can't make sense of this one
+	AudioRingReader second(ring.Header());
+	ring.Header()->formatRequest.store(0);
+	TEST_CHECK(writer.Write(&value, sizeof(value), 1, 2));
+	TEST_CHECK(second.Peek(view) && !view.format);
+	second.Release();
+
+	// But asking again gets it resent ahead of the next packet
+	second.Detach();
+	second.Attach(ring.Header());
+	TEST_CHECK(writer.Write(&value, sizeof(value), 1, 3));
+	TEST_CHECK(second.Peek(view) && SameFormat(view.format, formatB));
+	TEST_CHECK(view.timestamp == 3);
+	second.Release();
+	TEST_CHECK(ring.Header()->formatRequest.load() == 0);
+}
+
+static void TestFullRing()
+{
+	TestRing ring(256);
+	AudioRingWriter writer(ring.Header());
+	AudioRingReader reader(ring.Header());
+	uint8_t payload[64] = {};
+	AudioRingView view;
+
+	writer.SetFormat(formatA);
+	while (writer.Write(payload, sizeof(payload), 16, 1))
+		;
+
+	// No room for the record means no room for what comes after it
+	writer.SetFormat(formatB);
+	TEST_CHECK(!writer.Write(payload, sizeof(payload), 16, 2));
+	TEST_CHECK(ring.Header()->overruns.load() == 2);
+
+	uint32_t drained = 0;
+	while (reader.Peek(view)) {
+		TEST_CHECK(SameFormat(view.format, formatA));
+		reader.Release();
+		drained++;
+	}
+	TEST_CHECK(drained > 0);
+
+	TEST_CHECK(writer.Write(payload, sizeof(payload), 16, 3));
+	TEST_CHECK(reader.Peek(view) && SameFormat(view.format, formatB));
+	reader.Release();
+
+	// Flushing mustn't skip over a record either
+	writer.SetFormat(formatA);
+	TEST_CHECK(writer.Write(payload, sizeof(payload), 16, 4));
+	reader.Flush();
+	TEST_CHECK(writer.Write(payload, sizeof(payload), 16, 5));
+	TEST_CHECK(reader.Peek(view) && SameFormat(view.format, formatA));
+	TEST_CHECK(view.timestamp == 5);
+}
+
+static void TestBatchedFormatChange()
+{
+	TestRing ring(TEST_CAPACITY);
+	AudioRingWriter writer(ring.Header());
+	AudioRingReader reader(ring.Header());
+	AudioRingBatcher batcher(writer);
+	float chunk[2 * 48] = {};
+	AudioRingView view;
+
+	ring.Header()->batchUs.store(4000);
+	ring.Header()->batchDeadlineUs.store(10000);
+	writer.SetFormat(formatA);
+	batcher.Configure(ring.Header(), 1000000);
+	TEST_CHECK(batcher.Enabled());
+
+	// A ms in, then the switch: the staged ms has to keep its format
+	TEST_CHECK(!batcher.Write(chunk, sizeof(chunk), 48, 1, 1));
+	batcher.Flush();
+	writer.SetFormat(formatB);
+	batcher.Configure(ring.Header(), 1000000);
+	for (uint32_t i = 0; i < 4; i++)
+		batcher.Write(chunk, sizeof(chunk), 48, 2 + i, 2 + i);
+
+	TEST_CHECK(reader.Peek(view) && view.frames == 48);
+	TEST_CHECK(SameFormat(view.format, formatA));
+	reader.Release();
+	TEST_CHECK(reader.Peek(view) && view.frames == 4 * 48);
+	TEST_CHECK(SameFormat(view.format, formatB));
+	reader.Release();
+}
+
+#ifndef _WIN32
+/* Payload of every packet in the two-process runs: its sequence number and
+ * the rate it was written at, to check against the format it's read with */
+struct SequencePayload {
+	uint32_t sequence;
+	uint32_t samplesPerSec;
+	uint8_t fill[56];
+};
+
+struct SharedRun {
+	uint32_t packets;
+	uint32_t formatEvery;
+	double seconds;
+};
+
+static void Produce(AudioRingHeader *header, const SharedRun &run)
+{
+	AudioRingWriter writer(header);
+	SequencePayload payload = {};
+
+	for (uint32_t i = 0; i < run.packets; i++) {
+		if (i % run.formatEvery == 0)
+			writer.SetFormat(i / run.formatEvery % 2 ? formatB
+								 : formatA);
+
+		payload.sequence = i;
+		payload.samplesPerSec = writer.Format().samplesPerSec;
+
+		// Unlike the hook, wait for room so every packet arrives
+		uint8_t *dst;
+		while (!(dst = writer.Reserve(sizeof(payload))))
+			std::this_thread::yield();
+		memcpy(dst, &payload, sizeof(payload));
+		writer.Commit(1, i + 1);
+	}
+
+	writer.Detach();
+}
+
+// Forks a producer into a shared mapping and reads everything it writes
+static void RunShared(SharedRun &run, uint32_t capacity, bool check)
+{
+	size_t bytes = AudioRingRegionSize(capacity);
+	void *region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	TEST_CHECK(region != MAP_FAILED);
+	if (region == MAP_FAILED)
+		return;
+
+	AudioRingHeader *header = static_cast<AudioRingHeader *>(region);
+	AudioRingInitialize(header, capacity);
+	AudioRingReader reader(header);
+
+	auto start = std::chrono::steady_clock::now();
+	pid_t child = fork();
+	if (child == 0) {
+		Produce(header, run);
+		_exit(0);
+	}
+	TEST_CHECK(child > 0);
+
+	uint32_t next = 0;
+	uint32_t mismatched = 0;
+	AudioRingView view;
+	while (child > 0 && next < run.packets) {
+		if (!reader.Peek(view)) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		SequencePayload payload;
+		memcpy(&payload, view.data, sizeof(payload));
+		if (payload.sequence != next || !view.format ||
+		    view.format->samplesPerSec != payload.samplesPerSec)
+			mismatched++;
+		reader.Release();
+		next++;
+	}
+
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	run.seconds = elapsed.count();
+
+	int status = -1;
+	if (child > 0)
+		waitpid(child, &status, 0);
+	if (check) {
+		TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		TEST_CHECK(next == run.packets);
+		TEST_CHECK(mismatched == 0);
+		TEST_CHECK(header->overruns.load() == 0);
+		TEST_CHECK(!header->producerAlive.load());
+	}
+
+	reader.Detach();
+	munmap(region, bytes);
+}
+#endif
+
+static void Bench()
+{
+	TestRing ring(AUDIO_RING_CAPACITY);
+	AudioRingWriter writer(ring.Header());
+	AudioRingReader reader(ring.Header());
+	float chunk[2 * 480] = {};
+	AudioRingView view;
+
+	writer.SetFormat(formatA);
+	double ns = TestBench(
+		[&]() {
+			writer.Write(chunk, sizeof(chunk), 480, 1);
+			reader.Peek(view);
+			reader.Release();
+		},
+		100000);
+	printf("write+read 10 ms stereo float: %.1f ns/packet\n", ns);
+
+#ifndef _WIN32
+	SharedRun run = {2000000, 100000, 0.0};
+	RunShared(run, 1 << 16, false);
+	printf("two processes, 64 byte packets: %.1f ns/packet\n",
+	       run.seconds * 1e9 / run.packets);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+	TestQueuedFormatChange();
+	TestLateReader();
+	TestFullRing();
+	TestBatchedFormatChange();
+
+#ifndef _WIN32
+	// Small ring so it wraps and fills a lot, format every few packets
+	SharedRun run = {200000, 7, 0.0};
+	RunShared(run, 1024, true);
+#endif
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("audio-ring-test");
+}
@@ -0,0 +1,217 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Runs synthetic sessions through everything a source would, minus OBS:
+ * the shared backend, a pooled worker per subscriber and the pipeline to
+ * stereo 48 kHz. Prints what each subscriber got and exits non-zero if a
+ * clean run lost audio or produced timestamps that go backwards.
+ *
+ *   capture-driver [--sessions N] [--subscribers N] [--seconds S] [--faults]
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture/capture-pipeline.hpp"
+#include "capture/capture-worker.hpp"
+#include "capture/frame-pool.hpp"
+#include "capture/shared-capture.hpp"
+#include "capture/synthetic-backend.hpp"
+#include "test-helpers.hpp"
+
+#define DRIVER_RATE 48000
+#define DRIVER_MASK 0x3
+
+struct DriverOptions {
+	uint32_t sessions = 2;
+	uint32_t subscribers = 1;
+	double seconds = 2.0;
+	bool faults = false;
+};
+
+struct Subscriber {
+	std::unique_ptr<CaptureStream> stream;
+	std::unique_ptr<CaptureWorker> worker;
+
+	CapturePipeline pipeline;
+	FramePool pool;
+	uint32_t formatSerial = 0;
+
+	uint64_t frames = 0;
+	uint64_t lastTimestamp = 0;
+	uint64_t backwards = 0;
+	uint64_t rejected = 0;
+
+	bool Drain();
+};
+
+bool Subscriber::Drain()
+{
+	return stream->Drain([this](const CapturePacket &packet) {
+		if (packet.formatSerial != formatSerial) {
+			formatSerial = packet.formatSerial;
+			pipeline.Configure(*packet.format, DRIVER_MASK,
+					   DRIVER_RATE,
+					   ResamplerQuality::MEDIUM);
+		}
+
+		CaptureOutput output;
+		if (!pipeline.Process(packet, pool, output)) {
+			rejected++;
+			return;
+		}
+
+		if (output.timestamp < lastTimestamp)
+			backwards++;
+		lastTimestamp = output.timestamp;
+		frames += output.frames;
+		pool.Release(output.buffer);
+	});
+}
+
+static SyntheticSessionConfig SessionConfig(uint32_t index, bool faults)
+{
+	SyntheticSessionConfig config;
+	config.name = "Driver " + std::to_string(index);
+	config.processId = 1000 + index;
+
+	// Every other one needs converting and resampling
+	if (index % 2) {
+		config.format = {AUDIO_RING_FORMAT_PCM, 44100, 0x3, 2, 16, 16,
+				 4, 0};
+		config.packetFrames = 441;
+	}
+
+	if (faults) {
+		config.dropEvery = 50;
+		config.jitterUs = 2000;
+		config.stallEvery = 100;
+		config.stallMs = 30;
+		config.zeroTimestampEvery = 20;
+	}
+
+	return config;
+}
+
+static bool ParseOptions(int argc, char **argv, DriverOptions &options)
+{
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool value = i + 1 < argc;
+
+		if (arg == "--sessions" && value)
+			options.sessions = atoi(argv[++i]);
+		else if (arg == "--subscribers" && value)
+			options.subscribers = atoi(argv[++i]);
+		else if (arg == "--seconds" && value)
+			options.seconds = atof(argv[++i]);
+		else if (arg == "--faults")
+			options.faults = true;
+		else
+			return false;
+	}
+
+	return options.sessions && options.subscribers &&
+	       options.seconds > 0.0;
+}
+
+int main(int argc, char **argv)
+{
+	DriverOptions options;
+	if (!ParseOptions(argc, argv, options)) {
+		fprintf(stderr, "usage: capture-driver [--sessions N] "
+				"[--subscribers N] [--seconds S] [--faults]\n");
+		return 2;
+	}
+
+	std::vector<SyntheticSessionConfig> configs;
+	for (uint32_t i = 0; i < options.sessions; i++)
+		configs.push_back(SessionConfig(i, options.faults));
+
+	std::shared_ptr<SyntheticBackend> synthetic =
+		std::make_shared<SyntheticBackend>(configs);
+	SharedCaptureBackend backend(synthetic);
+	std::shared_ptr<const SessionSnapshot> snapshot = backend.Sessions();
+
+	std::vector<std::unique_ptr<Subscriber>> subscribers;
+	for (const SessionRecord &session : snapshot->sessions) {
+		for (uint32_t i = 0; i < options.subscribers; i++) {
+			std::unique_ptr<Subscriber> subscriber(new Subscriber);
+			subscriber->pool.Configure(2, DRIVER_RATE);
+			subscriber->stream = backend.Attach(session);
+			TEST_CHECK(subscriber->stream != nullptr);
+			if (!subscriber->stream)
+				return TestResult("capture-driver");
+			subscribers.push_back(std::move(subscriber));
+		}
+	}
+
+	uint64_t start = CaptureClockNs();
+	for (auto &subscriber : subscribers) {
+		Subscriber *target = subscriber.get();
+		target->worker.reset(new CaptureWorker(
+			target->stream->Waker(),
+			[target]() { return target->Drain(); }, 20));
+	}
+
+	std::this_thread::sleep_for(
+		std::chrono::duration<double>(options.seconds));
+
+	for (auto &subscriber : subscribers)
+		subscriber->worker.reset();
+	double elapsed = (CaptureClockNs() - start) / 1000000000.0;
+
+	for (size_t i = 0; i < subscribers.size(); i++) {
+		Subscriber &subscriber = *subscribers[i];
+		uint32_t session = static_cast<uint32_t>(
+			i / options.subscribers);
+		const SyntheticStats &stats = synthetic->Stats(session);
+
+		double seconds = subscriber.frames / double(DRIVER_RATE);
+		printf("session %u subscriber %zu: %.2f s of %.2f s, "
+		       "%llu dropped, %llu lost, %llu stalls, %llu backwards, "
+		       "%llu rejected\n",
+		       session, i % options.subscribers, seconds, elapsed,
+		       static_cast<unsigned long long>(
+			       subscriber.stream->DroppedFrames()),
+		       static_cast<unsigned long long>(stats.faultDrops.load()),
+		       static_cast<unsigned long long>(stats.stalls.load()),
+		       static_cast<unsigned long long>(subscriber.backwards),
+		       static_cast<unsigned long long>(subscriber.rejected));
+
+		TEST_CHECK(subscriber.backwards == 0);
+		TEST_CHECK(subscriber.rejected == 0);
+
+		// Faults lose audio on purpose, a clean run mustn't
+		if (options.faults) {
+			TEST_CHECK(seconds > elapsed / 2);
+			continue;
+		}
+
+		// Up to one packet is still in flight either end
+		TEST_CHECK(seconds > elapsed - 0.1);
+		TEST_CHECK(seconds < elapsed + 0.1);
+	}
+
+	subscribers.clear();
+	return TestResult("capture-driver");
+}
@@ -0,0 +1,189 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Histogram accuracy on jittery latencies, counts that stay exact under
+ * concurrent writers, and underruns told apart from jitter. --bench
+ * measures what recording costs on every packet. */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "capture/capture-metrics.hpp"
+#include "test-helpers.hpp"
+
+// Within the ~6% the sub-buckets promise
+static bool Close(uint64_t value, uint64_t expected)
+{
+	double error = std::abs(static_cast<double>(value) -
+				static_cast<double>(expected));
+	return error <= expected / 16.0;
+}
+
+static void TestPercentiles()
+{
+	LatencyHistogram histogram;
+	TEST_CHECK(histogram.Percentile(50.0) == 0);
+	TEST_CHECK(histogram.Mean() == 0.0);
+
+	// 10 ms of latency with up to 3 ms of jitter either way
+	std::mt19937_64 random(7);
+	std::uniform_int_distribution<uint64_t> jitter(7000000, 13000000);
+	std::vector<uint64_t> values(100000);
+	for (uint64_t &value : values) {
+		value = jitter(random);
+		histogram.Record(value);
+	}
+	std::sort(values.begin(), values.end());
+
+	TEST_CHECK(histogram.Count() == values.size());
+	TEST_CHECK(histogram.Max() == values.back());
+	TEST_CHECK_NEAR(histogram.Mean(), 10000000.0, 20000.0);
+	for (double p : {1.0, 50.0, 90.0, 99.0, 99.9}) {
+		size_t rank = static_cast<size_t>(p / 100.0 * values.size());
+		TEST_CHECK(Close(histogram.Percentile(p), values[rank - 1]));
+	}
+	TEST_CHECK(Close(histogram.Percentile(100.0), values.back()));
+
+	// Small values are exact, huge ones land in the last bucket
+	histogram.Reset();
+	TEST_CHECK(histogram.Count() == 0);
+	for (uint64_t value = 0; value < HISTOGRAM_SUB_COUNT; value++)
+		histogram.Record(value);
+	TEST_CHECK(histogram.Percentile(50.0) == HISTOGRAM_SUB_COUNT / 2 - 1);
+	histogram.Record(1ULL << 50);
+	TEST_CHECK(histogram.Max() == 1ULL << 50);
+	TEST_CHECK(histogram.Percentile(100.0) <= 1ULL << 50);
+}
+
+static void TestConcurrent()
+{
+	const int threads = 4;
+	const uint64_t each = 100000;
+
+	CaptureMetrics metrics;
+	std::vector<std::thread> writers;
+	for (int t = 0; t < threads; t++) {
+		writers.emplace_back([&metrics, t]() {
+			for (uint64_t i = 1; i <= each; i++) {
+				metrics.latency.Record(i * (t + 1));
+				CaptureCount(metrics.counters.framesCaptured,
+					     480);
+				CaptureCount(metrics.counters.wakeups);
+			}
+		});
+	}
+	for (std::thread &writer : writers)
+		writer.join();
+
+	TEST_CHECK(metrics.latency.Count() == threads * each);
+	TEST_CHECK(metrics.latency.Max() == threads * each);
+	TEST_CHECK(metrics.counters.framesCaptured == threads * each * 480);
+	TEST_CHECK(metrics.counters.wakeups == threads * each);
+	// 1+2+3+4 times the mean of 1..each, over four writers
+	TEST_CHECK_NEAR(metrics.latency.Mean(), 2.5 * (each + 1) / 2.0, 1e-6);
+
+	TEST_CHECK(metrics.Describe().find("Wakeups: 400000") !=
+		   std::string::npos);
+	metrics.Reset();
+	TEST_CHECK(metrics.latency.Count() == 0);
+	TEST_CHECK(metrics.counters.framesCaptured == 0);
+}
+
+static void TestUnderruns()
+{
+	const uint64_t packet = 10000000; // 480 frames at 48 kHz
+	UnderrunTracker tracker;
+
+	// The first output has nothing to be late against
+	TEST_CHECK(!tracker.Advance(5 * packet, 480, 48000));
+	TEST_CHECK(tracker.Expected() == 6 * packet);
+
+	// Early, late and then exactly on the limit: all jitter
+	uint64_t timestamp = 6 * packet - 2000000;
+	TEST_CHECK(!tracker.Advance(timestamp, 480, 48000));
+	timestamp += packet + 4000000;
+	TEST_CHECK(!tracker.Advance(timestamp, 480, 48000));
+	timestamp = tracker.Expected() + UNDERRUN_NS;
+	TEST_CHECK(!tracker.Advance(timestamp, 480, 48000));
+
+	// A packet's worth went missing
+	timestamp = tracker.Expected() + UNDERRUN_NS + 1;
+	TEST_CHECK(tracker.Advance(timestamp, 480, 48000));
+	TEST_CHECK(tracker.Expected() == timestamp + packet);
+
+	// A gap on purpose isn't counted
+	tracker.Reset();
+	TEST_CHECK(tracker.Expected() == 0);
+	TEST_CHECK(!tracker.Advance(timestamp + 60 * packet, 480, 48000));
+
+	// Other rates and long outputs advance without overflow
+	tracker.Reset();
+	tracker.Advance(0, 44100 * 3600, 44100);
+	TEST_CHECK(tracker.Expected() == 3600000000000ULL);
+}
+
+static void Bench()
+{
+	CaptureMetrics metrics;
+	uint64_t value = 1;
+	double record = TestBench(
+		[&]() {
+			metrics.latency.Record(value);
+			value = value * 6364136223846793005ULL + 1;
+			value >>= 40;
+		},
+		10000000);
+
+	double count = TestBench(
+		[&]() { CaptureCount(metrics.counters.framesCaptured, 480); },
+		10000000);
+
+	double contended = 0.0;
+	{
+		std::atomic<bool> stop{false};
+		std::thread other([&]() {
+			while (!stop)
+				metrics.latency.Record(12345);
+		});
+		contended = TestBench([&]() { metrics.latency.Record(12345); },
+				      1000000);
+		stop = true;
+		other.join();
+	}
+
+	double describe = TestBench([&]() { metrics.Describe(); }, 1000);
+
+	printf("Record %.1f ns (%.1f ns with a second writer), "
+	       "count %.1f ns, describe %.0f ns\n",
+	       record, contended, count, describe);
+}
+
+int main(int argc, char **argv)
+{
+	TestPercentiles();
+	TestConcurrent();
+	TestUnderruns();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("capture-metrics-test");
+}
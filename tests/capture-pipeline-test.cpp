@@ -0,0 +1,264 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* The pipeline end to end: what comes out for a given format, where its
+ * timestamps land relative to the packets that went in, and the zero copy
+ * path handing packets over as they are. */
+
+#include <vector>
+
+#include "capture/capture-pipeline.hpp"
+#include "test-helpers.hpp"
+
+#define PACKET_FRAMES 480
+
+static const AudioRingFormatInfo stereoFloat48 = {
+	AUDIO_RING_FORMAT_FLOAT, 48000, 0x3, 2, 32, 32, 8, 0};
+static const AudioRingFormatInfo stereoFloat44 = {
+	AUDIO_RING_FORMAT_FLOAT, 44100, 0x3, 2, 32, 32, 8, 0};
+static const AudioRingFormatInfo stereoS16 = {
+	AUDIO_RING_FORMAT_PCM, 48000, 0x3, 2, 16, 16, 4, 0};
+static const AudioRingFormatInfo surroundFloat48 = {
+	AUDIO_RING_FORMAT_FLOAT, 48000, 0x3F, 6, 32, 32, 24, 0};
+
+// Evenly spaced packets of a quiet ramp, timestamps exactly on time
+struct PacketSource {
+	AudioRingFormatInfo format;
+	std::vector<float> samples;
+	uint64_t start = 1000000000ULL;
+	uint64_t frames = 0;
+
+	explicit PacketSource(const AudioRingFormatInfo &format)
+		: format(format), samples(PACKET_FRAMES * format.channels)
+	{
+	}
+
+	CapturePacket Next(uint32_t count = PACKET_FRAMES)
+	{
+		for (size_t i = 0; i < count * format.channels; i++)
+			samples[i] = static_cast<float>((frames + i) % 100) *
+				     0.001f;
+
+		CapturePacket packet;
+		packet.data = reinterpret_cast<const uint8_t *>(
+			samples.data());
+		packet.size = count * format.blockAlign;
+		packet.frames = count;
+		packet.timestamp =
+			start + frames * 1000000000ULL / format.samplesPerSec;
+		packet.formatSerial = 1;
+		packet.format = &format;
+		frames += count;
+		return packet;
+	}
+};
+
+// No resampler means no group delay to take off the timestamps
+static void TestTimestampsSameRate()
+{
+	CapturePipeline pipeline;
+	FramePool pool;
+	pool.Configure(2, 48000);
+	PacketSource source(stereoFloat48);
+
+	TEST_CHECK(pipeline.Configure(source.format, 0x3, 48000,
+				      ResamplerQuality::HIGH));
+	TEST_CHECK(pipeline.Resample().Passthrough());
+
+	for (int i = 0; i < 200; i++) {
+		CapturePacket packet = source.Next();
+		CaptureOutput output;
+		TEST_CHECK(pipeline.Process(packet, pool, output));
+		TEST_CHECK(output.frames == PACKET_FRAMES);
+		TEST_CHECK_NEAR(static_cast<double>(output.timestamp),
+				static_cast<double>(packet.timestamp), 1000.0);
+		pool.Release(output.buffer);
+	}
+}
+
+static void TestTimestampsResampled()
+{
+	CapturePipeline pipeline;
+	FramePool pool;
+	pool.Configure(2, 48000);
+	PacketSource source(stereoFloat44);
+
+	TEST_CHECK(pipeline.Configure(source.format, 0x3, 48000,
+				      ResamplerQuality::MEDIUM));
+	TEST_CHECK(!pipeline.Resample().Passthrough());
+	double delay = pipeline.Resample().Latency() * 1e9 / 44100;
+	TEST_CHECK(delay > 0.0);
+
+	uint64_t frames = 0;
+	for (int i = 0; i < 200; i++) {
+		CapturePacket packet = source.Next(441);
+		CaptureOutput output;
+		if (!pipeline.Process(packet, pool, output))
+			continue;
+		frames += output.frames;
+		TEST_CHECK(output.samplesPerSec == 48000);
+		TEST_CHECK_NEAR(static_cast<double>(output.timestamp),
+				packet.timestamp - delay, 1000.0);
+		pool.Release(output.buffer);
+	}
+
+	// Ten ms in, ten ms out, give or take the filter filling up
+	TEST_CHECK_NEAR(static_cast<double>(frames), 200 * 480.0, 480.0);
+}
+
+// Whether Configure() leaves the pipeline able to hand packets over as is
+static bool Native(const AudioRingFormatInfo &format, uint32_t outMask,
+		   uint32_t outRate)
+{
+	CapturePipeline pipeline;
+	return pipeline.Configure(format, outMask, outRate,
+				  ResamplerQuality::HIGH) &&
+	       pipeline.Native();
+}
+
+static void TestSpanNative()
+{
+	TEST_CHECK(Native(stereoFloat48, 0x3, 48000));
+	TEST_CHECK(!Native(stereoFloat44, 0x3, 48000));
+	TEST_CHECK(!Native(surroundFloat48, 0x3, 48000));
+	TEST_CHECK(Native(surroundFloat48, 0x3F, 48000));
+	TEST_CHECK(Native(stereoS16, 0x3, 48000) ==
+		   IsNativeSampleFormat(SampleFormat::S16));
+
+	// Anything that has to be converted says no rather than copy
+	CapturePipeline pipeline;
+	PacketSource source(stereoFloat44);
+	CaptureSpan span;
+	TEST_CHECK(pipeline.Configure(source.format, 0x3, 48000,
+				      ResamplerQuality::LOW));
+	TEST_CHECK(!pipeline.Span(source.Next(441), span));
+
+	// and so do packets with less data than frames
+	PacketSource native(stereoFloat48);
+	TEST_CHECK(pipeline.Configure(native.format, 0x3, 48000,
+				      ResamplerQuality::LOW));
+	CapturePacket packet = native.Next();
+	packet.size -= 1;
+	TEST_CHECK(!pipeline.Span(packet, span));
+	packet.size += 1;
+	packet.frames = 0;
+	TEST_CHECK(!pipeline.Span(packet, span));
+}
+
+/* Span() points into the packet itself, and taking turns with Process()
+ * on one stream gives the same timestamps and samples as either alone */
+static void TestSpanZeroCopy()
+{
+	CapturePipeline mixed, processed;
+	FramePool pool;
+	pool.Configure(2, 48000);
+	PacketSource source(stereoFloat48);
+
+	TEST_CHECK(mixed.Configure(source.format, 0x3, 48000,
+				   ResamplerQuality::HIGH));
+	TEST_CHECK(processed.Configure(source.format, 0x3, 48000,
+				       ResamplerQuality::HIGH));
+	TEST_CHECK(mixed.Native());
+
+	uint64_t end = 0;
+	for (int i = 0; i < 200; i++) {
+		CapturePacket packet = source.Next(i % 3 ? 480 : 441);
+		CaptureOutput output;
+		TEST_CHECK(processed.Process(packet, pool, output));
+
+		uint64_t timestamp;
+		if (i % 4 < 2) {
+			CaptureSpan span;
+			TEST_CHECK(mixed.Span(packet, span));
+			TEST_CHECK(span.data == packet.data);
+			TEST_CHECK(span.sampleFormat == SampleFormat::F32);
+			TEST_CHECK(span.channels == 2);
+			TEST_CHECK(span.frames == packet.frames);
+			TEST_CHECK(span.samplesPerSec == 48000);
+			timestamp = span.timestamp;
+
+			// The planes Process() wrote hold the same samples
+			const float *in =
+				reinterpret_cast<const float *>(span.data);
+			size_t wrong = 0;
+			for (uint32_t f = 0; f < span.frames; f++) {
+				if (in[f * 2] != output.data[0][f] ||
+				    in[f * 2 + 1] != output.data[1][f])
+					wrong++;
+			}
+			TEST_CHECK(wrong == 0);
+		} else {
+			CaptureOutput other;
+			TEST_CHECK(mixed.Process(packet, pool, other));
+			timestamp = other.timestamp;
+			pool.Release(other.buffer);
+		}
+
+		TEST_CHECK(timestamp == output.timestamp);
+		TEST_CHECK_NEAR(static_cast<double>(timestamp),
+				static_cast<double>(packet.timestamp), 1000.0);
+		// One timeline with no gaps or overlaps where they hand over
+		if (end)
+			TEST_CHECK_NEAR(static_cast<double>(timestamp),
+					static_cast<double>(end), 1000.0);
+		end = timestamp + packet.frames * 1000000000ULL / 48000;
+		pool.Release(output.buffer);
+	}
+}
+
+static void Bench()
+{
+	CapturePipeline pipeline;
+	FramePool pool;
+	pool.Configure(2, 48000);
+	PacketSource source(stereoFloat48);
+	pipeline.Configure(source.format, 0x3, 48000, ResamplerQuality::HIGH);
+	CapturePacket packet = source.Next();
+
+	double span = TestBench(
+		[&]() {
+			CaptureSpan out;
+			pipeline.Span(packet, out);
+			packet.timestamp += 10000000;
+		},
+		100000);
+	double process = TestBench(
+		[&]() {
+			CaptureOutput out;
+			pipeline.Process(packet, pool, out);
+			pool.Release(out.buffer);
+			packet.timestamp += 10000000;
+		},
+		100000);
+
+	printf("10 ms stereo float: span %.1f ns, process %.1f ns\n", span,
+	       process);
+}
+
+int main(int argc, char **argv)
+{
+	TestTimestampsSameRate();
+	TestTimestampsResampled();
+	TestSpanNative();
+	TestSpanZeroCopy();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("capture-pipeline-test");
+}
@@ -0,0 +1,394 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Capture traces: what a stream hands out recorded to disk, read back
+ * record for record, played back as a session of its own and replayed
+ * through the pipeline the same way every time. */
+
+#include <cstdio>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "capture/trace-backend.hpp"
+#include "test-helpers.hpp"
+
+#define TRACE_PATH "capture-trace-test.trace"
+#define JUNK_PATH "capture-trace-test.junk"
+#define PACKET_NS 10000000ULL
+
+static const AudioRingFormatInfo stereoFloat48 = {
+	AUDIO_RING_FORMAT_FLOAT, 48000, 0x3, 2, 32, 32, 8, 0};
+static const AudioRingFormatInfo stereoS16_44 = {
+	AUDIO_RING_FORMAT_PCM, 44100, 0x3, 2, 16, 16, 4, 0};
+
+// Hands out whatever it's been given, in one drain
+class ScriptStream : public CaptureStream {
+	std::shared_ptr<LocalWaker> waker = std::make_shared<LocalWaker>();
+
+public:
+	std::deque<CapturePacket> queued;
+	uint64_t droppedFrames = 0;
+	uint64_t overruns = 0;
+
+	std::shared_ptr<CaptureWaker> Waker() const override { return waker; }
+
+	bool Drain(const CaptureSink &sink) override
+	{
+		bool worked = !queued.empty();
+		for (; !queued.empty(); queued.pop_front())
+			sink(queued.front());
+		return worked;
+	}
+
+	uint64_t DroppedFrames() const override { return droppedFrames; }
+	uint64_t Overruns() const override { return overruns; }
+};
+
+// Made up audio, 10 ms a packet, the format switching halfway through
+struct Script {
+	std::vector<std::vector<uint8_t>> payloads;
+	std::vector<CapturePacket> packets;
+	uint64_t start;
+
+	explicit Script(uint32_t count) : start(CaptureClockNs())
+	{
+		for (uint32_t i = 0; i < count; i++) {
+			const AudioRingFormatInfo &format =
+				i < count / 2 ? stereoFloat48 : stereoS16_44;
+			uint32_t frames = format.samplesPerSec / 100;
+
+			std::vector<uint8_t> payload(frames *
+						     format.blockAlign);
+			for (size_t b = 0; b < payload.size(); b++)
+				payload[b] = static_cast<uint8_t>(
+					b % 7 == 3 ? 0 : (i * 31 + b) % 61);
+			payloads.push_back(payload);
+
+			CapturePacket packet;
+			packet.frames = frames;
+			packet.timestamp = start + i * PACKET_NS;
+			packet.formatSerial = i < count / 2 ? 1 : 2;
+			packet.format = &format;
+			packets.push_back(packet);
+		}
+		for (size_t i = 0; i < packets.size(); i++) {
+			packets[i].data = payloads[i].data();
+			packets[i].size =
+				static_cast<uint32_t>(payloads[i].size());
+		}
+	}
+};
+
+static SessionRecord Game()
+{
+	SessionRecord session;
+	session.exe = "game.exe";
+	session.processId = 4242;
+	return session;
+}
+
+// Records the script in three drains, with drops seen after the second
+static bool Record(const Script &script, uint64_t &bytes)
+{
+	FILE *file = fopen(TRACE_PATH, "wb");
+	if (!file)
+		return false;
+
+	ScriptStream *inner = new ScriptStream();
+	TracingStream tracing(std::unique_ptr<CaptureStream>(inner), file,
+			      Game());
+	if (!tracing.Recording())
+		return false;
+
+	size_t third = script.packets.size() / 3;
+	uint32_t seen = 0;
+	for (int drain = 0; drain < 3; drain++) {
+		size_t end = drain == 2 ? script.packets.size()
+					: (drain + 1) * third;
+		for (size_t i = drain * third; i < end; i++)
+			inner->queued.push_back(script.packets[i]);
+		if (drain == 2) {
+			inner->droppedFrames = 480;
+			inner->overruns = 1;
+		}
+		tracing.Drain([&seen](const CapturePacket &) { seen++; });
+	}
+	bytes = tracing.Bytes();
+
+	// Passed on untouched while being recorded
+	return seen == script.packets.size() && tracing.Recording();
+}
+
+static void TestRoundTrip(const Script &script)
+{
+	uint64_t bytes = 0;
+	TEST_CHECK(Record(script, bytes));
+
+	std::vector<uint8_t> data;
+	TEST_CHECK(LoadCaptureTrace(TRACE_PATH, data));
+	TEST_CHECK(data.size() == bytes);
+
+	CaptureTraceReader reader;
+	TEST_CHECK(reader.Attach(data.data(), data.size()));
+	TEST_CHECK(reader.Header().processId == 4242);
+	TEST_CHECK(strcmp(reader.Header().exe, "game.exe") == 0);
+	TEST_CHECK(reader.Header().startNs >= script.start);
+
+	CaptureTraceEntry entry;
+	uint32_t formats = 0, packets = 0, counters = 0;
+	uint64_t arrival = 0;
+	size_t wrong = 0;
+	while (reader.Next(entry)) {
+		TEST_CHECK(entry.arrival >= arrival);
+		TEST_CHECK(reinterpret_cast<uintptr_t>(entry.payload) %
+				   CAPTURE_TRACE_ALIGN ==
+			   reinterpret_cast<uintptr_t>(data.data()) %
+				   CAPTURE_TRACE_ALIGN);
+		arrival = entry.arrival;
+
+		if (entry.type == CaptureTraceType::FORMAT) {
+			const CaptureTraceFormat *record =
+				reinterpret_cast<const CaptureTraceFormat *>(
+					entry.payload);
+			TEST_CHECK(record->formatSerial == formats + 1);
+			TEST_CHECK(record->format.samplesPerSec ==
+				   (formats ? 44100u : 48000u));
+			formats++;
+		} else if (entry.type == CaptureTraceType::PACKET) {
+			const CaptureTracePacket *record =
+				reinterpret_cast<const CaptureTracePacket *>(
+					entry.payload);
+			const CapturePacket &packet = script.packets[packets];
+			if (record->timestamp != packet.timestamp ||
+			    record->frames != packet.frames ||
+			    record->formatSerial != packet.formatSerial ||
+			    entry.size != sizeof(*record) + packet.size ||
+			    memcmp(record + 1, packet.data, packet.size) != 0)
+				wrong++;
+			packets++;
+		} else if (entry.type == CaptureTraceType::COUNTERS) {
+			const CaptureTraceCounters *record =
+				reinterpret_cast<const CaptureTraceCounters *>(
+					entry.payload);
+			TEST_CHECK(record->droppedFrames == 480);
+			TEST_CHECK(record->overruns == 1);
+			counters++;
+		}
+	}
+	TEST_CHECK(wrong == 0);
+	TEST_CHECK(formats == 2);
+	TEST_CHECK(packets == script.packets.size());
+	TEST_CHECK(counters == 1);
+
+	// Cut short anywhere, it ends at the last whole record
+	for (size_t cut = data.size() - 1; cut > data.size() - 2000;
+	     cut -= 97) {
+		TEST_CHECK(reader.Attach(data.data(), cut));
+		uint32_t whole = 0;
+		while (reader.Next(entry))
+			whole++;
+		TEST_CHECK(whole > 0 && whole < formats + packets + counters);
+	}
+
+	// Anything that isn't a trace is turned away
+	TEST_CHECK(
+		!reader.Attach(data.data(), sizeof(CaptureTraceHeader) - 1));
+	std::vector<uint8_t> junk(data.begin(), data.begin() + 64);
+	junk[0] ^= 0xFF;
+	TEST_CHECK(!reader.Attach(junk.data(), junk.size()));
+	junk[0] ^= 0xFF;
+	reinterpret_cast<CaptureTraceHeader *>(junk.data())->version++;
+	TEST_CHECK(!reader.Attach(junk.data(), junk.size()));
+}
+
+// Played back as a session, as fast as it's drained
+static void TestBackend(const Script &script)
+{
+	FILE *file = fopen(JUNK_PATH, "wb");
+	TEST_CHECK(file && fputs("not a trace", file) >= 0);
+	if (file)
+		fclose(file);
+
+	TraceBackend backend({JUNK_PATH, TRACE_PATH, "missing.trace"});
+	std::shared_ptr<const SessionSnapshot> sessions = backend.Sessions();
+	TEST_CHECK(sessions->sessions.size() == 1);
+	const SessionRecord &session = sessions->sessions[0];
+	TEST_CHECK(session.sessionId == "trace-0");
+	TEST_CHECK(session.deviceId == "trace");
+	TEST_CHECK(session.exe == "game.exe");
+	TEST_CHECK(session.processId == 4242);
+
+	uint64_t attached = CaptureClockNs();
+	std::unique_ptr<CaptureStream> stream = backend.Attach(session);
+	TEST_CHECK(stream != nullptr);
+	if (!stream)
+		return;
+
+	size_t index = 0, wrong = 0;
+	uint64_t first = 0;
+	while (stream->Drain([&](const CapturePacket &packet) {
+		const CapturePacket &original = script.packets[index];
+		if (!index)
+			first = packet.timestamp;
+		// Same spacing, but starting from when it was attached
+		if (packet.timestamp - first !=
+			    original.timestamp - script.packets[0].timestamp ||
+		    packet.frames != original.frames ||
+		    packet.size != original.size ||
+		    packet.formatSerial != original.formatSerial ||
+		    memcmp(packet.data, original.data, packet.size) != 0 ||
+		    memcmp(packet.format, original.format,
+			   sizeof(AudioRingFormatInfo)) != 0)
+			wrong++;
+		index++;
+	}))
+		;
+
+	TEST_CHECK(index == script.packets.size());
+	TEST_CHECK(wrong == 0);
+
+	/* Captured a little before recording started, and replayed that
+	 * much before it was attached */
+	std::vector<uint8_t> data;
+	CaptureTraceReader reader;
+	TEST_CHECK(LoadCaptureTrace(TRACE_PATH, data));
+	TEST_CHECK(reader.Attach(data.data(), data.size()));
+	uint64_t before = reader.Header().startNs - script.start;
+	TEST_CHECK(first + before >= attached);
+	TEST_CHECK(first + before <= CaptureClockNs());
+	TEST_CHECK(stream->DroppedFrames() == 480);
+	TEST_CHECK(stream->Overruns() == 1);
+
+	SessionRecord other = session;
+	other.instanceId = "trace-1";
+	TEST_CHECK(backend.Attach(other) == nullptr);
+	remove(JUNK_PATH);
+}
+
+// At full speed packets come out no sooner than they first arrived
+static void TestRealTime(const Script &script)
+{
+	std::vector<uint8_t> data;
+	CaptureTraceReader reader;
+	CaptureTraceEntry entry;
+	TEST_CHECK(LoadCaptureTrace(TRACE_PATH, data));
+	TEST_CHECK(reader.Attach(data.data(), data.size()));
+	uint64_t recorded = 0;
+	while (reader.Next(entry))
+		recorded = entry.arrival - reader.Header().startNs;
+
+	TraceBackend backend({TRACE_PATH}, 1.0);
+	uint64_t attached = CaptureClockNs();
+	std::unique_ptr<CaptureStream> stream =
+		backend.Attach(backend.Sessions()->sessions[0]);
+	TEST_CHECK(stream != nullptr);
+	if (!stream)
+		return;
+
+	size_t packets = 0;
+	for (int i = 0; i < 1000 && packets < script.packets.size(); i++) {
+		if (!stream->Drain([&packets](const CapturePacket &) {
+			    packets++;
+		    }))
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(1));
+	}
+	TEST_CHECK(packets == script.packets.size());
+	TEST_CHECK(CaptureClockNs() - attached >= recorded);
+}
+
+// FNV-1a over the bits of every output sample
+static void Hash(uint64_t &sum, const CaptureOutput &output)
+{
+	for (uint32_t c = 0; c < output.channels; c++) {
+		for (uint32_t f = 0; f < output.frames; f++) {
+			uint32_t bits;
+			memcpy(&bits, &output.data[c][f], sizeof(bits));
+			sum = (sum ^ bits) * 1099511628211ULL;
+		}
+	}
+}
+
+static uint64_t Checksum(CaptureTraceReader &reader, TraceReplayStats &stats)
+{
+	uint64_t sum = 1469598103934665603ULL;
+	ReplayCaptureTrace(reader, 0x3, 48000, ResamplerQuality::HIGH, stats,
+			   [&sum](const CaptureOutput &output) {
+				   Hash(sum, output);
+			   });
+	return sum;
+}
+
+static void TestReplay(const Script &script)
+{
+	std::vector<uint8_t> data;
+	TEST_CHECK(LoadCaptureTrace(TRACE_PATH, data));
+	CaptureTraceReader reader;
+	TEST_CHECK(reader.Attach(data.data(), data.size()));
+
+	TraceReplayStats first, second;
+	uint64_t a = Checksum(reader, first);
+	uint64_t b = Checksum(reader, second);
+
+	TEST_CHECK(a == b);
+	TEST_CHECK(first.packets == script.packets.size());
+	TEST_CHECK(first.formatChanges == 2);
+	TEST_CHECK(first.outputFrames == second.outputFrames);
+	// Half at 48 kHz as is, half resampled up from 44.1 kHz
+	TEST_CHECK_NEAR(static_cast<double>(first.outputFrames),
+			script.packets.size() * 480.0, 480.0);
+}
+
+static void Bench(const Script &script)
+{
+	uint64_t bytes = 0;
+	double record = TestBench([&]() { Record(script, bytes); }, 10);
+	printf("record: %.1f MiB/s\n",
+	       bytes / (1024.0 * 1024.0) / (record / 1e9));
+
+	std::vector<uint8_t> data;
+	LoadCaptureTrace(TRACE_PATH, data);
+	CaptureTraceReader reader;
+	reader.Attach(data.data(), data.size());
+	TraceReplayStats stats;
+	double replay = TestBench(
+		[&]() {
+			ReplayCaptureTrace(reader, 0x3, 48000,
+					   ResamplerQuality::HIGH, stats);
+		},
+		10);
+	printf("replay: %.0f ns/packet\n", replay / script.packets.size());
+}
+
+int main(int argc, char **argv)
+{
+	Script script(600);
+
+	TestRoundTrip(script);
+	TestBackend(script);
+	TestRealTime(script);
+	TestReplay(script);
+
+	if (TestBenchRequested(argc, argv))
+		Bench(script);
+
+	remove(TRACE_PATH);
+	return TestResult("capture-trace-test");
+}
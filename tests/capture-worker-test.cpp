@@ -0,0 +1,477 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* The capture pool under load: deadlines for captures that never signal,
+ * workers removed while their drain is running, drains never overlapping
+ * while workers come and go, and idle threads stealing from a busy one. */
+
+#include <condition_variable>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "capture/capture-worker.hpp"
+#include "test-helpers.hpp"
+
+#ifdef __linux__
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "helpers/wake-eventfd.hpp"
+#endif
+
+// Polls rather than waits so a bug fails the test instead of hanging it
+template <typename Pred> static bool WaitFor(Pred pred, int ms)
+{
+	for (int i = 0; i < ms; i++) {
+		if (pred())
+			return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return pred();
+}
+
+static void TestDeadline()
+{
+	auto pool = std::make_shared<CapturePool>(2);
+	auto waker = std::make_shared<LocalWaker>();
+	std::atomic<int> drains{0};
+
+	CaptureWorker worker(
+		waker,
+		[&]() {
+			drains++;
+			return false;
+		},
+		20, pool);
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+	// 25 due, loose either way for a loaded machine
+	TEST_CHECK(drains >= 10 && drains <= 40);
+	TEST_CHECK(worker.Stats().timeoutWakeups >= 10);
+	TEST_CHECK(worker.Stats().signalledWakeups == 0);
+	TEST_CHECK(worker.Stats().idleWakeups == worker.Stats().timeoutWakeups);
+}
+
+static void TestSignal()
+{
+	auto pool = std::make_shared<CapturePool>(2);
+	auto waker = std::make_shared<LocalWaker>();
+	std::atomic<int> drains{0};
+
+	// Long enough that only the signals can account for the drains
+	CaptureWorker worker(
+		waker,
+		[&]() {
+			drains++;
+			return true;
+		},
+		10000, pool);
+
+	// Drained once on Add() to pick up anything already queued
+	TEST_CHECK(WaitFor([&]() { return drains == 1; }, 1000));
+
+	for (int i = 1; i <= 20; i++) {
+		waker->Signal();
+		TEST_CHECK(WaitFor([&]() { return drains > i; }, 1000));
+	}
+	// Counted once the drain has returned
+	TEST_CHECK(WaitFor(
+		[&]() { return worker.Stats().signalledWakeups >= 20; }, 1000));
+}
+
+static void TestRemoveWhileRunning()
+{
+	auto pool = std::make_shared<CapturePool>(2);
+	auto waker = std::make_shared<LocalWaker>();
+	std::atomic<bool> inside{false};
+	std::atomic<bool> finished{false};
+	std::atomic<int> drains{0};
+
+	std::unique_ptr<CaptureWorker> worker(new CaptureWorker(
+		waker,
+		[&]() {
+			inside = true;
+			std::this_thread::sleep_for(
+				std::chrono::milliseconds(100));
+			drains++;
+			finished = true;
+			return true;
+		},
+		10000, pool));
+
+	waker->Signal();
+	TEST_CHECK(WaitFor([&]() { return inside.load(); }, 1000));
+
+	// Queued again behind the running drain, then removed
+	waker->Signal();
+	worker.reset();
+	TEST_CHECK(finished);
+	int after = drains;
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(150));
+	TEST_CHECK(drains == after);
+
+	// Signals after the removal don't reach anything
+	waker->Signal();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	TEST_CHECK(drains == after);
+}
+
+// Workers come and go while producers hammer their wakers
+static void TestChurn()
+{
+	const int count = 16;
+	auto pool = std::make_shared<CapturePool>(3);
+	std::vector<std::shared_ptr<LocalWaker>> wakers;
+	std::vector<std::unique_ptr<std::atomic<int>>> inDrain;
+	for (int i = 0; i < count; i++) {
+		wakers.push_back(std::make_shared<LocalWaker>());
+		inDrain.emplace_back(new std::atomic<int>(0));
+	}
+
+	std::atomic<bool> stop{false};
+	std::atomic<int> overlaps{0};
+	std::atomic<long> drains{0};
+	std::vector<std::thread> producers;
+	for (int p = 0; p < 2; p++) {
+		producers.emplace_back([&, p]() {
+			std::mt19937 rng(p);
+			while (!stop) {
+				wakers[rng() % count]->Signal();
+				if (rng() % 64 == 0)
+					std::this_thread::yield();
+			}
+		});
+	}
+
+	std::mt19937 rng(7);
+	std::vector<std::unique_ptr<CaptureWorker>> workers(count);
+	for (int it = 0; it < 2000; it++) {
+		int i = rng() % count;
+		if (workers[i]) {
+			workers[i].reset();
+			continue;
+		}
+
+		std::shared_ptr<LocalWaker> waker = wakers[i];
+		std::atomic<int> *busy = inDrain[i].get();
+		workers[i].reset(new CaptureWorker(
+			waker,
+			[&, waker, busy]() {
+				if ((*busy)++)
+					overlaps++;
+				// Some drains signal themselves, like a
+				// producer that commits while it's read
+				if (++drains % 7 == 0)
+					waker->Signal();
+				(*busy)--;
+				return true;
+			},
+			5, pool));
+	}
+
+	workers.clear();
+	stop = true;
+	for (std::thread &producer : producers)
+		producer.join();
+
+	TEST_CHECK(overlaps == 0);
+	TEST_CHECK(drains > 0);
+	for (auto &busy : inDrain)
+		TEST_CHECK(*busy == 0);
+}
+
+/* One drain hogs a thread while captures queued behind it on the same
+ * thread are signalled. They only get drained if the other one steals. */
+static void TestStealing()
+{
+	const int count = 6;
+	auto pool = std::make_shared<CapturePool>(2);
+	std::atomic<bool> hogging{false};
+	std::atomic<bool> release{false};
+	std::vector<std::shared_ptr<LocalWaker>> wakers;
+	std::vector<std::unique_ptr<std::atomic<int>>> drains;
+	std::vector<std::unique_ptr<CaptureWorker>> workers;
+
+	for (int i = 0; i < count; i++) {
+		wakers.push_back(std::make_shared<LocalWaker>());
+		drains.emplace_back(new std::atomic<int>(0));
+	}
+	for (int i = 0; i < count; i++) {
+		std::atomic<int> *drained = drains[i].get();
+		bool hog = i == 0;
+		workers.emplace_back(new CaptureWorker(
+			wakers[i],
+			[&, drained, hog]() {
+				auto released = [&]() {
+					return release.load();
+				};
+				if (hog && !release) {
+					hogging = true;
+					WaitFor(released, 2000);
+				}
+				(*drained)++;
+				return true;
+			},
+			10000, pool));
+	}
+
+	// Its first drain on Add() is enough to get it hogging
+	TEST_CHECK(WaitFor([&]() { return hogging.load(); }, 1000));
+
+	for (int round = 1; round <= 5; round++) {
+		for (int i = 1; i < count; i++)
+			wakers[i]->Signal();
+		for (int i = 1; i < count; i++)
+			TEST_CHECK(WaitFor(
+				[&]() { return *drains[i] >= round; }, 1000));
+	}
+	TEST_CHECK(*drains[0] == 0);
+
+	release = true;
+	TEST_CHECK(WaitFor([&]() { return *drains[0] >= 1; }, 2000));
+	workers.clear();
+}
+
+// A 0 interval is taken as 1 ms rather than a deadline that's always due
+static void TestZeroInterval()
+{
+	auto pool = std::make_shared<CapturePool>(2);
+	auto waker = std::make_shared<LocalWaker>();
+	std::atomic<int> drains{0};
+
+	CaptureWorker worker(
+		waker,
+		[&]() {
+			drains++;
+			return false;
+		},
+		0, pool);
+	TEST_CHECK(worker.Interval() == 1);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	// 200 due, spinning would be thousands
+	TEST_CHECK(drains >= 20 && drains <= 400);
+
+	worker.SetInterval(0);
+	TEST_CHECK(worker.Interval() == 1);
+}
+
+#ifdef __linux__
+/* The eventfd waker, signalled in-process and from a forked producer, and
+ * behaving like an auto-reset event around its listener */
+static void TestEventFd()
+{
+	auto waker = std::make_shared<WakeEventFd>();
+	std::atomic<int> calls{0};
+	auto count = [&]() { calls++; };
+
+	// Two signals before anyone listens are one wakeup once someone does
+	waker->Signal();
+	waker->Signal();
+	waker->SetListener(count);
+	TEST_CHECK(WaitFor([&]() { return calls == 1; }, 1000));
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	TEST_CHECK(calls == 1);
+
+	// Nothing while nobody listens, then the signal is still there
+	waker->SetListener(nullptr);
+	waker->Signal();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	TEST_CHECK(calls == 1);
+	waker->SetListener(count);
+	TEST_CHECK(WaitFor([&]() { return calls == 2; }, 1000));
+	waker->SetListener(nullptr);
+
+	auto pool = std::make_shared<CapturePool>(2);
+	std::atomic<int> drains{0};
+	CaptureWorker worker(
+		waker,
+		[&]() {
+			drains++;
+			return true;
+		},
+		10000, pool);
+	TEST_CHECK(WaitFor([&]() { return drains == 1; }, 1000));
+
+	for (int i = 2; i <= 6; i++) {
+		pid_t child = fork();
+		if (child == 0) {
+			uint64_t one = 1;
+			_exit(write(waker->Descriptor(), &one, sizeof(one)) ==
+				      sizeof(one)
+				      ? 0
+				      : 1);
+		}
+
+		int status = -1;
+		TEST_CHECK(child > 0 && waitpid(child, &status, 0) == child);
+		TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+		TEST_CHECK(WaitFor([&]() { return drains == i; }, 1000));
+	}
+	// Counted once the drain has returned
+	TEST_CHECK(WaitFor(
+		[&]() { return worker.Stats().signalledWakeups == 5; }, 1000));
+}
+#endif
+
+/* What the pool replaced: a thread per capture, asleep on a condition
+ * variable its waker notifies, with the interval as the wait's timeout */
+class ThreadedCapture {
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool pending = false;
+	bool stopping = false;
+	uint64_t signalledAt = 0;
+	std::shared_ptr<CaptureWaker> waker;
+	std::function<bool()> drain;
+	std::thread thread;
+
+	void Run(uint32_t intervalMs)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!stopping) {
+			wake.wait_for(lock,
+				      std::chrono::milliseconds(intervalMs),
+				      [&]() { return pending || stopping; });
+			if (stopping)
+				break;
+
+			uint64_t since = signalledAt;
+			pending = false;
+			lock.unlock();
+			drain();
+			if (since)
+				maxLatencyNs = std::max(maxLatencyNs.load(),
+							CaptureClockNs() -
+								since);
+			lock.lock();
+		}
+	}
+
+public:
+	std::atomic<uint64_t> maxLatencyNs{0};
+
+	ThreadedCapture(std::shared_ptr<CaptureWaker> waker_,
+			std::function<bool()> drain_, uint32_t intervalMs)
+		: waker(waker_), drain(drain_)
+	{
+		waker->SetListener([this]() {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!pending)
+				signalledAt = CaptureClockNs();
+			pending = true;
+			wake.notify_one();
+		});
+		thread = std::thread(&ThreadedCapture::Run, this, intervalMs);
+	}
+
+	~ThreadedCapture()
+	{
+		waker->SetListener(nullptr);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		thread.join();
+	}
+};
+
+// Signals every capture at once and waits for all of them to be drained
+static double BenchWakeups(std::vector<std::shared_ptr<LocalWaker>> &wakers,
+			   std::atomic<long> &drains)
+{
+	long target = drains;
+	double ns = TestBench(
+		[&]() {
+			target += (long)wakers.size();
+			for (auto &waker : wakers)
+				waker->Signal();
+			while (drains < target)
+				std::this_thread::yield();
+		},
+		200, 3);
+	return ns / wakers.size();
+}
+
+/* Signal to drain latency and what a wakeup costs, on the pool and on a
+ * thread per capture, with every capture signalled at once */
+static void Bench()
+{
+	for (int count : {8, 64}) {
+		std::vector<std::shared_ptr<LocalWaker>> wakers;
+		for (int i = 0; i < count; i++)
+			wakers.push_back(std::make_shared<LocalWaker>());
+		std::atomic<long> drains{0};
+		auto counted = [&]() {
+			drains++;
+			return true;
+		};
+
+		for (size_t threads : {2, 4}) {
+			auto pool = std::make_shared<CapturePool>(threads);
+			std::vector<std::unique_ptr<CaptureWorker>> workers;
+			for (auto &waker : wakers)
+				workers.emplace_back(new CaptureWorker(
+					waker, counted, 10000, pool));
+
+			double ns = BenchWakeups(wakers, drains);
+			uint64_t worst = 0;
+			for (auto &worker : workers)
+				worst = std::max<uint64_t>(
+					worst, worker->Stats().maxLatencyNs);
+			printf("%2d captures, pool of %zu:   %6.0f ns/wakeup, "
+			       "worst latency %.3f ms\n",
+			       count, threads, ns, worst / 1e6);
+		}
+
+		std::vector<std::unique_ptr<ThreadedCapture>> captures;
+		for (auto &waker : wakers)
+			captures.emplace_back(
+				new ThreadedCapture(waker, counted, 10000));
+
+		double ns = BenchWakeups(wakers, drains);
+		uint64_t worst = 0;
+		for (auto &capture : captures)
+			worst = std::max<uint64_t>(worst,
+						   capture->maxLatencyNs);
+		printf("%2d captures, thread each: %6.0f ns/wakeup, "
+		       "worst latency %.3f ms\n",
+		       count, ns, worst / 1e6);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	TestDeadline();
+	TestSignal();
+	TestRemoveWhileRunning();
+	TestChurn();
+	TestStealing();
+	TestZeroInterval();
+#ifdef __linux__
+	TestEventFd();
+#endif
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("capture-worker-test");
+}
@@ -0,0 +1,238 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Channel remixing: the fold-down matrices against ITU-R BS.775, and the
+ * kernels at every SIMD level against the matrix they were built from. */
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "audio/channel-remix.hpp"
+#include "test-helpers.hpp"
+
+#define LAYOUT_STEREO (REMIX_SPEAKER_FL | REMIX_SPEAKER_FR)
+#define LAYOUT_5POINT1                                             \
+	(REMIX_SPEAKER_FL | REMIX_SPEAKER_FR | REMIX_SPEAKER_FC |  \
+	 REMIX_SPEAKER_LFE | REMIX_SPEAKER_BL | REMIX_SPEAKER_BR)
+#define LAYOUT_5POINT1_SIDE                                        \
+	(REMIX_SPEAKER_FL | REMIX_SPEAKER_FR | REMIX_SPEAKER_FC |  \
+	 REMIX_SPEAKER_LFE | REMIX_SPEAKER_SL | REMIX_SPEAKER_SR)
+#define LAYOUT_7POINT1 (LAYOUT_5POINT1 | REMIX_SPEAKER_SL | REMIX_SPEAKER_SR)
+// KSAUDIO_SPEAKER_SURROUND, which OBS calls 4.0
+#define LAYOUT_4POINT0                                             \
+	(REMIX_SPEAKER_FL | REMIX_SPEAKER_FR | REMIX_SPEAKER_FC |  \
+	 REMIX_SPEAKER_BC)
+
+#define K REMIX_MINUS_3DB
+
+/* BS.775 table 2, 3/2 to 2/0: Lo = L + k C + k Ls, Ro = R + k C + k Rs with
+ * k = -3 dB, and the LFE left out. Inputs in mask order. */
+static const float stereoFrom51[2][6] = {{1, 0, K, 0, K, 0},
+					 {0, 1, K, 0, 0, K}};
+
+/* BS.775 table 2, 3/1 to 2/0: the one surround goes to both sides at
+ * -3 dB, like the centre */
+static const float stereoFrom40[2][4] = {{1, 0, K, K}, {0, 1, K, K}};
+
+// 7.1 has both surround pairs and each folds in like the 5.1 one
+static const float stereoFrom71[2][8] = {{1, 0, K, 0, K, 0, K, 0},
+					 {0, 1, K, 0, 0, K, 0, K}};
+
+// 3/2 to 1/0 by way of the stereo fold: M = k (Lo + Ro)
+static const float monoFrom51[1][6] = {{K, K, 2 * K * K, 0, K * K, K * K}};
+
+template <size_t Outputs, size_t Inputs>
+static void CheckMatrix(uint32_t inMask, uint32_t outMask,
+			const float (&expected)[Outputs][Inputs])
+{
+	ChannelRemix remix;
+	TEST_CHECK(remix.Configure(inMask, Inputs, outMask));
+	TEST_CHECK(remix.InputChannels() == Inputs);
+	TEST_CHECK(remix.OutputChannels() == Outputs);
+	TEST_CHECK(!remix.Passthrough());
+
+	for (uint32_t o = 0; o < Outputs; o++) {
+		for (uint32_t i = 0; i < Inputs; i++)
+			TEST_CHECK_NEAR(remix.Coefficient(o, i),
+					expected[o][i], 1e-6);
+	}
+}
+
+static void TestFoldDown()
+{
+	CheckMatrix(LAYOUT_5POINT1, LAYOUT_STEREO, stereoFrom51);
+	CheckMatrix(LAYOUT_5POINT1_SIDE, LAYOUT_STEREO, stereoFrom51);
+	CheckMatrix(LAYOUT_7POINT1, LAYOUT_STEREO, stereoFrom71);
+	CheckMatrix(LAYOUT_5POINT1, REMIX_SPEAKER_FC, monoFrom51);
+
+	// Zero masks fall back to the layout OBS would assume
+	CheckMatrix(0, LAYOUT_STEREO, stereoFrom51);
+	CheckMatrix(LAYOUT_4POINT0, LAYOUT_STEREO, stereoFrom40);
+	CheckMatrix(0, LAYOUT_STEREO, stereoFrom40);
+	TEST_CHECK(ChannelRemix::DefaultMask(4) == LAYOUT_4POINT0);
+
+	// A surround pair takes the back centre between them
+	static const float fiveFrom40[6][4] = {
+		{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0},
+		{0, 0, 0, 0}, {0, 0, 0, K}, {0, 0, 0, K}};
+	CheckMatrix(LAYOUT_4POINT0, LAYOUT_5POINT1, fiveFrom40);
+
+	static const float monoFromStereo[1][2] = {{K, K}};
+	static const float stereoFromMono[2][1] = {{K}, {K}};
+	CheckMatrix(LAYOUT_STEREO, REMIX_SPEAKER_FC, monoFromStereo);
+	CheckMatrix(REMIX_SPEAKER_FC, LAYOUT_STEREO, stereoFromMono);
+
+	// Surrounds go to whichever pair the output has, at unity
+	static const float sideFromBack[6][6] = {
+		{1, 0, 0, 0, 0, 0}, {0, 1, 0, 0, 0, 0}, {0, 0, 1, 0, 0, 0},
+		{0, 0, 0, 1, 0, 0}, {0, 0, 0, 0, 1, 0}, {0, 0, 0, 0, 0, 1}};
+	CheckMatrix(LAYOUT_5POINT1, LAYOUT_5POINT1_SIDE, sideFromBack);
+
+	ChannelRemix remix;
+	TEST_CHECK(remix.Configure(LAYOUT_5POINT1, 6, LAYOUT_5POINT1));
+	TEST_CHECK(remix.Passthrough());
+	TEST_CHECK(!remix.Configure(LAYOUT_STEREO, 0, LAYOUT_STEREO));
+}
+
+// A full-scale signal in every channel stays within the fold's own gain
+static void TestFoldDownLevel()
+{
+	ChannelRemix remix;
+	TEST_CHECK(remix.Configure(LAYOUT_5POINT1, 6, LAYOUT_STEREO));
+
+	float sum = 0.0f;
+	for (uint32_t i = 0; i < 6; i++)
+		sum += remix.Coefficient(0, i);
+	TEST_CHECK_NEAR(sum, 1.0 + 2.0 * K, 1e-6);
+
+	// LFE reaches neither side
+	TEST_CHECK(remix.Coefficient(0, 3) == 0.0f);
+	TEST_CHECK(remix.Coefficient(1, 3) == 0.0f);
+}
+
+static void TestKernels(std::mt19937 &rng)
+{
+	// Input mask, its channel count, output mask
+	static const uint32_t layouts[][3] = {
+		{LAYOUT_5POINT1, 6, LAYOUT_STEREO},
+		{LAYOUT_7POINT1, 8, LAYOUT_STEREO},
+		{LAYOUT_STEREO, 2, LAYOUT_7POINT1},
+		{REMIX_SPEAKER_FC, 1, LAYOUT_STEREO},
+		{LAYOUT_4POINT0, 4, LAYOUT_STEREO},
+		{LAYOUT_7POINT1, 8, LAYOUT_5POINT1_SIDE},
+	};
+	std::uniform_real_distribution<float> sample(-1.0f, 1.0f);
+
+	for (auto &layout : layouts) {
+		for (size_t frames : {0, 1, 3, 8, 17, 480, 1021}) {
+			ChannelRemix reference;
+			TEST_CHECK(reference.Configure(layout[0], layout[1],
+						       layout[2],
+						       SimdLevel::SCALAR));
+			uint32_t inChannels = reference.InputChannels();
+			uint32_t outChannels = reference.OutputChannels();
+
+			std::vector<std::vector<float>> in(
+				inChannels, std::vector<float>(frames));
+			std::vector<const float *> inPtr;
+			for (auto &plane : in) {
+				for (float &v : plane)
+					v = sample(rng);
+				inPtr.push_back(plane.data());
+			}
+
+			for (int level = 0; level < TestSimdLevels();
+			     level++) {
+				ChannelRemix remix;
+				remix.Configure(layout[0], layout[1],
+						layout[2],
+						static_cast<SimdLevel>(level));
+
+				std::vector<std::vector<float>> out(
+					outChannels,
+					std::vector<float>(frames + 1, 9.0f));
+				std::vector<float *> outPtr;
+				for (auto &plane : out)
+					outPtr.push_back(plane.data());
+
+				remix.Process(inPtr.data(), outPtr.data(),
+					      frames);
+
+				double worst = 0.0;
+				for (uint32_t o = 0; o < outChannels; o++) {
+					for (size_t f = 0; f < frames; f++) {
+						double v = 0.0;
+						for (uint32_t i = 0;
+						     i < inChannels; i++)
+							v += remix.Coefficient(
+								     o, i) *
+							     in[i][f];
+						worst = std::max(
+							worst,
+							std::fabs(out[o][f] -
+								  v));
+					}
+					TEST_CHECK(out[o][frames] == 9.0f);
+				}
+				TEST_CHECK(worst < 1e-5);
+			}
+		}
+	}
+}
+
+static void Bench()
+{
+	const size_t frames = 480;
+	std::vector<std::vector<float>> in(8, std::vector<float>(frames));
+	std::vector<std::vector<float>> out(2, std::vector<float>(frames));
+	std::vector<const float *> inPtr;
+	std::vector<float *> outPtr;
+	for (auto &plane : in)
+		inPtr.push_back(plane.data());
+	for (auto &plane : out)
+		outPtr.push_back(plane.data());
+
+	for (int level = 0; level < TestSimdLevels(); level++) {
+		ChannelRemix remix;
+		remix.Configure(LAYOUT_7POINT1, 8, LAYOUT_STEREO,
+				static_cast<SimdLevel>(level));
+		double ns = TestBench(
+			[&]() {
+				remix.Process(inPtr.data(), outPtr.data(),
+					      frames);
+			},
+			20000);
+		printf("7.1 to stereo %-6s %.3f ns/frame\n",
+		       TestSimdName(level), ns / frames);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::mt19937 rng(3);
+
+	TestFoldDown();
+	TestFoldDownLevel();
+	TestKernels(rng);
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("channel-remix-test");
+}
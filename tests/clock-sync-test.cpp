@@ -0,0 +1,260 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* The delay-locked loop against a simulated device: a known drift under
+ * scheduling jitter has to be found and followed without the jitter
+ * reaching the timeline, and a step in the device's clock has to resync
+ * rather than be slewed out over seconds. */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "capture/clock-sync.hpp"
+#include "test-helpers.hpp"
+
+#define RATE 48000
+#define PACKET_FRAMES 480
+#define NOMINAL_NS (1000000000.0 / RATE)
+
+/* A device whose clock runs `ppm` off ours, handing over 10 ms packets
+ * stamped up to `jitterNs` either side of when they really started */
+struct FakeDevice {
+	double nsPerFrame;
+	double time = 1000000000.0;
+	std::mt19937 rng;
+	std::uniform_real_distribution<double> jitter;
+
+	FakeDevice(double ppm, double jitterNs, unsigned seed)
+		: nsPerFrame(NOMINAL_NS * (1.0 + ppm / 1000000.0)),
+		  rng(seed),
+		  jitter(-jitterNs, jitterNs)
+	{
+	}
+
+	double PacketNs() const { return PACKET_FRAMES * nsPerFrame; }
+
+	// The true start of the packet Next() is about to hand over
+	double Truth() const { return time; }
+
+	uint64_t Next()
+	{
+		uint64_t stamped = static_cast<uint64_t>(time + jitter(rng));
+		time += PacketNs();
+		return stamped;
+	}
+};
+
+struct Worst {
+	double error = 0.0;
+	double step = 0.0;
+	double drift = 0.0;
+	double skew = 0.0;
+	double skewStep = 0.0;
+	double squared = 0.0;
+	int count = 0;
+};
+
+/* Feeds `packets` packets. Once `settle` have gone by, records how far the
+ * timeline, its steps, the drift and the skew get from the truth. */
+static Worst Run(ClockSync &sync, FakeDevice &device, double ppm,
+		 int packets, int settle)
+{
+	Worst worst;
+	double lastOut = 0.0;
+	int64_t lastSkew = 0;
+	double origin = device.Truth();
+
+	for (int i = 0; i < packets; i++) {
+		double truth = device.Truth();
+		double out = static_cast<double>(
+			sync.Update(device.Next(), PACKET_FRAMES));
+
+		/* SkewNs() is where the next packet should start against
+		 * where the nominal rate puts it */
+		double elapsed = truth + device.PacketNs() - origin;
+		double skew = elapsed * ppm / (1000000.0 + ppm);
+		double skewStep = device.PacketNs() * ppm / (1000000.0 + ppm);
+
+		if (i >= settle) {
+			double error = out - truth;
+			worst.error = std::max(worst.error, std::fabs(error));
+			worst.squared += error * error;
+			worst.count++;
+			worst.step = std::max(
+				worst.step,
+				std::fabs(out - lastOut - device.PacketNs()));
+			worst.drift = std::max(worst.drift,
+					       std::fabs(sync.DriftPpm() - ppm));
+			worst.skew = std::max(worst.skew,
+					      std::fabs(sync.SkewNs() - skew));
+			worst.skewStep = std::max(
+				worst.skewStep,
+				std::fabs(sync.SkewNs() - lastSkew - skewStep));
+		}
+		lastOut = out;
+		lastSkew = sync.SkewNs();
+	}
+	return worst;
+}
+
+// Without jitter the loop has nothing to filter and has to be exact
+static void TestClean()
+{
+	for (double ppm : {-300.0, 0.0, 120.0}) {
+		ClockSync sync;
+		sync.Reset(RATE);
+		FakeDevice device(ppm, 0.0, 1);
+		Worst worst = Run(sync, device, ppm, 12000, 6000);
+
+		TEST_CHECK(sync.Locked());
+		TEST_CHECK(worst.error < 1000.0);
+		TEST_CHECK(worst.step < 1000.0);
+		TEST_CHECK_NEAR(sync.DriftPpm(), ppm, 0.5);
+		TEST_CHECK(worst.skew < 1000.0);
+		TEST_CHECK(sync.Resyncs() == 0);
+	}
+}
+
+/* ±1 ms of jitter on 10 ms packets, which is about what a busy machine's
+ * scheduling does to the hook */
+static void TestJitter()
+{
+	const double jitterNs = 1000000.0;
+
+	for (double ppm : {-300.0, -40.0, 0.0, 25.0, 500.0}) {
+		ClockSync sync;
+		sync.Reset(RATE);
+		FakeDevice device(ppm, jitterNs, 11);
+
+		// Two minutes, judged after the first
+		Worst worst = Run(sync, device, ppm, 12000, 6000);
+		double rms = std::sqrt(worst.squared / worst.count);
+
+		// Uniform jitter is jitterNs / sqrt(3) rms going in
+		TEST_CHECK(rms < jitterNs / std::sqrt(3.0) / 3.0);
+		TEST_CHECK(worst.error < jitterNs / 2.0);
+		// 10 ms steps stay within 0.1 ms of the device's own
+		TEST_CHECK(worst.step < 100000.0);
+		TEST_CHECK(worst.drift < 40.0);
+		// Plus the jitter on the packet it locked to
+		TEST_CHECK(worst.skew < jitterNs * 1.5);
+		TEST_CHECK(worst.skewStep < 100000.0);
+		TEST_CHECK(sync.Resyncs() == 0);
+
+		if (worst.drift >= 40.0 || worst.error >= jitterNs / 2.0)
+			fprintf(stderr,
+				"%g ppm: drift off by %.1f, error %.0f ns\n",
+				ppm, worst.drift, worst.error);
+	}
+}
+
+// A clock further off than the loop will believe is held at the limit
+static void TestDriftLimit()
+{
+	ClockSync sync;
+	sync.Reset(RATE);
+	FakeDevice device(5000.0, 0.0, 1);
+	Run(sync, device, 5000.0, 12000, 12000);
+
+	TEST_CHECK_NEAR(sync.DriftPpm(), 1000.0, 1.0);
+	TEST_CHECK(sync.Resyncs() == 0);
+}
+
+/* Stalls and clock changes: anything past the resync limit restarts the
+ * timeline where the device now is, anything under it is slewed */
+static void TestSteps()
+{
+	const double ppm = 80.0;
+	ClockSync sync(0.5, 100);
+	sync.Reset(RATE);
+	FakeDevice device(ppm, 500000.0, 5);
+	Run(sync, device, ppm, 3000, 3000);
+	TEST_CHECK(sync.Resyncs() == 0);
+
+	for (double jump : {250000000.0, -200000000.0, 150000000.0}) {
+		uint64_t resyncs = sync.Resyncs();
+		device.time += jump;
+
+		// Handed back as it came rather than eased towards
+		uint64_t stamped = device.Next();
+		TEST_CHECK(sync.Update(stamped, PACKET_FRAMES) == stamped);
+		TEST_CHECK(sync.Resyncs() == resyncs + 1);
+		TEST_CHECK(sync.Locked());
+
+		// And back on the device's time within a second or so
+		Worst worst = Run(sync, device, ppm, 1000, 200);
+		TEST_CHECK(worst.error < 500000.0);
+		TEST_CHECK(worst.step < 100000.0);
+		TEST_CHECK(sync.Resyncs() == resyncs + 1);
+	}
+
+	// 20 ms is jitter to a loop that resyncs at 100 ms
+	uint64_t resyncs = sync.Resyncs();
+	device.time += 20000000.0;
+	Worst worst = Run(sync, device, ppm, 3000, 1500);
+	TEST_CHECK(sync.Resyncs() == resyncs);
+	TEST_CHECK(worst.error < 500000.0);
+}
+
+// Unknown rates and empty packets go straight through
+static void TestPassthrough()
+{
+	ClockSync sync;
+	TEST_CHECK(sync.Update(12345, PACKET_FRAMES) == 12345);
+	TEST_CHECK(!sync.Locked());
+
+	sync.Reset(RATE);
+	TEST_CHECK(sync.Update(1000000, 0) == 1000000);
+	TEST_CHECK(!sync.Locked());
+	TEST_CHECK(sync.Update(1000000, PACKET_FRAMES) == 1000000);
+	TEST_CHECK(sync.Locked());
+	TEST_CHECK(sync.SkewNs() == 0);
+
+	sync.Reset(0);
+	TEST_CHECK(!sync.Locked());
+	TEST_CHECK(sync.Update(777, PACKET_FRAMES) == 777);
+	TEST_CHECK(sync.DriftPpm() == 0.0);
+}
+
+static void Bench()
+{
+	ClockSync sync;
+	sync.Reset(RATE);
+	FakeDevice device(50.0, 1000000.0, 3);
+	volatile uint64_t sink = 0;
+
+	double ns = TestBench(
+		[&]() { sink = sync.Update(device.Next(), PACKET_FRAMES); },
+		1000000);
+	printf("update: %.1f ns/packet\n", ns);
+}
+
+int main(int argc, char **argv)
+{
+	TestClean();
+	TestJitter();
+	TestDriftLimit();
+	TestSteps();
+	TestPassthrough();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("clock-sync-test");
+}
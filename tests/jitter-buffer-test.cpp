@@ -0,0 +1,319 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* The jitter buffer on made up arrival traces: steady and jittery
+ * delivery, a hitch covered with silence and slowly squeezed back out,
+ * blocks too old to play, blocks out of order and a session going quiet.
+ * Whatever arrives, output is never stamped in the past and never
+ * overlaps itself. */
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "capture/frame-pool.hpp"
+#include "capture/jitter-buffer.hpp"
+#include "test-helpers.hpp"
+
+#define MS 1000000ULL
+#define BLOCK_FRAMES 480
+#define BLOCK_NS (10 * MS)
+// Capture clock time of the first block
+#define T0 1000000000ULL
+
+// Output as OBS would see it, checked one block at a time
+struct Timeline {
+	JitterBuffer jitter;
+	FramePool pool;
+	std::vector<float> ramp;
+
+	uint64_t end = 0;
+	uint32_t overlaps = 0;
+	uint32_t gaps = 0;
+	uint32_t inPast = 0;
+	uint32_t concealedLate = 0;
+	uint32_t squeezed = 0;
+	uint32_t loudSilence = 0;
+	uint64_t lastStamp = 0;
+
+	Timeline() : ramp(BLOCK_FRAMES)
+	{
+		for (uint32_t i = 0; i < BLOCK_FRAMES; i++)
+			ramp[i] = 0.1f + i * 0.001f;
+		pool.Configure(2, 48000);
+		jitter.Configure(2, 48000);
+	}
+
+	void Check(const CaptureOutput &output, uint64_t now, bool audio)
+	{
+		// Within a microsecond, block ends are rounded to the ns
+		if (end && output.timestamp + 1000 < end)
+			overlaps++;
+		if (end && output.timestamp > end + 1000)
+			gaps++;
+		/* Audio never goes out stamped in the past. Silence picks up
+		 * where output left off, at most one wakeup after that. */
+		if (audio && output.timestamp < now)
+			inPast++;
+		if (!audio && output.timestamp + BLOCK_NS < now)
+			concealedLate++;
+		end = output.timestamp +
+		      output.frames * 1000000000ULL / output.samplesPerSec;
+		lastStamp = output.timestamp;
+	}
+
+	// Block `index` of the trace, arriving at `arrival`
+	bool Deliver(uint64_t index, uint64_t arrival)
+	{
+		CaptureOutput input = {};
+		input.channels = 2;
+		input.frames = BLOCK_FRAMES;
+		input.samplesPerSec = 48000;
+		input.timestamp = T0 + index * BLOCK_NS;
+		input.data[0] = input.data[1] = ramp.data();
+
+		CaptureOutput output;
+		jitter.Process(input, arrival, pool, output);
+		if (!output.frames)
+			return false;
+
+		Check(output, arrival, true);
+		if (output.buffer) {
+			TEST_CHECK(output.frames < BLOCK_FRAMES);
+			squeezed++;
+		} else {
+			TEST_CHECK(output.data[0] == ramp.data());
+		}
+		pool.Release(output.buffer);
+		return true;
+	}
+
+	// What the worker does each time it wakes, returns frames concealed
+	uint64_t Conceal(uint64_t now, uint64_t ahead = BLOCK_NS)
+	{
+		uint64_t frames = 0;
+		CaptureOutput output;
+		while (jitter.Conceal(now, ahead, pool, output)) {
+			Check(output, now, false);
+			for (uint32_t i = 0; i < output.frames; i++)
+				if (output.data[0][i] || output.data[1][i])
+					loudSilence++;
+			frames += output.frames;
+			pool.Release(output.buffer);
+		}
+		return frames;
+	}
+};
+
+static void TestSteady()
+{
+	Timeline line;
+	for (uint64_t i = 0; i < 300; i++) {
+		TEST_CHECK(line.Deliver(i, T0 + i * BLOCK_NS + MS));
+		TEST_CHECK(line.Conceal(T0 + i * BLOCK_NS + MS) == 0);
+	}
+
+	// A ms of age and the 2 ms margin, nothing more
+	TEST_CHECK_NEAR(line.jitter.DelayNs(), 3.0 * MS, 1000.0);
+	TEST_CHECK(line.jitter.Settled());
+	TEST_CHECK(line.overlaps == 0 && line.gaps == 0 && line.inPast == 0);
+	TEST_CHECK(line.squeezed == 0);
+	TEST_CHECK(line.jitter.Stats().blocks == 300);
+	TEST_CHECK(line.jitter.Stats().late == 0);
+}
+
+static void TestJitter()
+{
+	Timeline line;
+	std::mt19937 rng(3);
+	std::uniform_int_distribution<uint64_t> age(0, 8 * MS);
+
+	uint64_t arrival = 0;
+	for (uint64_t i = 0; i < 2000; i++) {
+		// Delivered in order, however late each one is
+		uint64_t late = T0 + i * BLOCK_NS + age(rng);
+		arrival = std::max(arrival, late);
+		line.Deliver(i, arrival);
+		line.Conceal(arrival);
+	}
+
+	const JitterBufferStats &stats = line.jitter.Stats();
+	TEST_CHECK(line.overlaps == 0 && line.inPast == 0);
+	// Each time it starts over further out leaves a gap, nothing else
+	TEST_CHECK(line.gaps == stats.late);
+	TEST_CHECK(stats.late < 10);
+	TEST_CHECK(stats.droppedFrames == 0 || line.squeezed > 0);
+	// Just over the worst age seen
+	TEST_CHECK(line.jitter.TargetNs() >= 8 * MS);
+	TEST_CHECK(line.jitter.TargetNs() <= 10 * MS + 1);
+	TEST_CHECK(line.jitter.DelayNs() <= 20 * MS);
+	// Mean deviation of an even spread over 8 ms is 2 ms
+	TEST_CHECK_NEAR(line.jitter.JitterNs(), 2.0 * MS, 0.5 * MS);
+}
+
+// Returns the delay right after the held blocks turned up
+static uint64_t RunHitch(Timeline &line, uint64_t ticks)
+{
+	// Blocks 100 to 105 are held up and all arrive at once with 106
+	uint64_t afterBurst = 0;
+	for (uint64_t k = 0; k < ticks; k++) {
+		uint64_t now = T0 + k * BLOCK_NS + MS;
+		if (k < 100 || k > 105) {
+			for (uint64_t i = k == 106 ? 100 : k; i <= k; i++)
+				line.Deliver(i, now);
+		}
+		if (k == 106)
+			afterBurst = line.jitter.DelayNs();
+		line.Conceal(now);
+	}
+	return afterBurst;
+}
+
+static void TestHitch()
+{
+	Timeline line;
+	uint64_t afterBurst = RunHitch(line, 1700);
+	const JitterBufferStats &stats = line.jitter.Stats();
+
+	// Covered with silence on time, picked up right after it
+	TEST_CHECK(stats.concealedFrames >= 50 * 48);
+	TEST_CHECK(stats.concealedFrames <= 70 * 48);
+	TEST_CHECK(line.loudSilence == 0);
+	TEST_CHECK(line.overlaps == 0 && line.gaps == 0 && line.inPast == 0);
+	TEST_CHECK(line.concealedLate == 0);
+	TEST_CHECK(stats.late == 0 && stats.restarts == 0);
+	TEST_CHECK(afterBurst > 55 * MS);
+
+	/* Then squeezed back out, a little from each block, until it's
+	 * within the margin of the target */
+	TEST_CHECK(line.squeezed > 500);
+	TEST_CHECK(stats.droppedFrames + 2 * 48 >= stats.concealedFrames);
+	TEST_CHECK(stats.droppedFrames <= 1700 * BLOCK_FRAMES / 100);
+	TEST_CHECK(line.jitter.Settled());
+	TEST_CHECK_NEAR(line.jitter.DelayNs(), 3.0 * MS, 2.0 * MS);
+}
+
+static void TestTooOld()
+{
+	Timeline line;
+	TEST_CHECK(line.Deliver(0, T0 + MS));
+
+	// Past the most delay there can be, there's no playing it
+	TEST_CHECK(!line.Deliver(1, T0 + BLOCK_NS + 300 * MS));
+	TEST_CHECK(line.jitter.Stats().droppedFrames == BLOCK_FRAMES);
+	TEST_CHECK(line.jitter.Stats().blocks == 2);
+
+	uint64_t timestamp = T0 + 2 * BLOCK_NS;
+	TEST_CHECK(!line.jitter.Retime(BLOCK_FRAMES, timestamp + 300 * MS,
+				       timestamp));
+}
+
+static void TestReorder()
+{
+	// 30 ms overtakes 20 ms, which turns up just after it
+	static const uint64_t order[] = {0, 1, 3, 2, 4, 5};
+	static const uint64_t arrival[] = {1, 11, 31, 31, 41, 51};
+
+	Timeline line;
+	JitterBuffer retime;
+	retime.Configure(2, 48000);
+	uint64_t stamps[6] = {};
+
+	for (int i = 0; i < 6; i++) {
+		uint64_t now = T0 + arrival[i] * MS + i * 1000;
+		bool played = line.Deliver(order[i], now);
+		TEST_CHECK(played == (order[i] != 2));
+		stamps[order[i]] = line.lastStamp;
+
+		// Output that can't be touched is placed just the same
+		uint64_t timestamp = T0 + order[i] * BLOCK_NS;
+		TEST_CHECK(retime.Retime(BLOCK_FRAMES, now, timestamp) ==
+			   played);
+		if (played)
+			TEST_CHECK(timestamp == line.lastStamp);
+	}
+
+	// Dropped rather than played over the block that overtook it
+	const JitterBufferStats &stats = line.jitter.Stats();
+	TEST_CHECK(stats.late == 1);
+	TEST_CHECK(stats.droppedFrames == BLOCK_FRAMES);
+	TEST_CHECK(line.overlaps == 0 && line.inPast == 0);
+	// The hole it leaves is the only gap, and nothing starts over twice
+	TEST_CHECK(line.gaps == 1 && stats.restarts == 1);
+	TEST_CHECK(stamps[4] == stamps[3] + BLOCK_NS);
+	TEST_CHECK(stamps[5] == stamps[4] + BLOCK_NS);
+}
+
+static void TestQuiet()
+{
+	Timeline line;
+	for (uint64_t i = 0; i < 50; i++) {
+		line.Deliver(i, T0 + i * BLOCK_NS + MS);
+		line.Conceal(T0 + i * BLOCK_NS + MS);
+	}
+
+	// Two seconds of nothing: silence only up to the maximum delay
+	for (uint64_t k = 50; k < 250; k++)
+		line.Conceal(T0 + k * BLOCK_NS + MS);
+	const JitterBufferStats &stats = line.jitter.Stats();
+	TEST_CHECK(stats.concealedFrames == 250 * 48);
+
+	// and coming back is a fresh start, a gap rather than a hitch
+	TEST_CHECK(line.Deliver(250, T0 + 250 * BLOCK_NS + MS));
+	TEST_CHECK(stats.restarts == 1 && stats.late == 0);
+	TEST_CHECK(line.gaps == 1 && line.overlaps == 0);
+	TEST_CHECK_NEAR(line.lastStamp, T0 + 250 * BLOCK_NS + 3 * MS, 1000.0);
+}
+
+static void Bench()
+{
+	Timeline steady;
+	uint64_t i = 0;
+	double ns = TestBench(
+		[&]() {
+			uint64_t now = T0 + i * BLOCK_NS + MS;
+			steady.Deliver(i++, now);
+			steady.Conceal(now);
+		},
+		100000);
+	printf("steady delivery: %.1f ns/block\n", ns);
+
+	// Hitches and the squeezing that follows them
+	double hitch = TestBench(
+		[]() {
+			Timeline line;
+			RunHitch(line, 1700);
+		},
+		1);
+	printf("hitch and recovery: %.1f ns/block\n", hitch / 1700);
+}
+
+int main(int argc, char **argv)
+{
+	TestSteady();
+	TestJitter();
+	TestHitch();
+	TestTooOld();
+	TestReorder();
+	TestQuiet();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("jitter-buffer-test");
+}
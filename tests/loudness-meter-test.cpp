@@ -0,0 +1,275 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* BS.1770 conformance of the loudness meter, along the lines of EBU Tech
+ * 3341: steady sines read at their known loudness at every rate and SIMD
+ * level, channels are weighted as the standard says, the windows forget
+ * at the right time, and true peak finds what falls between samples. */
+
+#include <cmath>
+#include <vector>
+
+#include "audio/loudness-meter.hpp"
+#include "test-helpers.hpp"
+
+static const double pi = 3.14159265358979323846;
+
+static const float stereo[] = {1.0f, 1.0f};
+// L R C LFE Ls Rs
+static const float surround[] = {1.0f, 1.0f, 1.0f, 0.0f, 1.41f, 1.41f};
+
+// Planar channels, each one a sine or silent
+struct Signal {
+	std::vector<std::vector<float>> planes;
+	std::vector<const float *> data;
+
+	Signal(uint32_t channels, uint32_t frames)
+		: planes(channels, std::vector<float>(frames)), data(channels)
+	{
+		for (uint32_t c = 0; c < channels; c++)
+			data[c] = planes[c].data();
+	}
+
+	void Sine(uint32_t channel, double db, double hz,
+		  uint32_t samplesPerSec, double phase = 0.0)
+	{
+		double amplitude = std::pow(10.0, db / 20.0);
+		std::vector<float> &plane = planes[channel];
+		for (size_t i = 0; i < plane.size(); i++)
+			plane[i] = static_cast<float>(
+				amplitude *
+				std::sin(2.0 * pi * hz * i / samplesPerSec +
+					 phase));
+	}
+};
+
+// The whole signal, `chunk` frames at a time
+static void Run(LoudnessMeter &meter, const Signal &signal,
+		uint32_t chunk)
+{
+	uint32_t frames = static_cast<uint32_t>(signal.planes[0].size());
+	std::vector<const float *> at(signal.data.size());
+	for (uint32_t done = 0; done < frames; done += chunk) {
+		for (size_t c = 0; c < at.size(); c++)
+			at[c] = signal.data[c] + done;
+		meter.Process(at.data(), std::min(chunk, frames - done));
+	}
+}
+
+static float Loudness(uint32_t channels, const float *weights,
+		      uint32_t samplesPerSec, SimdLevel level,
+		      const Signal &signal)
+{
+	LoudnessMeter meter;
+	meter.Configure(channels, samplesPerSec, weights, level);
+	Run(meter, signal, samplesPerSec / 100);
+	return meter.ShortTerm();
+}
+
+static void TestSines(int level)
+{
+	static const uint32_t rates[] = {44100, 48000, 96000};
+	SimdLevel simd = static_cast<SimdLevel>(level);
+
+	for (uint32_t rate : rates) {
+		// Whole 100 ms blocks, 4 s so short-term is full
+		Signal signal(2, rate * 4);
+		signal.Sine(0, -20.0, 1000.0, rate);
+		signal.Sine(1, -20.0, 1000.0, rate);
+
+		LoudnessMeter meter;
+		meter.Configure(2, rate, stereo, simd);
+		Run(meter, signal, rate / 100);
+		TEST_CHECK_NEAR(meter.Momentary(), -20.0, 0.1);
+		TEST_CHECK_NEAR(meter.ShortTerm(), -20.0, 0.1);
+		// A sine's RMS is 3 dB under its peak
+		TEST_CHECK_NEAR(meter.Rms(), -23.01, 0.01);
+		TEST_CHECK_NEAR(meter.TruePeak(), -20.0, 0.1);
+
+		// Tech 3341 case 1: -23 dBFS in both channels is -23 LUFS
+		signal.Sine(0, -23.0, 1000.0, rate);
+		signal.Sine(1, -23.0, 1000.0, rate);
+		TEST_CHECK_NEAR(Loudness(2, stereo, rate, simd, signal),
+				-23.0, 0.1);
+
+		// One channel of two is half the power
+		signal.Sine(0, -20.0, 1000.0, rate);
+		signal.Sine(1, -200.0, 1000.0, rate);
+		TEST_CHECK_NEAR(Loudness(2, stereo, rate, simd, signal),
+				-23.0, 0.1);
+	}
+}
+
+static void TestWeighting(int level)
+{
+	SimdLevel simd = static_cast<SimdLevel>(level);
+	const uint32_t rate = 48000;
+
+	// One sine per channel in turn: fronts as is, surrounds +1.5 dB
+	static const double expected[] = {-23.0, -23.0, -23.0,
+					  -INFINITY, -21.5, -21.5};
+	for (uint32_t c = 0; c < 6; c++) {
+		Signal signal(6, rate * 3);
+		signal.Sine(c, -20.0, 1000.0, rate);
+		float lufs = Loudness(6, surround, rate, simd, signal);
+		if (std::isinf(expected[c]))
+			TEST_CHECK(std::isinf(lufs) && lufs < 0);
+		else
+			TEST_CHECK_NEAR(lufs, expected[c], 0.1);
+	}
+
+	// K-weighting: lows rolled off, highs lifted by the shelf
+	Signal low(1, rate * 3), high(1, rate * 3), mid(1, rate * 3);
+	low.Sine(0, -20.0, 25.0, rate);
+	mid.Sine(0, -20.0, 1000.0, rate);
+	high.Sine(0, -20.0, 10000.0, rate);
+	float reference = Loudness(1, stereo, rate, simd, mid);
+	TEST_CHECK_NEAR(reference, -23.0, 0.1);
+	TEST_CHECK(Loudness(1, stereo, rate, simd, low) < reference - 10.0f);
+	TEST_CHECK_NEAR(Loudness(1, stereo, rate, simd, high) - reference,
+			3.3, 0.2);
+}
+
+static void TestWindows()
+{
+	const uint32_t rate = 48000;
+	Signal tone(2, rate), quiet(2, rate / 10);
+	tone.Sine(0, -20.0, 1000.0, rate);
+	tone.Sine(1, -20.0, 1000.0, rate);
+
+	LoudnessMeter meter;
+	meter.Configure(2, rate, stereo);
+	Run(meter, tone, 480);
+
+	/* Four quiet blocks take momentary down to the filter's own ringing,
+	 * a couple more and that's gone too. Short-term holds on for 3 s. */
+	for (int block = 1; block <= 31; block++) {
+		Run(meter, quiet, 480);
+		if (block == 3)
+			TEST_CHECK(meter.Momentary() > -30.0f);
+		if (block == 5) {
+			TEST_CHECK(meter.Momentary() < -200.0f);
+			// A second of tone over one and a half
+			TEST_CHECK_NEAR(meter.ShortTerm(),
+					-20.0 + 10.0 * std::log10(10.0 / 15.0),
+					0.1);
+		}
+		if (block == 7)
+			TEST_CHECK(std::isinf(meter.Momentary()));
+		if (block == 29) {
+			TEST_CHECK(meter.ShortTerm() > -40.0f);
+			TEST_CHECK_NEAR(meter.TruePeak(), -20.0, 0.1);
+		}
+	}
+	TEST_CHECK(meter.ShortTerm() < -200.0f);
+	TEST_CHECK(std::isinf(meter.TruePeak()));
+
+	// Until the window fills it covers just the blocks there are
+	meter.Reset();
+	Signal brief(2, rate / 5);
+	brief.Sine(0, -20.0, 1000.0, rate);
+	brief.Sine(1, -20.0, 1000.0, rate);
+	Run(meter, brief, 480);
+	TEST_CHECK_NEAR(meter.ShortTerm(), -20.0, 0.2);
+}
+
+static void TestTruePeak(int level)
+{
+	SimdLevel simd = static_cast<SimdLevel>(level);
+	const uint32_t rate = 48000;
+
+	/* A quarter the rate, 45 degrees out: every sample lands at 0.707
+	 * of the peak, which is 3 dB more than any sample shows */
+	Signal signal(2, rate);
+	signal.Sine(0, -6.0, rate / 4.0, rate, pi / 4);
+	signal.Sine(1, -6.0, rate / 4.0, rate, pi / 4);
+
+	LoudnessMeter meter;
+	meter.Configure(2, rate, stereo, simd);
+	Run(meter, signal, 480);
+	TEST_CHECK_NEAR(meter.TruePeak(), -6.0, 0.6);
+	TEST_CHECK_NEAR(meter.Rms(), -9.0, 0.1);
+}
+
+// However it's chunked and whatever the level, the readings agree
+static void TestConsistency()
+{
+	const uint32_t rate = 44100;
+	Signal signal(6, rate * 2);
+	for (uint32_t c = 0; c < 6; c++)
+		signal.Sine(c, -10.0 - 3.0 * c, 200.0 * (c + 1), rate, c);
+
+	LoudnessMeter reference;
+	reference.Configure(6, rate, surround, SimdLevel::SCALAR);
+	Run(reference, signal, rate / 100);
+
+	for (int level = 0; level < TestSimdLevels(); level++) {
+		for (uint32_t chunk : {1u, 7u, 441u, 4410u, 10000u}) {
+			LoudnessMeter meter;
+			meter.Configure(6, rate, surround,
+					static_cast<SimdLevel>(level));
+			Run(meter, signal, chunk);
+			TEST_CHECK_NEAR(meter.Momentary(),
+					reference.Momentary(), 0.01);
+			TEST_CHECK_NEAR(meter.ShortTerm(),
+					reference.ShortTerm(), 0.01);
+			TEST_CHECK_NEAR(meter.Rms(), reference.Rms(), 0.01);
+			TEST_CHECK_NEAR(meter.TruePeak(), reference.TruePeak(),
+					0.01);
+		}
+	}
+}
+
+static void Bench()
+{
+	const uint32_t rate = 48000;
+	for (uint32_t channels : {2u, 6u}) {
+		Signal signal(channels, 480);
+		for (uint32_t c = 0; c < channels; c++)
+			signal.Sine(c, -20.0, 997.0, rate);
+
+		for (int level = 0; level < TestSimdLevels(); level++) {
+			LoudnessMeter meter;
+			meter.Configure(channels, rate, surround,
+					static_cast<SimdLevel>(level));
+			double ns = TestBench(
+				[&]() {
+					meter.Process(signal.data.data(), 480);
+				},
+				20000);
+			printf("%-6s %u channels, 10 ms: %.0f ns\n",
+			       TestSimdName(level), channels, ns);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	for (int level = 0; level < TestSimdLevels(); level++) {
+		TestSines(level);
+		TestWeighting(level);
+		TestTruePeak(level);
+	}
+	TestWindows();
+	TestConsistency();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("loudness-meter-test");
+}
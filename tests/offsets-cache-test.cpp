@@ -0,0 +1,252 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* The offsets cache against an in-memory store and a module whose
+ * identity the test decides: hits, misses when audioses.dll's version or
+ * contents change, and failed resolves that must never be kept. */
+
+#include <map>
+
+#include "capture/offsets-cache.hpp"
+#include "test-helpers.hpp"
+
+// Outlives the caches, the way the ini file outlives a launch
+struct MemoryStore : public OffsetsStore {
+	std::map<bool, CachedOffsets> entries;
+	int reads = 0;
+	int writes = 0;
+
+	bool Read(bool is32bit, CachedOffsets &entry) override
+	{
+		reads++;
+		auto found = entries.find(is32bit);
+		if (found == entries.end())
+			return false;
+		entry = found->second;
+		return true;
+	}
+
+	void Write(bool is32bit, const CachedOffsets &entry) override
+	{
+		writes++;
+		entries[is32bit] = entry;
+	}
+};
+
+// Hands the cache a view of a store that lives on across launches
+struct StoreView : public OffsetsStore {
+	MemoryStore &store;
+
+	explicit StoreView(MemoryStore &store) : store(store) {}
+
+	bool Read(bool is32bit, CachedOffsets &entry) override
+	{
+		return store.Read(is32bit, entry);
+	}
+
+	void Write(bool is32bit, const CachedOffsets &entry) override
+	{
+		store.Write(is32bit, entry);
+	}
+};
+
+struct FakeModules {
+	ModuleIdentity identities[2];
+	int calls[2] = {};
+
+	ModuleIdentityProvider Provider()
+	{
+		return [this](bool is32bit) {
+			calls[is32bit]++;
+			return identities[is32bit];
+		};
+	}
+};
+
+static ModuleIdentity Identity(const char *version, uint64_t hash)
+{
+	ModuleIdentity identity;
+	identity.version = version;
+	identity.hash = hash;
+	return identity;
+}
+
+static bool Same(const AudioRenderClientOffsets &a,
+		 const AudioRenderClientOffsets &b)
+{
+	return a.getBuffer == b.getBuffer &&
+	       a.releaseBuffer == b.releaseBuffer;
+}
+
+// A fresh launch over whatever the store kept
+static std::unique_ptr<OffsetsCache> Launch(MemoryStore &store,
+					    FakeModules &modules)
+{
+	return std::unique_ptr<OffsetsCache>(new OffsetsCache(
+		std::unique_ptr<OffsetsStore>(new StoreView(store)),
+		modules.Provider()));
+}
+
+static const AudioRenderClientOffsets offsets32 = {0x1234, 0x5678};
+static const AudioRenderClientOffsets offsets64 = {0x9ABC, 0xDEF0};
+
+static void TestHit()
+{
+	MemoryStore store;
+	FakeModules modules;
+	modules.identities[0] = Identity("10.0.19041.1", 0x1111);
+	modules.identities[1] = Identity("10.0.19041.1", 0x2222);
+
+	{
+		std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+		AudioRenderClientOffsets offsets = {};
+		TEST_CHECK(!cache->Load(true, offsets));
+		TEST_CHECK(!cache->Load(false, offsets));
+		cache->Save(true, offsets32);
+		cache->Save(false, offsets64);
+		TEST_CHECK(store.writes == 2);
+
+		// Worked out once per launch, not on every call
+		TEST_CHECK(modules.calls[0] == 1 && modules.calls[1] == 1);
+	}
+
+	std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+	AudioRenderClientOffsets offsets = {};
+	TEST_CHECK(cache->Load(true, offsets));
+	TEST_CHECK(Same(offsets, offsets32));
+	TEST_CHECK(cache->Load(false, offsets));
+	TEST_CHECK(Same(offsets, offsets64));
+	TEST_CHECK(modules.calls[0] == 2 && modules.calls[1] == 2);
+}
+
+/* Windows updates audioses.dll: a new version, or the same version with
+ * different contents, is a miss until it's been resolved again */
+static void TestModuleChanged()
+{
+	MemoryStore store;
+	FakeModules modules;
+	modules.identities[0] = Identity("10.0.19041.1", 0x1111);
+	modules.identities[1] = Identity("10.0.19041.1", 0x2222);
+	{
+		std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+		cache->Save(true, offsets32);
+		cache->Save(false, offsets64);
+	}
+
+	modules.identities[0].version = "10.0.19041.2";
+	modules.identities[1].hash = 0x3333;
+	{
+		std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+		AudioRenderClientOffsets offsets = {};
+		TEST_CHECK(!cache->Load(true, offsets));
+		TEST_CHECK(!cache->Load(false, offsets));
+		TEST_CHECK(offsets.getBuffer == 0);
+
+		const AudioRenderClientOffsets moved = {0x4444, 0x5555};
+		cache->Save(true, moved);
+		cache->Save(false, moved);
+	}
+
+	std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+	AudioRenderClientOffsets offsets = {};
+	TEST_CHECK(cache->Load(true, offsets));
+	TEST_CHECK(offsets.getBuffer == 0x4444);
+	TEST_CHECK(cache->Load(false, offsets));
+	TEST_CHECK(offsets.releaseBuffer == 0x5555);
+}
+
+/* A resolve that failed outright or only half worked, or a module that
+ * couldn't be identified, never reaches the store */
+static void TestFailureNotCached()
+{
+	MemoryStore store;
+	FakeModules modules;
+	modules.identities[0] = Identity("10.0.19041.1", 0x1111);
+	modules.identities[1] = Identity("10.0.19041.1", 0x2222);
+
+	{
+		std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+		const AudioRenderClientOffsets none = {};
+		const AudioRenderClientOffsets half = {0x1234, 0};
+		cache->Save(true, none);
+		cache->Save(false, half);
+		TEST_CHECK(store.writes == 0);
+
+		AudioRenderClientOffsets offsets = {};
+		TEST_CHECK(!cache->Load(true, offsets));
+		TEST_CHECK(!cache->Load(false, offsets));
+	}
+
+	// Nothing to key on, no version or no hash
+	modules.identities[0] = Identity("", 0x1111);
+	modules.identities[1] = Identity("10.0.19041.1", 0);
+	{
+		std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+		cache->Save(true, offsets32);
+		cache->Save(false, offsets64);
+		TEST_CHECK(store.writes == 0);
+	}
+
+	// And a good entry stays good after a failed resolve
+	modules.identities[1] = Identity("10.0.19041.1", 0x2222);
+	{
+		std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+		cache->Save(true, offsets32);
+		const AudioRenderClientOffsets none = {};
+		cache->Save(true, none);
+		TEST_CHECK(store.writes == 1);
+	}
+
+	std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+	AudioRenderClientOffsets offsets = {};
+	TEST_CHECK(cache->Load(true, offsets));
+	TEST_CHECK(Same(offsets, offsets32));
+}
+
+// Whatever's stored has to be complete to count, and bitnesses don't mix
+static void TestStoredEntries()
+{
+	MemoryStore store;
+	FakeModules modules;
+	modules.identities[0] = Identity("10.0.19041.1", 0x1111);
+	modules.identities[1] = Identity("10.0.19041.1", 0x1111);
+
+	CachedOffsets broken;
+	broken.identity = modules.identities[1];
+	broken.offsets.getBuffer = 0x1234;
+	store.entries[true] = broken;
+
+	std::unique_ptr<OffsetsCache> cache = Launch(store, modules);
+	AudioRenderClientOffsets offsets = {};
+	TEST_CHECK(!cache->Load(true, offsets));
+
+	cache->Save(false, offsets64);
+	TEST_CHECK(!cache->Load(true, offsets));
+	TEST_CHECK(cache->Load(false, offsets));
+	TEST_CHECK(Same(offsets, offsets64));
+}
+
+int main()
+{
+	TestHit();
+	TestModuleChanged();
+	TestFailureNotCached();
+	TestStoredEntries();
+
+	return TestResult("offsets-cache-test");
+}
@@ -0,0 +1,194 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Attaching against offsets that resolve in the background, the way
+ * Preinitialize() runs it: each bitness on its own std::async task whose
+ * shared future shutdown waits on, feeding SetOffsets() whenever it's
+ * done. Sources submitted before then have to wait for their own side
+ * only, and spend no more of the budget while they do. */
+
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "capture/attach-scheduler.hpp"
+#include "test-helpers.hpp"
+
+static const AudioRenderClientOffsets offsets32 = {0x1111, 0x2222};
+static const AudioRenderClientOffsets offsets64 = {0x3333, 0x4444};
+
+struct Attempts {
+	std::mutex mutex;
+	// Target index, in the order they attached
+	std::vector<int> attached;
+	std::vector<int> failed;
+	int wrongOffsets = 0;
+};
+
+static AttachTarget MakeTarget(int index, bool is32Bit, Attempts &attempts)
+{
+	AttachTarget target;
+	target.probe = [is32Bit](bool &bitness) {
+		bitness = is32Bit;
+		return true;
+	};
+	target.attach = [index, &attempts](
+				const AudioRenderClientOffsets &offsets,
+				bool bitness) {
+		const AudioRenderClientOffsets &expected =
+			bitness ? offsets32 : offsets64;
+		std::lock_guard<std::mutex> lock(attempts.mutex);
+		if (offsets.getBuffer != expected.getBuffer ||
+		    offsets.releaseBuffer != expected.releaseBuffer)
+			attempts.wrongOffsets++;
+		attempts.attached.push_back(index);
+		return AttachResult::ATTACHED;
+	};
+	target.failed = [index, &attempts]() {
+		std::lock_guard<std::mutex> lock(attempts.mutex);
+		attempts.failed.push_back(index);
+	};
+	return target;
+}
+
+// Stands in for LoadOffsets(), the cache hit or the helper process
+static AudioRenderClientOffsets Resolve(AttachScheduler &scheduler,
+					bool is32Bit, int ms,
+					AudioRenderClientOffsets offsets)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+	scheduler.SetOffsets(is32Bit, offsets);
+	return offsets;
+}
+
+static void RunUntil(AttachScheduler &scheduler,
+		     const std::shared_future<AudioRenderClientOffsets> &until)
+{
+	while (until.wait_for(std::chrono::milliseconds(1)) !=
+	       std::future_status::ready)
+		scheduler.RunDue();
+	scheduler.RunDue();
+}
+
+static void TestSlow32Bit()
+{
+	AttachScheduler scheduler;
+	Attempts attempts;
+
+	// Odd ones are 32-bit, all submitted before anything resolves
+	for (int i = 0; i < 6; i++)
+		scheduler.Submit(MakeTarget(i, i % 2 == 1, attempts));
+	scheduler.RunDue();
+	TEST_CHECK(scheduler.Pending() == 6);
+	TEST_CHECK(scheduler.Stats().attempts == 6);
+
+	std::shared_future<AudioRenderClientOffsets> future32 =
+		std::async(std::launch::async, Resolve, std::ref(scheduler),
+			   true, 200, offsets32)
+			.share();
+	std::shared_future<AudioRenderClientOffsets> future64 =
+		std::async(std::launch::async, Resolve, std::ref(scheduler),
+			   false, 10, offsets64)
+			.share();
+
+	// The 64-bit side doesn't wait for the 32-bit one
+	RunUntil(scheduler, future64);
+	{
+		std::lock_guard<std::mutex> lock(attempts.mutex);
+		TEST_CHECK(future32.wait_for(std::chrono::seconds(0)) !=
+			   std::future_status::ready);
+		TEST_CHECK(attempts.attached == std::vector<int>({0, 2, 4}));
+	}
+
+	RunUntil(scheduler, future32);
+	TEST_CHECK(attempts.attached ==
+		   std::vector<int>({0, 2, 4, 1, 3, 5}));
+	TEST_CHECK(attempts.wrongOffsets == 0);
+	TEST_CHECK(attempts.failed.empty());
+	TEST_CHECK(scheduler.Pending() == 0);
+
+	// Parked targets cost one attempt each to probe, one more to attach
+	AttachSchedulerStats stats = scheduler.Stats();
+	TEST_CHECK(stats.attempts == 12);
+	TEST_CHECK(stats.attached == 6);
+	TEST_CHECK(stats.retries == 0);
+
+	// Shutdown waits on both, long since done
+	future32.wait();
+	future64.wait();
+	TEST_CHECK(future32.get().getBuffer == offsets32.getBuffer);
+}
+
+// Submitted after the offsets are in, a target attaches on its first go
+static void TestResolvedFirst()
+{
+	AttachScheduler scheduler;
+	Attempts attempts;
+
+	std::shared_future<AudioRenderClientOffsets> future64 =
+		std::async(std::launch::async, Resolve, std::ref(scheduler),
+			   false, 0, offsets64)
+			.share();
+	future64.wait();
+
+	scheduler.Submit(MakeTarget(0, false, attempts));
+	scheduler.RunDue();
+	TEST_CHECK(attempts.attached == std::vector<int>({0}));
+	TEST_CHECK(scheduler.Stats().attempts == 1);
+}
+
+// A side the helper couldn't resolve gives up its targets, not the other's
+static void TestUnavailable()
+{
+	AttachScheduler scheduler;
+	Attempts attempts;
+
+	scheduler.Submit(MakeTarget(0, true, attempts));
+	scheduler.Submit(MakeTarget(1, false, attempts));
+	scheduler.RunDue();
+
+	AudioRenderClientOffsets none = {};
+	std::shared_future<AudioRenderClientOffsets> future32 =
+		std::async(std::launch::async, Resolve, std::ref(scheduler),
+			   true, 5, none)
+			.share();
+	std::shared_future<AudioRenderClientOffsets> future64 =
+		std::async(std::launch::async, Resolve, std::ref(scheduler),
+			   false, 5, offsets64)
+			.share();
+	RunUntil(scheduler, future32);
+	RunUntil(scheduler, future64);
+
+	TEST_CHECK(attempts.failed == std::vector<int>({0}));
+	TEST_CHECK(attempts.attached == std::vector<int>({1}));
+	TEST_CHECK(scheduler.Pending() == 0);
+
+	// And anything submitted for it later goes the same way
+	scheduler.Submit(MakeTarget(2, true, attempts));
+	scheduler.RunDue();
+	TEST_CHECK(attempts.failed == std::vector<int>({0, 2}));
+}
+
+int main()
+{
+	TestSlow32Bit();
+	TestResolvedFirst();
+	TestUnavailable();
+
+	return TestResult("preinit-test");
+}
@@ -0,0 +1,313 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Resampler quality in numbers: distortion of an in-band tone, how far a
+ * tone above the output Nyquist is kept from folding back, passband
+ * flatness, and the SIMD kernels against scalar. */
+
+#include <algorithm>
+#include <vector>
+
+#include "audio/resampler.hpp"
+#include "test-helpers.hpp"
+
+static const double pi = 3.14159265358979323846;
+static const char *const qualityNames[] = {"low", "medium", "high"};
+
+// One second of a full-scale tone, fed through in 10 ms chunks
+static std::vector<float> Run(uint32_t inRate, uint32_t outRate,
+			      ResamplerQuality quality, double freq,
+			      SimdLevel level = SimdLevel::SCALAR)
+{
+	Resampler resampler;
+	TEST_CHECK(resampler.Configure(inRate, outRate, 1, quality, level));
+
+	std::vector<float> input(inRate);
+	for (size_t i = 0; i < input.size(); i++)
+		input[i] = static_cast<float>(
+			std::sin(2.0 * pi * freq * i / inRate));
+
+	std::vector<float> output;
+	std::vector<float> block;
+	size_t chunk = inRate / 100;
+	for (size_t i = 0; i < input.size(); i += chunk) {
+		size_t frames = std::min(chunk, input.size() - i);
+		block.resize(resampler.MaxOutput(frames));
+		const float *in = input.data() + i;
+		float *out = block.data();
+		size_t produced =
+			resampler.Process(&in, frames, &out, block.size());
+		output.insert(output.end(), block.begin(),
+			      block.begin() + produced);
+	}
+
+	// Leave out the filter filling up, with room to spare
+	size_t settle = static_cast<size_t>(resampler.Latency()) * 2 *
+				outRate / inRate +
+			16;
+	output.erase(output.begin(), output.begin() + settle);
+	return output;
+}
+
+static double Rms(const std::vector<float> &signal)
+{
+	double sum = 0.0;
+	for (float v : signal)
+		sum += double(v) * v;
+	return std::sqrt(sum / signal.size());
+}
+
+static double Db(double ratio)
+{
+	return 20.0 * std::log10(ratio);
+}
+
+/* Least squares fit of a sine at `freq` plus DC. Returns the fitted
+ * amplitude and leaves what the fit can't explain in `residual`. */
+static double FitSine(const std::vector<float> &signal, double freq,
+		      uint32_t rate, double &residual)
+{
+	double m[3][4] = {};
+	for (size_t n = 0; n < signal.size(); n++) {
+		double w = 2.0 * pi * freq * n / rate;
+		double basis[3] = {std::sin(w), std::cos(w), 1.0};
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++)
+				m[i][j] += basis[i] * basis[j];
+			m[i][3] += basis[i] * signal[n];
+		}
+	}
+
+	// Gauss-Jordan on the 3x3 normal equations, they're well conditioned
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			if (j == i)
+				continue;
+			double f = m[j][i] / m[i][i];
+			for (int k = i; k < 4; k++)
+				m[j][k] -= f * m[i][k];
+		}
+	}
+	double a = m[0][3] / m[0][0];
+	double b = m[1][3] / m[1][1];
+	double c = m[2][3] / m[2][2];
+
+	double sum = 0.0;
+	for (size_t n = 0; n < signal.size(); n++) {
+		double w = 2.0 * pi * freq * n / rate;
+		double e = signal[n] - (a * std::sin(w) + b * std::cos(w) + c);
+		sum += e * e;
+	}
+	residual = std::sqrt(sum / signal.size());
+	return std::sqrt(a * a + b * b);
+}
+
+// THD+N of a 1 kHz tone, in dB below the tone
+static void TestDistortion()
+{
+	static const uint32_t pairs[][2] = {{44100, 48000},
+					    {48000, 44100},
+					    {96000, 48000},
+					    {192000, 48000}};
+	static const double limit[] = {-75.0, -95.0, -115.0};
+
+	for (auto &pair : pairs) {
+		for (int q = 0; q < 3; q++) {
+			std::vector<float> out =
+				Run(pair[0], pair[1],
+				    static_cast<ResamplerQuality>(q), 1000.0);
+			double residual;
+			double amplitude =
+				FitSine(out, 1000.0, pair[1], residual);
+			double thd = Db(residual / amplitude);
+			if (thd > limit[q])
+				fprintf(stderr, "%u -> %u %s: THD+N %.1f dB\n",
+					pair[0], pair[1], qualityNames[q],
+					thd);
+			TEST_CHECK(thd <= limit[q]);
+			TEST_CHECK_NEAR(Db(amplitude), 0.0, 0.01);
+		}
+	}
+}
+
+// What's left of a tone the output can't represent, in dBFS
+static void TestAliasing()
+{
+	struct Case {
+		uint32_t inRate;
+		uint32_t outRate;
+		double freq;
+	};
+	static const Case cases[] = {{192000, 48000, 30000.0},
+				     {96000, 44100, 25000.0},
+				     {48000, 44100, 23000.0},
+				     {48000, 16000, 9000.0}};
+	// The design targets, every stopband starts at the output Nyquist
+	static const double limit[] = {-60.0, -80.0, -100.0};
+
+	for (const Case &c : cases) {
+		for (int q = 0; q < 3; q++) {
+			std::vector<float> out =
+				Run(c.inRate, c.outRate,
+				    static_cast<ResamplerQuality>(q), c.freq);
+			// Full scale sine is -3 dB RMS
+			double level = Db(Rms(out) * std::sqrt(2.0));
+			if (level > limit[q])
+				fprintf(stderr,
+					"%u -> %u, %.0f Hz %s: alias at "
+					"%.1f dB\n",
+					c.inRate, c.outRate, c.freq,
+					qualityNames[q], level);
+			TEST_CHECK(level <= limit[q]);
+		}
+	}
+}
+
+// Gain near the top of the passband, where LOW used to sag
+static void TestPassband()
+{
+	static const uint32_t pairs[][2] = {
+		{44100, 48000}, {48000, 44100}, {192000, 48000}};
+	static const double edge[] = {0.86, 0.89, 0.93};
+
+	for (auto &pair : pairs) {
+		double nyquist = std::min(pair[0], pair[1]) / 2.0;
+		for (int q = 0; q < 3; q++) {
+			for (double fraction : {0.1, 0.5, edge[q]}) {
+				double freq = fraction * nyquist;
+				std::vector<float> out = Run(
+					pair[0], pair[1],
+					static_cast<ResamplerQuality>(q), freq);
+				double residual;
+				double gain = Db(
+					FitSine(out, freq, pair[1], residual));
+				if (std::fabs(gain) > 0.1)
+					fprintf(stderr,
+						"%u -> %u %s: %.0f Hz at "
+						"%.2f dB\n",
+						pair[0], pair[1],
+						qualityNames[q], freq, gain);
+				TEST_CHECK(std::fabs(gain) <= 0.1);
+			}
+		}
+	}
+
+	// The complaint that started this, 19 kHz going 44.1 to 48
+	std::vector<float> out =
+		Run(44100, 48000, ResamplerQuality::LOW, 19000.0);
+	double residual;
+	TEST_CHECK(Db(FitSine(out, 19000.0, 48000, residual)) > -0.1);
+}
+
+static void TestLevels()
+{
+	for (int level = 1; level < TestSimdLevels(); level++) {
+		for (int q = 0; q < 3; q++) {
+			ResamplerQuality quality =
+				static_cast<ResamplerQuality>(q);
+			std::vector<float> reference =
+				Run(44100, 48000, quality, 997.0);
+			std::vector<float> out =
+				Run(44100, 48000, quality, 997.0,
+				    static_cast<SimdLevel>(level));
+
+			TEST_CHECK(out.size() == reference.size());
+			double worst = 0.0;
+			for (size_t i = 0;
+			     i < std::min(out.size(), reference.size()); i++)
+				worst = std::max(worst,
+						 std::fabs(double(out[i]) -
+							   reference[i]));
+			TEST_CHECK(worst < 1e-5);
+		}
+	}
+}
+
+static void TestLatency()
+{
+	Resampler resampler;
+	TEST_CHECK(resampler.Configure(48000, 48000, 2,
+				       ResamplerQuality::MEDIUM));
+	TEST_CHECK(resampler.Passthrough());
+
+	// Decimating takes a longer filter than interpolating
+	uint32_t taps[2];
+	for (int i = 0; i < 2; i++) {
+		resampler.Configure(i ? 192000 : 44100, 48000, 2,
+				    ResamplerQuality::HIGH);
+		taps[i] = resampler.Latency() * 2;
+		TEST_CHECK(taps[i] % 8 == 0);
+	}
+	TEST_CHECK(taps[1] >= 3 * taps[0]);
+}
+
+static void Bench()
+{
+	static const uint32_t pairs[][2] = {
+		{44100, 48000}, {48000, 44100}, {192000, 48000}};
+	const uint32_t channels = 2;
+
+	for (auto &pair : pairs) {
+		size_t frames = pair[0] / 100;
+		std::vector<float> input(frames, 0.25f);
+		const float *in[] = {input.data(), input.data()};
+
+		for (int q = 0; q < 3; q++) {
+			for (int level = 0; level < TestSimdLevels();
+			     level++) {
+				Resampler resampler;
+				resampler.Configure(
+					pair[0], pair[1], channels,
+					static_cast<ResamplerQuality>(q),
+					static_cast<SimdLevel>(level));
+				std::vector<float> left(
+					resampler.MaxOutput(frames)),
+					right(left.size());
+				float *out[] = {left.data(), right.data()};
+
+				double ns = TestBench(
+					[&]() {
+						resampler.Process(in, frames,
+								  out,
+								  left.size());
+					},
+					500);
+				printf("%6u -> %u %-6s %-6s %3u taps: "
+				       "%.1f ns/output frame\n",
+				       pair[0], pair[1], qualityNames[q],
+				       TestSimdName(level),
+				       resampler.Latency() * 2,
+				       ns / (pair[1] / 100));
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	TestDistortion();
+	TestAliasing();
+	TestPassband();
+	TestLevels();
+	TestLatency();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("resampler-test");
+}
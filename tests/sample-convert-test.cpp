@@ -0,0 +1,264 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Sample conversion: integer input scales exactly by a power of two, so
+ * every kernel at every SIMD level has to match the reference bit for bit,
+ * interleaved and planar, whatever the length and alignment. */
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "audio/sample-convert.hpp"
+#include "test-helpers.hpp"
+
+static const SampleFormat formats[] = {SampleFormat::S16, SampleFormat::S24,
+				       SampleFormat::S32, SampleFormat::F32};
+static const char *const formatNames[] = {"s16", "s24", "s32", "f32"};
+
+// What a sample should come out as, worked out in double
+static float Reference(SampleFormat format, const uint8_t *p)
+{
+	switch (format) {
+	case SampleFormat::S16: {
+		int16_t v;
+		memcpy(&v, p, sizeof(v));
+		return static_cast<float>(v / 32768.0);
+	}
+	case SampleFormat::S24: {
+		int32_t v = p[0] | p[1] << 8 | static_cast<int8_t>(p[2]) << 16;
+		return static_cast<float>(v / 8388608.0);
+	}
+	case SampleFormat::S32: {
+		int32_t v;
+		memcpy(&v, p, sizeof(v));
+		return static_cast<float>(v / 2147483648.0);
+	}
+	default: {
+		float v;
+		memcpy(&v, p, sizeof(v));
+		return v;
+	}
+	}
+}
+
+// Bit for bit, so -0 isn't 0 and a NaN from misaligned float input is itself
+static bool SameBits(float a, float b)
+{
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+/* Random bytes with the extremes of every format planted at the start, so
+ * they land in the vector body as well as the tail */
+static std::vector<uint8_t> Input(SampleFormat format, size_t samples,
+				  std::mt19937 &rng)
+{
+	size_t bytes = SampleFormatBytes(format);
+	std::vector<uint8_t> input(samples * bytes + 1);
+	for (uint8_t &b : input)
+		b = static_cast<uint8_t>(rng());
+
+	static const uint8_t extremes[][4] = {{0x00, 0x00, 0x00, 0x80},
+					      {0xFF, 0xFF, 0xFF, 0x7F},
+					      {0xFF, 0xFF, 0xFF, 0xFF},
+					      {0x01, 0x00, 0x00, 0x00}};
+	for (size_t i = 0; i < 4 && i < samples; i++) {
+		if (format == SampleFormat::F32)
+			break;
+		memcpy(&input[i * bytes], extremes[i] + 4 - bytes, bytes);
+	}
+
+	// Mostly ordinary floats, which random bytes rarely are
+	if (format == SampleFormat::F32) {
+		for (size_t i = 0; i < samples; i++) {
+			float v = std::ldexp(
+				static_cast<float>(rng() % 2000000) - 1e6f,
+				-20);
+			memcpy(&input[i * bytes], &v, sizeof(v));
+		}
+	}
+	return input;
+}
+
+static void TestS16Exhaustive(int level)
+{
+	std::vector<int16_t> input(65536);
+	std::vector<float> output(input.size());
+	for (size_t i = 0; i < input.size(); i++)
+		input[i] = static_cast<int16_t>(i - 32768);
+
+	GetSampleConverter(SampleFormat::S16, static_cast<SimdLevel>(level))
+		.interleaved(input.data(), output.data(), input.size());
+
+	size_t wrong = 0;
+	for (size_t i = 0; i < input.size(); i++) {
+		if (output[i] != static_cast<float>(input[i] / 32768.0))
+			wrong++;
+	}
+	TEST_CHECK(wrong == 0);
+	TEST_CHECK(output[0] == -1.0f);
+	TEST_CHECK(output[32768] == 0.0f);
+}
+
+static void TestInterleaved(int level, std::mt19937 &rng)
+{
+	for (size_t f = 0; f < 4; f++) {
+		SampleConverter convert = GetSampleConverter(
+			formats[f], static_cast<SimdLevel>(level));
+		size_t bytes = SampleFormatBytes(formats[f]);
+
+		for (size_t samples = 0; samples < 80; samples++) {
+			for (size_t misalign = 0; misalign < 2; misalign++) {
+				std::vector<uint8_t> input =
+					Input(formats[f], samples, rng);
+				const uint8_t *src = input.data() + misalign;
+				std::vector<float> output(samples + 2, 9.0f);
+
+				convert.interleaved(src, output.data() + 1,
+						    samples);
+
+				size_t wrong = 0;
+				for (size_t i = 0; i < samples; i++) {
+					float expected = Reference(
+						formats[f], src + i * bytes);
+					if (!SameBits(output[i + 1], expected))
+						wrong++;
+				}
+				if (wrong)
+					fprintf(stderr, "%s %s %zu samples\n",
+						TestSimdName(level),
+						formatNames[f], samples);
+				TEST_CHECK(wrong == 0);
+				TEST_CHECK(output[0] == 9.0f);
+				TEST_CHECK(output[samples + 1] == 9.0f);
+			}
+		}
+	}
+}
+
+static void TestPlanar(int level, std::mt19937 &rng)
+{
+	for (size_t f = 0; f < 4; f++) {
+		SampleConverter convert = GetSampleConverter(
+			formats[f], static_cast<SimdLevel>(level));
+		size_t bytes = SampleFormatBytes(formats[f]);
+
+		// Up to 7.1, then wider than a block holds in one frame
+		static const uint32_t widths[] = {1,    2,    3,    4,   5,
+						  6,    7,    8,    2047, 2048,
+						  2049, 4097};
+		for (uint32_t channels : widths) {
+			// Past the internal block size as well as around it
+			static const size_t lengths[] = {0,   1,    7,   33,
+							 255, 1023, 4099};
+			for (size_t frames : lengths) {
+				if (channels > 8 && frames > 33)
+					break;
+
+				std::vector<uint8_t> input = Input(
+					formats[f], frames * channels, rng);
+				std::vector<std::vector<float>> planes(
+					channels,
+					std::vector<float>(frames + 1, 9.0f));
+				std::vector<float *> dst;
+				for (auto &plane : planes)
+					dst.push_back(plane.data());
+
+				convert.planar(input.data(), dst.data(),
+					       channels, frames);
+
+				size_t wrong = 0;
+				for (uint32_t c = 0; c < channels; c++) {
+					for (size_t i = 0; i < frames; i++) {
+						size_t at = (i * channels + c) *
+							    bytes;
+						float expected = Reference(
+							formats[f],
+							&input[at]);
+						if (!SameBits(planes[c][i],
+							      expected))
+							wrong++;
+					}
+					TEST_CHECK(planes[c][frames] == 9.0f);
+				}
+				TEST_CHECK(wrong == 0);
+			}
+		}
+
+		// Nothing to convert, and nowhere to put it
+		uint8_t input[16] = {};
+		convert.planar(input, nullptr, 0, 4);
+	}
+}
+
+static void Bench()
+{
+	const size_t frames = 480;
+	const uint32_t channels = 2;
+	std::mt19937 rng(7);
+
+	for (size_t f = 0; f < 4; f++) {
+		std::vector<uint8_t> input =
+			Input(formats[f], frames * channels, rng);
+		std::vector<float> output(frames * channels);
+		std::vector<float> left(frames), right(frames);
+		float *planes[] = {left.data(), right.data()};
+
+		for (int level = 0; level < TestSimdLevels(); level++) {
+			SampleConverter convert = GetSampleConverter(
+				formats[f], static_cast<SimdLevel>(level));
+			double interleaved = TestBench(
+				[&]() {
+					convert.interleaved(input.data(),
+							    output.data(),
+							    frames * channels);
+				},
+				20000);
+			double planar = TestBench(
+				[&]() {
+					convert.planar(input.data(), planes,
+						       channels, frames);
+				},
+				20000);
+			printf("%s %-6s interleaved %.3f ns/sample, "
+			       "planar %.3f ns/sample\n",
+			       formatNames[f], TestSimdName(level),
+			       interleaved / (frames * channels),
+			       planar / (frames * channels));
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::mt19937 rng(1);
+
+	for (int level = 0; level < TestSimdLevels(); level++) {
+		TestS16Exhaustive(level);
+		TestInterleaved(level, rng);
+		TestPlanar(level, rng);
+	}
+
+	TEST_CHECK(SampleFormatBytes(SampleFormat::S24) == 3);
+	TEST_CHECK(SampleFormatBytes(SampleFormat::UNKNOWN) == 0);
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("sample-convert-test");
+}
@@ -0,0 +1,297 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Lining inputs up on the mix timeline: gaps bridged with silence up to
+ * the horizon and no further, overlaps trimmed, stale inputs no longer
+ * holding up the rest, and the output timestamps that come of it. Also
+ * the ramp kernels and crossfades that run across slabs. */
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "capture/session-mixer.hpp"
+#include "test-helpers.hpp"
+
+#define RATE 48000
+#define MS(ms) ((ms) * 1000000ULL)
+
+static const uint64_t origin = 5000000000ULL;
+
+// 10 ms of a constant per input, so the mix says where each came from
+struct Chunk {
+	std::vector<float> left, right;
+	const float *planes[2];
+
+	explicit Chunk(float value, uint32_t frames = RATE / 100)
+		: left(frames, value), right(frames, value)
+	{
+		planes[0] = left.data();
+		planes[1] = right.data();
+	}
+};
+
+// Mixes everything that's ready, returns the frames and the first stamp
+static size_t Drain(SessionMixer &mixer, FramePool &pool, uint64_t now,
+		    std::vector<float> *out = nullptr,
+		    uint64_t *timestamp = nullptr)
+{
+	size_t frames = 0;
+	CaptureOutput output;
+	while (mixer.Mix(now, pool, output)) {
+		if (timestamp && !frames)
+			*timestamp = output.timestamp;
+		if (out)
+			out->insert(out->end(), output.data[0],
+				    output.data[0] + output.frames);
+		frames += output.frames;
+		pool.Release(output.buffer);
+	}
+	return frames;
+}
+
+static void TestGapFilled()
+{
+	SessionMixer mixer;
+	FramePool pool;
+	pool.Configure(2, RATE);
+	mixer.Configure(2, RATE, 1);
+	Chunk chunk(0.5f);
+
+	mixer.Push(0, chunk.planes, 480, origin, origin);
+	// 30 ms late, well within the 100 ms horizon
+	mixer.Push(0, chunk.planes, 480, origin + MS(40), origin + MS(40));
+
+	std::vector<float> out;
+	uint64_t timestamp = 0;
+	TEST_CHECK(Drain(mixer, pool, origin + MS(40), &out, &timestamp) ==
+		   2 * 480 + 1440);
+	TEST_CHECK(timestamp == origin);
+	TEST_CHECK(out[479] == 0.5f && out[480] == 0.0f);
+	TEST_CHECK(out[1919] == 0.0f && out[1920] == 0.5f);
+}
+
+/* A jump past the horizon used to be filled in whole, an hour of silence
+ * for a clock that jumped by an hour */
+static void TestGapResync()
+{
+	SessionMixer mixer;
+	FramePool pool;
+	pool.Configure(2, RATE);
+	mixer.Configure(2, RATE, 1);
+	Chunk chunk(0.5f);
+
+	mixer.Push(0, chunk.planes, 480, origin, origin);
+	uint64_t later = origin + 3600ULL * 1000000000ULL;
+	mixer.Push(0, chunk.planes, 480, later, origin + MS(10));
+	TEST_CHECK(mixer.Queued(0) == 480);
+
+	uint64_t timestamp = 0;
+	TEST_CHECK(Drain(mixer, pool, origin + MS(10), nullptr, &timestamp) ==
+		   480);
+	TEST_CHECK(timestamp == later);
+
+	// Carries on from there as usual
+	mixer.Push(0, chunk.planes, 480, later + MS(10), origin + MS(20));
+	TEST_CHECK(Drain(mixer, pool, origin + MS(20), nullptr, &timestamp) ==
+		   480);
+	TEST_CHECK(timestamp == later + MS(10));
+}
+
+// With another input still on the old timeline the mix waits for it
+static void TestGapResyncHeld()
+{
+	SessionMixer mixer;
+	FramePool pool;
+	pool.Configure(2, RATE);
+	mixer.Configure(2, RATE, 2);
+	Chunk chunk(0.5f);
+
+	mixer.Push(0, chunk.planes, 480, origin, origin);
+	mixer.Push(1, chunk.planes, 480, origin, origin);
+	mixer.Push(0, chunk.planes, 480, origin + MS(500), origin);
+	TEST_CHECK(mixer.Queued(0) == 480);
+
+	uint64_t timestamp = 0;
+	TEST_CHECK(Drain(mixer, pool, origin, nullptr, &timestamp) == 480);
+	TEST_CHECK(timestamp == origin);
+}
+
+static void TestOverlapTrimmed()
+{
+	SessionMixer mixer;
+	FramePool pool;
+	pool.Configure(2, RATE);
+	mixer.Configure(2, RATE, 1);
+	Chunk chunk(0.25f);
+
+	mixer.Push(0, chunk.planes, 480, origin, origin);
+	// Starts 6 ms into what's queued, past the 5 ms tolerance
+	mixer.Push(0, chunk.planes, 480, origin + MS(4), origin);
+	TEST_CHECK(mixer.Queued(0) == 480 + 192);
+
+	// Inside the tolerance it's taken as contiguous
+	mixer.Push(0, chunk.planes, 480, origin + MS(16), origin);
+	TEST_CHECK(mixer.Queued(0) == 2 * 480 + 192);
+}
+
+static void TestStaleInput()
+{
+	SessionMixer mixer;
+	FramePool pool;
+	pool.Configure(2, RATE);
+	mixer.Configure(2, RATE, 2);
+	Chunk a(0.5f), b(0.25f);
+
+	mixer.Push(0, a.planes, 480, origin, origin);
+	mixer.Push(1, b.planes, 480, origin, origin);
+	std::vector<float> out;
+	TEST_CHECK(Drain(mixer, pool, origin, &out) == 480);
+	TEST_CHECK_NEAR(out[0], 0.75, 1e-6);
+
+	// Input 1 goes quiet; until it's stale it holds the mix back
+	mixer.Push(0, a.planes, 480, origin + MS(10), origin + MS(10));
+	TEST_CHECK(Drain(mixer, pool, origin + MS(10)) == 0);
+
+	// Past 100 ms since input 1 pushed but not since input 0 did
+	out.clear();
+	TEST_CHECK(Drain(mixer, pool, origin + MS(105), &out) == 480);
+	TEST_CHECK_NEAR(out[0], 0.5, 1e-6);
+}
+
+// Every level against the scalar ramp, tails that don't fill a vector too
+static void TestRampKernels()
+{
+	std::mt19937 rng(15);
+	std::uniform_real_distribution<float> sample(-1.0f, 1.0f);
+	MixRampFunc reference = GetMixRamp(SimdLevel::SCALAR);
+
+	for (size_t count : {0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 479,
+			     480, 1021}) {
+		std::vector<float> src(count);
+		std::vector<float> dst(count + 1);
+		for (float &v : src)
+			v = sample(rng);
+		for (float &v : dst)
+			v = sample(rng);
+
+		// Fading in and out, at an offset gain like a mid-fade slab
+		for (float step : {1.0f / 1000.0f, -1.0f / 333.0f}) {
+			std::vector<float> expected = dst;
+			reference(expected.data(), src.data(), 0.4f, step,
+				  count);
+
+			for (int level = 0; level < TestSimdLevels();
+			     level++) {
+				std::vector<float> out = dst;
+				GetMixRamp(static_cast<SimdLevel>(level))(
+					out.data(), src.data(), 0.4f, step,
+					count);
+
+				double worst = 0.0;
+				for (size_t i = 0; i < count; i++)
+					worst = std::max<double>(
+						worst,
+						std::fabs(out[i] -
+							  expected[i]));
+				TEST_CHECK(worst < 1e-5);
+				TEST_CHECK(out[count] == dst[count]);
+			}
+		}
+	}
+}
+
+/* Pushes `chunks` of 10 ms of `value` to each input and mixes as it goes,
+ * so every fade below is cut up by both pushes and slabs */
+static std::vector<float> MixChunks(SessionMixer &mixer, FramePool &pool,
+				    uint32_t inputs, float value, int chunks)
+{
+	Chunk chunk(value);
+	std::vector<float> out;
+	for (int i = 0; i < chunks; i++) {
+		uint64_t timestamp = origin + MS(10) * i;
+		for (uint32_t input = 0; input < inputs; input++)
+			mixer.Push(input, chunk.planes, RATE / 100, timestamp,
+				   timestamp);
+		Drain(mixer, pool, timestamp, &out);
+	}
+	return out;
+}
+
+/* Fades that start partway into a slab and run on across several more.
+ * Out of one input into another carrying the same signal, the sum has to
+ * hold still to the sample. */
+static void TestCrossfade()
+{
+	const int64_t start = 200;
+	const uint32_t frames = 1000;
+
+	for (int level = 0; level < TestSimdLevels(); level++) {
+		SimdLevel simd = static_cast<SimdLevel>(level);
+		SessionMixer mixer;
+		FramePool pool;
+		// 7 ms slabs, so neither pushes nor the fade line up with them
+		pool.Configure(2, RATE, 7);
+		mixer.Configure(2, RATE, 2, 100, 5, simd);
+
+		mixer.SetEnvelope(1, 0.0f);
+		TEST_CHECK(mixer.Fade(0, 0.0f, frames, start) == start);
+		TEST_CHECK(mixer.Fade(1, 1.0f, frames, start) == start);
+
+		std::vector<float> out = MixChunks(mixer, pool, 2, 0.5f, 6);
+		TEST_CHECK(out.size() == 6 * RATE / 100);
+
+		double worst = 0.0;
+		for (float v : out)
+			worst = std::max(worst, std::fabs(v - 0.5));
+		TEST_CHECK(worst < 1e-5);
+		TEST_CHECK(!mixer.Fading(0) && !mixer.Fading(1));
+		TEST_CHECK(mixer.Envelope(0) == 0.0f);
+
+		// On its own the fade out is a straight line
+		SessionMixer single;
+		single.Configure(2, RATE, 1, 100, 5, simd);
+		single.Fade(0, 0.0f, frames, start);
+		out = MixChunks(single, pool, 1, 0.5f, 6);
+
+		worst = 0.0;
+		for (size_t i = 0; i < out.size(); i++) {
+			int64_t into = static_cast<int64_t>(i) - start;
+			into = std::min<int64_t>(std::max<int64_t>(into, 0),
+						 frames);
+			double level = 1.0 - static_cast<double>(into) / frames;
+			worst = std::max(worst,
+					 std::fabs(out[i] - 0.5 * level));
+		}
+		TEST_CHECK(worst < 1e-5);
+	}
+}
+
+int main()
+{
+	TestGapFilled();
+	TestGapResync();
+	TestGapResyncHeld();
+	TestOverlapTrimmed();
+	TestStaleInput();
+	TestRampKernels();
+	TestCrossfade();
+
+	return TestResult("session-mixer-test");
+}
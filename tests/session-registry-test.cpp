@@ -0,0 +1,332 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* The session registry: snapshots that never change under a reader, the
+ * name caches, listeners that call back into the registry, and sessions
+ * followed across a relaunch. */
+
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture/session-registry.hpp"
+#include "capture/synthetic-backend.hpp"
+#include "test-helpers.hpp"
+
+static SessionRecord Record(const char *session, const char *device,
+			    uint32_t pid, uint64_t created = 1)
+{
+	SessionRecord record;
+	record.sessionName = session;
+	record.sessionId = session;
+	record.instanceId =
+		std::string(session) + "/" + std::to_string(created);
+	record.deviceName = device;
+	record.deviceId = device;
+	record.processId = pid;
+	record.processCreateTime = created;
+	record.exe = "game.exe";
+	return record;
+}
+
+static void TestSnapshots()
+{
+	SessionRegistry registry;
+	TEST_CHECK(registry.Snapshot()->sessions.empty());
+
+	registry.Reset({Record("a", "speakers", 10),
+			Record("b", "speakers", 11),
+			Record("c", "headset", 12)});
+	std::shared_ptr<const SessionSnapshot> first = registry.Snapshot();
+	TEST_CHECK(first->sessions.size() == 3);
+	TEST_CHECK(first->Find("b", "speakers") != nullptr);
+	TEST_CHECK(first->Find("b", "headset") == nullptr);
+
+	// Nothing new, nothing published
+	TEST_CHECK(!registry.AddSession(Record("a", "speakers", 10)));
+	TEST_CHECK(registry.Snapshot() == first);
+
+	TEST_CHECK(registry.AddSession(Record("a", "speakers", 20)));
+	TEST_CHECK(registry.RemoveSession("c/1", "headset"));
+	TEST_CHECK(!registry.RemoveSession("c/1", "headset"));
+	TEST_CHECK(registry.RenameDevice("speakers", "Speakers (USB)"));
+	TEST_CHECK(!registry.RenameDevice("speakers", "Speakers (USB)"));
+
+	std::shared_ptr<const SessionSnapshot> last = registry.Snapshot();
+	TEST_CHECK(last->generation == first->generation + 3);
+	TEST_CHECK(last->sessions.size() == 2);
+	TEST_CHECK(last->Find("a", "speakers")->processId == 20);
+	TEST_CHECK(last->Find("b", "speakers")->deviceName ==
+		   "Speakers (USB)");
+
+	// What a reader already holds stays as it was
+	TEST_CHECK(first->sessions.size() == 3);
+	TEST_CHECK(first->Find("a", "speakers")->processId == 10);
+	TEST_CHECK(first->Find("b", "speakers")->deviceName == "speakers");
+
+	TEST_CHECK(registry.RemoveProcess(11, 1));
+	TEST_CHECK(!registry.RemoveProcess(20, 2));
+	TEST_CHECK(registry.RemoveDevice("speakers"));
+	TEST_CHECK(registry.Snapshot()->sessions.empty());
+}
+
+/* Two instances of the same exe on one device share a session id, and
+ * used to overwrite each other */
+static void TestInstances()
+{
+	SessionRegistry registry;
+	registry.Reset({Record("game", "speakers", 10, 5),
+			Record("game", "speakers", 11, 7),
+			Record("game", "headset", 12, 9)});
+
+	std::shared_ptr<const SessionSnapshot> both = registry.Snapshot();
+	TEST_CHECK(both->sessions.size() == 3);
+	TEST_CHECK(both->Find("game", "speakers")->processId == 11);
+	TEST_CHECK(both->FindInstance("game/5", "speakers")->processId == 10);
+	TEST_CHECK(both->FindInstance("game/5", "headset") == nullptr);
+
+	// Renaming one instance leaves the other alone
+	SessionRecord renamed = Record("game", "speakers", 10, 5);
+	renamed.sessionName = "Game (2)";
+	TEST_CHECK(registry.AddSession(renamed));
+	TEST_CHECK(registry.Snapshot()->sessions.size() == 3);
+	TEST_CHECK(registry.Snapshot()
+			   ->FindInstance("game/7", "speakers")
+			   ->sessionName == "game");
+
+	// The newest one going leaves the older one found
+	TEST_CHECK(registry.RemoveSession("game/7", "speakers"));
+	std::shared_ptr<const SessionSnapshot> one = registry.Snapshot();
+	TEST_CHECK(one->Find("game", "speakers")->processId == 10);
+	TEST_CHECK(one->Find("game", "speakers")->sessionName == "Game (2)");
+	TEST_CHECK(one->Find("game", "headset")->processId == 12);
+
+	TEST_CHECK(registry.RemoveProcess(10, 5));
+	TEST_CHECK(registry.Snapshot()->Find("game", "speakers") == nullptr);
+}
+
+/* A game restarting keeps its session id but not its instance. Whoever
+ * captured the old instance has to see it was relaunched, rather than
+ * take the session still being there as nothing having changed. */
+static void TestRelaunch()
+{
+	SyntheticBackend backend(std::vector<SyntheticSessionConfig>(2));
+	SessionRecord attached = backend.Sessions()->sessions[0];
+	std::unique_ptr<CaptureStream> stream = backend.Attach(attached);
+	TEST_CHECK(stream != nullptr);
+
+	// What the source does on every change
+	std::vector<SessionRecord> followed;
+	uint64_t id = backend.Subscribe([&]() {
+		std::shared_ptr<const SessionSnapshot> snapshot =
+			backend.Sessions();
+		const SessionRecord *next = snapshot->Successor(
+			attached.instanceId, attached.sessionId,
+			attached.deviceId);
+		if (next) {
+			followed.push_back(*next);
+			attached = *next;
+		}
+	});
+
+	TEST_CHECK(!backend.Sessions()->Successor(
+		attached.instanceId, attached.sessionId, attached.deviceId));
+
+	SessionRecord before = attached;
+	backend.Relaunch(0);
+	TEST_CHECK(followed.size() == 1);
+	if (followed.empty())
+		return;
+
+	const SessionRecord &after = followed[0];
+	TEST_CHECK(after.sessionId == before.sessionId);
+	TEST_CHECK(after.deviceId == before.deviceId);
+	TEST_CHECK(after.instanceId != before.instanceId);
+	TEST_CHECK(after.processId != before.processId);
+
+	std::shared_ptr<const SessionSnapshot> snapshot = backend.Sessions();
+	TEST_CHECK(snapshot->sessions.size() == 2);
+	TEST_CHECK(snapshot->Find(before.sessionId, before.deviceId)
+			   ->processId == after.processId);
+	TEST_CHECK(!snapshot->FindInstance(before.instanceId,
+					   before.deviceId));
+
+	// Only the live instance can be attached
+	TEST_CHECK(backend.Attach(before) == nullptr);
+	std::unique_ptr<CaptureStream> next = backend.Attach(after);
+	TEST_CHECK(next != nullptr);
+
+	// Followed once per restart, and never onto the other session
+	backend.Relaunch(1);
+	backend.Relaunch(0);
+	TEST_CHECK(followed.size() == 2);
+	TEST_CHECK(followed.back().sessionId == before.sessionId);
+	TEST_CHECK(followed.back().processCreateTime >
+		   after.processCreateTime);
+
+	backend.Unsubscribe(id);
+}
+
+static void TestNameCaches()
+{
+	SessionRegistry registry;
+	int fetches = 0;
+	auto fetch = [&fetches]() {
+		fetches++;
+		return std::string("fetched");
+	};
+
+	TEST_CHECK(registry.DeviceName("usb", fetch) == "fetched");
+	TEST_CHECK(registry.DeviceName("usb", fetch) == "fetched");
+	TEST_CHECK(registry.ExeName(4, 1, fetch) == "fetched");
+	TEST_CHECK(registry.ExeName(4, 1, fetch) == "fetched");
+	TEST_CHECK(fetches == 2);
+
+	// A reused pid is a different process
+	registry.ExeName(4, 2, fetch);
+	TEST_CHECK(fetches == 3);
+
+	// Names from a scan seed the cache, a rename replaces them
+	registry.Reset({Record("a", "headset", 1)});
+	TEST_CHECK(registry.DeviceName("headset", fetch) == "headset");
+	registry.RenameDevice("headset", "Headset");
+	TEST_CHECK(registry.DeviceName("headset", fetch) == "Headset");
+	TEST_CHECK(fetches == 3);
+
+	// Gone with the process
+	registry.RemoveProcess(4, 1);
+	registry.ExeName(4, 1, fetch);
+	TEST_CHECK(fetches == 4);
+}
+
+/* Listeners that subscribe and unsubscribe from inside their callback,
+ * which used to deadlock on the listener lock */
+static void TestReentrantListeners()
+{
+	SessionRegistry registry;
+	int calls[3] = {};
+	uint64_t ids[3] = {};
+	uint64_t added = 0;
+	uint64_t seenGeneration = 0;
+
+	ids[0] = registry.Subscribe([&]() {
+		calls[0]++;
+		seenGeneration = registry.Snapshot()->generation;
+		if (!added)
+			added = registry.Subscribe([]() {});
+		// Takes out the one after it before it's been called
+		if (calls[0] == 2)
+			registry.Unsubscribe(ids[1]);
+	});
+	ids[1] = registry.Subscribe([&]() { calls[1]++; });
+	ids[2] = registry.Subscribe([&]() {
+		calls[2]++;
+		registry.Unsubscribe(ids[2]);
+	});
+
+	registry.AddSession(Record("a", "speakers", 1));
+	TEST_CHECK(calls[0] == 1 && calls[1] == 1 && calls[2] == 1);
+	TEST_CHECK(seenGeneration == registry.Snapshot()->generation);
+	TEST_CHECK(added != 0);
+
+	registry.AddSession(Record("b", "speakers", 2));
+	TEST_CHECK(calls[0] == 2 && calls[1] == 1 && calls[2] == 1);
+
+	registry.Unsubscribe(ids[0]);
+	registry.Unsubscribe(added);
+	registry.AddSession(Record("c", "speakers", 3));
+	TEST_CHECK(calls[0] == 2);
+}
+
+// Unsubscribe() from elsewhere waits for a running callback to finish
+static void TestUnsubscribeWaits()
+{
+	SessionRegistry registry;
+	std::atomic<bool> inside{false};
+	std::atomic<bool> finished{false};
+	std::atomic<int> calls{0};
+
+	uint64_t id = registry.Subscribe([&]() {
+		calls++;
+		inside = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		finished = true;
+	});
+
+	std::thread writer(
+		[&]() { registry.AddSession(Record("a", "speakers", 1)); });
+	while (!inside)
+		std::this_thread::yield();
+
+	registry.Unsubscribe(id);
+	TEST_CHECK(finished);
+	writer.join();
+
+	registry.AddSession(Record("b", "speakers", 2));
+	TEST_CHECK(calls == 1);
+}
+
+// Readers racing a writer only ever see whole, ordered snapshots
+static void TestConcurrentReaders()
+{
+	SessionRegistry registry;
+	std::atomic<bool> stop{false};
+	std::atomic<int> torn{0};
+
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 3; r++) {
+		readers.emplace_back([&]() {
+			uint64_t last = 0;
+			while (!stop) {
+				auto snapshot = registry.Snapshot();
+				if (snapshot->generation < last)
+					torn++;
+				last = snapshot->generation;
+				// Every publish below leaves a and b paired
+				if (snapshot->sessions.size() % 2)
+					torn++;
+			}
+		});
+	}
+
+	for (uint32_t i = 0; i < 2000; i++) {
+		registry.Reset({Record("a", "speakers", i),
+				Record("b", "speakers", i)});
+		registry.RemoveProcess(i, 1);
+	}
+	stop = true;
+	for (std::thread &reader : readers)
+		reader.join();
+
+	TEST_CHECK(torn == 0);
+	TEST_CHECK(registry.Snapshot()->generation == 4000);
+}
+
+int main()
+{
+	TestSnapshots();
+	TestInstances();
+	TestRelaunch();
+	TestNameCaches();
+	TestReentrantListeners();
+	TestUnsubscribeWaits();
+	TestConcurrentReaders();
+
+	return TestResult("session-registry-test");
+}
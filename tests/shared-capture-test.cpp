@@ -0,0 +1,289 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* One session captured by several sources: every stream sees every packet,
+ * the session is attached once, and nothing calls out under a lock, so a
+ * sink can attach to the session it's being fed from and one slow attach
+ * doesn't hold up the others. */
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture/shared-capture.hpp"
+#include "test-helpers.hpp"
+
+static const AudioRingFormatInfo stereoFloat48 = {
+	AUDIO_RING_FORMAT_FLOAT, 48000, 0x3, 2, 32, 32, 8, 0};
+
+// Hands out numbered packets pushed by the test
+class QueueStream : public CaptureStream {
+	std::shared_ptr<LocalWaker> waker = std::make_shared<LocalWaker>();
+	std::mutex mutex;
+	std::deque<uint32_t> queued;
+
+public:
+	std::atomic<int> *detached;
+
+	explicit QueueStream(std::atomic<int> *detached) : detached(detached)
+	{
+	}
+	~QueueStream() override { (*detached)++; }
+
+	void Push(uint32_t sequence)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queued.push_back(sequence);
+		}
+		waker->Signal();
+	}
+
+	std::shared_ptr<CaptureWaker> Waker() const override { return waker; }
+
+	bool Drain(const CaptureSink &sink) override
+	{
+		std::deque<uint32_t> taken;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			taken.swap(queued);
+		}
+		for (uint32_t sequence : taken) {
+			CapturePacket packet;
+			packet.data = reinterpret_cast<const uint8_t *>(
+				&sequence);
+			packet.size = sizeof(sequence);
+			packet.frames = 1;
+			packet.timestamp = sequence;
+			packet.formatSerial = 1;
+			packet.format = &stereoFloat48;
+			sink(packet);
+		}
+		return !taken.empty();
+	}
+};
+
+/* Sessions "slow" attach only once released, "missing" never attach,
+ * anything else straight away */
+class QueueBackend : public CaptureBackend {
+public:
+	std::mutex mutex;
+	std::vector<QueueStream *> streams;
+	std::atomic<int> attaches{0};
+	std::atomic<int> detached{0};
+	std::shared_future<void> slowRelease;
+	std::promise<void> slowStarted;
+
+	const char *Name() const override { return "queue"; }
+
+	std::shared_ptr<const SessionSnapshot> Sessions() override
+	{
+		return std::make_shared<SessionSnapshot>();
+	}
+
+	std::unique_ptr<CaptureStream>
+	Attach(const SessionRecord &session) override
+	{
+		attaches++;
+		if (session.sessionId == "missing")
+			return nullptr;
+		if (session.sessionId == "slow") {
+			slowStarted.set_value();
+			slowRelease.wait();
+		}
+
+		QueueStream *stream = new QueueStream(&detached);
+		std::lock_guard<std::mutex> lock(mutex);
+		streams.push_back(stream);
+		return std::unique_ptr<CaptureStream>(stream);
+	}
+};
+
+static SessionRecord Session(const char *id, const char *instance = "1")
+{
+	SessionRecord session;
+	session.deviceId = "device";
+	session.sessionId = id;
+	session.instanceId = id + std::string("/") + instance;
+	return session;
+}
+
+static std::vector<uint32_t> Drain(CaptureStream &stream)
+{
+	std::vector<uint32_t> sequences;
+	stream.Drain([&sequences](const CapturePacket &packet) {
+		uint32_t sequence;
+		memcpy(&sequence, packet.data, sizeof(sequence));
+		sequences.push_back(sequence);
+	});
+	return sequences;
+}
+
+static void TestFanout()
+{
+	std::shared_ptr<QueueBackend> inner = std::make_shared<QueueBackend>();
+	SharedCaptureBackend backend(inner);
+
+	std::unique_ptr<CaptureStream> first = backend.Attach(Session("a"));
+	std::unique_ptr<CaptureStream> second = backend.Attach(Session("a"));
+	TEST_CHECK(first && second);
+	if (!first || !second)
+		return;
+	TEST_CHECK(inner->attaches == 1);
+	TEST_CHECK(backend.Captures() == 1);
+
+	// Another instance of the same exe is a session of its own
+	std::unique_ptr<CaptureStream> other =
+		backend.Attach(Session("a", "2"));
+	TEST_CHECK(other != nullptr);
+	TEST_CHECK(inner->attaches == 2);
+	TEST_CHECK(backend.Captures() == 2);
+	other.reset();
+	TEST_CHECK(inner->detached == 1);
+
+	QueueStream *source = inner->streams[0];
+	for (uint32_t i = 0; i < 3; i++)
+		source->Push(i);
+
+	// Only the first drains the session, the second reads the copies
+	TEST_CHECK(Drain(*second).empty());
+	TEST_CHECK(Drain(*first) == std::vector<uint32_t>({0, 1, 2}));
+	TEST_CHECK(Drain(*second) == std::vector<uint32_t>({0, 1, 2}));
+	TEST_CHECK(Drain(*second).empty());
+
+	// With the first gone the second takes over the session
+	source->Push(3);
+	first.reset();
+	TEST_CHECK(inner->detached == 1);
+	TEST_CHECK(Drain(*second) == std::vector<uint32_t>({3}));
+	source->Push(4);
+	TEST_CHECK(Drain(*second) == std::vector<uint32_t>({4}));
+
+	second.reset();
+	TEST_CHECK(inner->detached == 2);
+	TEST_CHECK(backend.Captures() == 0);
+
+	// A session that can't be attached is tried again next time
+	TEST_CHECK(!backend.Attach(Session("missing")));
+	TEST_CHECK(!backend.Attach(Session("missing")));
+	TEST_CHECK(inner->attaches == 4);
+}
+
+// Would deadlock if the sink were called with the capture locked
+static void TestReentrantSink()
+{
+	std::shared_ptr<QueueBackend> inner = std::make_shared<QueueBackend>();
+	SharedCaptureBackend backend(inner);
+	std::unique_ptr<CaptureStream> first = backend.Attach(Session("a"));
+	TEST_CHECK(first != nullptr);
+	if (!first)
+		return;
+
+	std::unique_ptr<CaptureStream> late;
+	inner->streams[0]->Push(0);
+	inner->streams[0]->Push(1);
+	uint32_t seen = 0;
+	first->Drain([&](const CapturePacket &) {
+		// Attached from inside, and detached again
+		std::unique_ptr<CaptureStream> brief =
+			backend.Attach(Session("a"));
+		TEST_CHECK(brief != nullptr);
+		if (!late)
+			late = backend.Attach(Session("a"));
+		seen++;
+	});
+	TEST_CHECK(seen == 2);
+	TEST_CHECK(inner->attaches == 1);
+
+	// Joined after the first packet, so it gets the second
+	TEST_CHECK(late && Drain(*late) == std::vector<uint32_t>({1}));
+}
+
+// One session slow to attach holds up only its own attaches
+static void TestSlowAttach()
+{
+	std::shared_ptr<QueueBackend> inner = std::make_shared<QueueBackend>();
+	std::promise<void> release;
+	inner->slowRelease = release.get_future().share();
+	std::future<void> started = inner->slowStarted.get_future();
+	SharedCaptureBackend backend(inner);
+
+	std::future<std::unique_ptr<CaptureStream>> slow =
+		std::async(std::launch::async,
+			   [&]() { return backend.Attach(Session("slow")); });
+	started.wait();
+
+	std::future<std::unique_ptr<CaptureStream>> again =
+		std::async(std::launch::async,
+			   [&]() { return backend.Attach(Session("slow")); });
+
+	std::unique_ptr<CaptureStream> fast = backend.Attach(Session("fast"));
+	TEST_CHECK(fast != nullptr);
+	TEST_CHECK(backend.Captures() == 1);
+	TEST_CHECK(again.wait_for(std::chrono::milliseconds(50)) ==
+		   std::future_status::timeout);
+
+	release.set_value();
+	std::unique_ptr<CaptureStream> a = slow.get();
+	std::unique_ptr<CaptureStream> b = again.get();
+	TEST_CHECK(a && b);
+	// Waited for rather than attached a second time
+	TEST_CHECK(inner->attaches == 2);
+	TEST_CHECK(backend.Captures() == 2);
+}
+
+static void Bench()
+{
+	// What sharing costs a lone stream, and each extra reader
+	for (int readers = 1; readers <= 4; readers *= 2) {
+		std::shared_ptr<QueueBackend> inner =
+			std::make_shared<QueueBackend>();
+		SharedCaptureBackend backend(inner);
+		std::vector<std::unique_ptr<CaptureStream>> streams;
+		for (int i = 0; i < readers; i++)
+			streams.push_back(backend.Attach(Session("a")));
+		QueueStream *source = inner->streams[0];
+
+		uint32_t sequence = 0;
+		CaptureSink sink = [](const CapturePacket &) {};
+		double ns = TestBench(
+			[&]() {
+				source->Push(sequence++);
+				for (auto &stream : streams)
+					stream->Drain(sink);
+			},
+			100000);
+		printf("%d stream(s): %.1f ns/packet\n", readers, ns);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	TestFanout();
+	TestReentrantSink();
+	TestSlowAttach();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("shared-capture-test");
+}
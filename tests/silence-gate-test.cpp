@@ -0,0 +1,277 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* Silence gating: the hold and hysteresis of the gate itself, and the peak
+ * scan feeding it, which at every SIMD level has to find the same peak as
+ * a plain loop over the raw samples. --bench puts the scan against the
+ * conversion it lets a quiet packet skip. */
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "audio/peak-scan.hpp"
+#include "capture/silence-gate.hpp"
+#include "test-helpers.hpp"
+
+// -60 dBFS closes, a hair under -54 dBFS reopens, 250 ms of hold at 48 kHz
+#define CLOSE_PEAK 0.001f
+#define OPEN_PEAK 0.002f
+#define PACKET 480
+#define HOLD_PACKETS 25
+
+static void TestHold()
+{
+	SilenceGate gate;
+	gate.Configure(-60.0f, 48000);
+	TEST_CHECK(gate.Open());
+	TEST_CHECK(gate.Process(0.5f, PACKET));
+
+	// The tail of a sound is let through until the hold runs out
+	for (int i = 1; i < HOLD_PACKETS; i++)
+		TEST_CHECK(gate.Process(0.0f, PACKET));
+	TEST_CHECK(gate.Open());
+	TEST_CHECK(!gate.Process(0.0f, PACKET));
+	TEST_CHECK(!gate.Open());
+	TEST_CHECK(gate.Closings() == 1);
+	TEST_CHECK(gate.GatedFrames() == PACKET);
+
+	TEST_CHECK(!gate.Process(0.0f, PACKET));
+	TEST_CHECK(gate.GatedFrames() == 2 * PACKET);
+
+	// Anything clearly audible opens it straight away
+	TEST_CHECK(gate.Process(0.1f, PACKET));
+	TEST_CHECK(gate.Open());
+	TEST_CHECK(gate.GatedFrames() == 2 * PACKET);
+
+	// and the hold starts over
+	for (int i = 1; i < HOLD_PACKETS; i++)
+		TEST_CHECK(gate.Process(0.0f, PACKET));
+	TEST_CHECK(!gate.Process(0.0f, PACKET));
+	TEST_CHECK(gate.Closings() == 2);
+
+	// Reset reopens without touching the totals
+	gate.Reset();
+	TEST_CHECK(gate.Open());
+	TEST_CHECK(gate.Closings() == 2);
+	TEST_CHECK(gate.GatedFrames() == 3 * PACKET);
+}
+
+static void TestHysteresis()
+{
+	SilenceGate gate;
+	gate.Configure(-60.0f, 48000);
+
+	// Quiet content just over the threshold never closes it
+	for (int i = 0; i < 10 * HOLD_PACKETS; i++)
+		TEST_CHECK(gate.Process(i % 2 ? 0.0f : CLOSE_PEAK * 1.1f,
+					PACKET));
+	TEST_CHECK(gate.Closings() == 0);
+
+	for (int i = 0; i < HOLD_PACKETS; i++)
+		gate.Process(0.0f, PACKET);
+	TEST_CHECK(!gate.Open());
+
+	// Between the two thresholds stays shut, so noise can't chatter it
+	for (int i = 0; i < 100; i++)
+		TEST_CHECK(!gate.Process((CLOSE_PEAK + OPEN_PEAK) / 2, PACKET));
+	TEST_CHECK(!gate.Process(OPEN_PEAK * 0.99f, PACKET));
+	TEST_CHECK(gate.Process(OPEN_PEAK * 1.01f, PACKET));
+	TEST_CHECK(gate.Closings() == 1);
+
+	// No hold at all closes on the first quiet packet
+	gate.Configure(-60.0f, 48000, 0);
+	TEST_CHECK(!gate.Process(0.0f, PACKET));
+	// and no hysteresis reopens right over the threshold
+	gate.Configure(-60.0f, 48000, 0, 0.0f);
+	TEST_CHECK(!gate.Process(0.0f, PACKET));
+	TEST_CHECK(gate.Process(CLOSE_PEAK * 1.01f, PACKET));
+}
+
+// Largest magnitude as a plain loop sees it, with full scale at 1.0
+static float Reference(SampleFormat format, const uint8_t *p, size_t count)
+{
+	double peak = 0.0;
+	for (size_t i = 0; i < count; i++) {
+		double value;
+		switch (format) {
+		case SampleFormat::S16: {
+			int16_t v;
+			memcpy(&v, p + i * 2, sizeof(v));
+			value = v / 32768.0;
+			break;
+		}
+		case SampleFormat::S24: {
+			const uint8_t *s = p + i * 3;
+			int32_t v = s[0] | s[1] << 8 |
+				    static_cast<int8_t>(s[2]) << 16;
+			value = v / 8388608.0;
+			break;
+		}
+		case SampleFormat::S32: {
+			int32_t v;
+			memcpy(&v, p + i * 4, sizeof(v));
+			value = v / 2147483648.0;
+			break;
+		}
+		default: {
+			float v;
+			memcpy(&v, p + i * 4, sizeof(v));
+			value = v;
+			break;
+		}
+		}
+		if (std::fabs(value) > peak)
+			peak = std::fabs(value);
+	}
+	return static_cast<float>(peak);
+}
+
+static void TestPeakScan(int level, std::mt19937 &rng)
+{
+	static const SampleFormat formats[] = {
+		SampleFormat::S16, SampleFormat::S24, SampleFormat::S32,
+		SampleFormat::F32};
+
+	for (SampleFormat format : formats) {
+		PeakScanFunc scan =
+			GetPeakScan(format, static_cast<SimdLevel>(level));
+		size_t bytes = SampleFormatBytes(format);
+		size_t wrong = 0;
+
+		for (size_t samples = 0; samples < 100; samples++) {
+			// Quiet noise, with one loud sample anywhere in it
+			std::vector<uint8_t> input(samples * bytes + 1);
+			for (size_t i = 0; i < samples; i++) {
+				float v = std::ldexp(
+					static_cast<float>(rng() % 2001) -
+						1000.0f,
+					-16);
+				if (samples && i == rng() % samples)
+					v = i % 2 ? -1.0f : 0.75f;
+
+				uint8_t *p = input.data() + 1 + i * bytes;
+				if (format == SampleFormat::F32) {
+					memcpy(p, &v, sizeof(v));
+					continue;
+				}
+				// Full scale negative is the one extreme
+				int64_t full = 1LL << (bytes * 8 - 1);
+				int64_t x = static_cast<int64_t>(v * full);
+				if (x >= full)
+					x = full - 1;
+				for (size_t b = 0; b < bytes; b++)
+					p[b] = static_cast<uint8_t>(x >> 8 * b);
+			}
+
+			// Misaligned on purpose, packets come as they are
+			const uint8_t *src = input.data() + 1;
+			if (scan(src, samples) !=
+			    Reference(format, src, samples))
+				wrong++;
+		}
+		if (wrong)
+			fprintf(stderr, "%s, format %d: %zu wrong\n",
+				TestSimdName(level), static_cast<int>(format),
+				wrong);
+		TEST_CHECK(wrong == 0);
+	}
+
+	// The most negative sample is exactly full scale, not more
+	int16_t s16[33] = {};
+	s16[32] = INT16_MIN;
+	TEST_CHECK(GetPeakScan(SampleFormat::S16,
+			       static_cast<SimdLevel>(level))(s16, 33) == 1.0f);
+	int32_t s32[33] = {};
+	s32[17] = INT32_MIN;
+	TEST_CHECK(GetPeakScan(SampleFormat::S32,
+			       static_cast<SimdLevel>(level))(s32, 33) == 1.0f);
+}
+
+// A tone, then silence, scanned and gated packet by packet
+static void TestStream()
+{
+	const uint32_t channels = 2;
+	std::vector<int16_t> packet(PACKET * channels);
+	PeakScanFunc scan = GetPeakScan(SampleFormat::S16);
+	SilenceGate gate;
+	gate.Configure(-60.0f, 48000);
+
+	uint32_t passed = 0;
+	for (int p = 0; p < 200; p++) {
+		for (size_t i = 0; i < packet.size(); i++)
+			packet[i] = p < 50 ? static_cast<int16_t>(
+						     (i % 48) * 400 - 9600)
+					   : static_cast<int16_t>(i % 3) - 1;
+		if (gate.Process(scan(packet.data(), packet.size()),
+				 PACKET))
+			passed++;
+	}
+
+	TEST_CHECK(passed == 50 + HOLD_PACKETS - 1);
+	TEST_CHECK(gate.GatedFrames() == (200 - passed) * PACKET);
+}
+
+static void Bench()
+{
+	const size_t samples = PACKET * 2;
+	std::vector<int16_t> s16(samples, 3);
+	std::vector<float> f32(samples, 0.0001f), out(samples);
+
+	for (int level = 0; level < TestSimdLevels(); level++) {
+		SimdLevel simd = static_cast<SimdLevel>(level);
+		PeakScanFunc scanS16 = GetPeakScan(SampleFormat::S16, simd);
+		PeakScanFunc scanF32 = GetPeakScan(SampleFormat::F32, simd);
+		InterleavedConvertFunc convert =
+			GetSampleConverter(SampleFormat::S16, simd).interleaved;
+
+		volatile float sink = 0.0f;
+		double scan16 = TestBench(
+			[&]() { sink = scanS16(s16.data(), samples); },
+			100000);
+		double scan32 = TestBench(
+			[&]() { sink = scanF32(f32.data(), samples); },
+			100000);
+		double convert16 = TestBench(
+			[&]() {
+				convert(s16.data(), out.data(), samples);
+				sink = out[0];
+			},
+			100000);
+
+		printf("%-6s 10 ms stereo: scan s16 %.0f ns, f32 %.0f ns; "
+		       "convert s16 %.0f ns\n",
+		       TestSimdName(level), scan16, scan32, convert16);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	TestHold();
+	TestHysteresis();
+
+	std::mt19937 rng(1);
+	for (int level = 0; level < TestSimdLevels(); level++)
+		TestPeakScan(level, rng);
+	TestStream();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("silence-gate-test");
+}
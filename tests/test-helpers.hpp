@@ -0,0 +1,103 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "audio/cpu-features.hpp"
+
+/* Just enough to write the tests with. Every check runs, each failure is
+ * printed where it happened and the program exits non-zero at the end if
+ * there were any. Benchmarks only run when asked for with --bench, so
+ * ctest stays quick. */
+static int testFailures = 0;
+
+#define TEST_CHECK(cond)                                                  \
+	do {                                                              \
+		if (!(cond)) {                                            \
+			fprintf(stderr, "%s:%d: failed: %s\n", __FILE__,  \
+				__LINE__, #cond);                         \
+			testFailures++;                                   \
+		}                                                         \
+	} while (0)
+
+#define TEST_CHECK_NEAR(value, expected, tolerance)                       \
+	do {                                                              \
+		double testValue = (value);                               \
+		double testExpected = (expected);                         \
+		if (!(std::fabs(testValue - testExpected) <= (tolerance))) { \
+			fprintf(stderr,                                   \
+				"%s:%d: failed: %s is %g, expected %g\n", \
+				__FILE__, __LINE__, #value, testValue,    \
+				testExpected);                            \
+			testFailures++;                                   \
+		}                                                         \
+	} while (0)
+
+static inline bool TestBenchRequested(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--bench") == 0)
+			return true;
+	}
+	return false;
+}
+
+// Best of `rounds`, in nanoseconds per call
+template <typename Func>
+static double TestBench(Func func, int iterations, int rounds = 5)
+{
+	double best = 0.0;
+	for (int r = 0; r < rounds; r++) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+			func();
+		std::chrono::duration<double, std::nano> elapsed =
+			std::chrono::steady_clock::now() - start;
+		double ns = elapsed.count() / iterations;
+		if (r == 0 || ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+/* Kernels are checked at every level this machine can run, up to and
+ * including GetSimdLevel(), in enum order so scalar comes first */
+static inline int TestSimdLevels()
+{
+	return static_cast<int>(GetSimdLevel()) + 1;
+}
+
+static inline const char *TestSimdName(int level)
+{
+	static const char *const names[] = {"scalar", "sse2", "avx2"};
+	return names[level];
+}
+
+static inline int TestResult(const char *name)
+{
+	if (testFailures)
+		printf("%s: %d check(s) failed\n", name, testFailures);
+	else
+		printf("%s: passed\n", name);
+	return testFailures ? 1 : 0;
+}
@@ -0,0 +1,238 @@
+/*
+Windows Audio Session Capture Plugin for OBS
+Copyright (C) 2020 Cameron Blomquist cameron@blomqu.ist
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program. If not, see <https://www.gnu.org/licenses/>
+*/
+
+/* UTF-16 to UTF-8: known encodings, unpaired surrogates, and every SIMD
+ * level against a plain reference on random text, with the non-ASCII
+ * units placed where the vector paths hand over to the scalar one.
+ * --bench converts the kind of strings WASAPI hands out. */
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "helpers/utf-convert.hpp"
+#include "test-helpers.hpp"
+
+// Decodes to code points, then encodes: nothing shared with the converter
+static std::string Reference(const std::u16string &text)
+{
+	std::string out;
+	for (size_t i = 0; i < text.size(); i++) {
+		uint32_t code = text[i];
+		if (code >= 0xD800 && code <= 0xDFFF) {
+			bool paired = code < 0xDC00 && i + 1 < text.size() &&
+				      text[i + 1] >= 0xDC00 &&
+				      text[i + 1] <= 0xDFFF;
+			if (paired)
+				code = 0x10000 + (code - 0xD800) * 0x400 +
+				       (text[++i] - 0xDC00);
+			else
+				code = 0xFFFD;
+		}
+
+		if (code < 0x80) {
+			out += static_cast<char>(code);
+		} else if (code < 0x800) {
+			out += static_cast<char>(0xC0 + code / 64);
+			out += static_cast<char>(0x80 + code % 64);
+		} else if (code < 0x10000) {
+			out += static_cast<char>(0xE0 + code / 4096);
+			out += static_cast<char>(0x80 + code / 64 % 64);
+			out += static_cast<char>(0x80 + code % 64);
+		} else {
+			out += static_cast<char>(0xF0 + code / 262144);
+			out += static_cast<char>(0x80 + code / 4096 % 64);
+			out += static_cast<char>(0x80 + code / 64 % 64);
+			out += static_cast<char>(0x80 + code % 64);
+		}
+	}
+	return out;
+}
+
+/* Converts at `level`, from a misaligned copy if asked, checking nothing
+ * is written past the room the header says to leave */
+static std::string Convert(int level, const std::u16string &text,
+			   bool misalign = false)
+{
+	std::vector<char16_t> src(text.size() + 1);
+	char16_t *in = src.data() + (misalign ? 1 : 0);
+	text.copy(in, text.size());
+
+	size_t room = UTF8_MAX_BYTES(text.size());
+	std::vector<char> dst(room + 16, '\x5A');
+	size_t written = GetUtf16ToUtf8(static_cast<SimdLevel>(level))(
+		in, text.size(), dst.data());
+
+	TEST_CHECK(written <= room);
+	for (size_t i = room; i < dst.size(); i++)
+		TEST_CHECK(dst[i] == '\x5A');
+	return std::string(dst.data(), written);
+}
+
+static void TestKnown(int level)
+{
+	static const struct {
+		std::u16string text;
+		std::string utf8;
+	} cases[] = {
+		{u"", ""},
+		{u"game.exe", "game.exe"},
+		{std::u16string(u"a\0b", 3), std::string("a\0b", 3)},
+		{u"\u007F\u0080", "\x7F\xC2\x80"},
+		{u"\u07FF\u0800", "\xDF\xBF\xE0\xA0\x80"},
+		{u"caf\u00E9", "caf\xC3\xA9"},
+		{u"\u20AC5", "\xE2\x82\xAC" "5"},
+		{u"\uFFFF", "\xEF\xBF\xBF"},
+		// Surrogate pairs, the first and last there are
+		{u"\U0001F600", "\xF0\x9F\x98\x80"},
+		{u"\U00010000\U0010FFFF", "\xF0\x90\x80\x80\xF4\x8F\xBF\xBF"},
+	};
+
+	for (const auto &test : cases) {
+		TEST_CHECK(Convert(level, test.text) == test.utf8);
+		TEST_CHECK(Reference(test.text) == test.utf8);
+	}
+}
+
+static void TestLoneSurrogates(int level)
+{
+	const std::string replacement = "\xEF\xBF\xBD";
+	std::u16string high(1, u'\xD83D'), low(1, u'\xDE00');
+
+	// At the end, at the start, the wrong way round and doubled up
+	TEST_CHECK(Convert(level, u"ab" + high) == "ab" + replacement);
+	TEST_CHECK(Convert(level, low + u"ab") == replacement + "ab");
+	TEST_CHECK(Convert(level, low + high) == replacement + replacement);
+	TEST_CHECK(Convert(level, high + high + low) ==
+		   replacement + "\xF0\x9F\x98\x80");
+	TEST_CHECK(Convert(level, high + u"x" + low) ==
+		   replacement + "x" + replacement);
+
+	// A pair cut in two by the end of a vector's worth of ASCII
+	for (size_t at = 0; at < 70; at++) {
+		std::u16string text(at, u'a');
+		text += high + low;
+		text += std::u16string(40, u'b');
+		TEST_CHECK(Convert(level, text) == Reference(text));
+		text.resize(at + 1);
+		TEST_CHECK(Convert(level, text) == Reference(text));
+	}
+}
+
+// Mostly ASCII, like the real thing, with some of everything else
+static std::u16string Random(std::mt19937 &rng, size_t length)
+{
+	std::u16string text(length, u' ');
+	for (char16_t &unit : text) {
+		uint32_t pick = rng() % 100;
+		if (pick < 80)
+			unit = static_cast<char16_t>(rng() % 0x80);
+		else if (pick < 88)
+			unit = static_cast<char16_t>(0x80 + rng() % 0x780);
+		else if (pick < 94)
+			unit = static_cast<char16_t>(0x800 + rng() % 0xF800);
+		else
+			unit = static_cast<char16_t>(0xD800 + rng() % 0x800);
+	}
+
+	// Proper pairs too, which random surrogates rarely make
+	for (size_t i = 0; i + 1 < length; i += 7 + rng() % 40) {
+		text[i] = static_cast<char16_t>(0xD800 + rng() % 0x400);
+		text[i + 1] = static_cast<char16_t>(0xDC00 + rng() % 0x400);
+	}
+	return text;
+}
+
+static void TestRandom(int level, std::mt19937 &rng)
+{
+	size_t wrong = 0;
+	for (int round = 0; round < 3000; round++) {
+		std::u16string text = Random(rng, rng() % 200);
+		// Long ASCII runs, so the fast path gets going between them
+		if (round % 2)
+			for (size_t i = 0; i < text.size(); i++)
+				if (i % 50 > 3)
+					text[i] = u'a' + i % 26;
+
+		if (Convert(level, text, round % 3 == 0) != Reference(text))
+			wrong++;
+	}
+	if (wrong)
+		fprintf(stderr, "%s: %zu wrong\n", TestSimdName(level), wrong);
+	TEST_CHECK(wrong == 0);
+}
+
+// Both sides of the stack buffer
+static void TestString()
+{
+	std::mt19937 rng(9);
+	for (size_t length : {0, 1, 255, 256, 257, 4000}) {
+		std::u16string text = Random(rng, length);
+		TEST_CHECK(Utf16ToUtf8(text.data(), text.size()) ==
+			   Reference(text));
+	}
+}
+
+static void Bench()
+{
+	// What an enumeration turns up: session ids, exe paths, names
+	static const std::u16string strings[] = {
+		u"{0.0.0.00000000}.{5d1f3c52-8c2e-4b6a-9a3b-2f6f0e4d7c11}|"
+		u"\\Device\\HarddiskVolume3\\Program Files (x86)\\Steam\\"
+		u"steamapps\\common\\Some Game\\bin\\win64\\game.exe%b"
+		u"{00000000-0000-0000-0000-000000000000}",
+		u"C:\\Program Files (x86)\\Steam\\steamapps\\common\\"
+		u"Some Game\\bin\\win64\\game.exe",
+		u"Speakers (Realtek(R) Audio)",
+		u"Lautsprecher (Ger\u00E4t f\u00FCr Audio) \u97F3\u58F0",
+	};
+
+	for (const std::u16string &text : strings) {
+		char out[UTF8_MAX_BYTES(256)];
+		printf("%3zu units:", text.size());
+		for (int level = 0; level < TestSimdLevels(); level++) {
+			Utf16ToUtf8Func convert =
+				GetUtf16ToUtf8(static_cast<SimdLevel>(level));
+			volatile size_t sink = 0;
+			double ns = TestBench(
+				[&]() {
+					sink = convert(text.data(),
+						       text.size(), out);
+				},
+				200000);
+			printf(" %s %.1f ns", TestSimdName(level), ns);
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	std::mt19937 rng(5);
+	for (int level = 0; level < TestSimdLevels(); level++) {
+		TestKnown(level);
+		TestLoneSurrogates(level);
+		TestRandom(level, rng);
+	}
+	TestString();
+
+	if (TestBenchRequested(argc, argv))
+		Bench();
+
+	return TestResult("utf-convert-test");
+}